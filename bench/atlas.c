@@ -0,0 +1,253 @@
+/*
+ * Benchmark of the whole pipeline on synthetic sprite sets from corpus.h.
+ * Images are encoded to PNG in memory once, then every run goes through the
+ * library stages like the tool does: prepare (decode, scale, trim, hash and
+ * deduplicate), pack, write data and write images, with atlas pages encoded
+ * and thrown away so the disk doesn't count. Pages are up to 4096x4096 with
+ * --multipack. Times of the steps inside of the stages come from --stats.
+ *
+ * Every run is a row of the CSV file, the header is written when the file is
+ * new, so results of several builds can be appended and compared:
+ *
+ *   make bench BENCH_FLAGS="-l before"
+ *   make bench BENCH_FLAGS="-l after"
+ *
+ * Options:
+ *   -o path      CSV file to append to (bench.csv)
+ *   -l label     build label of the rows (default)
+ *   -s name      run only this scenario
+ *   -r count     runs of every scenario (3)
+ *   -j jobs      --jobs of the runs, 0 for number of CPUs (1)
+ *   -c dir       write the corpus as PNG files to dir/<scenario>/ and exit,
+ *                to benchmark the tool itself on the same images
+ *
+ * peak_rss is the peak of the whole process so far, run one scenario with -s
+ * to see its own.
+ */
+
+#define IMGPACK_NO_MAIN
+#include "../main.c"
+
+#include <stdio.h>
+
+#include "corpus.h"
+
+#ifdef _WIN32
+#define BENCH_NULL_PATH "NUL"
+#else
+#define BENCH_NULL_PATH "/dev/null"
+#endif
+
+struct BenchFile {
+	unsigned char *data;
+	size_t size;
+};
+
+struct BenchOptions {
+	const char *csvPath;
+	const char *label;
+	const char *scenario;
+	const char *corpusDir;
+	int runs;
+	const char *jobs;
+};
+
+static int bench_encode(int scenario, int index, struct BenchFile *file) {
+	int width, height, size = 0;
+	unsigned char *pixels = bench_make_image(scenario, index, &width, &height);
+	file->data = pixels ? stbi_write_png_to_mem(pixels, 4 * width, width, height, 4, &size) : NULL;
+	file->size = (size_t)size;
+	free(pixels);
+	return !file->data;
+}
+
+static int bench_discard_write(void *udata, const void *data, size_t size) {
+	(void)udata;
+	(void)data;
+	(void)size;
+	return 0;
+}
+
+static int bench_discard_seek(void *udata, size_t offset) {
+	(void)udata;
+	(void)offset;
+	return 0;
+}
+
+static int bench_open_image(void *udata, struct ImgPackWriter *writer, const char *path, int page, int level) {
+	(void)udata;
+	(void)path;
+	(void)page;
+	(void)level;
+	*writer = (struct ImgPackWriter) {.write = bench_discard_write, .seek = bench_discard_seek};
+	return 0;
+}
+
+static int bench_write_corpus(const struct BenchOptions *options, int scenario) {
+	const char *name = bench_scenarios[scenario].name;
+	char *path = malloc(strlen(options->corpusDir) + strlen(name) + 16);
+	sprintf(path, "%s/%s", options->corpusDir, name);
+	struct stat st;
+	if (stat(path, &st) && imgpack_mkdir(path)) {
+		printf("Cannot create \"%s\"\n", path);
+		free(path);
+		return 1;
+	}
+	int status = 0;
+	for (int i = 0; i < bench_scenarios[scenario].count && !status; i++) {
+		struct BenchFile file;
+		status = bench_encode(scenario, i, &file);
+		sprintf(path, "%s/%s/%06d.png", options->corpusDir, name, i);
+		FILE *f = status ? NULL : fopen(path, "wb");
+		status = !f || fwrite(file.data, 1, file.size, f) != file.size;
+		if (f) status = fclose(f) || status;
+		if (status) printf("Cannot write \"%s\"\n", path);
+		free(file.data);
+	}
+	if (!status) printf("%s: %d images\n", name, bench_scenarios[scenario].count);
+	free(path);
+	return status;
+}
+
+static double bench_stage_ms(const struct ImgPackContext *ctx, enum ImgPackStage stage) {
+	return ctx->stats->stages[stage].wallMs;
+}
+
+static int bench_run(const struct BenchOptions *options, FILE *csv, int scenario, const struct BenchFile *files, int run) {
+	const struct BenchScenario *s = &bench_scenarios[scenario];
+	char *argv[32] = {"bench-atlas", "-i", "bench.png", "-f", "JSON_HASH", "-T", BENCH_NULL_PATH, "-j", (char *)options->jobs,
+		"-m", "-w", "4096", "-h", "4096"};
+	int argc = 14;
+	for (int i = 0; i < 8 && s->options[i]; i++) argv[argc++] = (char *)s->options[i];
+	struct ImgPackContext *ctx = imgpack_create();
+	struct ImgPackBuffer data = {0};
+	struct ImgPackWriter writer;
+	char name[32];
+	int status = !ctx || imgpack_configure(ctx, argc, argv);
+	for (int i = 0; i < s->count && !status; i++) {
+		sprintf(name, "%s/%06d.png", s->name, i);
+		status = imgpack_add_memory(ctx, name, files[i].data, files[i].size);
+	}
+	if (status) {
+		printf("Cannot set up scenario %s\n", s->name);
+		imgpack_destroy(ctx);
+		return 1;
+	}
+	imgpack_set_image_writer(ctx, bench_open_image, NULL);
+	imgpack_buffer_writer(&data, &writer);
+	double start = imgpack_stats__wall_ms(), cpu_start = imgpack_stats__cpu_ms(0);
+	status = imgpack_prepare(ctx);
+	double prepared = imgpack_stats__wall_ms();
+	status = status || imgpack_pack(ctx);
+	double packed = imgpack_stats__wall_ms();
+	status = status || imgpack_write_data(ctx, &writer);
+	double formatted = imgpack_stats__wall_ms();
+	status = status || imgpack_write_images(ctx);
+	double written = imgpack_stats__wall_ms(), cpu = imgpack_stats__cpu_ms(0) - cpu_start;
+	if (!status) {
+		int unique = 0, width = 0, height = 0;
+		long long area = 0, used = 0;
+		for (int i = 0; i < ctx->size; i++) {
+			if (ctx->images[i].copyOf < 0) unique++;
+		}
+		for (int page = 0; page < ctx->pagesCount; page++) {
+			if (ctx->pages[page].width > width) width = ctx->pages[page].width;
+			if (ctx->pages[page].height > height) height = ctx->pages[page].height;
+			area += (long long)ctx->pages[page].width * ctx->pages[page].height;
+			used += imgpack_stats_used_area(ctx, page);
+		}
+		double efficiency = area > 0 ? (double)used / area : 0.0;
+		fprintf(csv, "%s,%s,%d,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%d,%d,%d,%lld,%lld,%.4f,%lld,%lld\n",
+				options->label, s->name, ctx->size, unique, ctx->jobs, run,
+				prepared - start, packed - prepared, formatted - packed, written - formatted, written - start, cpu,
+				bench_stage_ms(ctx, IMGPACK_STAGE_DECODE), bench_stage_ms(ctx, IMGPACK_STAGE_RESIZE), bench_stage_ms(ctx, IMGPACK_STAGE_TRIM),
+				bench_stage_ms(ctx, IMGPACK_STAGE_HASH), bench_stage_ms(ctx, IMGPACK_STAGE_DEDUP),
+				bench_stage_ms(ctx, IMGPACK_STAGE_COMPOSITE), bench_stage_ms(ctx, IMGPACK_STAGE_ENCODE),
+				ctx->pagesCount, width, height, area, used, efficiency, imgpack_stats__peak_rss(), ctx->stats->bytesWritten);
+		fflush(csv);
+		printf("%-10s run %d: %d images, %d unique, %.1f ms (prepare %.1f, pack %.1f, write %.1f), %d pages up to %dx%d, efficiency %.1f%%\n",
+				s->name, run, ctx->size, unique, written - start, prepared - start, packed - prepared, written - packed,
+				ctx->pagesCount, width, height, 100.0 * efficiency);
+	} else {
+		printf("Scenario %s failed\n", s->name);
+	}
+	imgpack_buffer_free(&data);
+	imgpack_destroy(ctx);
+	return status;
+}
+
+static int bench_scenario(const struct BenchOptions *options, FILE *csv, int scenario) {
+	const struct BenchScenario *s = &bench_scenarios[scenario];
+	struct BenchFile *files = calloc(s->count, sizeof(*files));
+	int status = !files;
+	for (int i = 0; i < s->count && !status; i++) {
+		status = bench_encode(scenario, i, &files[i]);
+	}
+	if (status) printf("Cannot generate scenario %s\n", s->name);
+	for (int run = 0; run < options->runs && !status; run++) {
+		status = bench_run(options, csv, scenario, files, run);
+	}
+	for (int i = 0; files && i < s->count; i++) free(files[i].data);
+	free(files);
+	return status;
+}
+
+int main(int argc, char *argv[]) {
+	struct BenchOptions options = {.csvPath = "bench.csv", .label = "default", .runs = 3, .jobs = "1"};
+	for (int i = 1; i < argc; i++) {
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (!value || argv[i][0] != '-' || strlen(argv[i]) != 2) {
+			printf("Usage: bench-atlas [-o results.csv] [-l label] [-s scenario] [-r runs] [-j jobs] [-c corpus dir]\n");
+			return 1;
+		}
+		switch (argv[i++][1]) {
+			case 'o': options.csvPath = value; break;
+			case 'l': options.label = value; break;
+			case 's': options.scenario = value; break;
+			case 'r': options.runs = atoi(value); break;
+			case 'j': options.jobs = value; break;
+			case 'c': options.corpusDir = value; break;
+			default:
+				printf("Unknown option %s\n", argv[i - 1]);
+				return 1;
+		}
+	}
+	int selected = -1;
+	for (int i = 0; i < BENCH_SCENARIOS_COUNT && options.scenario; i++) {
+		if (!strcmp(bench_scenarios[i].name, options.scenario)) selected = i;
+	}
+	if (options.scenario && selected < 0) {
+		printf("Unknown scenario %s, scenarios are:", options.scenario);
+		for (int i = 0; i < BENCH_SCENARIOS_COUNT; i++) printf(" %s", bench_scenarios[i].name);
+		printf("\n");
+		return 1;
+	}
+	int status = 0;
+	if (options.corpusDir) {
+		struct stat st;
+		if (stat(options.corpusDir, &st) && imgpack_mkdir(options.corpusDir)) {
+			printf("Cannot create \"%s\"\n", options.corpusDir);
+			return 1;
+		}
+		for (int i = 0; i < BENCH_SCENARIOS_COUNT && !status; i++) {
+			if (selected < 0 || selected == i) status = bench_write_corpus(&options, i);
+		}
+		return status;
+	}
+	FILE *csv = fopen(options.csvPath, "ab");
+	if (!csv) {
+		printf("Cannot open \"%s\"\n", options.csvPath);
+		return 1;
+	}
+	fseek(csv, 0, SEEK_END);
+	if (ftell(csv) == 0) {
+		fprintf(csv, "label,scenario,images,unique,jobs,run,prepare_ms,pack_ms,data_ms,images_ms,total_ms,cpu_ms,"
+				"decode_ms,resize_ms,trim_ms,hash_ms,dedup_ms,composite_ms,encode_ms,"
+				"pages,width,height,atlas_area,used_area,efficiency,peak_rss,bytes_written\n");
+	}
+	for (int i = 0; i < BENCH_SCENARIOS_COUNT && !status; i++) {
+		if (selected < 0 || selected == i) status = bench_scenario(&options, csv, i);
+	}
+	status = fclose(csv) || status;
+	return status;
+}
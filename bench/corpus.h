@@ -0,0 +1,154 @@
+/*
+ * Deterministic sprite corpora for bench/atlas.c. Every image is made from
+ * the seed of its scenario and its index only, so the same sprites come out
+ * on every machine, in any order and on any number of threads.
+ *
+ * Sprites are ellipses and rounded rectangles with gradients on transparent
+ * canvases, so they compress, trim and deduplicate like game art does rather
+ * than like noise.
+ */
+
+#ifndef BENCH_CORPUS_H_
+#define BENCH_CORPUS_H_
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum BenchKind {
+	// Near square sprites with one pixel of transparent border
+	BENCH_ICONS,
+	// Sides spread evenly on log scale, from tiny to large
+	BENCH_MIXED,
+	// Long and thin horizontal and vertical strips
+	BENCH_STRIPS,
+	// Small content on big transparent canvases
+	BENCH_BORDERS,
+};
+
+struct BenchScenario {
+	const char *name;
+	enum BenchKind kind;
+	int count;
+	int minSide;
+	int maxSide;
+	// Images past the first uniqueCount copy one of them with extra
+	// transparent border, so they are equal after trimming; 0 for all unique
+	int uniqueCount;
+	// Options added to the command line of every run
+	const char *options[8];
+};
+
+static const struct BenchScenario bench_scenarios[] = {
+	{"icons", BENCH_ICONS, 5000, 8, 32, 0, {"-t", "0", "-p", "1"}},
+	{"mixed", BENCH_MIXED, 1500, 8, 512, 0, {"-t", "0", "-p", "2"}},
+	{"strips", BENCH_STRIPS, 600, 128, 1024, 0, {"-t", "0", "-p", "1"}},
+	{"borders", BENCH_BORDERS, 1000, 64, 384, 0, {"-t", "0", "-p", "1"}},
+	{"duplicates", BENCH_MIXED, 4000, 16, 96, 400, {"-t", "0", "-p", "1", "-u"}},
+	{"huge", BENCH_ICONS, 100000, 4, 24, 0, {"-t", "0", "-p", "1"}},
+};
+
+#define BENCH_SCENARIOS_COUNT ((int)(sizeof(bench_scenarios) / sizeof(*bench_scenarios)))
+
+static unsigned bench_random(unsigned *state) {
+	*state = *state * 1664525u + 1013904223u;
+	return *state >> 8;
+}
+
+static int bench_random_range(unsigned *state, int min, int max) {
+	return min + (int)(bench_random(state) % (unsigned)(max - min + 1));
+}
+
+static int bench_random_log(unsigned *state, int min, int max) {
+	double t = (bench_random(state) & 0xffff) / 65535.0;
+	return (int)(min * pow((double)max / min, t) + 0.5);
+}
+
+// Mixes the numbers into a seed, nearby indices give unrelated sequences
+static unsigned bench_seed(unsigned a, unsigned b) {
+	unsigned h = a * 0x9e3779b9u ^ (b + 0x7f4a7c15u);
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	return h ^ (h >> 16);
+}
+
+// Returns RGBA pixels of the image allocated with malloc
+static unsigned char *bench_make_image(int scenario, int index, int *width, int *height) {
+	const struct BenchScenario *s = &bench_scenarios[scenario];
+	int source = index, margin = 0;
+	if (s->uniqueCount > 0 && index >= s->uniqueCount) {
+		unsigned state = bench_seed((unsigned)scenario, (unsigned)index);
+		source = (int)(bench_random(&state) % (unsigned)s->uniqueCount);
+		margin = bench_random_range(&state, 0, 3);
+	}
+	unsigned state = bench_seed((unsigned)scenario + 1000u, (unsigned)source);
+	int w, h, x0, y0, cw, ch;
+	switch (s->kind) {
+		case BENCH_ICONS:
+			w = bench_random_range(&state, s->minSide, s->maxSide);
+			h = w + bench_random_range(&state, -w / 4, w / 4);
+			if (h < 3) h = 3;
+			x0 = y0 = 1;
+			cw = w - 2;
+			ch = h - 2;
+			break;
+		case BENCH_MIXED:
+			w = bench_random_log(&state, s->minSide, s->maxSide);
+			h = bench_random_log(&state, s->minSide, s->maxSide);
+			x0 = y0 = 0;
+			cw = w;
+			ch = h;
+			break;
+		case BENCH_STRIPS:
+			w = bench_random_range(&state, s->minSide, s->maxSide);
+			h = bench_random_range(&state, 4, 24);
+			if (bench_random(&state) & 1) {
+				int t = w;
+				w = h;
+				h = t;
+			}
+			x0 = y0 = 0;
+			cw = w;
+			ch = h;
+			break;
+		default:
+			w = bench_random_range(&state, s->minSide, s->maxSide);
+			h = bench_random_range(&state, s->minSide, s->maxSide);
+			cw = w * bench_random_range(&state, 15, 45) / 100;
+			ch = h * bench_random_range(&state, 15, 45) / 100;
+			x0 = bench_random_range(&state, 0, w - cw);
+			y0 = bench_random_range(&state, 0, h - ch);
+			break;
+	}
+	int ellipse = bench_random(&state) & 1;
+	unsigned char r = (unsigned char)bench_random(&state), g = (unsigned char)bench_random(&state), b = (unsigned char)bench_random(&state);
+	*width = w + 2 * margin;
+	*height = h + 2 * margin;
+	unsigned char *data = calloc(4 * (size_t)*width * *height, 1);
+	if (!data) return NULL;
+	double cx = cw / 2.0, cy = ch / 2.0, radius = (cw < ch ? cw : ch) / 4.0;
+	for (int y = 0; y < ch; y++) {
+		for (int x = 0; x < cw; x++) {
+			double dx = x + 0.5 - cx, dy = y + 0.5 - cy;
+			int inside;
+			if (ellipse) {
+				inside = (dx * dx) / (cx * cx) + (dy * dy) / (cy * cy) <= 1.0;
+			} else {
+				double ex = fabs(dx) - (cx - radius), ey = fabs(dy) - (cy - radius);
+				inside = ex <= 0 || ey <= 0 || ex * ex + ey * ey <= radius * radius;
+			}
+			if (!inside) continue;
+			unsigned char *p = data + 4 * ((size_t)(y + y0 + margin) * *width + x + x0 + margin);
+			int shade = 64 + 191 * x / (cw > 1 ? cw - 1 : 1);
+			p[0] = (unsigned char)(r * shade / 255);
+			p[1] = (unsigned char)(g * shade / 255);
+			p[2] = (unsigned char)((b + 2 * y) & 0xff);
+			p[3] = 255;
+		}
+	}
+	return data;
+}
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * Microbenchmark of alpha bounds search used for trimming: compares the four
+ * nested loops imgpack used before with utils/trim.h on synthetic images and
+ * checks that both give the same bounds.
+ *
+ * Build and run with `make bench-trim`, add -mavx2 or -march=native to CFLAGS
+ * to get the AVX2 path.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../utils/trim.h"
+
+static void trim_loops(const unsigned char *data, int width, int height, int threshold,
+		int *min_x, int *min_y, int *max_x, int *max_y) {
+	int minY = 0, minX = 0, maxY = height-1, maxX = width-1;
+	for (int y = 0; y < height; y++) for (int x = 0; x < width; x++) if (data[4*(y*width+x)+3] > threshold) {
+		minY = y;
+		y = height;
+		break;
+	}
+	for (int y = height-1; y >= 0; y--) for (int x = 0; x < width; x++) if (data[4*(y*width+x)+3] > threshold) {
+		maxY = y;
+		y = -1;
+		break;
+	}
+	for (int x = 0; x < width; x++) for (int y = 0; y < height; y++) if (data[4*(y*width+x)+3] > threshold) {
+		minX = x;
+		x = width;
+		break;
+	}
+	for (int x = width-1; x >= 0; x--) for (int y = 0; y < height; y++) if (data[4*(y*width+x)+3] > threshold) {
+		maxX = x;
+		x = -1;
+		break;
+	}
+	*min_x = minX;
+	*min_y = minY;
+	*max_x = maxX;
+	*max_y = maxY;
+}
+
+static void trim_bounds(const unsigned char *data, int width, int height, int threshold,
+		int *min_x, int *min_y, int *max_x, int *max_y) {
+	*min_x = 0;
+	*min_y = 0;
+	*max_x = width-1;
+	*max_y = height-1;
+	imgpack_alpha_bounds(data, width, height, threshold, min_x, min_y, max_x, max_y);
+}
+
+// Transparent image with opaque ellipse inside the given margins and some noise
+// with alpha below the threshold, like key art with soft shadows
+static unsigned char *make_image(int width, int height, int margin, unsigned seed) {
+	unsigned char *data = malloc(4 * (size_t)width * height);
+	double cx = width / 2.0, cy = height / 2.0, rx = width / 2.0 - margin, ry = height / 2.0 - margin;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			unsigned char *p = data + 4 * ((size_t)y * width + x);
+			double dx = (x - cx) / rx, dy = (y - cy) / ry;
+			seed = seed * 1664525u + 1013904223u;
+			p[0] = seed >> 24;
+			p[1] = seed >> 16;
+			p[2] = seed >> 8;
+			p[3] = dx*dx + dy*dy <= 1.0 ? 255 : (seed >> 28);
+		}
+	}
+	return data;
+}
+
+typedef void (*trim_fn)(const unsigned char *data, int width, int height, int threshold,
+		int *min_x, int *min_y, int *max_x, int *max_y);
+
+static double run(trim_fn fn, const unsigned char *data, int width, int height, int repeats, int *bounds) {
+	clock_t start = clock();
+	for (int i = 0; i < repeats; i++) {
+		fn(data, width, height, 16, &bounds[0], &bounds[1], &bounds[2], &bounds[3]);
+	}
+	return (double)(clock() - start) / CLOCKS_PER_SEC / repeats * 1000.0;
+}
+
+int main(void) {
+	static const struct {int width, height, margin, repeats;} cases[] = {
+		{4096, 4096, 600, 5},
+		{4096, 4096, 16, 5},
+		{2048, 1024, 200, 20},
+		{256, 256, 32, 2000},
+		{64, 64, 4, 20000},
+	};
+#if defined(IMGPACK_TRIM_AVX2)
+	const char *path = "AVX2";
+#elif defined(IMGPACK_TRIM_SSE2)
+	const char *path = "SSE2";
+#elif defined(IMGPACK_TRIM_NEON)
+	const char *path = "NEON";
+#else
+	const char *path = "scalar";
+#endif
+	int status = 0;
+	printf("image, margin, loops ms, %s ms, speedup\n", path);
+	for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+		int width = cases[i].width, height = cases[i].height;
+		unsigned char *data = make_image(width, height, cases[i].margin, (unsigned)i);
+		int expected[4], actual[4];
+		double loops_ms = run(trim_loops, data, width, height, cases[i].repeats, expected);
+		double bounds_ms = run(trim_bounds, data, width, height, cases[i].repeats, actual);
+		printf("%dx%d, %d, %.3f, %.3f, %.1fx\n", width, height, cases[i].margin, loops_ms, bounds_ms,
+				bounds_ms > 0 ? loops_ms / bounds_ms : 0.0);
+		if (memcmp(expected, actual, sizeof(expected))) {
+			printf("  bounds differ: (%d, %d, %d, %d) vs (%d, %d, %d, %d)\n", expected[0], expected[1], expected[2], expected[3],
+					actual[0], actual[1], actual[2], actual[3]);
+			status = 1;
+		}
+		free(data);
+	}
+	return status;
+}
@@ -71,6 +71,13 @@
 
 #endif // CUTE_FILES_DEBUG_CHECKS
 
+// Define CUTE_FILES_STATIC to make the functions static
+#ifdef CUTE_FILES_STATIC
+	#define CUTE_FILES_DEF static
+#else
+	#define CUTE_FILES_DEF
+#endif
+
 #define CUTE_FILES_MAX_PATH 1024
 #define CUTE_FILES_MAX_FILENAME 256
 #define CUTE_FILES_MAX_EXT 32
@@ -85,43 +92,43 @@ typedef void (cf_callback_t)(cf_file_t* file, void* udata);
 
 // Stores the file extension in cf_file_t::ext, and returns a pointer to
 // cf_file_t::ext
-const char* cf_get_ext(cf_file_t* file);
+CUTE_FILES_DEF const char* cf_get_ext(cf_file_t* file);
 
 // Applies a function (cb) to all files in a directory. Will recursively visit
 // all subdirectories. Useful for asset management, file searching, indexing, etc.
-void cf_traverse(const char* path, cf_callback_t* cb, void* udata);
+CUTE_FILES_DEF void cf_traverse(const char* path, cf_callback_t* cb, void* udata);
 
 // Fills out a cf_file_t struct with file information. Does not actually open the
 // file contents, and instead performs more lightweight OS-specific calls.
-int cf_read_file(cf_dir_t* dir, cf_file_t* file);
+CUTE_FILES_DEF int cf_read_file(cf_dir_t* dir, cf_file_t* file);
 
 // Once a cf_dir_t is opened, this function can be used to grab another file
 // from the operating system.
-void cf_dir_next(cf_dir_t* dir);
+CUTE_FILES_DEF void cf_dir_next(cf_dir_t* dir);
 
 // Performs lightweight OS-specific call to close internal handle.
-void cf_dir_close(cf_dir_t* dir);
+CUTE_FILES_DEF void cf_dir_close(cf_dir_t* dir);
 
 // Performs lightweight OS-specific call to open a file handle on a directory.
-int cf_dir_open(cf_dir_t* dir, const char* path);
+CUTE_FILES_DEF int cf_dir_open(cf_dir_t* dir, const char* path);
 
 // Compares file last write times. -1 if file at path_a was modified earlier than path_b.
 // 0 if they are equal. 1 if file at path_b was modified earlier than path_a.
-int cf_compare_file_times_by_path(const char* path_a, const char* path_b);
+CUTE_FILES_DEF int cf_compare_file_times_by_path(const char* path_a, const char* path_b);
 
 // Retrieves time file was last modified, returns 0 upon failure
-int cf_get_file_time(const char* path, cf_time_t* time);
+CUTE_FILES_DEF int cf_get_file_time(const char* path, cf_time_t* time);
 
 // Compares file last write times. -1 if time_a was modified earlier than path_b.
 // 0 if they are equal. 1 if time_b was modified earlier than path_a.
-int cf_compare_file_times(cf_time_t* time_a, cf_time_t* time_b);
+CUTE_FILES_DEF int cf_compare_file_times(cf_time_t* time_a, cf_time_t* time_b);
 
 // Returns 1 of file exists, otherwise returns 0.
-int cf_file_exists(const char* path);
+CUTE_FILES_DEF int cf_file_exists(const char* path);
 
 // Returns 1 if the file's extension matches the string in ext
 // Returns 0 otherwise
-int cf_match_ext(cf_file_t* file, const char* ext);
+CUTE_FILES_DEF int cf_match_ext(cf_file_t* file, const char* ext);
 
 // Prints detected errors to stdout
 void cf_do_unit_tests();
@@ -223,7 +230,7 @@ static int cf_safe_strcpy_internal(char* dst, const char* src, int n, int max, c
 	return n;
 }
 
-const char* cf_get_ext(cf_file_t* file)
+CUTE_FILES_DEF const char* cf_get_ext(cf_file_t* file)
 {
 	char* name = file->name;
 	char* period = NULL;
@@ -233,7 +240,7 @@ const char* cf_get_ext(cf_file_t* file)
 	return file->ext;
 }
 
-void cf_traverse(const char* path, cf_callback_t* cb, void* udata)
+CUTE_FILES_DEF void cf_traverse(const char* path, cf_callback_t* cb, void* udata)
 {
 	cf_dir_t dir;
 	cf_dir_open(&dir, path);
@@ -259,14 +266,14 @@ void cf_traverse(const char* path, cf_callback_t* cb, void* udata)
 	cf_dir_close(&dir);
 }
 
-int cf_match_ext(cf_file_t* file, const char* ext)
+CUTE_FILES_DEF int cf_match_ext(cf_file_t* file, const char* ext)
 {
 	return !strcmp(file->ext, ext);
 }
 
 #if CUTE_FILES_PLATFORM == CUTE_FILES_WINDOWS
 
-	int cf_read_file(cf_dir_t* dir, cf_file_t* file)
+	CUTE_FILES_DEF int cf_read_file(cf_dir_t* dir, cf_file_t* file)
 	{
 		CUTE_FILES_ASSERT(dir->handle != INVALID_HANDLE_VALUE);
 
@@ -294,7 +301,7 @@ int cf_match_ext(cf_file_t* file, const char* ext)
 		return 1;
 	}
 
-	void cf_dir_next(cf_dir_t* dir)
+	CUTE_FILES_DEF void cf_dir_next(cf_dir_t* dir)
 	{
 		CUTE_FILES_ASSERT(dir->has_next);
 
@@ -306,14 +313,14 @@ int cf_match_ext(cf_file_t* file, const char* ext)
 		}
 	}
 
-	void cf_dir_close(cf_dir_t* dir)
+	CUTE_FILES_DEF void cf_dir_close(cf_dir_t* dir)
 	{
 		dir->path[0] = 0;
 		dir->has_next = 0;
 		if (dir->handle != INVALID_HANDLE_VALUE) FindClose(dir->handle);
 	}
 
-	int cf_dir_open(cf_dir_t* dir, const char* path)
+	CUTE_FILES_DEF int cf_dir_open(cf_dir_t* dir, const char* path)
 	{
 		int n = cf_safe_strcpy(dir->path, path, 0, CUTE_FILES_MAX_PATH);
 		n = cf_safe_strcpy(dir->path, "\\*", n - 1, CUTE_FILES_MAX_PATH);
@@ -333,7 +340,7 @@ int cf_match_ext(cf_file_t* file, const char* ext)
 		return 1;
 	}
 
-	int cf_compare_file_times_by_path(const char* path_a, const char* path_b)
+	CUTE_FILES_DEF int cf_compare_file_times_by_path(const char* path_a, const char* path_b)
 	{
 		FILETIME time_a = { 0 };
 		FILETIME time_b = { 0 };
@@ -344,7 +351,7 @@ int cf_match_ext(cf_file_t* file, const char* ext)
 		return CompareFileTime(&time_a, &time_b);
 	}
 
-	int cf_get_file_time(const char* path, cf_time_t* time)
+	CUTE_FILES_DEF int cf_get_file_time(const char* path, cf_time_t* time)
 	{
 		FILETIME initialized_to_zero = { 0 };
 		time->time = initialized_to_zero;
@@ -357,12 +364,12 @@ int cf_match_ext(cf_file_t* file, const char* ext)
 		return 0;
 	}
 
-	int cf_compare_file_times(cf_time_t* time_a, cf_time_t* time_b)
+	CUTE_FILES_DEF int cf_compare_file_times(cf_time_t* time_a, cf_time_t* time_b)
 	{
 		return CompareFileTime(&time_a->time, &time_b->time);
 	}
 
-	int cf_file_exists(const char* path)
+	CUTE_FILES_DEF int cf_file_exists(const char* path)
 	{
 		WIN32_FILE_ATTRIBUTE_DATA unused;
 		return GetFileAttributesExA(path, GetFileExInfoStandard, &unused);
@@ -370,7 +377,7 @@ int cf_match_ext(cf_file_t* file, const char* ext)
 
 #elif CUTE_FILES_PLATFORM == CUTE_FILES_MAC || CUTE_FILES_PLATFORM == CUTE_FILES_UNIX
 
-	int cf_read_file(cf_dir_t* dir, cf_file_t* file)
+	CUTE_FILES_DEF int cf_read_file(cf_dir_t* dir, cf_file_t* file)
 	{
 		CUTE_FILES_ASSERT(dir->entry);
 
@@ -399,14 +406,14 @@ int cf_match_ext(cf_file_t* file, const char* ext)
 		return 1;
 	}
 
-	void cf_dir_next(cf_dir_t* dir)
+	CUTE_FILES_DEF void cf_dir_next(cf_dir_t* dir)
 	{
 		CUTE_FILES_ASSERT(dir->has_next);
 		dir->entry = readdir(dir->dir);
 		dir->has_next = dir->entry ? 1 : 0;
 	}
 
-	void cf_dir_close(cf_dir_t* dir)
+	CUTE_FILES_DEF void cf_dir_close(cf_dir_t* dir)
 	{
 		dir->path[0] = 0;
 		if (dir->dir) closedir(dir->dir);
@@ -415,7 +422,7 @@ int cf_match_ext(cf_file_t* file, const char* ext)
 		dir->entry = 0;
 	}
 
-	int cf_dir_open(cf_dir_t* dir, const char* path)
+	CUTE_FILES_DEF int cf_dir_open(cf_dir_t* dir, const char* path)
 	{
 		cf_safe_strcpy(dir->path, path, 0, CUTE_FILES_MAX_PATH);
 		dir->dir = opendir(path);
@@ -436,7 +443,7 @@ int cf_match_ext(cf_file_t* file, const char* ext)
 	}
 
 	// Warning : untested code! (let me know if it breaks)
-	int cf_compare_file_times_by_path(const char* path_a, const char* path_b)
+	CUTE_FILES_DEF int cf_compare_file_times_by_path(const char* path_a, const char* path_b)
 	{
 		time_t time_a;
 		time_t time_b;
@@ -449,7 +456,7 @@ int cf_match_ext(cf_file_t* file, const char* ext)
 	}
 
 	// Warning : untested code! (let me know if it breaks)
-	int cf_get_file_time(const char* path, cf_time_t* time)
+	CUTE_FILES_DEF int cf_get_file_time(const char* path, cf_time_t* time)
 	{
 		struct stat info;
 		if (stat(path, &info)) return 0;
@@ -458,13 +465,13 @@ int cf_match_ext(cf_file_t* file, const char* ext)
 	}
 
 	// Warning : untested code! (let me know if it breaks)
-	int cf_compare_file_times(cf_time_t* time_a, cf_time_t* time_b)
+	CUTE_FILES_DEF int cf_compare_file_times(cf_time_t* time_a, cf_time_t* time_b)
 	{
 		return (int)difftime(time_a->time, time_b->time);
 	}
 
 	// Warning : untested code! (let me know if it breaks)
-	int cf_file_exists(const char* path)
+	CUTE_FILES_DEF int cf_file_exists(const char* path)
 	{
 		return access(path, F_OK) != -1;
 	}
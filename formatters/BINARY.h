@@ -0,0 +1,120 @@
+// Fixed layout little endian data read in place by runtime/imgpack_atlas.h,
+// see the layout there
+
+struct ImgPackBinaryStrings {
+	char *data;
+	uint32_t size;
+	uint32_t allocated;
+};
+
+// Appends concatenation of a and b to the pool and returns its offset
+static uint32_t imgpack_formatter_BINARY__add_string(struct ImgPackBinaryStrings *strings, const char *a, const char *b) {
+	uint32_t offset = strings->size, length = (uint32_t)(strlen(a) + strlen(b) + 1);
+	if (strings->size + length > strings->allocated) {
+		uint32_t allocated = strings->allocated ? strings->allocated : 256;
+		while (strings->size + length > allocated) allocated *= 2;
+		char *data = ISLIP_REALLOC(strings->data, allocated);
+		if (!data) return UINT32_MAX;
+		strings->data = data;
+		strings->allocated = allocated;
+	}
+	sprintf(strings->data + offset, "%s%s", a, b);
+	strings->size += length;
+	return offset;
+}
+
+static void imgpack_formatter_BINARY__u32(struct ImgPackWriter *f, uint32_t v) {
+	unsigned char bytes[4] = {(unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24)};
+	imgpack_writer_write(f, bytes, 4);
+}
+
+static int imgpack_formatter_BINARY(struct ImgPackContext *ctx, struct ImgPackWriter *f) {
+	struct ImgPackBinaryStrings strings = {0};
+	uint32_t frames = (uint32_t)ctx->size, pages = (uint32_t)ctx->pagesCount, slots = 1;
+	while (slots < 2 * frames) slots *= 2;
+	uint32_t *names = ISLIP_MALLOC(sizeof(*names) * (frames + 1));
+	uint32_t *page_paths = ISLIP_MALLOC(sizeof(*page_paths) * (pages + 1));
+	uint32_t *hash = ISLIP_MALLOC(2 * sizeof(*hash) * slots);
+	int status = !names || !page_paths || !hash;
+	// Offset 0 is the empty string
+	uint32_t format = 0;
+	if (!status) status = imgpack_formatter_BINARY__add_string(&strings, "", "") == UINT32_MAX;
+	if (!status) format = imgpack_formatter_BINARY__add_string(&strings, get_output_image_format(ctx), "");
+	for (uint32_t i = 0; i < pages && !status; i++) {
+		page_paths[i] = imgpack_formatter_BINARY__add_string(&strings, ctx->pages[i].imagePath, "");
+	}
+	for (uint32_t i = 0; i < frames && !status; i++) {
+		switch (ctx->naming) {
+			case IMGPACK_FULL_PATH: names[i] = imgpack_formatter_BINARY__add_string(&strings, ctx->images[i].path, ""); break;
+			case IMGPACK_NAME_NO_EXT: names[i] = imgpack_formatter_BINARY__add_string(&strings, ctx->images[i].name, ""); break;
+			case IMGPACK_NAME_WITH_EXT: names[i] = imgpack_formatter_BINARY__add_string(&strings, ctx->images[i].name, ctx->images[i].ext); break;
+		}
+		status = names[i] == UINT32_MAX;
+	}
+	for (uint32_t i = 0; i < pages && !status; i++) status = page_paths[i] == UINT32_MAX;
+	if (status || format == UINT32_MAX) {
+		ISLIP_FREE(names);
+		ISLIP_FREE(page_paths);
+		ISLIP_FREE(hash);
+		ISLIP_FREE(strings.data);
+		return 1;
+	}
+
+	// Open addressing by FNV-1a of the name, the first frame wins for duplicate names
+	memset(hash, 0, 2 * sizeof(*hash) * slots);
+	for (uint32_t i = 0; i < frames; i++) {
+		const char *name = strings.data + names[i];
+		uint32_t h = imgpack_atlas_hash(name), j = h & (slots - 1);
+		while (hash[2*j + 1] && strcmp(strings.data + names[hash[2*j + 1] - 1], name)) j = (j + 1) & (slots - 1);
+		if (hash[2*j + 1]) continue;
+		hash[2*j] = h;
+		hash[2*j + 1] = i + 1;
+	}
+
+	uint32_t frames_offset = IMGPACK_ATLAS_HEADER_SIZE;
+	uint32_t pages_offset = frames_offset + 4 * IMGPACK_ATLAS_ARRAYS * frames;
+	uint32_t hash_offset = pages_offset + 16 * pages;
+	uint32_t strings_offset = hash_offset + 8 * slots;
+	imgpack_writer_write(f, IMGPACK_ATLAS_MAGIC, 8);
+	uint32_t header[] = {IMGPACK_ATLAS_VERSION, strings_offset + strings.size, frames, pages, slots,
+		frames_offset, pages_offset, hash_offset, strings_offset, strings.size, format,
+		(uint32_t)ctx->scaleNumerator, (uint32_t)ctx->scaleDenominator, 0};
+	for (size_t i = 0; i < sizeof(header) / sizeof(*header); i++) imgpack_formatter_BINARY__u32(f, header[i]);
+
+	for (int array = 0; array < IMGPACK_ATLAS_ARRAYS; array++) {
+		for (uint32_t i = 0; i < frames; i++) {
+			struct stbrp_rect frame = get_frame_rect(ctx, i);
+			uint32_t v = 0;
+			switch (array) {
+				case IMGPACK_ATLAS_X: v = frame.x; break;
+				case IMGPACK_ATLAS_Y: v = frame.y; break;
+				case IMGPACK_ATLAS_W: v = frame.w; break;
+				case IMGPACK_ATLAS_H: v = frame.h; break;
+				case IMGPACK_ATLAS_OFFSET_X: v = ctx->images[i].source.x; break;
+				case IMGPACK_ATLAS_OFFSET_Y: v = ctx->images[i].source.y; break;
+				case IMGPACK_ATLAS_SOURCE_W: v = ctx->images[i].source.w; break;
+				case IMGPACK_ATLAS_SOURCE_H: v = ctx->images[i].source.h; break;
+				case IMGPACK_ATLAS_PAGE: v = get_frame_page(ctx, i); break;
+				case IMGPACK_ATLAS_FLAGS:
+					v = (is_image_rotated(ctx, i) ? IMGPACK_ATLAS_ROTATED : 0) | (is_image_trimmed(ctx, i) ? IMGPACK_ATLAS_TRIMMED : 0);
+					break;
+				case IMGPACK_ATLAS_NAME: v = names[i]; break;
+			}
+			imgpack_formatter_BINARY__u32(f, v);
+		}
+	}
+	for (uint32_t i = 0; i < pages; i++) {
+		imgpack_formatter_BINARY__u32(f, page_paths[i]);
+		imgpack_formatter_BINARY__u32(f, ctx->pages[i].width);
+		imgpack_formatter_BINARY__u32(f, ctx->pages[i].height);
+		imgpack_formatter_BINARY__u32(f, 0);
+	}
+	for (uint32_t i = 0; i < 2 * slots; i++) imgpack_formatter_BINARY__u32(f, hash[i]);
+	imgpack_writer_write(f, strings.data, strings.size);
+
+	ISLIP_FREE(names);
+	ISLIP_FREE(page_paths);
+	ISLIP_FREE(hash);
+	ISLIP_FREE(strings.data);
+	return f->status;
+}
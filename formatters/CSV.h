@@ -1,11 +1,16 @@
-static int imgpack_formatter_CSV(struct ImgPackContext *ctx, FILE *f) {
-	fprintf(f, "id, name, path, x, y, width, height, src_width, src_height, image, format, scale\n");
+static int imgpack_formatter_CSV(struct ImgPackContext *ctx, struct ImgPackWriter *f) {
+	imgpack_writer_printf(f, "id, name, path, x, y, width, height, src_width, src_height, image, format, scale%s%s\n", ctx->allowMultipack ? ", page" : "",
+			ctx->allowRotation ? ", rotated" : "");
 	for (int i = 0; i < ctx->size; i++) {
 		struct stbrp_rect frame = get_frame_rect(ctx, i);
-		fprintf(f, "%d, \"%s\", \"%s\", %d, %d, %d, %d, %d, %d, \"%s\", \"%s\", \"%.5g\"\n", i,
+		int page = get_frame_page(ctx, i);
+		imgpack_writer_printf(f, "%d, \"%s\", \"%s\", %d, %d, %d, %d, %d, %d, \"%s\", \"%s\", \"%.5g\"", i,
 				ctx->images[i].name, ctx->images[i].path, frame.x, frame.y, frame.w, frame.h, ctx->images[i].source.w,
-				ctx->images[i].source.h, ctx->outputImagePath, get_output_image_format(ctx),
+				ctx->images[i].source.h, ctx->pages[page].imagePath, get_output_image_format(ctx),
 				((1.0*ctx->scaleNumerator)/ctx->scaleDenominator));
+		if (ctx->allowMultipack) imgpack_writer_printf(f, ", %d", page);
+		if (ctx->allowRotation) imgpack_writer_printf(f, ", %d", is_image_rotated(ctx, i));
+		imgpack_writer_printf(f, "\n");
 	}
-	return 0;
+	return f->status;
 }
@@ -1,27 +1,36 @@
-static int imgpack_formatter_JSON_HASH(struct ImgPackContext *ctx, FILE *f) {
-	fprintf(f, "{\"frames\": {\n\n");
+static int imgpack_formatter_JSON_HASH(struct ImgPackContext *ctx, struct ImgPackWriter *f) {
+	imgpack_writer_printf(f, "{\"frames\": {\n\n");
 	for (int i = 0; i < ctx->size; i++) {
 		struct stbrp_rect frame = get_frame_rect(ctx, i);
 		switch (ctx->naming) {
-			case IMGPACK_FULL_PATH: fprintf(f, "\"%s\":\n{\n", ctx->images[i].path); break;
-			case IMGPACK_NAME_NO_EXT: fprintf(f, "\"%s\":\n{\n", ctx->images[i].name); break;
-			case IMGPACK_NAME_WITH_EXT: fprintf(f, "\"%s%s\":\n{\n", ctx->images[i].name, ctx->images[i].ext); break;
+			case IMGPACK_FULL_PATH: imgpack_writer_printf(f, "\"%s\":\n{\n", ctx->images[i].path); break;
+			case IMGPACK_NAME_NO_EXT: imgpack_writer_printf(f, "\"%s\":\n{\n", ctx->images[i].name); break;
+			case IMGPACK_NAME_WITH_EXT: imgpack_writer_printf(f, "\"%s%s\":\n{\n", ctx->images[i].name, ctx->images[i].ext); break;
 		}
-		fprintf(f, "\t\"frame\": {\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d},\n", frame.x, frame.y, frame.w, frame.h);
-		fprintf(f, "\t\"rotated\": %s,\n", is_image_rotated(ctx, i) ? "true" : "false");
-		fprintf(f, "\t\"trimmed\": %s,\n", is_image_trimmed(ctx, i) ? "true" : "false");
-		fprintf(f, "\t\"spriteSourceSize\": {\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d},\n", ctx->images[i].source.x, ctx->images[i].source.y, frame.w, frame.h);
-		fprintf(f, "\t\"sourceRects\": {\"w\":%d,\"h\":%d},\n", ctx->images[i].source.w, ctx->images[i].source.h);
-		fprintf(f, "\t\"pivot\": {\"x\":0.5,\"y\":0.5}\n");
-		fprintf(f, "}%s\n", i == ctx->size-1 ? "}," : ",");
+		imgpack_writer_printf(f, "\t\"frame\": {\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d},\n", frame.x, frame.y, frame.w, frame.h);
+		imgpack_writer_printf(f, "\t\"rotated\": %s,\n", is_image_rotated(ctx, i) ? "true" : "false");
+		imgpack_writer_printf(f, "\t\"trimmed\": %s,\n", is_image_trimmed(ctx, i) ? "true" : "false");
+		if (ctx->allowMultipack) imgpack_writer_printf(f, "\t\"page\": %d,\n", get_frame_page(ctx, i));
+		imgpack_writer_printf(f, "\t\"spriteSourceSize\": {\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d},\n", ctx->images[i].source.x, ctx->images[i].source.y, frame.w, frame.h);
+		imgpack_writer_printf(f, "\t\"sourceRects\": {\"w\":%d,\"h\":%d},\n", ctx->images[i].source.w, ctx->images[i].source.h);
+		imgpack_writer_printf(f, "\t\"pivot\": {\"x\":0.5,\"y\":0.5}\n");
+		imgpack_writer_printf(f, "}%s\n", i == ctx->size-1 ? "}," : ",");
 	}
-	fprintf(f, "\"meta\": {\n");
-	fprintf(f, "\t\"app\": \"https://github.com/iskolbin/imgpack\",\n");
-	fprintf(f, "\t\"version\": \"%s\",\n", ISLIP_VERSION);
-	fprintf(f, "\t\"image\": \"%s\",\n", ctx->outputImagePath);
-	fprintf(f, "\t\"format\": \"%s\",\n", get_output_image_format(ctx));
-	fprintf(f, "\t\"size\": {\"w\":%d,\"h\":%d},\n", ctx->width, ctx->height);
-	fprintf(f, "\t\"scale\": \"%.5g\"\n", ((1.0*ctx->scaleNumerator)/ctx->scaleDenominator));
-	fprintf(f, "}\n}");
-	return 0;
+	imgpack_writer_printf(f, "\"meta\": {\n");
+	imgpack_writer_printf(f, "\t\"app\": \"https://github.com/iskolbin/imgpack\",\n");
+	imgpack_writer_printf(f, "\t\"version\": \"%s\",\n", ISLIP_VERSION);
+	imgpack_writer_printf(f, "\t\"image\": \"%s\",\n", ctx->pages[0].imagePath);
+	if (ctx->allowMultipack) {
+		imgpack_writer_printf(f, "\t\"pages\": [\n");
+		for (int i = 0; i < ctx->pagesCount; i++) {
+			imgpack_writer_printf(f, "\t\t{\"image\": \"%s\", \"size\": {\"w\":%d,\"h\":%d}}%s\n", ctx->pages[i].imagePath,
+					ctx->pages[i].width, ctx->pages[i].height, i == ctx->pagesCount-1 ? "" : ",");
+		}
+		imgpack_writer_printf(f, "\t],\n");
+	}
+	imgpack_writer_printf(f, "\t\"format\": \"%s\",\n", get_output_image_format(ctx));
+	imgpack_writer_printf(f, "\t\"size\": {\"w\":%d,\"h\":%d},\n", ctx->width, ctx->height);
+	imgpack_writer_printf(f, "\t\"scale\": \"%.5g\"\n", ((1.0*ctx->scaleNumerator)/ctx->scaleDenominator));
+	imgpack_writer_printf(f, "}\n}");
+	return f->status;
 }
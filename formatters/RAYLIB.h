@@ -10,174 +10,340 @@ static void imgpack_formatter_RAYLIB__generate_name(const char *image_path, char
 	out_buffer[j] = '\0';
 }
 
-static int imgpack_formatter_RAYLIB(struct ImgPackContext *ctx, FILE *f) {
+// Same hash as emitted <name>_Hash, FNV-1a with the seed mixed into the basis
+static uint32_t imgpack_formatter_RAYLIB__hash(uint32_t seed, const char *s) {
+	uint32_t h = 2166136261u ^ seed;
+	for (; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+	return h;
+}
+
+// Builds minimal perfect hash of count keys with hash and displace: keys go to
+// buckets by the unseeded hash, buckets from the biggest one get the smallest
+// seed which puts all their keys to free slots. Buckets of a single key store
+// the slot as -slot-1. Slots hold id of the key plus one, keys repeating an
+// earlier one are left out. Returns non-zero on allocation failure
+static int imgpack_formatter_RAYLIB__perfect_hash(char **keys, int count, int *seeds, int *slots) {
+	int size = count > 0 ? count : 1;
+	int *buckets = ISLIP_MALLOC(sizeof(*buckets) * size), *starts = ISLIP_MALLOC(sizeof(*starts) * (size + 1));
+	int *items = ISLIP_MALLOC(sizeof(*items) * size), *placed = ISLIP_MALLOC(sizeof(*placed) * size);
+	if (!buckets || !starts || !items || !placed) {
+		ISLIP_FREE(buckets);
+		ISLIP_FREE(starts);
+		ISLIP_FREE(items);
+		ISLIP_FREE(placed);
+		return 1;
+	}
+	memset(seeds, 0, sizeof(*seeds) * size);
+	memset(slots, 0, sizeof(*slots) * size);
+	memset(starts, 0, sizeof(*starts) * (size + 1));
+	for (int i = 0; i < count; i++) {
+		buckets[i] = (int)(imgpack_formatter_RAYLIB__hash(0, keys[i]) % (uint32_t)size);
+		starts[buckets[i] + 1]++;
+	}
+	for (int b = 0; b < size; b++) starts[b + 1] += starts[b];
+	// Placed counts keys in the bucket so far, without repeated ones
+	memset(placed, 0, sizeof(*placed) * size);
+	int max_count = 0;
+	for (int i = 0; i < count; i++) {
+		int b = buckets[i], repeated = 0;
+		for (int j = 0; j < placed[b] && !repeated; j++) repeated = !strcmp(keys[items[starts[b] + j]], keys[i]);
+		if (repeated) continue;
+		items[starts[b] + placed[b]++] = i;
+		if (placed[b] > max_count) max_count = placed[b];
+	}
+	for (int bucket_count = max_count; bucket_count >= 2; bucket_count--) {
+		for (int b = 0; b < size; b++) {
+			if (placed[b] != bucket_count) continue;
+			for (uint32_t seed = 1;; seed++) {
+				int fits = 1;
+				for (int j = 0; j < bucket_count && fits; j++) {
+					uint32_t slot = imgpack_formatter_RAYLIB__hash(seed, keys[items[starts[b] + j]]) % (uint32_t)size;
+					fits = slots[slot] == 0;
+					for (int k = 0; k < j && fits; k++) {
+						fits = imgpack_formatter_RAYLIB__hash(seed, keys[items[starts[b] + k]]) % (uint32_t)size != slot;
+					}
+				}
+				if (!fits) continue;
+				for (int j = 0; j < bucket_count; j++) {
+					int id = items[starts[b] + j];
+					slots[imgpack_formatter_RAYLIB__hash(seed, keys[id]) % (uint32_t)size] = id + 1;
+				}
+				seeds[b] = (int)seed;
+				break;
+			}
+		}
+	}
+	for (int b = 0, free_slot = 0; b < size; b++) {
+		if (placed[b] != 1) continue;
+		while (slots[free_slot]) free_slot++;
+		slots[free_slot] = items[starts[b]] + 1;
+		seeds[b] = -free_slot - 1;
+	}
+	ISLIP_FREE(buckets);
+	ISLIP_FREE(starts);
+	ISLIP_FREE(items);
+	ISLIP_FREE(placed);
+	return 0;
+}
+
+static void imgpack_formatter_RAYLIB__print_table(struct ImgPackWriter *f, const char *name, const char *table, const int *values, int count) {
+	imgpack_writer_printf(f, "static const int %s_%s[%d] = {", name, table, count);
+	for (int i = 0; i < count; i++) {
+		imgpack_writer_printf(f, "%s%d%s", i % 16 == 0 ? "\n  " : " ", values[i], i < count - 1 ? "," : "\n");
+	}
+	imgpack_writer_printf(f, "};\n\n");
+}
+
+static int imgpack_formatter_RAYLIB(struct ImgPackContext *ctx, struct ImgPackWriter *f) {
 	char *name = ctx->name;
-	fprintf(f, "#ifndef %s_H_\n", name);
-	fprintf(f, "#define %s_H_\n", name);
-	fprintf(f, "/* Generated by imgpack %s */\n", ISLIP_VERSION);
-	fprintf(f, "#ifndef %s_STRCMP\n", name);
-	fprintf(f, "int strcmp(const char *, const char *);\n");
-	fprintf(f, "#define %s_STRCMP strcmp\n", name);
-	fprintf(f, "#endif\n");
-	fprintf(f, "enum %s_Id {\n", name);
-	fprintf(f, "  %s_NONE = 0,\n", name);
+	imgpack_writer_printf(f, "#ifndef %s_H_\n", name);
+	imgpack_writer_printf(f, "#define %s_H_\n", name);
+	imgpack_writer_printf(f, "/* Generated by imgpack %s */\n", ISLIP_VERSION);
+	imgpack_writer_printf(f, "#ifndef %s_STRCMP\n", name);
+	imgpack_writer_printf(f, "int strcmp(const char *, const char *);\n");
+	imgpack_writer_printf(f, "#define %s_STRCMP strcmp\n", name);
+	imgpack_writer_printf(f, "#endif\n");
+	imgpack_writer_printf(f, "enum %s_Id {\n", name);
+	imgpack_writer_printf(f, "  %s_NONE = 0,\n", name);
 	for (int i = 0; i < ctx->size; i++) {
 		char buffer[512];
 		imgpack_formatter_RAYLIB__generate_name(ctx->images[i].path, buffer);
-		fprintf(f, "  %s_%s = %d,\n", name, buffer, i+1);
-	}
-	fprintf(f, "};\n\n");
-
-	fprintf(f, "#define %s_PATH \"%s\"\n\n", name, ctx->outputImagePath);
-
-	fprintf(f, "#ifndef %s_DEF\n", name);
-	fprintf(f, "#define %s_DEF static\n", name);
-	fprintf(f, "#endif\n\n");
-
-	fprintf(f, "#ifdef %s_NAMESPACED_ANCHOR\n", name);
-	fprintf(f, "#define %s_CENTER 0\n", name);
-	fprintf(f, "#define %s_LEFT 1\n", name);
-	fprintf(f, "#define %s_RIGHT 2\n", name);
-	fprintf(f, "#define %s_TOP 4\n", name);
-	fprintf(f, "#define %s_BOTTOM 8\n", name);
-	fprintf(f, "#else\n");
-	fprintf(f, "#ifndef CENTER\n#define CENTER 0\n#endif\n");
-	fprintf(f, "#ifndef LEFT\n#define LEFT 1\n#endif\n");
-	fprintf(f, "#ifndef RIGHT\n#define RIGHT 2\n#endif\n");
-	fprintf(f, "#ifndef TOP\n#define TOP 4\n#endif\n");
-	fprintf(f, "#ifndef BOTTOM\n#define BOTTOM 8\n#endif\n");
-	fprintf(f, "#endif\n");
-
-	fprintf(f, "%s_DEF void %s_Load(void);\n", name, name);
-	fprintf(f, "%s_DEF void %s_Unload(void);\n", name, name);
-	fprintf(f, "%s_DEF int %s_Draw(enum %s_Id id, float x, float y, Color color, int anchor, const Vector2 *point);\n", name, name, name);
-	fprintf(f, "%s_DEF int %s_DrawEx(enum %s_Id id, float x, float y, float rotation, float scale, Color color, int anchor, const Vector2 *point);\n", name, name, name);
-	fprintf(f, "%s_DEF Texture %s_GetTexture(void);\n", name, name);
-	fprintf(f, "%s_DEF const Vector2 %s_GetScale(void);\n", name, name);
-	fprintf(f, "%s_DEF const Rectangle %s_GetFrame(enum %s_Id id);\n", name, name, name);
-	fprintf(f, "%s_DEF const Vector2 %s_GetOffset(enum %s_Id id);\n", name, name, name);
-	fprintf(f, "%s_DEF const Vector2 %s_GetSourceSize(enum %s_Id id);\n", name, name, name);
-	fprintf(f, "%s_DEF const Vector2 %s_GetOrigin(enum %s_Id id);\n", name, name, name);
-	fprintf(f, "%s_DEF enum %s_Id %s_IdFromPath(const char *path);\n", name, name, name);
-	fprintf(f, "%s_DEF enum %s_Id %s_IdFromStr(const char* str);\n", name, name, name);
-	fprintf(f, "%s_DEF const char* %s_StrId(enum %s_Id id);\n", name, name, name);
-	fprintf(f, "\n");
-	fprintf(f, "#endif\n\n");
-
-	fprintf(f, "#ifdef %s_IMPLEMENTATAION\n", name);
-	fprintf(f, "#ifndef %s_IMPLEMENTATAION_ONCE\n", name);
-	fprintf(f, "#define %s_IMPLEMENTATAION_ONCE\n", name);
-
-	fprintf(f, "static const Vector2 %s_Scale = {%d, %d};\n\n", name, ctx->scaleNumerator, ctx->scaleDenominator);
+		imgpack_writer_printf(f, "  %s_%s = %d,\n", name, buffer, i+1);
+	}
+	imgpack_writer_printf(f, "};\n\n");
+
+	imgpack_writer_printf(f, "#define %s_PATH \"%s\"\n", name, ctx->pages[0].imagePath);
+	imgpack_writer_printf(f, "#define %s_PAGES %d\n\n", name, ctx->pagesCount);
+
+	imgpack_writer_printf(f, "#ifndef %s_DEF\n", name);
+	imgpack_writer_printf(f, "#define %s_DEF static\n", name);
+	imgpack_writer_printf(f, "#endif\n\n");
+
+	imgpack_writer_printf(f, "#ifdef %s_NAMESPACED_ANCHOR\n", name);
+	imgpack_writer_printf(f, "#define %s_CENTER 0\n", name);
+	imgpack_writer_printf(f, "#define %s_LEFT 1\n", name);
+	imgpack_writer_printf(f, "#define %s_RIGHT 2\n", name);
+	imgpack_writer_printf(f, "#define %s_TOP 4\n", name);
+	imgpack_writer_printf(f, "#define %s_BOTTOM 8\n", name);
+	imgpack_writer_printf(f, "#else\n");
+	imgpack_writer_printf(f, "#ifndef CENTER\n#define CENTER 0\n#endif\n");
+	imgpack_writer_printf(f, "#ifndef LEFT\n#define LEFT 1\n#endif\n");
+	imgpack_writer_printf(f, "#ifndef RIGHT\n#define RIGHT 2\n#endif\n");
+	imgpack_writer_printf(f, "#ifndef TOP\n#define TOP 4\n#endif\n");
+	imgpack_writer_printf(f, "#ifndef BOTTOM\n#define BOTTOM 8\n#endif\n");
+	imgpack_writer_printf(f, "#endif\n");
+
+	imgpack_writer_printf(f, "%s_DEF void %s_Load(void);\n", name, name);
+	imgpack_writer_printf(f, "%s_DEF void %s_Unload(void);\n", name, name);
+	imgpack_writer_printf(f, "%s_DEF int %s_Draw(enum %s_Id id, float x, float y, Color color, int anchor, const Vector2 *point);\n", name, name, name);
+	imgpack_writer_printf(f, "%s_DEF int %s_DrawEx(enum %s_Id id, float x, float y, float rotation, float scale, Color color, int anchor, const Vector2 *point);\n", name, name, name);
+	imgpack_writer_printf(f, "%s_DEF Texture %s_GetTexture(void);\n", name, name);
+	imgpack_writer_printf(f, "%s_DEF Texture %s_GetPageTexture(int page);\n", name, name);
+	imgpack_writer_printf(f, "%s_DEF int %s_GetPage(enum %s_Id id);\n", name, name, name);
+	imgpack_writer_printf(f, "%s_DEF const Vector2 %s_GetScale(void);\n", name, name);
+	imgpack_writer_printf(f, "%s_DEF const Rectangle %s_GetFrame(enum %s_Id id);\n", name, name, name);
+	imgpack_writer_printf(f, "%s_DEF const Vector2 %s_GetOffset(enum %s_Id id);\n", name, name, name);
+	imgpack_writer_printf(f, "%s_DEF const Vector2 %s_GetSourceSize(enum %s_Id id);\n", name, name, name);
+	imgpack_writer_printf(f, "%s_DEF const Vector2 %s_GetOrigin(enum %s_Id id);\n", name, name, name);
+	imgpack_writer_printf(f, "%s_DEF enum %s_Id %s_IdFromPath(const char *path);\n", name, name, name);
+	imgpack_writer_printf(f, "%s_DEF enum %s_Id %s_IdFromStr(const char* str);\n", name, name, name);
+	imgpack_writer_printf(f, "%s_DEF const char* %s_StrId(enum %s_Id id);\n", name, name, name);
+	imgpack_writer_printf(f, "\n");
+	imgpack_writer_printf(f, "#endif\n\n");
+
+	imgpack_writer_printf(f, "#ifdef %s_IMPLEMENTATAION\n", name);
+	imgpack_writer_printf(f, "#ifndef %s_IMPLEMENTATAION_ONCE\n", name);
+	imgpack_writer_printf(f, "#define %s_IMPLEMENTATAION_ONCE\n", name);
+
+	imgpack_writer_printf(f, "static const Vector2 %s_Scale = {%d, %d};\n\n", name, ctx->scaleNumerator, ctx->scaleDenominator);
 	
-	fprintf(f, "static const Rectangle %s_Frame[%d] = {\n  {0, 0, 0, 0},\t /* (NONE) */\n", name, ctx->size+1);
+	imgpack_writer_printf(f, "static const Rectangle %s_Frame[%d] = {\n  {0, 0, 0, 0},\t /* (NONE) */\n", name, ctx->size+1);
 	for (int i = 0; i < ctx->size; i++) {
 		struct stbrp_rect frame = get_frame_rect(ctx, i);
-		fprintf(f, "  {%d, %d, %d, %d},\t/* %d (%s) */\n", frame.x, frame.y, frame.w, frame.h, i + 1, ctx->images[i].path);
+		if (is_image_rotated(ctx, i)) {
+			imgpack_writer_printf(f, "  {%d, %d, %d, %d},\t/* %d (%s) rotated */\n", frame.x, frame.y, frame.h, frame.w, i + 1, ctx->images[i].path);
+		} else {
+			imgpack_writer_printf(f, "  {%d, %d, %d, %d},\t/* %d (%s) */\n", frame.x, frame.y, frame.w, frame.h, i + 1, ctx->images[i].path);
+		}
+	}
+	imgpack_writer_printf(f, "};\n\n");
+
+	imgpack_writer_printf(f, "static const unsigned char %s_Rotated[%d] = {\n  0,\t /* (NONE) */\n", name, ctx->size+1);
+	for (int i = 0; i < ctx->size; i++) {
+		imgpack_writer_printf(f, "  %d,\t/* %d (%s) */\n", is_image_rotated(ctx, i), i + 1, ctx->images[i].path);
 	}
-	fprintf(f, "};\n\n");
+	imgpack_writer_printf(f, "};\n\n");
 
-	fprintf(f, "static const Vector2 %s_Offset[%d] = {\n  {0, 0},\t /* (NONE) */\n", name, ctx->size+1);
+	imgpack_writer_printf(f, "static const int %s_Page[%d] = {\n  0,\t /* (NONE) */\n", name, ctx->size+1);
 	for (int i = 0; i < ctx->size; i++) {
-		fprintf(f, "  {%d, %d},\t/* %d (%s) */\n", ctx->images[i].source.x, ctx->images[i].source.y, i + 1, ctx->images[i].path);
+		imgpack_writer_printf(f, "  %d,\t/* %d (%s) */\n", get_frame_page(ctx, i), i + 1, ctx->images[i].path);
 	}
-	fprintf(f, "};\n\n");
+	imgpack_writer_printf(f, "};\n\n");
 
-	fprintf(f, "static const Vector2 %s_SourceSize[%d] = {\n  {0, 0},\t /* (NONE) */\n", name, ctx->size+1);
+	imgpack_writer_printf(f, "static const Vector2 %s_Offset[%d] = {\n  {0, 0},\t /* (NONE) */\n", name, ctx->size+1);
 	for (int i = 0; i < ctx->size; i++) {
-		fprintf(f, "  {%d, %d},\t/* %d (%s) */\n", ctx->images[i].source.w, ctx->images[i].source.h, i + 1, ctx->images[i].path);
+		imgpack_writer_printf(f, "  {%d, %d},\t/* %d (%s) */\n", ctx->images[i].source.x, ctx->images[i].source.y, i + 1, ctx->images[i].path);
 	}
-	fprintf(f, "};\n\n");
+	imgpack_writer_printf(f, "};\n\n");
 
-	fprintf(f, "static const Vector2 %s_Origin[%d] = {\n  {0, 0},\t /* (NONE) */\n", name, ctx->size+1);
+	imgpack_writer_printf(f, "static const Vector2 %s_SourceSize[%d] = {\n  {0, 0},\t /* (NONE) */\n", name, ctx->size+1);
+	for (int i = 0; i < ctx->size; i++) {
+		imgpack_writer_printf(f, "  {%d, %d},\t/* %d (%s) */\n", ctx->images[i].source.w, ctx->images[i].source.h, i + 1, ctx->images[i].path);
+	}
+	imgpack_writer_printf(f, "};\n\n");
+
+	imgpack_writer_printf(f, "static const Vector2 %s_Origin[%d] = {\n  {0, 0},\t /* (NONE) */\n", name, ctx->size+1);
 	for (int i = 0; i < ctx->size; i++) {
 		struct stbrp_rect source = ctx->images[i].source;
-		fprintf(f, "  {%d, %d},\t/* %d (%s) */\n", source.w/2 - source.x, source.h/2 - source.y, i + 1, ctx->images[i].path);
+		imgpack_writer_printf(f, "  {%d, %d},\t/* %d (%s) */\n", source.w/2 - source.x, source.h/2 - source.y, i + 1, ctx->images[i].path);
 	}
-	fprintf(f, "};\n\n");
+	imgpack_writer_printf(f, "};\n\n");
 
-	fprintf(f, "static Texture %s_Texture = {0};\n\n", name);
+	imgpack_writer_printf(f, "static const char *%s_PagePath[%s_PAGES] = {\n", name, name);
+	for (int i = 0; i < ctx->pagesCount; i++) {
+		imgpack_writer_printf(f, "  \"%s\",\n", ctx->pages[i].imagePath);
+	}
+	imgpack_writer_printf(f, "};\n\n");
 
-	fprintf(f, "void %s_Load(void) {\n", name);
-	fprintf(f, "  %s_Texture = LoadTexture(%s_PATH);\n", name, name);
-	fprintf(f, "}\n\n");
+	imgpack_writer_printf(f, "static Texture %s_Texture[%s_PAGES] = {0};\n\n", name, name);
 
-	fprintf(f, "void %s_Unload(void) {\n", name);
-	fprintf(f, "  UnloadTexture(%s_Texture);\n", name);
-	fprintf(f, "  %s_Texture = (Texture) {0};\n", name);
-	fprintf(f, "}\n\n");
+	imgpack_writer_printf(f, "void %s_Load(void) {\n", name);
+	imgpack_writer_printf(f, "  for (int i = 0; i < %s_PAGES; i++) %s_Texture[i] = LoadTexture(%s_PagePath[i]);\n", name, name, name);
+	imgpack_writer_printf(f, "}\n\n");
 
-	fprintf(f, "enum %s_Id %s_IdFromPath(const char *path) {\n", name, name);
-	for (int i = 0; i < ctx->size; i++) {
+	imgpack_writer_printf(f, "void %s_Unload(void) {\n", name);
+	imgpack_writer_printf(f, "  for (int i = 0; i < %s_PAGES; i++) {\n", name);
+	imgpack_writer_printf(f, "    UnloadTexture(%s_Texture[i]);\n", name);
+	imgpack_writer_printf(f, "    %s_Texture[i] = (Texture) {0};\n", name);
+	imgpack_writer_printf(f, "  }\n");
+	imgpack_writer_printf(f, "}\n\n");
+
+	char **id_strs = ISLIP_MALLOC(sizeof(*id_strs) * (ctx->size + 1));
+	char **paths = ISLIP_MALLOC(sizeof(*paths) * (ctx->size + 1));
+	int slots = ctx->size > 0 ? ctx->size : 1;
+	int *path_seeds = ISLIP_MALLOC(sizeof(*path_seeds) * slots), *path_ids = ISLIP_MALLOC(sizeof(*path_ids) * slots);
+	int *str_seeds = ISLIP_MALLOC(sizeof(*str_seeds) * slots), *str_ids = ISLIP_MALLOC(sizeof(*str_ids) * slots);
+	int status = !id_strs || !paths || !path_seeds || !path_ids || !str_seeds || !str_ids;
+	for (int i = 0; i < ctx->size && !status; i++) {
 		char buffer[512];
 		imgpack_formatter_RAYLIB__generate_name(ctx->images[i].path, buffer);
-		fprintf(f, "  if (%s_STRCMP(path, \"%s\") == 0) return %s_%s;\n", name, ctx->images[i].path, name, buffer);
+		id_strs[i] = ISLIP_MALLOC(strlen(name) + strlen(buffer) + 2);
+		if (id_strs[i]) sprintf(id_strs[i], "%s_%s", name, buffer);
+		else status = 1;
+		paths[i] = ctx->images[i].path;
 	}
-	fprintf(f, "  return %s_NONE;\n", name);
-	fprintf(f, "}\n\n");
+	if (!status) status = imgpack_formatter_RAYLIB__perfect_hash(paths, ctx->size, path_seeds, path_ids);
+	if (!status) status = imgpack_formatter_RAYLIB__perfect_hash(id_strs, ctx->size, str_seeds, str_ids);
+	if (!status) {
+		imgpack_writer_printf(f, "static const char *%s_ImagePath[%d] = {\n  \"\",\t /* (NONE) */\n", name, ctx->size+1);
+		for (int i = 0; i < ctx->size; i++) {
+			imgpack_writer_printf(f, "  \"%s\",\t/* %d */\n", paths[i], i + 1);
+		}
+		imgpack_writer_printf(f, "};\n\n");
 
-	fprintf(f, "enum %s_Id %s_IdFromStr(const char *id_str) {\n", name, name);
-	for (int i = 0; i < ctx->size; i++) {
-		char buffer[512];
-		imgpack_formatter_RAYLIB__generate_name(ctx->images[i].path, buffer);
-		fprintf(f, "  if (%s_STRCMP(id_str, \"%s_%s\") == 0) return %s_%s;\n", name, name, buffer, name, buffer);
+		imgpack_writer_printf(f, "static const char *%s_IdStr[%d] = {\n  \"%s_NONE\",\n", name, ctx->size+1, name);
+		for (int i = 0; i < ctx->size; i++) {
+			imgpack_writer_printf(f, "  \"%s\",\t/* %d */\n", id_strs[i], i + 1);
+		}
+		imgpack_writer_printf(f, "};\n\n");
+
+		imgpack_formatter_RAYLIB__print_table(f, name, "PathSeed", path_seeds, slots);
+		imgpack_formatter_RAYLIB__print_table(f, name, "PathSlot", path_ids, slots);
+		imgpack_formatter_RAYLIB__print_table(f, name, "IdStrSeed", str_seeds, slots);
+		imgpack_formatter_RAYLIB__print_table(f, name, "IdStrSlot", str_ids, slots);
+
+		imgpack_writer_printf(f, "/* Minimal perfect hash: the seed of the bucket gives the slot of the key, or the\n");
+		imgpack_writer_printf(f, "   slot itself as -slot-1 for single key buckets, the key is compared once */\n");
+		imgpack_writer_printf(f, "static unsigned long %s_Hash(unsigned long seed, const char *s) {\n", name);
+		imgpack_writer_printf(f, "  unsigned long h = 2166136261UL ^ seed;\n");
+		imgpack_writer_printf(f, "  for (; *s; s++) h = ((h ^ (unsigned char)*s) * 16777619UL) & 0xffffffffUL;\n");
+		imgpack_writer_printf(f, "  return h;\n");
+		imgpack_writer_printf(f, "}\n\n");
+
+		imgpack_writer_printf(f, "static int %s_Lookup(const int *seeds, const int *slots, const char **keys, const char *key) {\n", name);
+		imgpack_writer_printf(f, "  int seed = seeds[%s_Hash(0, key) %% %d];\n", name, slots);
+		imgpack_writer_printf(f, "  int id = slots[seed < 0 ? -seed - 1 : (int)(%s_Hash((unsigned long)seed, key) %% %d)];\n", name, slots);
+		imgpack_writer_printf(f, "  return id && %s_STRCMP(key, keys[id]) == 0 ? id : 0;\n", name);
+		imgpack_writer_printf(f, "}\n\n");
+
+		imgpack_writer_printf(f, "enum %s_Id %s_IdFromPath(const char *path) {\n", name, name);
+		imgpack_writer_printf(f, "  return (enum %s_Id)%s_Lookup(%s_PathSeed, %s_PathSlot, %s_ImagePath, path);\n", name, name, name, name, name);
+		imgpack_writer_printf(f, "}\n\n");
+
+		imgpack_writer_printf(f, "enum %s_Id %s_IdFromStr(const char *id_str) {\n", name, name);
+		imgpack_writer_printf(f, "  return (enum %s_Id)%s_Lookup(%s_IdStrSeed, %s_IdStrSlot, %s_IdStr, id_str);\n", name, name, name, name, name);
+		imgpack_writer_printf(f, "}\n\n");
+
+		imgpack_writer_printf(f, "const char* %s_StrId(enum %s_Id id) {\n", name, name);
+		imgpack_writer_printf(f, "  return (int)id >= 0 && (int)id <= %d ? %s_IdStr[id] : \"%s_NONE\";\n", ctx->size, name, name);
+		imgpack_writer_printf(f, "}\n\n");
 	}
-	fprintf(f, "  return %s_NONE;\n", name);
-	fprintf(f, "}\n\n");
+	for (int i = 0; i < ctx->size && id_strs; i++) ISLIP_FREE(id_strs[i]);
+	ISLIP_FREE(id_strs);
+	ISLIP_FREE(paths);
+	ISLIP_FREE(path_seeds);
+	ISLIP_FREE(path_ids);
+	ISLIP_FREE(str_seeds);
+	ISLIP_FREE(str_ids);
+	if (status) return 1;
 
-	fprintf(f, "const char* %s_StrId(enum %s_Id id) {\n", name, name);
-	fprintf(f, "  switch(id) {\n");
-	fprintf(f, "  case %s_NONE: return %s_NONE;\n", name, name);
-	for (int i = 0; i < ctx->size; i++) {
-		char buffer[512];
-		imgpack_formatter_RAYLIB__generate_name(ctx->images[i].path, buffer);
-		fprintf(f, "    case %s_%s: return \"%s_%s\";\n", name, buffer, name, buffer);
-	}
-	fprintf(f, "  }\n");
-	fprintf(f, "  return \"%s_NONE\";\n", name);
-	fprintf(f, "}\n\n");
-
-	fprintf(f, "int %s_Draw(enum %s_Id id, float x, float y, Color color, int anchor, const Vector2 *point) {\n", name, name);
-	fprintf(f, "  if (id) {\n");
-	fprintf(f, "    x += (anchor & 1 ? 0 : anchor & 2 ? -%s_SourceSize[id].x : -%s_Origin[id].x - %s_Offset[id].x);\n", name, name, name);
-	fprintf(f, "    y += (anchor & 4 ? 0 : anchor & 8 ? -%s_SourceSize[id].y : -%s_Origin[id].y - %s_Offset[id].y);\n", name, name, name);
-	fprintf(f, "    Rectangle destRec = {x + %s_Offset[id].x, y + %s_Offset[id].y, %s_Frame[id].width, %s_Frame[id].height};\n", name, name, name, name);
-	fprintf(f, "    DrawTexturePro(%s_Texture, %s_Frame[id], destRec, (Vector2){0,0}, 0, color);\n", name, name);
-	fprintf(f, "    if (point) {\n");
-	fprintf(f, "      Rectangle collisionRec = {x, y, %s_SourceSize[id].x, %s_SourceSize[id].y};\n", name, name);
-	fprintf(f, "      return CheckCollisionPointRec(*point, collisionRec);\n");
-	fprintf(f, "    }\n");
-	fprintf(f, "  }\n");
-	fprintf(f, "  return 0;\n");
-	fprintf(f, "}\n\n");
-
-	fprintf(f, "int %s_DrawEx(enum %s_Id id, float x, float y, float rotation, float scale, Color color, int anchor, const Vector2 *point) {\n", name, name);
-	fprintf(f, "  if (id) {\n");
-	fprintf(f, "    Rectangle sourceRec = %s_Frame[id];\n", name);
-	fprintf(f, "    Vector2 origin = %s_Origin[id];\n", name);
-	fprintf(f, "    if (anchor & 1) origin.x = 0; else if (anchor & 2) origin.x = %s_SourceSize[id].x;\n", name);
-	fprintf(f, "    if (anchor & 4) origin.y = 0; else if (anchor & 8) origin.y = %s_SourceSize[id].y;\n", name);
-	fprintf(f, "    origin.x *= scale; origin.y *= scale;\n");
-	fprintf(f, "    Rectangle destRec = {x, y, sourceRec.width * scale, sourceRec.height * scale};\n");
-	fprintf(f, "    DrawTexturePro(%s_Texture, %s_Frame[id], destRec, origin, rotation, color);\n", name, name);
-	fprintf(f, "    if (point) {\n");
-	fprintf(f, "      destRec.x -= origin.x;\n");
-	fprintf(f, "      destRec.y -= origin.y;\n");
-	fprintf(f, "      return CheckCollisionPointRec(*point, destRec);\n");
-	fprintf(f, "    }\n");
-	fprintf(f, "  }\n");
-	fprintf(f, "  return 0;\n");
-	fprintf(f, "}\n\n");
-
-	fprintf(f, "Texture %s_GetTexture(void) {\n  return %s_Texture;\n}\n\n", name, name);
-	fprintf(f, "const Vector2 %s_GetScale(void) {\n  return %s_Scale;\n}\n\n", name, name);
-	fprintf(f, "const Rectangle %s_GetFrame(enum %s_Id id) {\n  return %s_Frame[id];\n}\n\n", name, name, name);
-	fprintf(f, "const Vector2 %s_GetOffset(enum %s_Id id) {\n  return %s_Offset[id];\n}\n\n", name, name, name);
-	fprintf(f, "const Vector2 %s_GetSourceSize(enum %s_Id id) {\n  return %s_SourceSize[id];\n}\n\n", name, name, name);
-	fprintf(f, "const Vector2 %s_GetOrigin(enum %s_Id id) {\n  return %s_Origin[id];\n}\n\n", name, name, name);
-
-	fprintf(f, "#endif\n");
-	fprintf(f, "#endif\n");
+	imgpack_writer_printf(f, "int %s_Draw(enum %s_Id id, float x, float y, Color color, int anchor, const Vector2 *point) {\n", name, name);
+	imgpack_writer_printf(f, "  if (id) {\n");
+	imgpack_writer_printf(f, "    x += (anchor & 1 ? 0 : anchor & 2 ? -%s_SourceSize[id].x : -%s_Origin[id].x - %s_Offset[id].x);\n", name, name, name);
+	imgpack_writer_printf(f, "    y += (anchor & 4 ? 0 : anchor & 8 ? -%s_SourceSize[id].y : -%s_Origin[id].y - %s_Offset[id].y);\n", name, name, name);
+	imgpack_writer_printf(f, "    Rectangle destRec = {x + %s_Offset[id].x, y + %s_Offset[id].y, %s_Frame[id].width, %s_Frame[id].height};\n", name, name, name, name);
+	imgpack_writer_printf(f, "    if (%s_Rotated[id]) {\n", name);
+	imgpack_writer_printf(f, "      /* Frame is stored rotated clockwise, rotate it back around the bottom left corner */\n");
+	imgpack_writer_printf(f, "      destRec.y += destRec.width;\n");
+	imgpack_writer_printf(f, "      DrawTexturePro(%s_Texture[%s_Page[id]], %s_Frame[id], destRec, (Vector2){0,0}, -90, color);\n", name, name, name);
+	imgpack_writer_printf(f, "    } else {\n");
+	imgpack_writer_printf(f, "      DrawTexturePro(%s_Texture[%s_Page[id]], %s_Frame[id], destRec, (Vector2){0,0}, 0, color);\n", name, name, name);
+	imgpack_writer_printf(f, "    }\n");
+	imgpack_writer_printf(f, "    if (point) {\n");
+	imgpack_writer_printf(f, "      Rectangle collisionRec = {x, y, %s_SourceSize[id].x, %s_SourceSize[id].y};\n", name, name);
+	imgpack_writer_printf(f, "      return CheckCollisionPointRec(*point, collisionRec);\n");
+	imgpack_writer_printf(f, "    }\n");
+	imgpack_writer_printf(f, "  }\n");
+	imgpack_writer_printf(f, "  return 0;\n");
+	imgpack_writer_printf(f, "}\n\n");
 
-	return 0;
+	imgpack_writer_printf(f, "int %s_DrawEx(enum %s_Id id, float x, float y, float rotation, float scale, Color color, int anchor, const Vector2 *point) {\n", name, name);
+	imgpack_writer_printf(f, "  if (id) {\n");
+	imgpack_writer_printf(f, "    Rectangle sourceRec = %s_Frame[id];\n", name);
+	imgpack_writer_printf(f, "    Vector2 origin = %s_Origin[id];\n", name);
+	imgpack_writer_printf(f, "    if (anchor & 1) origin.x = 0; else if (anchor & 2) origin.x = %s_SourceSize[id].x;\n", name);
+	imgpack_writer_printf(f, "    if (anchor & 4) origin.y = 0; else if (anchor & 8) origin.y = %s_SourceSize[id].y;\n", name);
+	imgpack_writer_printf(f, "    origin.x *= scale; origin.y *= scale;\n");
+	imgpack_writer_printf(f, "    Rectangle destRec = {x, y, sourceRec.width * scale, sourceRec.height * scale};\n");
+	imgpack_writer_printf(f, "    if (%s_Rotated[id]) {\n", name);
+	imgpack_writer_printf(f, "      /* Frame is stored rotated clockwise, origin is moved into the rotated frame space */\n");
+	imgpack_writer_printf(f, "      Vector2 rotatedOrigin = {destRec.width - origin.y, origin.x};\n");
+	imgpack_writer_printf(f, "      DrawTexturePro(%s_Texture[%s_Page[id]], sourceRec, destRec, rotatedOrigin, rotation - 90, color);\n", name, name);
+	imgpack_writer_printf(f, "      destRec.width = sourceRec.height * scale;\n");
+	imgpack_writer_printf(f, "      destRec.height = sourceRec.width * scale;\n");
+	imgpack_writer_printf(f, "    } else {\n");
+	imgpack_writer_printf(f, "      DrawTexturePro(%s_Texture[%s_Page[id]], sourceRec, destRec, origin, rotation, color);\n", name, name);
+	imgpack_writer_printf(f, "    }\n");
+	imgpack_writer_printf(f, "    if (point) {\n");
+	imgpack_writer_printf(f, "      destRec.x -= origin.x;\n");
+	imgpack_writer_printf(f, "      destRec.y -= origin.y;\n");
+	imgpack_writer_printf(f, "      return CheckCollisionPointRec(*point, destRec);\n");
+	imgpack_writer_printf(f, "    }\n");
+	imgpack_writer_printf(f, "  }\n");
+	imgpack_writer_printf(f, "  return 0;\n");
+	imgpack_writer_printf(f, "}\n\n");
+
+	imgpack_writer_printf(f, "Texture %s_GetTexture(void) {\n  return %s_Texture[0];\n}\n\n", name, name);
+	imgpack_writer_printf(f, "Texture %s_GetPageTexture(int page) {\n  return %s_Texture[page];\n}\n\n", name, name);
+	imgpack_writer_printf(f, "int %s_GetPage(enum %s_Id id) {\n  return %s_Page[id];\n}\n\n", name, name, name);
+	imgpack_writer_printf(f, "const Vector2 %s_GetScale(void) {\n  return %s_Scale;\n}\n\n", name, name);
+	imgpack_writer_printf(f, "const Rectangle %s_GetFrame(enum %s_Id id) {\n  return %s_Frame[id];\n}\n\n", name, name, name);
+	imgpack_writer_printf(f, "const Vector2 %s_GetOffset(enum %s_Id id) {\n  return %s_Offset[id];\n}\n\n", name, name, name);
+	imgpack_writer_printf(f, "const Vector2 %s_GetSourceSize(enum %s_Id id) {\n  return %s_SourceSize[id];\n}\n\n", name, name, name);
+	imgpack_writer_printf(f, "const Vector2 %s_GetOrigin(enum %s_Id id) {\n  return %s_Origin[id];\n}\n\n", name, name, name);
+
+	imgpack_writer_printf(f, "#endif\n");
+	imgpack_writer_printf(f, "#endif\n");
+
+	return f->status;
 }
@@ -0,0 +1,95 @@
+#ifndef IMGPACK_H_
+#define IMGPACK_H_
+
+/*
+ * ImgPack library interface, built from main.c with IMGPACK_NO_MAIN defined
+ * (make lib gives libimgpack.a)
+ *
+ * Context is configured once with command line options, takes images from
+ * directories, encoded files in memory or decoded RGBA pixels, and runs the
+ * stages one by one:
+ *
+ *   struct ImgPackContext *ctx = imgpack_create();
+ *   char *options[] = {"imgpack", "-i", "ui.png", "-f", "JSON_HASH", "-t", "0", "-u"};
+ *   imgpack_configure(ctx, 8, options);
+ *   imgpack_add_memory(ctx, "ui/button.png", png_data, png_size);
+ *   imgpack_add_rgba(ctx, "ui/cursor.png", pixels, 32, 32, 0);
+ *   imgpack_prepare(ctx);      // decode, scale, trim, hash and deduplicate
+ *   imgpack_pack(ctx);
+ *   imgpack_write_data(ctx, &data_writer);
+ *   imgpack_write_images(ctx); // composite and encode every page
+ *   imgpack_destroy(ctx);
+ *
+ * Atlas images go to files named by --image unless imgpack_set_image_writer
+ * gives another destination, imgpack_composite draws rows of a page without
+ * encoding them. Functions return non-zero on failure, messages are printed
+ * to stdout like the command line tool does.
+ */
+
+#include <stddef.h>
+
+struct ImgPackContext;
+
+// Output stream. write gets the data in order, seek moves to an absolute
+// offset and is needed only by DDS and KTX2 images with mip levels, it may be
+// NULL otherwise. close may be NULL too. Callbacks return non-zero on failure.
+// position, written and status are kept by imgpack, initialize them with zeros
+struct ImgPackWriter {
+	int (*write)(void *udata, const void *data, size_t size);
+	int (*seek)(void *udata, size_t offset);
+	int (*close)(void *udata);
+	void *udata;
+	size_t position;
+	size_t written;
+	int status;
+};
+
+// Growing memory block, data is allocated with ISLIP_REALLOC and belongs to
+// the caller
+struct ImgPackBuffer {
+	unsigned char *data;
+	size_t size;
+	size_t allocated;
+	size_t position;
+};
+
+// Opens the writer for the mip level of the page, path is the file name the
+// tool would write, see --image and --mipmaps
+typedef int (*ImgPackOpenImage)(void *udata, struct ImgPackWriter *writer, const char *path, int page, int level);
+
+struct ImgPackContext *imgpack_create(void);
+void imgpack_destroy(struct ImgPackContext *ctx);
+
+// Options as in argv of the tool: the first argument is skipped and the
+// images folder is not needed, --image is required and names the pages.
+// Arguments are copied. Can be called once
+int imgpack_configure(struct ImgPackContext *ctx, int argc, char *argv[]);
+
+// Queue images for imgpack_prepare: all files of the folder, an encoded
+// image file copied from memory or 8 bit RGBA pixels with stride in bytes
+// (0 for 4 * width). path is the name of the frame. Images from memory don't
+// work with --cache-dir and are not decoded again with --low-memory
+int imgpack_add_directory(struct ImgPackContext *ctx, const char *path);
+int imgpack_add_memory(struct ImgPackContext *ctx, const char *path, const void *data, size_t size);
+int imgpack_add_rgba(struct ImgPackContext *ctx, const char *path, const unsigned char *pixels, int width, int height, int stride);
+
+// Decodes, scales, trims, hashes and deduplicates queued images on --jobs threads
+int imgpack_prepare(struct ImgPackContext *ctx);
+// Non-zero if --cache-dir found nothing changed since the last run
+int imgpack_is_up_to_date(struct ImgPackContext *ctx);
+int imgpack_pack(struct ImgPackContext *ctx);
+
+int imgpack_get_pages_count(struct ImgPackContext *ctx);
+int imgpack_get_page_size(struct ImgPackContext *ctx, int page, int *width, int *height);
+// Draws rows [y, y + rows) of the page to rgba, 4 * width bytes per row
+int imgpack_composite(struct ImgPackContext *ctx, int page, int y, int rows, unsigned char *rgba);
+
+int imgpack_write_data(struct ImgPackContext *ctx, struct ImgPackWriter *writer);
+void imgpack_set_image_writer(struct ImgPackContext *ctx, ImgPackOpenImage open_image, void *udata);
+int imgpack_write_images(struct ImgPackContext *ctx);
+
+// Writer filling the buffer from the start, imgpack_buffer_free releases the data
+void imgpack_buffer_writer(struct ImgPackBuffer *buffer, struct ImgPackWriter *writer);
+void imgpack_buffer_free(struct ImgPackBuffer *buffer);
+
+#endif
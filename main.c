@@ -32,8 +32,28 @@
 #define ISLIP_FREE free
 #endif
 
+#include "imgpack.h"
+
 #include "external/isl_args.h"
 
+// The library exports only imgpack_* functions, so it can be linked into
+// programs which have their own copies of stb and cute_files
+#ifdef IMGPACK_NO_MAIN
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_RESIZE_STATIC
+#define STBRP_STATIC
+#define CUTE_FILES_STATIC
+// Static functions of the libraries the packer doesn't call are left unused
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#endif
+
+// Images are decoded on several threads, failure reasons of stb_image are
+// global and not thread safe, so they are not collected
+#define STBI_NO_FAILURE_STRINGS
 #define STB_IMAGE_IMPLEMENTATION 
 #include "external/stb_image.h"
 
@@ -49,8 +69,78 @@
 #define CUTE_FILES_IMPLEMENTATION
 #include "external/cute_files.h"
 
-enum ImgPackColorFormat {
-	IMGPACK_RGBA8888,
+#if defined(IMGPACK_NO_MAIN) && defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+#include "utils/threads.h"
+#include "utils/trim.h"
+#include "utils/hash.h"
+#include "utils/deflate.h"
+#include "utils/writer.h"
+#include "utils/png.h"
+#include "utils/bc.h"
+#include "utils/etc.h"
+#include "utils/texture.h"
+#include "utils/dither.h"
+#include "utils/filter.h"
+
+#include "packers/areas.h"
+#include "packers/SKYLINE.h"
+#include "packers/MAXRECTS.h"
+#include "packers/GUILLOTINE.h"
+#include "packers/SHELF.h"
+
+enum ImgPackSortOrder {
+	IMGPACK_SORT_AREA,
+	IMGPACK_SORT_PERIMETER,
+	IMGPACK_SORT_MAX_SIDE,
+	IMGPACK_SORT_HEIGHT,
+	IMGPACK_SORT_WIDTH,
+};
+
+static const char *sort_order_names[] = {"AREA", "PERIMETER", "MAX_SIDE", "HEIGHT", "WIDTH"};
+
+enum ImgPackImageFormat {
+	IMGPACK_IMAGE_PNG,
+	IMGPACK_IMAGE_RAW,
+	IMGPACK_IMAGE_DDS,
+	IMGPACK_IMAGE_KTX2,
+};
+
+static const char *image_format_names[] = {"PNG", "RAW", "DDS", "KTX2"};
+
+static const char *color_format_names[] = {"RGBA8888", "BC1", "BC3", "BC7", "ETC2_RGB", "ETC2_RGBA",
+	"RGBA4444", "RGB565", "RGBA5551", "A8", "L8"};
+
+static const char *dither_names[] = {"NONE", "ORDERED", "FLOYD_STEINBERG"};
+
+static const char *block_quality_names[] = {"FAST", "DEFAULT", "MAX"};
+
+static const char *png_level_names[] = {"FAST", "DEFAULT", "MAX"};
+
+static const char *png_filter_names[] = {"NONE", "SUB", "UP", "AVERAGE", "PAETH", "ADAPTIVE"};
+
+struct ImgPackPacker {
+	const char *name;
+	int (*pack)(int heuristic, int allow_rotation, int width, int height, stbrp_rect *rects, const int *order, int count);
+	int heuristic;
+	int sorts;
+	int rotates;
+	enum ImgPackSortOrder sortOrder;
+};
+
+// Packers which sort rects themselves ignore the order, packers which can't
+// rotate rects get them rotated to lie flat when rotation is allowed
+static const struct ImgPackPacker imgpack_packers[] = {
+	{"SKYLINE_BL", imgpack_packer_SKYLINE, STBRP_HEURISTIC_Skyline_BL_sortHeight, 1, 0, IMGPACK_SORT_HEIGHT},
+	{"SKYLINE_BF", imgpack_packer_SKYLINE, STBRP_HEURISTIC_Skyline_BF_sortHeight, 1, 0, IMGPACK_SORT_HEIGHT},
+	{"MAXRECTS_BSSF", imgpack_packer_MAXRECTS, IMGPACK_MAXRECTS_BSSF, 0, 1, IMGPACK_SORT_AREA},
+	{"MAXRECTS_BAF", imgpack_packer_MAXRECTS, IMGPACK_MAXRECTS_BAF, 0, 1, IMGPACK_SORT_AREA},
+	{"MAXRECTS_BL", imgpack_packer_MAXRECTS, IMGPACK_MAXRECTS_BL, 0, 1, IMGPACK_SORT_HEIGHT},
+	{"MAXRECTS_CP", imgpack_packer_MAXRECTS, IMGPACK_MAXRECTS_CP, 0, 1, IMGPACK_SORT_AREA},
+	{"GUILLOTINE", imgpack_packer_GUILLOTINE, 0, 0, 1, IMGPACK_SORT_AREA},
+	{"SHELF", imgpack_packer_SHELF, 0, 0, 1, IMGPACK_SORT_HEIGHT},
 };
 
 enum ImgPackNaming {
@@ -70,13 +160,35 @@ struct ImgPackImage {
 	int copyOf;
 };
 
+struct ImgPackPage {
+	int width;
+	int height;
+	char *imagePath;
+};
+
+struct ImgPackUniqueSlot {
+	uint64_t key;
+	int id;
+};
+
 struct ImgPackContext {
 	enum ImgPackColorFormat colorFormat;
 	enum ImgPackNaming naming;
-	int (*formatter)(struct ImgPackContext *ctx, FILE *output_file);
+	int (*formatter)(struct ImgPackContext *ctx, struct ImgPackWriter *output);
+	const struct ImgPackPacker *packer;
+	enum ImgPackSortOrder sortOrder;
+	int packEffort;
+	enum ImgPackImageFormat imageFormat;
+	int bandHeight;
+	enum ImgPackDeflateLevel pngLevel;
+	enum ImgPackPngFilter pngFilter;
+	enum ImgPackBlockQuality blockQuality;
+	enum ImgPackDither dither;
+	int mipmaps;
 	int forcePOT;
 	int forceSquared;
 	int allowMultipack;
+	int allowRotation;
 	int trimThreshold;
 	double sideGrowCoefficient;
 	int maxWidth;
@@ -84,13 +196,39 @@ struct ImgPackContext {
 	int padding;
 	int extrude;
 	int unique;
+	int lowMemory;
 	int verbose;
+	int jobs;
+	int sortImages;
+	struct ImgPackCache *cache;
+	struct ImgPackSeed *seed;
+	struct ImgPackStats *stats;
+	struct ImgPackFilter *filter;
+	double repackThreshold;
+	// Area of the last full repack, when set seeded layouts are compared with
+	// it instead of packing from scratch every time
+	long long repackArea;
+	int watch;
+	char *manifestPath;
+
+	// Images queued for imgpack_prepare
+	struct ImgPackInputs *inputs;
 
 	struct ImgPackImage *images;
 	struct stbrp_rect *packingRects;
+	int *packingPages;
+	int *packingRotated;
 	int size;
 	int allocated;
 
+	struct ImgPackUniqueSlot *uniqueSlots;
+	int uniqueSlotsCount;
+	int uniqueSlotsAllocated;
+
+	struct ImgPackPage *pages;
+	int pagesCount;
+	int packAttempts;
+
 	int width;
 	int height;
 	int scaleNumerator;
@@ -99,6 +237,8 @@ struct ImgPackContext {
 	char *outputImagePath;
 	char *outputDataPath;
 	char *name;
+	ImgPackOpenImage openImage;
+	void *openImageUdata;
 
 	int argc;
 	char **argv;
@@ -107,7 +247,11 @@ struct ImgPackContext {
 
 static int is_image_rotated(struct ImgPackContext *ctx, int id) {
 	if (id >= 0 && id < ctx->size) {
-		return 0;
+		int rid = ctx->images[id].id;
+		if (ctx->images[id].copyOf >= 0) {
+			rid = ctx->images[id].copyOf;
+		}
+		return ctx->packingRotated[rid];
 	} else {
 		return -1;
 	}
@@ -117,10 +261,18 @@ static int is_image_trimmed(struct ImgPackContext *ctx, int id) {
 	if (id >= 0 && id < ctx->size) {
 		int d = ctx->padding + ctx->extrude;
 		int rid = ctx->images[id].id;
+		if (ctx->images[id].copyOf >= 0) {
+			rid = ctx->images[id].copyOf;
+		}
+		int w = ctx->packingRects[rid].w, h = ctx->packingRects[rid].h;
+		if (ctx->packingRotated[rid]) {
+			w = ctx->packingRects[rid].h;
+			h = ctx->packingRects[rid].w;
+		}
 		return ctx->images[id].source.x != 0 ||
 			ctx->images[id].source.y != 0 ||
-			ctx->images[id].source.w != ctx->packingRects[rid].w-2*d ||
-			ctx->images[id].source.h != ctx->packingRects[rid].h-2*d;
+			ctx->images[id].source.w != w-2*d ||
+			ctx->images[id].source.h != h-2*d;
 	} else {
 		return -1;
 	}
@@ -130,6 +282,16 @@ static const char *get_output_image_format(struct ImgPackContext *ctx) {
 	return ctx->colorFormatString;
 }
 
+static int get_frame_page(struct ImgPackContext *ctx, int id) {
+	if (id >= 0 && id < ctx->size) {
+		return ctx->packingPages[ctx->images[id].id];
+	} else {
+		return -1;
+	}
+}
+
+// Position of the frame in the atlas and its size in the image orientation, so
+// rotated frames occupy h x w area of the atlas
 static struct stbrp_rect get_frame_rect(struct ImgPackContext *ctx, int id) {
 	struct stbrp_rect frame = {0};
 	if (id >= 0 && id < ctx->size) {
@@ -142,17 +304,26 @@ static struct stbrp_rect get_frame_rect(struct ImgPackContext *ctx, int id) {
 		frame.y = ctx->packingRects[rid].y + d;
 		frame.w = ctx->packingRects[rid].w - 2*d;
 		frame.h = ctx->packingRects[rid].h - 2*d;
+		if (ctx->packingRotated[rid]) {
+			frame.w = ctx->packingRects[rid].h - 2*d;
+			frame.h = ctx->packingRects[rid].w - 2*d;
+		}
 	}
 	return frame;
 }
 
+#define IMGPACK_ATLAS_NO_MMAP
+#include "runtime/imgpack_atlas.h"
+
+#include "formatters/BINARY.h"
 #include "formatters/CSV.h"
 #include "formatters/JSON_ARRAY.h"
 #include "formatters/JSON_HASH.h"
 #include "formatters/RAYLIB.h"
 
 static int parse_data_format(struct ImgPackContext *ctx, const char *s) {
-	if (!strcmp(s, "CSV")) ctx->formatter = imgpack_formatter_CSV;
+	if (!strcmp(s, "BINARY")) ctx->formatter = imgpack_formatter_BINARY;
+	else if (!strcmp(s, "CSV")) ctx->formatter = imgpack_formatter_CSV;
 	else if (!strcmp(s, "JSON_ARRAY")) ctx->formatter = imgpack_formatter_JSON_ARRAY;
 	else if (!strcmp(s, "JSON_HASH")) ctx->formatter = imgpack_formatter_JSON_HASH;
 	else if (!strcmp(s, "RAYLIB")) ctx->formatter = imgpack_formatter_RAYLIB;
@@ -160,6 +331,57 @@ static int parse_data_format(struct ImgPackContext *ctx, const char *s) {
 	return 0;
 }
 
+static int parse_packer(struct ImgPackContext *ctx, const char *s) {
+	for (size_t i = 0; i < sizeof(imgpack_packers) / sizeof(*imgpack_packers); i++) {
+		if (!strcmp(s, imgpack_packers[i].name)) {
+			ctx->packer = &imgpack_packers[i];
+			ctx->sortOrder = ctx->packer->sortOrder;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int parse_sort_order(struct ImgPackContext *ctx, const char *s) {
+	for (size_t i = 0; i < sizeof(sort_order_names) / sizeof(*sort_order_names); i++) {
+		if (!strcmp(s, sort_order_names[i])) {
+			ctx->sortOrder = i;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int parse_image_format(struct ImgPackContext *ctx, const char *s) {
+	for (size_t i = 0; i < sizeof(image_format_names) / sizeof(*image_format_names); i++) {
+		if (!strcmp(s, image_format_names[i])) {
+			ctx->imageFormat = i;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int parse_png_level(struct ImgPackContext *ctx, const char *s) {
+	for (size_t i = 0; i < sizeof(png_level_names) / sizeof(*png_level_names); i++) {
+		if (!strcmp(s, png_level_names[i])) {
+			ctx->pngLevel = i;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int parse_png_filter(struct ImgPackContext *ctx, const char *s) {
+	for (size_t i = 0; i < sizeof(png_filter_names) / sizeof(*png_filter_names); i++) {
+		if (!strcmp(s, png_filter_names[i])) {
+			ctx->pngFilter = i;
+			return 0;
+		}
+	}
+	return 1;
+}
+
 static int parse_naming(struct ImgPackContext *ctx, const char *s) {
 	if (!strcmp(s, "FULL_PATH")) ctx->naming = IMGPACK_FULL_PATH;
 	else if (!strcmp(s, "NAME_NO_EXT")) ctx->naming = IMGPACK_NAME_NO_EXT;
@@ -169,98 +391,404 @@ static int parse_naming(struct ImgPackContext *ctx, const char *s) {
 }
 
 static int parse_data_color(struct ImgPackContext *ctx, const char *s) {
-	if (!strcmp(s, "RGBA8888")) ctx->colorFormat = IMGPACK_RGBA8888;
-	else return 1;
-	ctx->colorFormatString = (char *)s;
-	return 0;
+	for (size_t i = 0; i < sizeof(color_format_names) / sizeof(*color_format_names); i++) {
+		if (!strcmp(s, color_format_names[i])) {
+			ctx->colorFormat = i;
+			ctx->colorFormatString = (char *)s;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int parse_block_quality(struct ImgPackContext *ctx, const char *s) {
+	for (size_t i = 0; i < sizeof(block_quality_names) / sizeof(*block_quality_names); i++) {
+		if (!strcmp(s, block_quality_names[i])) {
+			ctx->blockQuality = i;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int parse_dither(struct ImgPackContext *ctx, const char *s) {
+	for (size_t i = 0; i < sizeof(dither_names) / sizeof(*dither_names); i++) {
+		if (!strcmp(s, dither_names[i])) {
+			ctx->dither = i;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Picks the image format by the extension of the output image when it's not set
+static const char *guess_image_format(const char *path) {
+	const char *dot = strrchr(path, '.');
+	if (dot && (!strcmp(dot, ".dds") || !strcmp(dot, ".DDS"))) return "DDS";
+	if (dot && (!strcmp(dot, ".ktx2") || !strcmp(dot, ".KTX2"))) return "KTX2";
+	return "PNG";
 }
 
 static void allocate_images_data(struct ImgPackContext *ctx) {
 	int next_size = ctx->allocated * 2;
 	if (next_size == 0) next_size = 16;
 	ctx->packingRects = ISLIP_REALLOC(ctx->packingRects, next_size * sizeof(*ctx->packingRects));
+	ctx->packingPages = ISLIP_REALLOC(ctx->packingPages, next_size * sizeof(*ctx->packingPages));
+	ctx->packingRotated = ISLIP_REALLOC(ctx->packingRotated, next_size * sizeof(*ctx->packingRotated));
 	ctx->images = ISLIP_REALLOC(ctx->images, next_size * sizeof(*ctx->images));
 	ctx->allocated = next_size;
 }
 
-static void add_image_data(struct ImgPackContext *ctx, stbi_uc *data, const char *img_path,
-		const char *img_name, const char *img_ext, int width, int height) {
-	int id = ctx->size;
-	while (id >= ctx->allocated) {
-		allocate_images_data(ctx);
+// Images from memory come as a copy of the encoded file or as decoded data
+struct ImgPackInput {
+	char *path;
+	char *name;
+	char *ext;
+	unsigned char *memory;
+	size_t memorySize;
+	stbi_uc *data;
+	int originalWidth;
+	int originalHeight;
+	int width;
+	int height;
+	int minX;
+	int minY;
+	int maxX;
+	int maxY;
+	uint64_t hash;
+	int64_t mtime;
+	int64_t fileSize;
+	uint64_t contentHash;
+	int cacheEntry;
+};
+
+struct ImgPackInputs {
+	struct ImgPackContext *ctx;
+	struct ImgPackInput *items;
+	int size;
+	int allocated;
+};
+
+static char *copy_string(const char *s) {
+	char *copy = ISLIP_MALLOC(strlen(s)+1);
+	strcpy(copy, s);
+	return copy;
+}
+
+#include "utils/cache.h"
+#include "utils/seed.h"
+#include "utils/stats.h"
+#ifndef IMGPACK_NO_MAIN
+#include "utils/watch.h"
+#include "utils/pool.h"
+#include "utils/manifest.h"
+#endif
+
+static struct ImgPackInput make_image_input(const char *img_path, const char *img_name, const char *img_ext) {
+	int name_len = strlen(img_name) - strlen(img_ext);
+	char *name = ISLIP_MALLOC(name_len + 1);
+	name[name_len] = '\0';
+	for (int i = 0; i < name_len; i++) {
+		name[i] = img_name[i];
 	}
-	ctx->size++;
+	return (struct ImgPackInput) {
+		.path = copy_string(img_path),
+		.name = name,
+		.ext = copy_string(img_ext),
+		.cacheEntry = -1,
+	};
+}
+
+static void push_image_input(struct ImgPackInputs *inputs, const char *img_path, const char *img_name, const char *img_ext) {
+	if (inputs->size >= inputs->allocated) {
+		inputs->allocated = inputs->allocated ? 2 * inputs->allocated : 64;
+		inputs->items = ISLIP_REALLOC(inputs->items, inputs->allocated * sizeof(*inputs->items));
+	}
+	inputs->items[inputs->size++] = make_image_input(img_path, img_name, img_ext);
+}
+
+// Name and extension of the path the way cute_files gives them for files
+static const char *get_path_name(const char *path, const char **ext) {
+	const char *name = path;
+	for (const char *c = path; *c; c++) {
+		if (*c == '/' || *c == '\\') name = c + 1;
+	}
+	*ext = strrchr(name, '.');
+	if (!*ext || *ext == name) *ext = "";
+	return name;
+}
 
+// Scales decoded image by the context scale, data is freed if resized
+static stbi_uc *scale_image_data(struct ImgPackContext *ctx, stbi_uc *data, int *width, int *height) {
 	if (ctx->scaleNumerator != 1 || ctx->scaleDenominator != 1) {
-		int resized_width = ctx->scaleNumerator * width / ctx->scaleDenominator;
-		int resized_height = ctx->scaleNumerator * height / ctx->scaleDenominator;
+		int resized_width = ctx->scaleNumerator * *width / ctx->scaleDenominator;
+		int resized_height = ctx->scaleNumerator * *height / ctx->scaleDenominator;
 		stbi_uc *resized_data = ISLIP_MALLOC(sizeof(*resized_data) * resized_width * resized_height * 4);
-		stbir_resize_uint8(data, width, height, 0,  resized_data, resized_width, resized_height, 0, 4);
-		if (ctx->verbose) printf("//  Resize \"%s\" (%d, %d) => (%d, %d)\n", img_path, width, height, resized_width, resized_height);
+		stbir_resize_uint8(data, *width, *height, 0,  resized_data, resized_width, resized_height, 0, 4);
 		stbi_image_free(data);
 		data = resized_data;
-		width = resized_width;
-		height = resized_height;
+		*width = resized_width;
+		*height = resized_height;
+	}
+	return data;
+}
+
+// Opens the file for stb_image if its first bytes are a signature of an
+// image, so other files are not read any further
+static FILE *open_image_file(const char *path, const char *ext) {
+	unsigned char head[IMGPACK_SNIFF_SIZE];
+	FILE *f = fopen(path, "rb");
+	if (!f) return NULL;
+	size_t size = fread(head, 1, sizeof(head), f);
+	if (!imgpack_sniff_image(head, size, ext) || fseek(f, 0, SEEK_SET)) {
+		fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+static stbi_uc *load_image_file(const char *path, const char *ext, int *width, int *height) {
+	int channels;
+	FILE *f = open_image_file(path, ext);
+	if (!f) return NULL;
+	stbi_uc *data = stbi_load_from_file(f, width, height, &channels, 4);
+	fclose(f);
+	return data;
+}
+
+static void decode_image_data(struct ImgPackContext *ctx, struct ImgPackInput *input, int index) {
+	int width, height, channels;
+	stbi_uc *data;
+	struct ImgPackStatsTimer timer = imgpack_stats_begin(ctx->stats, 1);
+	if (input->data) {
+		data = input->data;
+		width = input->originalWidth;
+		height = input->originalHeight;
+		input->data = NULL;
+	} else if (input->memory) {
+		data = stbi_load_from_memory(input->memory, (int)input->memorySize, &width, &height, &channels, 4);
+		imgpack_stats_add_bytes(ctx->stats, (long long)input->memorySize, 0);
+		ISLIP_FREE(input->memory);
+		input->memory = NULL;
+	} else if (ctx->cache) {
+		unsigned char *file_data = NULL;
+		int file_size = 0;
+		if (imgpack_cache_load_image(ctx, input, &file_data, &file_size)) return;
+		data = file_data && imgpack_sniff_image(file_data, file_size, input->ext) ?
+			stbi_load_from_memory(file_data, file_size, &width, &height, &channels, 4) : NULL;
+		imgpack_stats_add_bytes(ctx->stats, file_size, 0);
+		ISLIP_FREE(file_data);
+	} else {
+		data = load_image_file(input->path, input->ext, &width, &height);
+		if (data) imgpack_stats_add_file(ctx->stats, input->path);
 	}
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_DECODE, timer, 1);
+	if (!data) return;
+	input->originalWidth = width;
+	input->originalHeight = height;
+	timer = imgpack_stats_begin(ctx->stats, 1);
+	data = scale_image_data(ctx, data, &width, &height);
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_RESIZE, timer, 1);
 
 	int minY = 0, minX = 0, maxY = height-1, maxX = width-1;
 	if (ctx->trimThreshold >= 0) {
-		for (int y = 0; y < height; y++) for (int x = 0; x < width; x++) if (data[4*(y*width+x)+3] > ctx->trimThreshold) {
-			minY = y;
-			y = height;
-			break;
-		}
-		for (int y = height-1; y >= 0; y--) for (int x = 0; x < width; x++) if (data[4*(y*width+x)+3] > ctx->trimThreshold) {
-			maxY = y;
-			y = -1;
-			break;
-		}
-		for (int x = 0; x < width; x++) for (int y = 0; y < height; y++) if (data[4*(y*width+x)+3] > ctx->trimThreshold) {
-			minX = x;
-			x = width;
-			break;
-		}
-		for (int x = width-1; x >= 0; x--) for (int y = 0; y < height; y++) if (data[4*(y*width+x)+3] > ctx->trimThreshold) {
-			maxX = x;
-			x = -1;
-			break;
+		timer = imgpack_stats_begin(ctx->stats, 1);
+		imgpack_alpha_bounds(data, width, height, ctx->trimThreshold, &minX, &minY, &maxX, &maxY);
+		imgpack_stats_end(ctx->stats, IMGPACK_STAGE_TRIM, timer, 1);
+	}
+
+	// Hash exactly the trimmed rect, one row at a time
+	timer = imgpack_stats_begin(ctx->stats, 1);
+	struct ImgPackHash hasher;
+	imgpack_hash_init(&hasher, 0);
+	for (int y = minY; y <= maxY; y++) {
+		imgpack_hash_update(&hasher, data + 4*((size_t)y*width + minX), 4*(size_t)(maxX - minX + 1));
+	}
+	uint64_t hash = imgpack_hash_final(&hasher);
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_HASH, timer, 1);
+
+	input->data = data;
+	input->width = width;
+	input->height = height;
+	input->minX = minX;
+	input->minY = minY;
+	input->maxX = maxX;
+	input->maxY = maxY;
+	input->hash = hash;
+	if (ctx->cache) imgpack_cache_store_image(ctx, input, index);
+}
+
+// Without trimming, deduplication and cache only the size is needed
+static void read_image_header(struct ImgPackContext *ctx, struct ImgPackInput *input) {
+	int width, height, channels;
+	struct ImgPackStatsTimer timer = imgpack_stats_begin(ctx->stats, 1);
+	FILE *f = open_image_file(input->path, input->ext);
+	int status = f && stbi_info_from_file(f, &width, &height, &channels);
+	if (f) fclose(f);
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_DECODE, timer, 1);
+	if (!status) return;
+	input->originalWidth = width;
+	input->originalHeight = height;
+	input->width = ctx->scaleNumerator * width / ctx->scaleDenominator;
+	input->height = ctx->scaleNumerator * height / ctx->scaleDenominator;
+	input->maxX = input->width - 1;
+	input->maxY = input->height - 1;
+}
+
+// Decodes, scales, trims and hashes single image. Touches only its own input.
+// In low memory mode pixels of files are dropped right away and decoded again
+// when the atlas is drawn, inputs which are images have non-zero width
+static void prepare_image_data(void *udata, int index) {
+	struct ImgPackInputs *inputs = udata;
+	struct ImgPackContext *ctx = inputs->ctx;
+	struct ImgPackInput *input = &inputs->items[index];
+	int from_file = !input->memory && !input->data;
+	if (from_file && ctx->lowMemory && ctx->trimThreshold < 0 && !ctx->unique && !ctx->cache) {
+		read_image_header(ctx, input);
+		return;
+	}
+	decode_image_data(ctx, input, index);
+	if (from_file && ctx->lowMemory) {
+		stbi_image_free(input->data);
+		input->data = NULL;
+	}
+}
+
+// Decodes pixels of the image dropped in low memory mode
+static stbi_uc *load_image_data(struct ImgPackContext *ctx, const struct ImgPackImage *image) {
+	int width, height;
+	struct ImgPackStatsTimer timer = imgpack_stats_begin(ctx->stats, 1);
+	stbi_uc *data = load_image_file(image->path, image->ext, &width, &height);
+	imgpack_stats_add_file(ctx->stats, image->path);
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_DECODE, timer, 1);
+	if (!data) return NULL;
+	timer = imgpack_stats_begin(ctx->stats, 1);
+	data = scale_image_data(ctx, data, &width, &height);
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_RESIZE, timer, 1);
+	if (width != image->source.w || height != image->source.h) {
+		stbi_image_free(data);
+		return NULL;
+	}
+	return data;
+}
+
+enum {
+	IMGPACK_EDGE_LEFT = 1,
+	IMGPACK_EDGE_TOP = 2,
+	IMGPACK_EDGE_RIGHT = 4,
+	IMGPACK_EDGE_BOTTOM = 8,
+};
+
+// Sides of the trimmed w x h image data which coincide with the source image
+// borders, extrusion is applied only to them
+static int get_image_edges(const struct ImgPackImage *image, int w, int h) {
+	return (image->source.x == 0 ? IMGPACK_EDGE_LEFT : 0) |
+		(image->source.y == 0 ? IMGPACK_EDGE_TOP : 0) |
+		(image->source.x + w == image->source.w ? IMGPACK_EDGE_RIGHT : 0) |
+		(image->source.y + h == image->source.h ? IMGPACK_EDGE_BOTTOM : 0);
+}
+
+static int is_same_image(struct ImgPackContext *ctx, int id, int other_id) {
+	struct ImgPackImage *image = &ctx->images[id], *other = &ctx->images[other_id];
+	int d = ctx->padding + ctx->extrude;
+	int w = ctx->packingRects[id].w - 2*d, h = ctx->packingRects[id].h - 2*d;
+	if (image->hash != other->hash ||
+			w != ctx->packingRects[other_id].w - 2*d ||
+			h != ctx->packingRects[other_id].h - 2*d) {
+		return 0;
+	}
+	if (ctx->extrude > 0 && get_image_edges(image, w, h) != get_image_edges(other, w, h)) {
+		return 0;
+	}
+	// Pixels of files are dropped in low memory mode, candidates with the same
+	// hash are decoded again to compare them
+	stbi_uc *data = image->data ? image->data : load_image_data(ctx, image);
+	stbi_uc *other_data = other->data ? other->data : load_image_data(ctx, other);
+	int same = data && other_data;
+	for (int y = 0; y < h && same; y++) {
+		const stbi_uc *row = data + 4*((image->source.y+y)*image->source.w + image->source.x);
+		const stbi_uc *other_row = other_data + 4*((other->source.y+y)*other->source.w + other->source.x);
+		same = !memcmp(row, other_row, 4*w);
+	}
+	if (data != image->data) stbi_image_free(data);
+	if (other_data != other->data) stbi_image_free(other_data);
+	return same;
+}
+
+static uint64_t get_unique_key(struct ImgPackContext *ctx, int id) {
+	uint64_t key = ctx->images[id].hash;
+	key ^= ((uint64_t)ctx->packingRects[id].w << 32 | (uint64_t)ctx->packingRects[id].h) * 0x9e3779b97f4a7c15ULL;
+	key ^= key >> 29;
+	return key;
+}
+
+static void grow_unique_slots(struct ImgPackContext *ctx) {
+	struct ImgPackUniqueSlot *slots = ctx->uniqueSlots;
+	int allocated = ctx->uniqueSlotsAllocated;
+	ctx->uniqueSlotsAllocated = allocated ? 2 * allocated : 64;
+	ctx->uniqueSlots = ISLIP_MALLOC(ctx->uniqueSlotsAllocated * sizeof(*ctx->uniqueSlots));
+	for (int i = 0; i < ctx->uniqueSlotsAllocated; i++) {
+		ctx->uniqueSlots[i].id = -1;
+	}
+	uint64_t mask = ctx->uniqueSlotsAllocated - 1;
+	for (int i = 0; i < allocated; i++) {
+		if (slots[i].id >= 0) {
+			uint64_t j = slots[i].key & mask;
+			while (ctx->uniqueSlots[j].id >= 0) j = (j + 1) & mask;
+			ctx->uniqueSlots[j] = slots[i];
 		}
 	}
+	ISLIP_FREE(slots);
+}
 
-	// FNV hash function C99 adapation
-	// for more info visit http://www.isthe.com/chongo/tech/comp/fnv/
-	uint64_t hash = 0xcbf29ce484222325ULL;
-	for (int y = minY; y < maxY; y++) {
-		for (int x = minX; x < maxX; x++) {
-			hash = (hash ^ data[4*(y*width+x)]) * 0x100000001b3ULL;
-			hash = (hash ^ data[4*(y*width+x)+1]) * 0x100000001b3ULL;
-			hash = (hash ^ data[4*(y*width+x)+2]) * 0x100000001b3ULL;
-			hash = (hash ^ data[4*(y*width+x)+3]) * 0x100000001b3ULL;
+// Looks for already added identical image using open addressing hash table keyed
+// by content hash and trimmed size. Candidates are confirmed by comparing pixels.
+// If nothing is found the image is inserted into the table and -1 is returned
+static int find_unique_image(struct ImgPackContext *ctx, int id) {
+	if (2 * (ctx->uniqueSlotsCount + 1) > ctx->uniqueSlotsAllocated) {
+		grow_unique_slots(ctx);
+	}
+	uint64_t key = get_unique_key(ctx, id);
+	uint64_t mask = ctx->uniqueSlotsAllocated - 1;
+	uint64_t j = key & mask;
+	for (; ctx->uniqueSlots[j].id >= 0; j = (j + 1) & mask) {
+		if (ctx->uniqueSlots[j].key == key && is_same_image(ctx, id, ctx->uniqueSlots[j].id)) {
+			return ctx->uniqueSlots[j].id;
 		}
 	}
-	if (ctx->verbose) printf("//  Hash of \"%s\" is %" PRIx64 "\n", img_path, hash);
+	ctx->uniqueSlots[j] = (struct ImgPackUniqueSlot) {.key = key, .id = id};
+	ctx->uniqueSlotsCount++;
+	return -1;
+}
 
-	char *path = ISLIP_MALLOC(strlen(img_path)+1);
-	strcpy(path, img_path);
-	int name_len = strlen(img_name) - strlen(img_ext);
-	char *name = ISLIP_MALLOC(name_len + 1);
-	name[name_len] = '\0';
-	for (int i = 0; i < name_len; i++) {
-		name[i] = img_name[i];
+// Appends prepared image to the context, takes ownership of input strings and data
+static void add_image_data(struct ImgPackContext *ctx, struct ImgPackInput *input) {
+	int id = ctx->size;
+	while (id >= ctx->allocated) {
+		allocate_images_data(ctx);
+	}
+	ctx->size++;
+
+	int width = input->width, height = input->height;
+	int minX = input->minX, minY = input->minY, maxX = input->maxX, maxY = input->maxY;
+	uint64_t hash = input->hash;
+	if (ctx->verbose && (width != input->originalWidth || height != input->originalHeight)) {
+		printf("//  Resize \"%s\" (%d, %d) => (%d, %d)\n", input->path, input->originalWidth, input->originalHeight, width, height);
 	}
-	char *ext = ISLIP_MALLOC(strlen(img_ext)+1);
-	strcpy(ext, img_ext);
+	if (ctx->verbose) printf("//  Hash of \"%s\" is %" PRIx64 "\n", input->path, hash);
+
 	ctx->images[id] = (struct ImgPackImage) {
 		.id = id,
-		.path = path,
+		.path = input->path,
 		.hash = hash,
-		.name = name,
-		.ext = ext,
+		.name = input->name,
+		.ext = input->ext,
 		.source = (stbrp_rect) {.x = minX, .y = minY, .w = width, .h = height},
-		.data = data,
+		.data = input->data,
 		.copyOf = -1,
 	};
 
+	ctx->packingRotated[id] = 0;
 	ctx->packingRects[id] = (stbrp_rect) {
 		.id = id,
 		.w = maxX - minX + 1 + 2*(ctx->padding + ctx->extrude),
@@ -268,57 +796,190 @@ static void add_image_data(struct ImgPackContext *ctx, stbi_uc *data, const char
 	};
 
 	if (ctx->unique) {
-		// TODO probably should use hashtable (stb_ds?) to avoid O(n^2)
-		for (int i = id-1; i >= 0; i--) {
-			if (ctx->images[i].copyOf < 0) {
-				if (ctx->images[i].hash == hash) {
-					// Is this enough? Well in most cases yes
-					if (ctx->images[i].source.x == ctx->images[id].source.x &&
-							ctx->images[i].source.y == ctx->images[id].source.y &&
-							ctx->images[i].source.w == ctx->images[id].source.w &&
-							ctx->images[i].source.h == ctx->images[id].source.h &&
-							ctx->packingRects[i].w == ctx->packingRects[id].w &&
-							ctx->packingRects[i].h == ctx->packingRects[id].h) {
-						ctx->images[id].copyOf = i;
-						ctx->packingRects[id].w = 0;
-						ctx->packingRects[id].h = 0;
-						break;
-					}
-				}
-			}
+		struct ImgPackStatsTimer timer = imgpack_stats_begin(ctx->stats, 0);
+		int copy_id = find_unique_image(ctx, id);
+		imgpack_stats_end(ctx->stats, IMGPACK_STAGE_DEDUP, timer, 0);
+		if (copy_id >= 0) {
+			if (ctx->verbose) printf("//  \"%s\" is a copy of \"%s\"\n", input->path, ctx->images[copy_id].path);
+			ctx->images[id].copyOf = copy_id;
+			ctx->packingRects[id].w = 0;
+			ctx->packingRects[id].h = 0;
 		}
 	}
-	if (ctx->verbose) printf("//  Added \"%s\" %dx%d(trimmed to %dx%d)\n", path, width, height, maxX - minX + 1, maxY - minY + 1);
+	if (ctx->verbose) printf("//  Added \"%s\" %dx%d(trimmed to %dx%d)\n", input->path, width, height, maxX - minX + 1, maxY - minY + 1);
 }
 
-static int get_images_data(struct ImgPackContext *ctx, const char *path) {
-	int count = 0;
+// Images folder is read level by level, directories of a level are read on
+// ctx->jobs threads. Entries keep the order cute_files gives them and the
+// queue is filled from the tree afterwards, so it's the same as if the
+// folder was read by one thread
+struct ImgPackScanEntry {
+	char *path;
+	char *name;
+	char *ext;
+	// Node of the directory, -1 for files
+	int node;
+};
+
+struct ImgPackScanNode {
+	char *path;
+	struct ImgPackScanEntry *entries;
+	int entriesCount;
+	int entriesAllocated;
+};
+
+struct ImgPackScan {
+	struct ImgPackContext *ctx;
+	size_t rootLength;
+	struct ImgPackScanNode *nodes;
+	int nodesCount;
+	int nodesAllocated;
+	// The first node of the level being read
+	int level;
+};
+
+static void push_scan_entry(struct ImgPackScanNode *node, const cf_file_t *file, int is_dir) {
+	if (node->entriesCount >= node->entriesAllocated) {
+		node->entriesAllocated = node->entriesAllocated ? 2 * node->entriesAllocated : 16;
+		node->entries = ISLIP_REALLOC(node->entries, node->entriesAllocated * sizeof(*node->entries));
+	}
+	node->entries[node->entriesCount++] = (struct ImgPackScanEntry) {
+		.path = copy_string(file->path),
+		.name = copy_string(file->name),
+		.ext = copy_string(file->ext),
+		.node = is_dir ? 0 : -1,
+	};
+}
+
+// Touches only its own node
+static void read_scan_node(void *udata, int index) {
+	struct ImgPackScan *scan = udata;
+	struct ImgPackScanNode *node = &scan->nodes[scan->level + index];
+	const struct ImgPackFilter *filter = scan->ctx->filter;
 	cf_dir_t dir;
-	if (cf_dir_open(&dir, path)) {
-		if (ctx->verbose) printf("// Reading images data from \"%s\" directory\n", path);
-		while(dir.has_next) {
-			cf_file_t file;
-			cf_read_file(&dir, &file);
-			if (file.is_dir && file.name[0] != '.') {
-				if (ctx->verbose) printf("//  Traverse %s\n", file.name);
-				count += get_images_data(ctx, file.path);
-			} else if (file.is_reg) {
-				if (ctx->verbose) printf("//  Reading %s\n", file.name);
-				int width, height, channels;
-				stbi_uc *data = stbi_load(file.path, &width, &height, &channels, 4);
-				if (data) {
-					add_image_data(ctx, data, file.path, file.name, file.ext, width, height);
-					count++;
+	if (!cf_dir_open(&dir, node->path)) return;
+	while (dir.has_next) {
+		cf_file_t file;
+		cf_read_file(&dir, &file);
+		const char *relative_path = file.path + scan->rootLength;
+		while (*relative_path == '/') relative_path++;
+		if (file.is_dir && imgpack_filter_dir(filter, relative_path, file.name)) {
+			push_scan_entry(node, &file, 1);
+		} else if (file.is_reg && imgpack_filter_file(filter, relative_path, file.name, file.ext)) {
+			push_scan_entry(node, &file, 0);
+		}
+		cf_dir_next(&dir);
+	}
+	cf_dir_close(&dir);
+}
+
+static int push_scan_node(struct ImgPackScan *scan, const char *path) {
+	if (scan->nodesCount >= scan->nodesAllocated) {
+		scan->nodesAllocated = scan->nodesAllocated ? 2 * scan->nodesAllocated : 16;
+		scan->nodes = ISLIP_REALLOC(scan->nodes, scan->nodesAllocated * sizeof(*scan->nodes));
+	}
+	scan->nodes[scan->nodesCount] = (struct ImgPackScanNode) {.path = copy_string(path)};
+	return scan->nodesCount++;
+}
+
+static int queue_scan_node(struct ImgPackScan *scan, struct ImgPackInputs *inputs, int index) {
+	struct ImgPackContext *ctx = scan->ctx;
+	struct ImgPackScanNode *node = &scan->nodes[index];
+	int count = 0;
+	if (ctx->verbose) printf("// Reading images paths from \"%s\" directory\n", node->path);
+	for (int i = 0; i < node->entriesCount; i++) {
+		struct ImgPackScanEntry *entry = &node->entries[i];
+		if (entry->node >= 0) {
+			if (ctx->verbose) printf("//  Traverse %s\n", entry->name);
+			count += queue_scan_node(scan, inputs, entry->node);
+		} else {
+			push_image_input(inputs, entry->path, entry->name, entry->ext);
+			count++;
+		}
+		ISLIP_FREE(entry->path);
+		ISLIP_FREE(entry->name);
+		ISLIP_FREE(entry->ext);
+	}
+	if (ctx->verbose) printf("// From %s collected %d files\n", node->path, count);
+	ISLIP_FREE(node->entries);
+	ISLIP_FREE(node->path);
+	return count;
+}
+
+// Queues files of the directory which pass ctx->filter, paths are matched
+// relative to root
+static int collect_images_paths(struct ImgPackInputs *inputs, const char *root, const char *path) {
+	struct ImgPackScan scan = {.ctx = inputs->ctx, .rootLength = strlen(root)};
+	push_scan_node(&scan, path);
+	while (scan.level < scan.nodesCount) {
+		int end = scan.nodesCount;
+		imgpack_parallel_for(scan.ctx->jobs, end - scan.level, read_scan_node, &scan);
+		for (int i = scan.level; i < end; i++) {
+			for (int j = 0; j < scan.nodes[i].entriesCount; j++) {
+				if (scan.nodes[i].entries[j].node >= 0) {
+					int node = push_scan_node(&scan, scan.nodes[i].entries[j].path);
+					scan.nodes[i].entries[j].node = node;
 				}
 			}
-			cf_dir_next(&dir);
 		}
-		cf_dir_close(&dir);
-		if (ctx->verbose) printf("// From %s added %d images\n", path, count);
+		scan.level = end;
+	}
+	int count = queue_scan_node(&scan, inputs, 0);
+	ISLIP_FREE(scan.nodes);
+	return count;
+}
+
+// Frames from memory get name and extension from the path like files do
+static struct ImgPackInput *push_memory_input(struct ImgPackInputs *inputs, const char *path) {
+	const char *ext, *name = get_path_name(path, &ext);
+	push_image_input(inputs, path, name, ext);
+	return &inputs->items[inputs->size - 1];
+}
+
+static void free_image_input(struct ImgPackInput *input) {
+	ISLIP_FREE(input->path);
+	ISLIP_FREE(input->name);
+	ISLIP_FREE(input->ext);
+	ISLIP_FREE(input->memory);
+	stbi_image_free(input->data);
+}
+
+// Adds prepared inputs in the queue order, so the result doesn't depend on
+// the order they were decoded in
+static int add_prepared_images(struct ImgPackContext *ctx) {
+	struct ImgPackInputs *inputs = ctx->inputs;
+	int count = 0;
+	for (int i = 0; i < inputs->size; i++) {
+		struct ImgPackInput *input = &inputs->items[i];
+		if (ctx->cache && !ctx->cache->upToDate) imgpack_cache_track_input(ctx, input);
+		if (input->width > 0) {
+			if (ctx->verbose) printf("//  Reading %s\n", input->path);
+			add_image_data(ctx, input);
+			count++;
+		} else {
+			if (ctx->verbose) printf("//  Cannot decode %s\n", input->path);
+			free_image_input(input);
+		}
 	}
+	inputs->size = 0;
+	if (ctx->verbose) printf("// Added %d images\n", count);
 	return count;
 }
 
+// Decodes and prepares the queue of inputs on ctx->jobs threads
+static int prepare_images_data(struct ImgPackContext *ctx) {
+	struct ImgPackInputs *inputs = ctx->inputs;
+	struct ImgPackStatsTimer timer = imgpack_stats_begin(ctx->stats, 0);
+	if (ctx->cache && imgpack_cache_lookup(ctx, inputs)) {
+		ctx->cache->upToDate = 1;
+	} else {
+		if (ctx->verbose) printf("// Decoding %d files using %d threads\n", inputs->size, ctx->jobs);
+		imgpack_parallel_for(ctx->jobs, inputs->size, prepare_image_data, inputs);
+	}
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_PREPARE, timer, 0);
+	return add_prepared_images(ctx);
+}
+
 static unsigned long upper_power_of_two(unsigned long v) {
 	v--;
 	v |= v >> 1;
@@ -330,358 +991,2524 @@ static unsigned long upper_power_of_two(unsigned long v) {
 	return v;
 }
 
-static int pack_images(struct ImgPackContext *ctx) {
-	int occupied_area = 0;
-	int side_add = ctx->padding + ctx->extrude;
-	for (int i = 0; i < ctx->size; i++) {
-		occupied_area += ((side_add+ctx->packingRects[i].w)*(side_add+ctx->packingRects[i].h));
-	}
-	if (ctx->verbose) printf("// Occupied area is %d\n", occupied_area);
-	if (occupied_area <= 0) return 1;
-	int assumed_side_size = (int)sqrt((double)occupied_area);
-	ctx->width = assumed_side_size;
-	ctx->height = assumed_side_size;
-	stbrp_node *nodes = ISLIP_MALLOC(sizeof(*nodes) * ctx->size);
-	if (!nodes) return 1;
-	stbrp_context rp_ctx = {0};
-	do {
-		if (ctx->forcePOT) {
-			int pot_side_size = upper_power_of_two(assumed_side_size);
-			if (pot_side_size >= (ctx->sideGrowCoefficient*assumed_side_size)) {
-				assumed_side_size = pot_side_size;
-			} else {
-				assumed_side_size = upper_power_of_two(pot_side_size+1);
-			}
-		} else {
-			assumed_side_size = ctx->sideGrowCoefficient*assumed_side_size;
-		}
+struct ImgPackLayout {
+	const struct ImgPackPacker *packer;
+	enum ImgPackSortOrder sortOrder;
+	int verbose;
+	// Pixels in a unit of rects and pages
+	int block;
+	stbrp_rect *rects;
+	int *rectsPages;
+	struct ImgPackPage *pages;
+	int pagesCount;
+	long long area;
+	int attempts;
+	int status;
+};
 
-		// TODO Wrong logic, we need non-square textures implementation
-		if ((ctx->maxWidth > 0 && assumed_side_size >= ctx->maxWidth) ||
-				(ctx->maxHeight > 0 && assumed_side_size >= ctx->maxHeight)) {
-			printf("Exceeded max size constraints %d x %d\n", ctx->maxWidth, ctx->maxHeight);
-			return 1;
-		}
+struct ImgPackSizeSearch {
+	struct ImgPackContext *ctx;
+	struct ImgPackLayout *layout;
+	stbrp_rect *rects;
+	stbrp_rect *bestRects;
+	int *order;
+	int count;
+	int minWidth;
+	int minHeight;
+	int maxWidth;
+	int maxHeight;
+	long long area;
+	long long bestArea;
+	int bestWidth;
+	int bestHeight;
+	int attempts;
+};
 
-		if (ctx->maxWidth > 0) {
-			if (ctx->width < ctx->maxWidth) {
-				ctx->width = ctx->maxWidth > assumed_side_size ? assumed_side_size : ctx->maxWidth;
-			}
-		} else {
-			ctx->width = assumed_side_size;
-		}
-		if (ctx->maxHeight > 0) {
-			if (ctx->height < ctx->maxHeight) {
-				ctx->height = ctx->maxHeight > assumed_side_size ? assumed_side_size : ctx->maxHeight;
-			}
-		} else {
-			ctx->height = assumed_side_size;
-		}
+struct ImgPackSortKey {
+	long long key;
+	int index;
+};
 
-		if (ctx->verbose) printf("// Trying to pack %d images into %dx%d\n", ctx->size, assumed_side_size, assumed_side_size);
-		stbrp_init_target(&rp_ctx, assumed_side_size, assumed_side_size, nodes, ctx->size);
-	} while (!stbrp_pack_rects(&rp_ctx, ctx->packingRects, ctx->size));
-	ISLIP_FREE(nodes);
-	return 0;
+static int compare_sort_keys(const void *a, const void *b) {
+	const struct ImgPackSortKey *p = a, *q = b;
+	if (p->key != q->key) return p->key > q->key ? -1 : 1;
+	return p->index - q->index;
 }
 
-static int write_atlas_data(struct ImgPackContext *ctx) {
-	FILE *output_file = stdout;
-	if (ctx->outputDataPath) {
-		output_file = fopen(ctx->outputDataPath, "w+");
-	}
-	int status = 1;
-	if (output_file) {
-		if (ctx->verbose) printf("// Writing description data to \"%s\"\n", ctx->outputDataPath ? ctx->outputDataPath : "stdout");
-		status = ctx->formatter(ctx, output_file);
-		if (ctx->verbose) printf("// Written\n");
-		if (output_file != stdout) fclose(output_file);
-	} else {
-		printf("// Cannot open for writing \"%s\"", ctx->outputDataPath);
+// Fills order with rect indices sorted in descending order of the sort key
+static void sort_rects(enum ImgPackSortOrder sort_order, const stbrp_rect *rects, int count, int *order) {
+	struct ImgPackSortKey *keys = ISLIP_MALLOC(sizeof(*keys) * count);
+	if (!keys) {
+		for (int i = 0; i < count; i++) order[i] = i;
+		return;
 	}
-	return status;
+	for (int i = 0; i < count; i++) {
+		long long w = rects[i].w, h = rects[i].h;
+		switch (sort_order) {
+			case IMGPACK_SORT_PERIMETER: keys[i].key = w + h; break;
+			case IMGPACK_SORT_MAX_SIDE: keys[i].key = (w > h ? w : h) << 16 | (w > h ? h : w); break;
+			case IMGPACK_SORT_HEIGHT: keys[i].key = h << 16 | w; break;
+			case IMGPACK_SORT_WIDTH: keys[i].key = w << 16 | h; break;
+			default: keys[i].key = w * h; break;
+		}
+		keys[i].index = i;
+	}
+	qsort(keys, count, sizeof(*keys), compare_sort_keys);
+	for (int i = 0; i < count; i++) {
+		order[i] = keys[i].index;
+	}
+	ISLIP_FREE(keys);
 }
 
-static int write_atlas_image(struct ImgPackContext *ctx) {
-	unsigned char *output_data = ISLIP_MALLOC(4 * ctx->width * ctx->height);
-	if (ctx->verbose) printf("// Drawing atlas image to \"%s\"\n", ctx->outputImagePath);
-	for (int i = 0; i < ctx->size; i++) {
-		int rid = ctx->images[i].id;
-		struct stbrp_rect rect = ctx->packingRects[rid];
-		if (rect.w == 0 || rect.h == 0) continue;
-		int x0 = ctx->images[i].source.x, y0 = ctx->images[i].source.y;
-		int d = ctx->padding + ctx->extrude;
-		int w = ctx->images[i].source.w, h = ctx->images[i].source.h;
-		stbi_uc *image_data = ctx->images[i].data;
-		if (ctx->verbose) printf("// Drawing %s\n", ctx->images[i].path);
-		for (int y = 0; y < rect.h-2*d; y++) {
-			for (int x = 0; x < rect.w-2*d; x++) {
-				int output_offset = 4*(x+rect.x+d + (y+rect.y+d)*ctx->width);
-				for (int j = 0; j < 4; j++) {
-					output_data[output_offset+j] = image_data[4*(x+x0+(y+y0)*w)+j];
-				}
-			}
+static int run_packer(struct ImgPackContext *ctx, struct ImgPackLayout *layout, int width, int height, stbrp_rect *rects, const int *order, int count) {
+	const struct ImgPackPacker *packer = layout->packer;
+	return packer->pack(packer->heuristic, ctx->allowRotation && packer->rotates, width, height, rects, order, count);
+}
+
+// Single packing attempt, on success remembers the layout if it's the smallest one
+static int try_pack_size(struct ImgPackSizeSearch *search, int width, int height) {
+	long long area = (long long)width * height;
+	if (width < search->minWidth || height < search->minHeight || area < search->area) return 0;
+	if (search->bestArea > 0 && area >= search->bestArea) return 1;
+	search->attempts++;
+	if (search->layout->verbose) printf("// Trying to pack %d images into %dx%d\n", search->count, width, height);
+	int fits = run_packer(search->ctx, search->layout, width, height, search->rects, search->order, search->count);
+	imgpack_stats_add_size(search->ctx->stats, width, height, fits);
+	if (!fits) return 0;
+	memcpy(search->bestRects, search->rects, search->count * sizeof(*search->rects));
+	search->bestArea = area;
+	search->bestWidth = width;
+	search->bestHeight = height;
+	return 1;
+}
+
+static int clamp_side(int side, int min_side, int max_side) {
+	return side < min_side ? min_side : side > max_side ? max_side : side;
+}
+
+// Binary search over the scale s of the size (s*sqrt(ratio), s/sqrt(ratio))
+static void search_ratio_size(struct ImgPackSizeSearch *search, double ratio) {
+	double kw = sqrt(ratio), kh = 1.0 / kw;
+	double lo = sqrt((double)search->area);
+	double hi = lo;
+	for (;;) {
+		int width = clamp_side((int)ceil(hi*kw), search->minWidth, search->maxWidth);
+		int height = clamp_side((int)ceil(hi*kh), search->minHeight, search->maxHeight);
+		if (search->bestArea > 0 && (long long)width * height >= search->bestArea) break;
+		if (try_pack_size(search, width, height)) break;
+		if (width == search->maxWidth && height == search->maxHeight) return;
+		lo = hi;
+		hi *= search->ctx->sideGrowCoefficient;
+	}
+	while (hi - lo > 0.5) {
+		double mid = 0.5 * (lo + hi);
+		int width = clamp_side((int)ceil(mid*kw), search->minWidth, search->maxWidth);
+		int height = clamp_side((int)ceil(mid*kh), search->minHeight, search->maxHeight);
+		if (try_pack_size(search, width, height)) {
+			hi = mid;
+		} else {
+			lo = mid;
 		}
+	}
+}
 
-		if (ctx->extrude > 0) {
-			if (y0 == 0) {
-				for (int y = ctx->padding; y < d; y++) {
-					for (int x = 0; x < rect.w-2*d; x++) {
-						int output_offset = 4*(x+rect.x+d + (y+rect.y)*ctx->width);
-						for (int j = 0; j < 4; j++) {
-							output_data[output_offset+j] = image_data[4*(x+x0 + (y0)*w) + j];
-						}
-					}
-				}
-			}
-			if (x0 == 0) {
-				for (int y = 0; y < rect.h-2*d; y++) {
-					for (int x = ctx->padding; x < d; x++) {
-						int output_offset = 4*(x+rect.x + (y+rect.y+d)*ctx->width);
-						for (int j = 0; j < 4; j++) {
-							output_data[output_offset+j] = image_data[4*(x0 + (y0+y)*w) + j];
-						}
-					}
-				}
+struct ImgPackPotSize {
+	int width;
+	int height;
+};
+
+static int compare_pot_sizes(const void *a, const void *b) {
+	const struct ImgPackPotSize *p = a, *q = b;
+	long long pa = (long long)p->width * p->height, qa = (long long)q->width * q->height;
+	if (pa != qa) return pa < qa ? -1 : 1;
+	int pd = abs(p->width - p->height), qd = abs(q->width - q->height);
+	if (pd != qd) return pd < qd ? -1 : 1;
+	return q->width - p->width;
+}
+
+// The largest power of two not above the side, at most 2^30 so it can be doubled
+static int lower_power_of_two(int side) {
+	int pot = 1;
+	while (pot < (1 << 30) && 2 * pot <= side) pot *= 2;
+	return pot;
+}
+
+// Power of two sizes are few, so try all of them ordered by area and stop on the first fit
+static void search_pot_size(struct ImgPackSizeSearch *search) {
+	struct ImgPackPotSize sizes[31*31];
+	int count = 0;
+	int max_width = lower_power_of_two(search->maxWidth), max_height = lower_power_of_two(search->maxHeight);
+	int min_width = search->minWidth > 1 ? (int)upper_power_of_two(search->minWidth) : 1;
+	int min_height = search->minHeight > 1 ? (int)upper_power_of_two(search->minHeight) : 1;
+	if (search->minWidth > max_width || search->minHeight > max_height) return;
+	for (long long width = min_width; width <= max_width; width *= 2) {
+		for (long long height = min_height; height <= max_height; height *= 2) {
+			if (search->ctx->forceSquared && width != height) continue;
+			if (width * height < search->area) continue;
+			sizes[count++] = (struct ImgPackPotSize) {(int)width, (int)height};
+		}
+	}
+	qsort(sizes, count, sizeof(*sizes), compare_pot_sizes);
+	for (int i = 0; i < count && !search->bestArea; i++) {
+		try_pack_size(search, sizes[i].width, sizes[i].height);
+	}
+}
+
+// Without --max-width and --max-height sides are kept within the texture
+// size most GPUs can load, larger sides are tried only if rects don't fit
+#define IMGPACK_DEFAULT_MAX_SIDE 8192
+#define IMGPACK_LARGEST_SIDE 0xffff
+
+static void search_size_within(struct ImgPackSizeSearch *search, int max_side) {
+	static const double ratios[] = {1.0, 2.0, 0.5, 4.0/3.0, 3.0/4.0, 3.0/2.0, 2.0/3.0, 3.0, 1.0/3.0, 4.0, 1.0/4.0};
+	struct ImgPackContext *ctx = search->ctx;
+	long long sum_width = 0, sum_height = 0;
+	search->area = 0;
+	search->minWidth = search->minHeight = 0;
+	for (int i = 0; i < search->count; i++) {
+		search->area += (long long)search->rects[i].w * search->rects[i].h;
+		sum_width += search->rects[i].w;
+		sum_height += search->rects[i].h;
+		if (search->rects[i].w > search->minWidth) search->minWidth = search->rects[i].w;
+		if (search->rects[i].h > search->minHeight) search->minHeight = search->rects[i].h;
+	}
+	// Any width not less than the widest rect fits all rects stacked vertically
+	search->maxWidth = ctx->maxWidth > 0 ? ctx->maxWidth : (int)(sum_width < max_side ? sum_width : max_side);
+	search->maxHeight = ctx->maxHeight > 0 ? ctx->maxHeight : (int)(sum_height < max_side ? sum_height : max_side);
+	if (ctx->forcePOT) {
+		// Power of two sides above the sums fit the stacked rects as well
+		if (ctx->maxWidth <= 0) search->maxWidth = clamp_side((int)upper_power_of_two(search->maxWidth), 1, max_side);
+		if (ctx->maxHeight <= 0) search->maxHeight = clamp_side((int)upper_power_of_two(search->maxHeight), 1, max_side);
+	}
+	if (ctx->forceSquared) {
+		search->minWidth = search->minHeight = search->minWidth > search->minHeight ? search->minWidth : search->minHeight;
+		search->maxWidth = search->maxHeight = search->maxWidth > search->maxHeight ? search->maxWidth : search->maxHeight;
+		if (ctx->maxWidth > 0 && search->maxWidth > ctx->maxWidth) search->maxWidth = search->maxHeight = ctx->maxWidth;
+		if (ctx->maxHeight > 0 && search->maxHeight > ctx->maxHeight) search->maxWidth = search->maxHeight = ctx->maxHeight;
+	}
+	if (search->minWidth > search->maxWidth || search->minHeight > search->maxHeight ||
+			search->area > (long long)search->maxWidth * search->maxHeight) {
+		if (search->layout->verbose) printf("// Images can't fit into %dx%d\n", search->maxWidth, search->maxHeight);
+		return;
+	}
+	if (ctx->forcePOT) {
+		search_pot_size(search);
+	} else {
+		int ratios_count = ctx->forceSquared ? 1 : sizeof(ratios) / sizeof(*ratios);
+		for (int i = 0; i < ratios_count; i++) {
+			search_ratio_size(search, ratios[i]);
+		}
+	}
+}
+
+static void search_size(struct ImgPackSizeSearch *search) {
+	struct ImgPackContext *ctx = search->ctx;
+	search_size_within(search, IMGPACK_DEFAULT_MAX_SIDE / search->layout->block);
+	if (!search->bestArea && (ctx->maxWidth <= 0 || ctx->maxHeight <= 0)) {
+		if (search->layout->verbose) printf("// Trying sides over %d\n", IMGPACK_DEFAULT_MAX_SIDE);
+		search_size_within(search, IMGPACK_LARGEST_SIDE / search->layout->block);
+	}
+}
+
+// Rotates rects to lie on the long side when it fits into max width. Skyline
+// packs such rects tighter, because rects are placed by height. Returns number
+// of rotated rects
+static int rotate_rects_flat(struct ImgPackContext *ctx, stbrp_rect *rects, int count) {
+	int rotated = 0;
+	for (int i = 0; i < count; i++) {
+		if (rects[i].h > rects[i].w && (ctx->maxWidth <= 0 || rects[i].h <= ctx->maxWidth)) {
+			stbrp_coord w = rects[i].w;
+			rects[i].w = rects[i].h;
+			rects[i].h = w;
+			rotated++;
+		}
+	}
+	return rotated;
+}
+
+// Searches for the smallest atlas size which fits all rects. Rectangular sizes
+// of several aspect ratios are tried, each one using binary search on the
+// scale. Sizes smaller than the total area or the biggest rect and sizes not
+// smaller than the best found so far are rejected without packing. With
+// allowRotation and packer which can't rotate rects itself the search is
+// repeated for rects rotated to lie flat
+static int pack_rects(struct ImgPackContext *ctx, struct ImgPackLayout *layout, stbrp_rect *rects, int count, int *width, int *height) {
+	struct ImgPackSizeSearch search = {.ctx = ctx, .layout = layout, .rects = rects, .count = count};
+	for (int i = 0; i < count; i++) {
+		search.area += (long long)rects[i].w * rects[i].h;
+	}
+	if (layout->verbose) printf("// Occupied area is %lld\n", search.area);
+	if (search.area <= 0) return 1;
+	search.bestRects = ISLIP_MALLOC(sizeof(*search.bestRects) * count);
+	search.order = ISLIP_MALLOC(sizeof(*search.order) * count);
+	if (!search.bestRects || !search.order) {
+		ISLIP_FREE(search.bestRects);
+		ISLIP_FREE(search.order);
+		return 1;
+	}
+	sort_rects(layout->sortOrder, rects, count, search.order);
+	search_size(&search);
+	if (ctx->allowRotation && !layout->packer->rotates) {
+		long long best_area = search.bestArea;
+		if (rotate_rects_flat(ctx, rects, count) > 0) {
+			sort_rects(layout->sortOrder, rects, count, search.order);
+			search_size(&search);
+			if (layout->verbose && search.bestArea != best_area) {
+				printf("// Rotated images packed into smaller %dx%d\n", search.bestWidth, search.bestHeight);
 			}
-			if (y0 + rect.h - 2*d == h) {
-				for (int y = d+h; y < d+h+ctx->extrude; y++) {
-					for (int x = 0; x < rect.w-2*d; x++) {
-						int output_offset = 4*(x+rect.x+d + (y+rect.y-y0)*ctx->width);
-						for (int j = 0; j < 4; j++) {
-							output_data[output_offset+j] = image_data[4*(x0+x + (y0+rect.h-2*d-1)*w) + j];
-						}
-					}
-				}
+		}
+	}
+	layout->attempts += search.attempts;
+	if (search.bestArea > 0) {
+		memcpy(rects, search.bestRects, count * sizeof(*rects));
+		*width = search.bestWidth;
+		*height = search.bestHeight;
+		if (layout->verbose) printf("// Packed %d images into %dx%d after %d attempts\n", count, *width, *height, search.attempts);
+	} else if (layout->verbose) {
+		printf("// Images can't be packed after %d attempts\n", search.attempts);
+	}
+	ISLIP_FREE(search.bestRects);
+	ISLIP_FREE(search.order);
+	return search.bestArea > 0 ? 0 : 1;
+}
+
+static void add_page(struct ImgPackContext *ctx, int width, int height) {
+	char *path = ctx->outputImagePath;
+	char *image_path;
+	if (ctx->allowMultipack) {
+		// "atlas.png" => "atlas_0.png", "atlas_1.png", ...
+		char *dot = strrchr(path, '.');
+		char *slash = strrchr(path, '/');
+		int base_len = (dot && (!slash || dot > slash)) ? (int)(dot - path) : (int)strlen(path);
+		image_path = ISLIP_MALLOC(strlen(path) + 16);
+		sprintf(image_path, "%.*s_%d%s", base_len, path, ctx->pagesCount, path + base_len);
+	} else {
+		image_path = copy_string(path);
+	}
+	ctx->pages = ISLIP_REALLOC(ctx->pages, (ctx->pagesCount + 1) * sizeof(*ctx->pages));
+	ctx->pages[ctx->pagesCount++] = (struct ImgPackPage) {
+		.width = width,
+		.height = height,
+		.imagePath = image_path,
+	};
+}
+
+static long long get_pages_area(struct ImgPackContext *ctx) {
+	long long area = 0;
+	for (int i = 0; i < ctx->pagesCount; i++) {
+		area += (long long)ctx->pages[i].width * ctx->pages[i].height;
+	}
+	return area;
+}
+
+static void add_layout_page(struct ImgPackLayout *layout, int width, int height) {
+	layout->pages = ISLIP_REALLOC(layout->pages, (layout->pagesCount + 1) * sizeof(*layout->pages));
+	layout->pages[layout->pagesCount++] = (struct ImgPackPage) {
+		.width = width,
+		.height = height,
+	};
+	layout->area += (long long)width * height;
+}
+
+// Packs rects into the page of maximal size, with allowRotation and packer which
+// can't rotate rects itself also tries rects rotated to lie flat and keeps the
+// variant which takes more area. Returns non-zero if all rects were packed
+static int pack_page_rects(struct ImgPackContext *ctx, struct ImgPackLayout *layout, stbrp_rect *rects,
+		stbrp_rect *flat_rects, int *order, int count) {
+	sort_rects(layout->sortOrder, rects, count, order);
+	int all_packed = run_packer(ctx, layout, ctx->maxWidth, ctx->maxHeight, rects, order, count);
+	layout->attempts++;
+	if (flat_rects && !all_packed && !layout->packer->rotates) {
+		memcpy(flat_rects, rects, count * sizeof(*rects));
+		if (rotate_rects_flat(ctx, flat_rects, count) > 0) {
+			long long area = 0, flat_area = 0;
+			sort_rects(layout->sortOrder, flat_rects, count, order);
+			int all_flat_packed = run_packer(ctx, layout, ctx->maxWidth, ctx->maxHeight, flat_rects, order, count);
+			layout->attempts++;
+			for (int i = 0; i < count; i++) {
+				if (rects[i].was_packed) area += (long long)rects[i].w * rects[i].h;
+				if (flat_rects[i].was_packed) flat_area += (long long)flat_rects[i].w * flat_rects[i].h;
 			}
-			if (x0 + rect.w - 2*d == w) {
-				for (int y = 0; y < rect.h-2*d; y++) {
-					for (int x = d+w; x < d+w+ctx->extrude; x++) {
-						int output_offset = 4*(x+rect.x-x0 + (y+rect.y+d)*ctx->width);
-						for (int j = 0; j < 4; j++) {
-							output_data[output_offset+j] = image_data[4*(x0+rect.w-2*d-1 + (y0+y)*w) + j];
-						}
-					}
-				}
+			if (all_flat_packed || flat_area > area) {
+				memcpy(rects, flat_rects, count * sizeof(*rects));
+				all_packed = all_flat_packed;
 			}
-			if (y0 == 0 && x0 == 0) {
-				for (int y = ctx->padding; y < d; y++) {
-					for (int x = ctx->padding; x < d; x++) {
-						int output_offset = 4*(x+rect.x + (y+rect.y)*ctx->width);
-						for (int j = 0; j < 4; j++) {
-							output_data[output_offset+j] = image_data[4*(x0 + (y0)*w) + j];
-						}
-					}
-				}
+		}
+	}
+	return all_packed;
+}
+
+// Fills pages of maximal size one after another while rects don't fit. Page
+// which takes all remaining rects is shrinked using the common size search
+static int pack_layout_pages(struct ImgPackContext *ctx, struct ImgPackLayout *layout) {
+	stbrp_rect *rects = ISLIP_MALLOC(sizeof(*rects) * ctx->size);
+	stbrp_rect *flat_rects = ctx->allowRotation ? ISLIP_MALLOC(sizeof(*rects) * ctx->size) : NULL;
+	int *order = ISLIP_MALLOC(sizeof(*order) * ctx->size);
+	int count = 0, status = 0;
+	if (!rects || !order || (ctx->allowRotation && !flat_rects)) {
+		status = 1;
+	} else {
+		for (int i = 0; i < ctx->size; i++) {
+			if (layout->rects[i].w > 0 && layout->rects[i].h > 0) {
+				rects[count++] = layout->rects[i];
 			}
-			if (y0 == 0 && x0 + rect.w - 2*d == w) {
-				for (int y = ctx->padding; y < d; y++) {
-					for (int x = d+w; x < d+w+ctx->extrude; x++) {
-						int output_offset = 4*(x+rect.x-x0 + (y+rect.y)*ctx->width);
-						for (int j = 0; j < 4; j++) {
-							output_data[output_offset+j] = image_data[4*(x0+rect.w-2*d-1 + (y0)*w) + j];
-						}
-					}
-				}
+		}
+		if (count == 0) {
+			status = 1;
+		}
+	}
+	while (status == 0 && count > 0) {
+		int width = ctx->maxWidth, height = ctx->maxHeight;
+		if (layout->verbose) printf("// Trying to pack %d images into page %d of %dx%d\n", count, layout->pagesCount, width, height);
+		if (pack_page_rects(ctx, layout, rects, flat_rects, order, count)) {
+			// Last page, the size search starts from not rotated rects
+			for (int i = 0; i < count; i++) {
+				int id = rects[i].id;
+				rects[i].w = ctx->packingRects[id].w;
+				rects[i].h = ctx->packingRects[id].h;
 			}
-			if (y0 + rect.h - 2*d == h && x0 == 0) {
-				for (int y = d+h; y < d+h+ctx->extrude; y++) {
-					for (int x = ctx->padding; x < d; x++) {
-						int output_offset = 4*(x+rect.x + (y+rect.y-y0)*ctx->width);
-						for (int j = 0; j < 4; j++) {
-							output_data[output_offset+j] = image_data[4*(x0 + (y0+rect.h-2*d-1)*w) + j];
-						}
-					}
-				}
+			if (pack_rects(ctx, layout, rects, count, &width, &height)) {
+				width = ctx->maxWidth;
+				height = ctx->maxHeight;
+				pack_page_rects(ctx, layout, rects, flat_rects, order, count);
 			}
-			if (y0 + rect.h - 2*d == h && x0 + rect.w - 2*d == w) {
-				for (int y = d+h; y < d+h+ctx->extrude; y++) {
-					for (int x = d+w; x < d+w+ctx->extrude; x++) {
-						int output_offset = 4*(x+rect.x + (y+rect.y-y0)*ctx->width);
-						for (int j = 0; j < 4; j++) {
-							output_data[output_offset+j] = image_data[4*(x0+rect.w-2*d-1 + (y0+rect.h-2*d-1)*w) + j];
-						}
-					}
-				}
+		}
+		int left = 0, right = 0, bottom = 0;
+		for (int i = 0; i < count; i++) {
+			if (rects[i].was_packed) {
+				layout->rects[rects[i].id] = rects[i];
+				layout->rectsPages[rects[i].id] = layout->pagesCount;
+				if (rects[i].x + rects[i].w > right) right = rects[i].x + rects[i].w;
+				if (rects[i].y + rects[i].h > bottom) bottom = rects[i].y + rects[i].h;
+			} else {
+				rects[left++] = rects[i];
 			}
 		}
+		if (left == count) {
+			status = 1;
+			break;
+		}
+		if (ctx->forcePOT) {
+			if ((int)upper_power_of_two(right) < width) width = upper_power_of_two(right);
+			if ((int)upper_power_of_two(bottom) < height) height = upper_power_of_two(bottom);
+		} else {
+			width = right;
+			height = bottom;
+		}
+		if (layout->verbose) printf("// Page %d of %dx%d holds %d images\n", layout->pagesCount, width, height, count - left);
+		add_layout_page(layout, width, height);
+		count = left;
 	}
-	stbi_write_png(ctx->outputImagePath, ctx->width, ctx->height, 4, output_data, ctx->width*4);
-	ISLIP_FREE(output_data);
-	return 0;
+	ISLIP_FREE(order);
+	ISLIP_FREE(flat_rects);
+	ISLIP_FREE(rects);
+	return status;
 }
 
-static void clear_context(struct ImgPackContext *ctx) {
+// Packs copy of the context rects with the layout packer and sort order
+static void pack_layout(struct ImgPackContext *ctx, struct ImgPackLayout *layout) {
+	layout->rects = ISLIP_MALLOC(sizeof(*layout->rects) * ctx->size);
+	layout->rectsPages = ISLIP_MALLOC(sizeof(*layout->rectsPages) * ctx->size);
+	if (!layout->rects || !layout->rectsPages) {
+		layout->status = 1;
+		return;
+	}
+	memcpy(layout->rects, ctx->packingRects, sizeof(*layout->rects) * ctx->size);
 	for (int i = 0; i < ctx->size; i++) {
-		ISLIP_FREE(ctx->images[i].path);
-		stbi_image_free(ctx->images[i].data);
+		layout->rectsPages[i] = 0;
+	}
+	if (ctx->allowMultipack) {
+		layout->status = pack_layout_pages(ctx, layout);
+	} else {
+		int width, height;
+		layout->status = pack_rects(ctx, layout, layout->rects, ctx->size, &width, &height);
+		if (layout->status == 0) {
+			add_layout_page(layout, width, height);
+		}
 	}
-	ISLIP_FREE(ctx->packingRects);
-	ISLIP_FREE(ctx->images);
-	ctx->packingRects = NULL;
-	ctx->images = NULL;
-	ctx->size = 0;
-	ctx->allocated = 0;
 }
 
-static int parse_scale(struct ImgPackContext *ctx, const char *scale) {
-	char numerator[128];
-	char denominator[128] = "1";
-	int i = 0, j = 0;
-	int num = 1, den = 1;
-	for (j = 0; j < 127 && scale[i] != '/' && scale[i] != '\0'; i++, j++) {
-		numerator[j] = scale[i];
+struct ImgPackLayouts {
+	struct ImgPackContext *ctx;
+	struct ImgPackLayout *items;
+};
+
+static void pack_layout_task(void *udata, int index) {
+	struct ImgPackLayouts *layouts = udata;
+	pack_layout(layouts->ctx, &layouts->items[index]);
+}
+
+static int is_better_layout(const struct ImgPackLayout *layout, const struct ImgPackLayout *best) {
+	if (layout->status) return 0;
+	if (!best || best->status) return 1;
+	if (layout->pagesCount != best->pagesCount) return layout->pagesCount < best->pagesCount;
+	return layout->area < best->area;
+}
+
+// Packs images with the selected packer, with packEffort several packers and
+// sort orders are tried on ctx->jobs threads and the smallest layout is kept.
+// Ties are resolved by the order of combinations, so the result doesn't depend
+// on the number of threads. Rects and pages are measured in blocks of block
+// pixels
+static int pack_layouts(struct ImgPackContext *ctx, int block) {
+	static const enum ImgPackSortOrder sort_orders[] = {IMGPACK_SORT_AREA, IMGPACK_SORT_PERIMETER,
+		IMGPACK_SORT_MAX_SIDE, IMGPACK_SORT_HEIGHT, IMGPACK_SORT_WIDTH};
+	int packers_count = sizeof(imgpack_packers) / sizeof(*imgpack_packers);
+	int sort_orders_count = sizeof(sort_orders) / sizeof(*sort_orders);
+	struct ImgPackLayouts layouts = {.ctx = ctx};
+	int count = 0;
+	layouts.items = ISLIP_MALLOC(sizeof(*layouts.items) * (1 + packers_count * sort_orders_count));
+	if (!layouts.items) return 1;
+	if (ctx->packEffort <= 0) {
+		layouts.items[count++] = (struct ImgPackLayout) {.packer = ctx->packer, .sortOrder = ctx->sortOrder};
+	} else {
+		for (int i = 0; i < packers_count; i++) {
+			const struct ImgPackPacker *packer = &imgpack_packers[i];
+			if (ctx->packEffort == 1 || packer->sorts) {
+				layouts.items[count++] = (struct ImgPackLayout) {.packer = packer, .sortOrder = packer->sortOrder};
+			} else {
+				for (int j = 0; j < sort_orders_count; j++) {
+					layouts.items[count++] = (struct ImgPackLayout) {.packer = packer, .sortOrder = sort_orders[j]};
+				}
+			}
+		}
 	}
-	numerator[j+1] = '\0';
-	if (scale[i] == '\0') {
-		num = strtol(numerator, NULL, 10);
-	} else if (scale[i] == '/') {
-		i++;
-		for (j = 0; j < 127 && scale[i] != '\0'; i++, j++) {
-			denominator[j] = scale[i];
+	for (int i = 0; i < count; i++) {
+		layouts.items[i].verbose = ctx->verbose && count == 1;
+		layouts.items[i].block = block;
+	}
+	if (ctx->verbose && count > 1) printf("// Trying %d packing variants using %d threads\n", count, ctx->jobs);
+	imgpack_parallel_for(ctx->jobs, count, pack_layout_task, &layouts);
+
+	struct ImgPackLayout *best = NULL;
+	for (int i = 0; i < count; i++) {
+		struct ImgPackLayout *layout = &layouts.items[i];
+		ctx->packAttempts += layout->attempts;
+		if (ctx->verbose && count > 1) {
+			if (layout->status) {
+				printf("// %s sorted by %s: failed after %d attempts\n", layout->packer->name, sort_order_names[layout->sortOrder], layout->attempts);
+			} else {
+				printf("// %s sorted by %s: %d pages of %lld area after %d attempts\n", layout->packer->name,
+						sort_order_names[layout->sortOrder], layout->pagesCount, layout->area, layout->attempts);
+			}
+		}
+		if (is_better_layout(layout, best)) {
+			best = layout;
 		}
-		denominator[j] = '\0';
 	}
-	num = strtol(numerator, NULL, 10);
-	den = strtol(denominator, NULL, 10);
-	if (num > 0 && den > 0) {
-		int gcd = 1;
-		for(int k = 1; k <= num && k <= den; k++) {
-			if (num % k == 0 && den % k == 0) {
-				gcd = k;
+	if (best) {
+		if (ctx->verbose && count > 1) printf("// Using %s sorted by %s\n", best->packer->name, sort_order_names[best->sortOrder]);
+		for (int i = 0; i < ctx->size; i++) {
+			// Rects are rotated only if they are not squares, so rotation is detected by changed width
+			ctx->packingRotated[i] = best->rects[i].w != ctx->packingRects[i].w;
+			ctx->packingRects[i] = best->rects[i];
+			ctx->packingPages[i] = best->rectsPages[i];
+		}
+		for (int i = 0; i < ctx->size; i++) {
+			if (ctx->images[i].copyOf >= 0) {
+				ctx->packingPages[ctx->images[i].id] = ctx->packingPages[ctx->images[i].copyOf];
 			}
-    }
-		ctx->scaleNumerator = num / gcd;
-		ctx->scaleDenominator = den / gcd;
-		return 0;
+		}
+		for (int i = 0; i < best->pagesCount; i++) {
+			add_page(ctx, best->pages[i].width * block, best->pages[i].height * block);
+		}
+		ctx->width = ctx->pages[0].width;
+		ctx->height = ctx->pages[0].height;
+	} else if (ctx->allowMultipack) {
+		printf("Cannot fit image into %dx%d page\n", ctx->maxWidth * block, ctx->maxHeight * block);
 	} else {
-		return 1;
+		printf("Exceeded max size constraints %d x %d\n", ctx->maxWidth * block, ctx->maxHeight * block);
+	}
+	for (int i = 0; i < count; i++) {
+		ISLIP_FREE(layouts.items[i].rects);
+		ISLIP_FREE(layouts.items[i].rectsPages);
+		ISLIP_FREE(layouts.items[i].pages);
 	}
+	ISLIP_FREE(layouts.items);
+	return best ? 0 : 1;
 }
 
-static int compare_images(const void *a, const void *b) {
-	return strcmp(((struct ImgPackImage *)a)->path, ((struct ImgPackImage *)b)->path);
+// Block compressed pages are packed in units of blocks, so every image starts
+// at a block boundary and no block holds pixels of two images. With mipmaps
+// units are 2^mipmaps pixels, so every rect takes whole pixels of all levels
+static int get_pack_unit(struct ImgPackContext *ctx) {
+	int block = imgpack_texture_formats[ctx->colorFormat].blockSize, level = 1 << ctx->mipmaps;
+	return block > level ? block : level;
 }
 
-static void sort_images(struct ImgPackContext *ctx) {
-	qsort(ctx->images, ctx->size, sizeof(struct ImgPackImage), compare_images);
+static int pack_images(struct ImgPackContext *ctx) {
+	int block = get_pack_unit(ctx);
+	if (ctx->cache && imgpack_cache_restore_layout(ctx)) {
+		if (ctx->verbose) printf("// Reusing cached layout of %d pages\n", ctx->cache->pagesCount);
+		for (int i = 0; i < ctx->cache->pagesCount; i++) {
+			add_page(ctx, ctx->cache->pages[i].width, ctx->cache->pages[i].height);
+		}
+		ctx->width = ctx->pages[0].width;
+		ctx->height = ctx->pages[0].height;
+		return 0;
+	}
+	if (block == 1) return pack_layouts(ctx, 1);
+
+	stbrp_rect *rects = ISLIP_MALLOC(sizeof(*rects) * ctx->size);
+	int max_width = ctx->maxWidth, max_height = ctx->maxHeight;
+	if (!rects) return 1;
+	if (ctx->verbose) printf("// Packing in blocks of %dx%d pixels\n", block, block);
+	memcpy(rects, ctx->packingRects, sizeof(*rects) * ctx->size);
+	for (int i = 0; i < ctx->size; i++) {
+		ctx->packingRects[i].w = (rects[i].w + block - 1) / block;
+		ctx->packingRects[i].h = (rects[i].h + block - 1) / block;
+	}
+	if (max_width > 0) ctx->maxWidth = max_width >= block ? max_width / block : 1;
+	if (max_height > 0) ctx->maxHeight = max_height >= block ? max_height / block : 1;
+	int status = pack_layouts(ctx, block);
+	ctx->maxWidth = max_width;
+	ctx->maxHeight = max_height;
+	for (int i = 0; i < ctx->size; i++) {
+		stbrp_rect rect = rects[i];
+		if (!status) {
+			rect.x = ctx->packingRects[i].x * block;
+			rect.y = ctx->packingRects[i].y * block;
+			rect.was_packed = ctx->packingRects[i].was_packed;
+			if (ctx->packingRotated[i]) {
+				rect.w = rects[i].h;
+				rect.h = rects[i].w;
+			}
+		}
+		ctx->packingRects[i] = rect;
+	}
+	ISLIP_FREE(rects);
+	return status;
 }
 
-int main(int argc, char *argv[]) {
-	struct ImgPackContext ctx = {
-		.scaleNumerator = 1,
-		.scaleDenominator = 1,
-		.sideGrowCoefficient = 1.2,
-		.trimThreshold = -1,
-		.argc = argc,
-		.argv = argv,
-	};
-	char *imagesPath = argv[argc-1];
-	char *format_data = "C";
-	char *format_color = "RGBA8888";
-	char *scale = "1";
-	char *naming = "NAME_WITH_EXT";
-	int sorting = 0;
-	IA_BEGIN(argc, argv, "--help", "-?", "ImgPack texture packer v0.8\n"
-		"Copyright 2019 Ilya Kolbin <iskolbin@gmail.com>\n\n"
-		"Usage : imgpack <OPTIONS> <images folder>\n\n"
-		"| Key          |    | Value   | Description\n"
-		"|--------------|----|---------|----------------------------------------------\n"
-		"| --data       | -d | string  | output file path, if ommited `stdout` is used\n"
-		"| --image      | -i | string  | output image path (NEEDED)\n"
-		"| --name       | -n | string  | name\n"
-		"| --format     | -f | string  | output atlas data format (CSV, JSON_HASH, JSON_ARRAY, RAYLIB)\n"
-		"| --naming     | -N | string  | frames naming for JSON_HASH/ARRAY: FULL_PATH, NAME_NO_EXT, NAME_WITH_EXT(default)\n"
-		"| --trim       | -t | int     | alpha threshold for trimming image with transparent border, should be 0-255\n"
-		"| --padding    | -p | int     | adds transparent padding\n"
-		"| --exturde    | -e | int     | adds copied pixels on image borders, which helps with texture bleeding\n"
-		"| --max-width  | -w | int     | maximum atlas width\n"
-		"| --max-height | -h | int     | maximum atlas height\n"
-		"| --scale      | -x | int/int | scaling ratio int form \"A/B\" or just \"K\"\n"
-		"| --color      | -c | string  | format (only RGBA8888 currently supported)\n"
-		"| --unique     | -u |         | remove identical images (after trimming)\n"
-		"| --force-pot  | -2 |         | force power of two texture output\n"
-		"| --sort       | -s |         | sorting by path name (ascending)\n"
-		//"| --multipack  | -m |         | allow multipacking\n"
-		"| --verbose    | -v |         | print debug messages during the packing process\n"
-		"| --help       | -? |         | prints this memo\n\n")
-		IA_STR("--data", "-d", ctx.outputDataPath)
-		IA_STR("--image", "-i", ctx.outputImagePath)
-		IA_STR("--name", "-n", ctx.name)
-		IA_STR("--format", "-f", format_data)
-		IA_STR("--naming", "-N", naming)
-		IA_INT("--trim", "-t", ctx.trimThreshold)
-		IA_INT("--padding", "-p", ctx.padding)
-		IA_INT("--extrude", "-e", ctx.extrude)
-		IA_INT("--max-width", "-w", ctx.maxWidth)
-		IA_INT("--max-height", "-h", ctx.maxHeight)
-		IA_STR("--scale", "-x", scale)
-		IA_STR("--color", "-c", format_data)
-		IA_FLAG("--unique", "-u", ctx.unique)
-		IA_FLAG("--force-pot", "-2", ctx.forcePOT)
-		IA_FLAG("--sort", "-s", sorting)
-		//IA_FLAG("--multipack", "-m", ctx.allowMultipack)
-		IA_FLAG("--verbose", "-v", ctx.verbose)
-		IA_FLAG("--force-squared", "-sq", ctx.forceSquared)
-	IA_END
+struct ImgPackSeededPage {
+	int width;
+	int height;
+	struct ImgPackAreas freeAreas;
+};
 
-	if (!ctx.outputImagePath) {
-		printf("Specify output image path using --image/-i <image path>");
-		return 1;
-	}
+struct ImgPackSeeded {
+	struct ImgPackSeededPage *pages;
+	int pagesCount;
+	stbrp_rect *rects;
+	int *rectsPages;
+	int *rectsRotated;
+};
 
-	if (!parse_data_format(&ctx, format_data)) {
-		if (ctx.verbose) printf("// Using data format %s\n", format_data);
-	} else {
-		printf("Bad data format \"%s\"\n", format_data);
-		return 1;
+static int is_seeded_area_free(struct ImgPackSeededPage *page, struct ImgPackArea area) {
+	for (int i = 0; i < page->freeAreas.size; i++) {
+		if (imgpack_area_contains(page->freeAreas.items[i], area)) return 1;
 	}
+	return 0;
+}
 
-	if (!parse_data_color(&ctx, format_color)) {
-		if (ctx.verbose) printf("// Using color format %s\n", format_color);
-	} else {
-		printf("Bad color format \"%s\"\n", format_color);
-		return 1;
+// Grows the page to the right and to the bottom. Free areas touching these
+// borders are extended into the new strips, so they stay maximal
+static int grow_seeded_page(struct ImgPackSeededPage *page, int width, int height) {
+	struct ImgPackAreas *areas = &page->freeAreas;
+	int size = areas->size, status = 0;
+	for (int i = 0; i < size; i++) {
+		struct ImgPackArea *f = &areas->items[i];
+		if (f->x + f->w == page->width) f->w = width - f->x;
+		if (f->y + f->h == page->height) f->h = height - f->y;
 	}
-
-	if (!parse_naming(&ctx, naming)) {
-		if (ctx.verbose) printf("// Using naming %s\n", naming);
-	} else {
-		printf("Bad naming \"%s\"\n", naming);
-		return 1;
+	if (width > page->width) status |= imgpack_areas_push(areas, (struct ImgPackArea) {page->width, 0, width - page->width, height});
+	if (height > page->height) status |= imgpack_areas_push(areas, (struct ImgPackArea) {0, page->height, width, height - page->height});
+	for (int j = size; j < areas->size; j++) {
+		for (int i = 0; i < areas->size; i++) {
+			if (i != j && areas->items[i].w > 0 && imgpack_area_contains(areas->items[i], areas->items[j])) {
+				areas->items[j].w = 0;
+				break;
+			}
+		}
 	}
-
-	if (!parse_scale(&ctx, scale)) {
-		if (ctx.verbose) printf("// Set scaling to %d/%d\n", ctx.scaleNumerator, ctx.scaleDenominator);
-	} else {
-		printf("Bad scale \"%s\"\n", scale);
-		return 1;
+	int count = 0;
+	for (int i = 0; i < areas->size; i++) {
+		if (areas->items[i].w > 0) areas->items[count++] = areas->items[i];
 	}
+	areas->size = count;
+	page->width = width;
+	page->height = height;
+	return status;
+}
 
-	if (ctx.maxWidth > 0 || ctx.maxHeight > 0) {
-		if (ctx.verbose) printf("// Size constraints: %d x %d\n", ctx.maxWidth, ctx.maxHeight);
+// Best short side fit over free areas of all pages, earlier pages win ties
+static int find_seeded_place(struct ImgPackContext *ctx, struct ImgPackSeeded *seeded, const stbrp_rect *rect,
+		int *best_page, struct ImgPackArea *best_area) {
+	long long best_score1 = 0, best_score2 = 0;
+	int found = 0, allow_rotation = ctx->allowRotation && rect->w != rect->h;
+	for (int p = 0; p < seeded->pagesCount; p++) {
+		struct ImgPackSeededPage *page = &seeded->pages[p];
+		for (int i = 0; i < page->freeAreas.size; i++) {
+			struct ImgPackArea f = page->freeAreas.items[i];
+			for (int rotated = 0; rotated <= allow_rotation; rotated++) {
+				int w = rotated ? rect->h : rect->w, h = rotated ? rect->w : rect->h;
+				if (w > f.w || h > f.h) continue;
+				long long score1, score2;
+				imgpack_maxrects__score(IMGPACK_MAXRECTS_BSSF, NULL, page->width, page->height, f, w, h, &score1, &score2);
+				if (!found || score1 < best_score1 || (score1 == best_score1 && score2 < best_score2)) {
+					found = 1;
+					*best_page = p;
+					*best_area = (struct ImgPackArea) {f.x, f.y, w, h};
+					best_score1 = score1;
+					best_score2 = score2;
+				}
+			}
+		}
 	}
+	return found;
+}
 
-	get_images_data(&ctx, imagesPath);	
+static int fit_seeded_side(struct ImgPackContext *ctx, int side, int max_side) {
+	if (ctx->forcePOT) side = upper_power_of_two(side);
+	return max_side > 0 && side > max_side ? -1 : side;
+}
 
-	if (!pack_images(&ctx)) {
-		if (ctx.verbose) printf("// Images have been packed\n");
-	} else {
-		printf("Cannot pack images\n");
-		return 1;
+// Makes room for the rect by growing one of the pages by the smallest area,
+// or by adding a new page when multipacking
+static int grow_seeded_pages(struct ImgPackContext *ctx, struct ImgPackSeeded *seeded, const stbrp_rect *rect) {
+	long long best_area = 0;
+	int best_page = -1, best_width = 0, best_height = 0;
+	for (int p = 0; p < seeded->pagesCount; p++) {
+		struct ImgPackSeededPage *page = &seeded->pages[p];
+		for (int right = 0; right <= 1; right++) {
+			int width = right ? page->width + rect->w : (page->width > rect->w ? page->width : rect->w);
+			int height = right ? (page->height > rect->h ? page->height : rect->h) : page->height + rect->h;
+			if (ctx->forceSquared) width = height = width > height ? width : height;
+			width = fit_seeded_side(ctx, width, ctx->maxWidth);
+			height = fit_seeded_side(ctx, height, ctx->maxHeight);
+			if (width < 0 || height < 0) continue;
+			long long area = (long long)width * height - (long long)page->width * page->height;
+			if (best_page < 0 || area < best_area) {
+				best_page = p;
+				best_area = area;
+				best_width = width;
+				best_height = height;
+			}
+		}
 	}
+	if (best_page < 0) {
+		if (!ctx->allowMultipack && seeded->pagesCount > 0) return 1;
+		int width = fit_seeded_side(ctx, rect->w, ctx->maxWidth), height = fit_seeded_side(ctx, rect->h, ctx->maxHeight);
+		if (width < 0 || height < 0) return 1;
+		seeded->pages = ISLIP_REALLOC(seeded->pages, (seeded->pagesCount + 1) * sizeof(*seeded->pages));
+		seeded->pages[seeded->pagesCount] = (struct ImgPackSeededPage) {0};
+		best_page = seeded->pagesCount++;
+		best_width = width;
+		best_height = height;
+	}
+	return grow_seeded_page(&seeded->pages[best_page], best_width, best_height);
+}
+
+static char *get_seed_frame_name(struct ImgPackContext *ctx, int id, char *buffer, size_t size) {
+	const struct ImgPackImage *image = &ctx->images[id];
+	if (ctx->seed->byPath || ctx->naming == IMGPACK_FULL_PATH) return image->path;
+	if (ctx->naming == IMGPACK_NAME_NO_EXT) return image->name;
+	snprintf(buffer, size, "%s%s", image->name, image->ext);
+	return buffer;
+}
+
+struct ImgPackSeededKeep {
+	int id;
+	struct ImgPackSeedFrame *frame;
+};
+
+static int compare_seeded_keeps(const void *a, const void *b) {
+	const struct ImgPackSeededKeep *ka = a, *kb = b;
+	if (ka->frame->page != kb->frame->page) return ka->frame->page < kb->frame->page ? -1 : 1;
+	if (ka->frame->y != kb->frame->y) return ka->frame->y < kb->frame->y ? -1 : 1;
+	if (ka->frame->x != kb->frame->x) return ka->frame->x < kb->frame->x ? -1 : 1;
+	return ka->id - kb->id;
+}
 
-	if (sorting) {
-		if (ctx.verbose) printf("// Sorting images\n");
-		sort_images(&ctx);
+// Keeps seeded frames which still have the same size at their places. Frames
+// are cut out of free areas top to bottom, in random order the number of
+// maximal free areas and the time to split them explode on large atlases
+static int keep_seeded_frames(struct ImgPackContext *ctx, struct ImgPackSeeded *seeded, int *kept) {
+	int d = ctx->padding + ctx->extrude, count = 0, keeps_count = 0;
+	char buffer[1024];
+	struct ImgPackSeededKeep *keeps = ISLIP_MALLOC((ctx->size + 1) * sizeof(*keeps));
+	if (!keeps) return -1;
+	for (int p = 0; p < seeded->pagesCount; p++) {
+		struct ImgPackSeededPage *page = &seeded->pages[p];
+		if (imgpack_areas_push(&page->freeAreas, (struct ImgPackArea) {0, 0, page->width, page->height})) count = -1;
+	}
+	for (int i = 0; i < ctx->size; i++) {
+		stbrp_rect *rect = &seeded->rects[i];
+		kept[i] = 0;
+		if (rect->w == 0 || rect->h == 0) continue;
+		struct ImgPackSeedFrame *frame = imgpack_seed_find(ctx->seed, get_seed_frame_name(ctx, i, buffer, sizeof(buffer)));
+		if (!frame || frame->w != rect->w - 2*d || frame->h != rect->h - 2*d || frame->page < 0 ||
+				frame->page >= seeded->pagesCount || (frame->rotated && !ctx->allowRotation)) {
+			continue;
+		}
+		// Reserved, so images with the same name get different frames
+		frame->used = 1;
+		keeps[keeps_count++] = (struct ImgPackSeededKeep) {i, frame};
+	}
+	qsort(keeps, keeps_count, sizeof(*keeps), compare_seeded_keeps);
+	for (int k = 0; k < keeps_count && count >= 0; k++) {
+		int i = keeps[k].id;
+		struct ImgPackSeedFrame *frame = keeps[k].frame;
+		stbrp_rect *rect = &seeded->rects[i];
+		struct ImgPackArea area = {frame->x - d, frame->y - d, frame->rotated ? rect->h : rect->w, frame->rotated ? rect->w : rect->h};
+		struct ImgPackSeededPage *page = &seeded->pages[frame->page];
+		frame->used = 0;
+		if (area.x < 0 || area.y < 0 || !is_seeded_area_free(page, area)) continue;
+		if ((ctx->maxWidth > 0 && area.x + area.w > ctx->maxWidth) || (ctx->maxHeight > 0 && area.y + area.h > ctx->maxHeight)) continue;
+		if (imgpack_maxrects__split(&page->freeAreas, area)) {
+			count = -1;
+			break;
+		}
+		frame->used = 1;
+		imgpack_rect_place(rect, area.x, area.y, frame->rotated);
+		seeded->rectsPages[i] = frame->page;
+		seeded->rectsRotated[i] = frame->rotated;
+		kept[i] = 1;
+		count++;
 	}
+	ISLIP_FREE(keeps);
+	return count;
+}
 
-	if (write_atlas_data(&ctx)) return 1;
-	if (write_atlas_image(&ctx)) return 1;
-	clear_context(&ctx);
-	return 0;
+// Places new and resized rects into the free space left by kept frames
+static int place_seeded_rects(struct ImgPackContext *ctx, struct ImgPackSeeded *seeded, const int *kept) {
+	int *order = ISLIP_MALLOC(ctx->size * sizeof(*order));
+	int count = 0, status = 0;
+	if (!order) return -1;
+	sort_rects(ctx->sortOrder, seeded->rects, ctx->size, order);
+	for (int k = 0; k < ctx->size && !status; k++) {
+		stbrp_rect *rect = &seeded->rects[order[k]];
+		if (kept[order[k]] || rect->w == 0 || rect->h == 0) continue;
+		int page = 0;
+		struct ImgPackArea area = {0};
+		while (!find_seeded_place(ctx, seeded, rect, &page, &area)) {
+			if (grow_seeded_pages(ctx, seeded, rect)) {
+				status = -1;
+				break;
+			}
+		}
+		if (status) break;
+		if (imgpack_maxrects__split(&seeded->pages[page].freeAreas, area)) status = -1;
+		int rotated = area.w != rect->w;
+		imgpack_rect_place(rect, area.x, area.y, rotated);
+		seeded->rectsPages[rect->id] = page;
+		seeded->rectsRotated[rect->id] = rotated;
+		count++;
+	}
+	ISLIP_FREE(order);
+	return status ? status : count;
 }
 
+// Shrinks pages to the used area and drops empty pages at the end, pages in
+// the middle are kept to not renumber the following ones
+static long long shrink_seeded_pages(struct ImgPackContext *ctx, struct ImgPackSeeded *seeded) {
+	long long area = 0;
+	int pages_count = 1;
+	for (int p = 0; p < seeded->pagesCount; p++) {
+		seeded->pages[p].width = seeded->pages[p].height = 1;
+	}
+	for (int i = 0; i < ctx->size; i++) {
+		stbrp_rect rect = seeded->rects[i];
+		struct ImgPackSeededPage *page = &seeded->pages[seeded->rectsPages[i]];
+		if (rect.w == 0 || rect.h == 0) continue;
+		if (rect.x + rect.w > page->width) page->width = rect.x + rect.w;
+		if (rect.y + rect.h > page->height) page->height = rect.y + rect.h;
+		if (seeded->rectsPages[i] >= pages_count) pages_count = seeded->rectsPages[i] + 1;
+	}
+	for (int p = pages_count; p < seeded->pagesCount; p++) {
+		ISLIP_FREE(seeded->pages[p].freeAreas.items);
+	}
+	seeded->pagesCount = pages_count;
+	for (int p = 0; p < seeded->pagesCount; p++) {
+		struct ImgPackSeededPage *page = &seeded->pages[p];
+		if (ctx->forceSquared) page->width = page->height = page->width > page->height ? page->width : page->height;
+		if (ctx->forcePOT) {
+			page->width = upper_power_of_two(page->width);
+			page->height = upper_power_of_two(page->height);
+		}
+		area += (long long)page->width * page->height;
+	}
+	return area;
+}
+
+static void commit_seeded_layout(struct ImgPackContext *ctx, struct ImgPackSeeded *seeded) {
+	for (int i = 0; i < ctx->pagesCount; i++) {
+		ISLIP_FREE(ctx->pages[i].imagePath);
+	}
+	ctx->pagesCount = 0;
+	for (int i = 0; i < ctx->size; i++) {
+		ctx->packingRects[i] = seeded->rects[i];
+		ctx->packingPages[i] = seeded->rectsPages[i];
+		ctx->packingRotated[i] = seeded->rectsRotated[i];
+	}
+	for (int i = 0; i < ctx->size; i++) {
+		if (ctx->images[i].copyOf >= 0) {
+			ctx->packingPages[ctx->images[i].id] = ctx->packingPages[ctx->images[i].copyOf];
+		}
+	}
+	for (int i = 0; i < seeded->pagesCount; i++) {
+		add_page(ctx, seeded->pages[i].width, seeded->pages[i].height);
+	}
+	ctx->width = ctx->pages[0].width;
+	ctx->height = ctx->pages[0].height;
+}
+
+// Layout-stable packing: frames of the seed data which kept their size stay at
+// the same place, other rects are put into the free space, pages grow if needed.
+// The result is compared with the full repack and is rejected if it's bigger by
+// more than the repack threshold
+static int pack_seeded_images(struct ImgPackContext *ctx) {
+	struct ImgPackSeed *seed = ctx->seed;
+	struct ImgPackSeeded seeded = {0};
+	int d = ctx->padding + ctx->extrude;
+	int *kept = ISLIP_MALLOC(ctx->size * sizeof(*kept));
+	seeded.rects = ISLIP_MALLOC(ctx->size * sizeof(*seeded.rects));
+	seeded.rectsPages = ISLIP_MALLOC(ctx->size * sizeof(*seeded.rectsPages));
+	seeded.rectsRotated = ISLIP_MALLOC(ctx->size * sizeof(*seeded.rectsRotated));
+	for (int i = 0; i < seed->framesCount; i++) {
+		struct ImgPackSeedFrame *frame = &seed->frames[i];
+		frame->used = 0;
+		if (frame->page >= seeded.pagesCount && frame->page < 0xffff) seeded.pagesCount = frame->page + 1;
+	}
+	if (seeded.pagesCount < seed->pagesCount) seeded.pagesCount = seed->pagesCount;
+	seeded.pages = ISLIP_MALLOC((seeded.pagesCount + 1) * sizeof(*seeded.pages));
+	for (int p = 0; p < seeded.pagesCount; p++) {
+		seeded.pages[p] = (struct ImgPackSeededPage) {0};
+		if (p < seed->pagesCount) {
+			seeded.pages[p].width = seed->pages[p].width;
+			seeded.pages[p].height = seed->pages[p].height;
+		}
+	}
+	// Data formats without page sizes get the bounding box of the frames
+	for (int i = 0; i < seed->framesCount; i++) {
+		struct ImgPackSeedFrame *frame = &seed->frames[i];
+		if (frame->page < 0 || frame->page >= seeded.pagesCount) continue;
+		struct ImgPackSeededPage *page = &seeded.pages[frame->page];
+		int right = frame->x + (frame->rotated ? frame->h : frame->w) + d, bottom = frame->y + (frame->rotated ? frame->w : frame->h) + d;
+		if (right > page->width) page->width = right;
+		if (bottom > page->height) page->height = bottom;
+	}
+	for (int p = 0; p < seeded.pagesCount; p++) {
+		if (ctx->maxWidth > 0 && seeded.pages[p].width > ctx->maxWidth) seeded.pages[p].width = ctx->maxWidth;
+		if (ctx->maxHeight > 0 && seeded.pages[p].height > ctx->maxHeight) seeded.pages[p].height = ctx->maxHeight;
+	}
+	for (int i = 0; i < ctx->size; i++) {
+		seeded.rects[i] = ctx->packingRects[i];
+		seeded.rectsPages[i] = 0;
+		seeded.rectsRotated[i] = 0;
+	}
+	int kept_count = keep_seeded_frames(ctx, &seeded, kept);
+	int placed_count = kept_count < 0 ? -1 : place_seeded_rects(ctx, &seeded, kept);
+	int status = placed_count < 0, repack = 0;
+	if (!status) {
+		long long seeded_area = shrink_seeded_pages(ctx, &seeded), packed_area = ctx->repackArea;
+		int seeded_pages = seeded.pagesCount;
+		if (packed_area <= 0 && !pack_images(ctx)) {
+			packed_area = get_pages_area(ctx);
+		}
+		double fragmentation = packed_area > 0 ? 1.0 - (double)packed_area / seeded_area : 0.0;
+		if (ctx->verbose) printf("// Seeded layout kept %d frames, placed %d, area %lld on %d pages, full repack area %lld, fragmentation %.3f\n",
+				kept_count, placed_count, seeded_area, seeded_pages, packed_area, fragmentation);
+		if (packed_area > 0 && fragmentation > ctx->repackThreshold) {
+			if (ctx->verbose) printf("// Fragmentation exceeds %.3f, using full repack\n", ctx->repackThreshold);
+			// Only the area of an earlier repack was compared
+			repack = ctx->repackArea > 0;
+		} else {
+			commit_seeded_layout(ctx, &seeded);
+		}
+	} else if (ctx->verbose) {
+		printf("// Cannot place images keeping seeded layout, using full repack\n");
+	}
+	for (int p = 0; p < seeded.pagesCount; p++) {
+		ISLIP_FREE(seeded.pages[p].freeAreas.items);
+	}
+	ISLIP_FREE(seeded.pages);
+	ISLIP_FREE(seeded.rects);
+	ISLIP_FREE(seeded.rectsPages);
+	ISLIP_FREE(seeded.rectsRotated);
+	ISLIP_FREE(kept);
+	if (!status && !repack) return 0;
+	status = pack_images(ctx);
+	if (!status && ctx->repackArea > 0) ctx->repackArea = get_pages_area(ctx);
+	return status;
+}
+
+// Copies rows [from, to) of the trimmed image w pixels wide one row at a time,
+// dst is the output row for the row from
+static void draw_image(struct ImgPackContext *ctx, int i, unsigned char *dst, int width, int x0, int w, int from, int to) {
+	struct ImgPackImage *image = &ctx->images[i];
+	size_t stride = 4 * (size_t)image->source.w;
+	const unsigned char *src = image->data + 4 * (size_t)image->source.x + image->source.y * stride;
+	for (int y = from; y < to; y++) {
+		memcpy(dst + 4 * (x0 + (size_t)(y - from) * width), src + y * stride, 4 * (size_t)w);
+	}
+}
+
+// Copies the trimmed image h pixels high rotated 90 degrees clockwise, so its
+// columns [from, to) become output rows starting at dst. Goes in square blocks
+// so both sides stay in cache
+static void draw_rotated_image(struct ImgPackContext *ctx, int i, unsigned char *dst, int width, int x0, int h, int from, int to) {
+	enum {BLOCK = 32};
+	struct ImgPackImage *image = &ctx->images[i];
+	size_t stride = 4 * (size_t)image->source.w;
+	const unsigned char *src = image->data + 4 * (size_t)image->source.x + image->source.y * stride;
+	for (int by = 0; by < h; by += BLOCK) {
+		int ey = by + BLOCK < h ? by + BLOCK : h;
+		for (int bx = from; bx < to; bx += BLOCK) {
+			int ex = bx + BLOCK < to ? bx + BLOCK : to;
+			for (int x = bx; x < ex; x++) {
+				unsigned char *row = dst + 4 * (x0 + h-1 + (size_t)(x - from) * width);
+				for (int y = by; y < ey; y++) {
+					memcpy(row - 4*y, src + y * stride + 4*x, 4);
+				}
+			}
+		}
+	}
+}
+
+// Replicates the border pixels of the row of w pixels at x0 outwards by
+// extrude pixels on the sides given by IMGPACK_EDGE_* bits
+static void extrude_row(unsigned char *row, int x0, int w, int extrude, int edges) {
+	for (int x = 1; x <= extrude; x++) {
+		if (edges & IMGPACK_EDGE_LEFT) memcpy(row + 4*(x0 - x), row + 4*x0, 4);
+		if (edges & IMGPACK_EDGE_RIGHT) memcpy(row + 4*(x0 + w-1 + x), row + 4*(x0 + w-1), 4);
+	}
+}
+
+// Output buffer holds rows [bandY, bandY + bandHeight) of the page
+struct ImgPackBlits {
+	struct ImgPackContext *ctx;
+	unsigned char *outputData;
+	int width;
+	int bandY;
+	int bandHeight;
+	int *ids;
+	unsigned char *failed;
+};
+
+// Draws the part of the image with its extrusion which falls into the band.
+// Extruded rows are drawn as copies of the border rows of the image, so bands
+// never read each other. Packing rects never overlap, so images are drawn in
+// parallel. Pixels dropped in low memory mode are decoded for the time of
+// drawing, images which span several bands are kept until the last one
+static void blit_image_task(void *udata, int index) {
+	struct ImgPackBlits *blits = udata;
+	struct ImgPackContext *ctx = blits->ctx;
+	struct ImgPackImage *image = &ctx->images[blits->ids[index]];
+	int rid = image->id, rotated = ctx->packingRotated[rid];
+	int d = ctx->padding + ctx->extrude, extrude = ctx->extrude;
+	struct stbrp_rect rect = ctx->packingRects[rid];
+	int x0 = rect.x + d, y0 = rect.y + d, w = rect.w - 2*d, h = rect.h - 2*d;
+	int edges = extrude > 0 ? get_image_edges(image, rotated ? h : w, rotated ? w : h) : 0;
+	if (rotated) {
+		// Image left side becomes the top, top becomes the right side and so on
+		edges = (edges & IMGPACK_EDGE_BOTTOM ? IMGPACK_EDGE_LEFT : 0) |
+			(edges & IMGPACK_EDGE_LEFT ? IMGPACK_EDGE_TOP : 0) |
+			(edges & IMGPACK_EDGE_TOP ? IMGPACK_EDGE_RIGHT : 0) |
+			(edges & IMGPACK_EDGE_RIGHT ? IMGPACK_EDGE_BOTTOM : 0);
+	}
+	int top = edges & IMGPACK_EDGE_TOP ? y0 - extrude : y0;
+	int bottom = edges & IMGPACK_EDGE_BOTTOM ? y0 + h + extrude : y0 + h;
+	int band_end = blits->bandY + blits->bandHeight;
+	int from = top > blits->bandY ? top : blits->bandY, to = bottom < band_end ? bottom : band_end;
+	if (from < to && !image->data) {
+		image->data = load_image_data(ctx, image);
+		if (!image->data) {
+			blits->failed[index] = 1;
+			return;
+		}
+	}
+	for (int y = from; y < to; y++) {
+		unsigned char *row = blits->outputData + 4 * (size_t)(y - blits->bandY) * blits->width;
+		// Rows of the image are drawn at once, extruded rows one by one
+		int image_to = y0 + h < to ? y0 + h : to;
+		int count = y >= y0 && y < image_to ? image_to - y : 1;
+		int image_y = y < y0 ? 0 : y >= y0 + h ? h-1 : y - y0;
+		if (rotated) draw_rotated_image(ctx, blits->ids[index], row, blits->width, x0, w, image_y, image_y + count);
+		else draw_image(ctx, blits->ids[index], row, blits->width, x0, w, image_y, image_y + count);
+		for (int k = 0; k < count && (edges & (IMGPACK_EDGE_LEFT | IMGPACK_EDGE_RIGHT)); k++) {
+			extrude_row(row + 4 * (size_t)k * blits->width, x0, w, extrude, edges);
+		}
+		y += count - 1;
+	}
+	if (ctx->lowMemory && bottom <= band_end) {
+		stbi_image_free(image->data);
+		image->data = NULL;
+	}
+}
+
+// PNG keeps only channels of the color format: gray for L8, gray with alpha for
+// A8, RGB for RGB565 and RGBA otherwise
+static int get_png_channels(enum ImgPackColorFormat color_format) {
+	const struct ImgPackTextureFormat *format = &imgpack_texture_formats[color_format];
+	if (format->gray) return 1;
+	if (!format->bits[0]) return 2;
+	if (!format->bits[3]) return 3;
+	return 4;
+}
+
+// Drops unused channels of count RGBA pixels in place
+static void pack_png_channels(unsigned char *pixels, size_t count, int channels) {
+	for (size_t i = 0; i < count && channels < 4; i++) {
+		unsigned char *p = pixels + 4*i, *out = pixels + channels*i;
+		unsigned char r = p[0], g = p[1], b = p[2], a = p[3];
+		out[0] = r;
+		if (channels == 2) out[1] = a;
+		if (channels == 3) {
+			out[1] = g;
+			out[2] = b;
+		}
+	}
+}
+
+// Image writers of one page, PNG and RAW pages get a file per mip level while
+// DDS and KTX2 hold all levels
+struct ImgPackPageOutput {
+	struct ImgPackContext *ctx;
+	int page;
+	int writingPng;
+	int writingTexture;
+	int quantizing;
+	int pngChannels;
+	int writingRaw;
+	struct ImgPackWriter writer;
+	struct ImgPackPngWriter png;
+	struct ImgPackTextureWriter texture;
+	struct ImgPackQuantizer quantizer;
+};
+
+// "atlas.png" => "atlas_mip1.png", "atlas_mip2.png", ...
+static char *get_level_path(const char *path, int level) {
+	const char *dot = strrchr(path, '.');
+	const char *slash = strrchr(path, '/');
+	int base_len = (dot && (!slash || dot > slash)) ? (int)(dot - path) : (int)strlen(path);
+	char *level_path = ISLIP_MALLOC(strlen(path) + 16);
+	if (level_path) sprintf(level_path, "%.*s_mip%d%s", base_len, path, level, path + base_len);
+	return level_path;
+}
+
+// Output of the level goes to the file at path unless the library caller opens it
+static int open_image_writer(struct ImgPackContext *ctx, struct ImgPackWriter *writer, const char *path, int page, int level) {
+	*writer = (struct ImgPackWriter) {0};
+	if (ctx->openImage) return ctx->openImage(ctx->openImageUdata, writer, path, page, level) || !writer->write;
+	return imgpack_writer_open(writer, path);
+}
+
+static int begin_page_level(struct ImgPackPageOutput *out, int level) {
+	struct ImgPackContext *ctx = out->ctx;
+	const struct ImgPackTextureFormat *format = &imgpack_texture_formats[ctx->colorFormat];
+	int width = imgpack_texture_level_size(ctx->pages[out->page].width, level);
+	int height = imgpack_texture_level_size(ctx->pages[out->page].height, level);
+	char *path = level > 0 ? get_level_path(ctx->pages[out->page].imagePath, level) : ctx->pages[out->page].imagePath;
+	int status = !path;
+	if (!status && out->quantizing) {
+		if (ctx->verbose && level == 0) printf("// Converting to %s with %s dithering\n", color_format_names[ctx->colorFormat], dither_names[ctx->dither]);
+		status = imgpack_quantize_begin(&out->quantizer, format->bits, format->gray, width, ctx->dither);
+	}
+	if (!status && (level == 0 || !out->writingTexture)) {
+		status = open_image_writer(ctx, &out->writer, path, out->page, level);
+	}
+	if (!status && out->writingPng) {
+		if (ctx->verbose && level == 0) printf("// Encoding PNG with %s level and %s filter using %d threads\n", png_level_names[ctx->pngLevel],
+				png_filter_names[ctx->pngFilter], ctx->jobs);
+		status = imgpack_png_begin(&out->png, &out->writer, width, height, out->pngChannels, ctx->pngLevel, ctx->pngFilter, ctx->jobs);
+	} else if (!status && out->writingTexture && level == 0) {
+		if (ctx->verbose) printf("// Encoding %s %s with %s quality using %d threads\n", image_format_names[ctx->imageFormat],
+				color_format_names[ctx->colorFormat], block_quality_names[ctx->blockQuality], ctx->jobs);
+		status = imgpack_texture_begin(&out->texture, &out->writer, ctx->imageFormat == IMGPACK_IMAGE_DDS ? IMGPACK_TEXTURE_DDS : IMGPACK_TEXTURE_KTX2,
+				ctx->colorFormat, width, height, ctx->mipmaps + 1, ctx->blockQuality, ctx->jobs);
+	} else if (!status && !out->writingTexture) {
+		out->writingRaw = 1;
+	}
+	if (ctx->verbose && !status && level > 0 && !out->writingTexture) printf("// Writing mip level %d to \"%s\"\n", level, path);
+	if (level > 0) ISLIP_FREE(path);
+	return status;
+}
+
+// Quantizes, packs and writes next rows of the current level
+static int write_page_rows(struct ImgPackPageOutput *out, unsigned char *data, int width, int y, int rows) {
+	struct ImgPackContext *ctx = out->ctx;
+	if (out->quantizing) {
+		imgpack_quantize_rows(&out->quantizer, data, y, rows);
+		if (out->writingPng) pack_png_channels(data, (size_t)width * rows, out->pngChannels);
+		else imgpack_texture_pack(ctx->colorFormat, data, (size_t)width * rows);
+	}
+	if (out->writingRaw) return imgpack_writer_write(&out->writer, data, (size_t)imgpack_texture_formats[ctx->colorFormat].blockBytes * width * rows);
+	if (out->writingTexture) return imgpack_texture_write_rows(&out->texture, data, rows);
+	return imgpack_png_write_rows(&out->png, data, rows);
+}
+
+// Closes the level, the texture is closed after the last level or on failure
+static int end_page_level(struct ImgPackPageOutput *out, int last) {
+	int status = 0;
+	if (out->writingRaw) status |= imgpack_writer_close(&out->writer);
+	if (out->png.out) status |= imgpack_png_end(&out->png);
+	if (last && out->texture.out) status |= imgpack_texture_end(&out->texture);
+	imgpack_quantize_end(&out->quantizer);
+	out->writingRaw = 0;
+	out->png.out = NULL;
+	if (last) out->texture.out = NULL;
+	// Writer opened but failed before the image writer took it
+	if (last) status |= imgpack_writer_close(&out->writer);
+	// Texture levels go to the same writer, every level counts its own bytes
+	imgpack_stats_add_bytes(out->ctx->stats, 0, (long long)out->writer.written);
+	out->writer.written = 0;
+	return status;
+}
+
+// Mip level is made of every image rect downscaled on its own, so sprites
+// never bleed into each other. Rects are aligned to 2^mipmaps, a rect which
+// doesn't fill whole pixels of the level is extended by its last row and column
+struct ImgPackMipmaps {
+	struct ImgPackContext *ctx;
+	const unsigned char *base;
+	int width;
+	unsigned char *level;
+	int levelWidth;
+	int shift;
+	int *rids;
+	unsigned char *failed;
+};
+
+static void mipmap_rect_task(void *udata, int index) {
+	struct ImgPackMipmaps *mipmaps = udata;
+	struct stbrp_rect rect = mipmaps->ctx->packingRects[mipmaps->rids[index]];
+	int scale = 1 << mipmaps->shift;
+	int w = (rect.w + scale - 1) >> mipmaps->shift, h = (rect.h + scale - 1) >> mipmaps->shift;
+	const unsigned char *input = mipmaps->base + 4 * ((size_t)rect.y * mipmaps->width + rect.x);
+	int input_stride = 4 * mipmaps->width;
+	unsigned char *extended = NULL;
+	if (w * scale != rect.w || h * scale != rect.h) {
+		extended = ISLIP_MALLOC(4 * (size_t)w * scale * h * scale);
+		if (!extended) {
+			mipmaps->failed[index] = 1;
+			return;
+		}
+		for (int y = 0; y < h * scale; y++) {
+			const unsigned char *row = input + (size_t)(y < rect.h ? y : rect.h - 1) * input_stride;
+			unsigned char *dst = extended + 4 * (size_t)y * w * scale;
+			memcpy(dst, row, 4 * (size_t)rect.w);
+			for (int x = rect.w; x < w * scale; x++) memcpy(dst + 4*x, row + 4 * (rect.w - 1), 4);
+		}
+		input = extended;
+		input_stride = 4 * w * scale;
+	}
+	unsigned char *output = mipmaps->level + 4 * ((size_t)(rect.y >> mipmaps->shift) * mipmaps->levelWidth + (rect.x >> mipmaps->shift));
+	mipmaps->failed[index] = !stbir_resize_uint8_generic(input, w * scale, h * scale, input_stride, output, w, h, 4 * mipmaps->levelWidth,
+			4, 3, 0, STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT, STBIR_COLORSPACE_LINEAR, NULL);
+	ISLIP_FREE(extended);
+}
+
+// Downscales every rect of the whole page base to the level and writes it
+static int write_mip_level(struct ImgPackPageOutput *out, const unsigned char *base, int level, int *rids, unsigned char *failed) {
+	struct ImgPackContext *ctx = out->ctx;
+	int width = ctx->pages[out->page].width, height = ctx->pages[out->page].height;
+	int level_width = imgpack_texture_level_size(width, level), level_height = imgpack_texture_level_size(height, level);
+	unsigned char *data = ISLIP_MALLOC(4 * (size_t)level_width * level_height);
+	int count = 0;
+	if (!data) return 1;
+	memset(data, 0, 4 * (size_t)level_width * level_height);
+	for (int i = 0; i < ctx->size; i++) {
+		int rid = ctx->images[i].id;
+		struct stbrp_rect rect = ctx->packingRects[rid];
+		if (rect.w == 0 || rect.h == 0 || ctx->packingPages[rid] != out->page) continue;
+		failed[count] = 0;
+		rids[count++] = rid;
+	}
+	struct ImgPackMipmaps mipmaps = {.ctx = ctx, .base = base, .width = width, .level = data,
+		.levelWidth = level_width, .shift = level, .rids = rids, .failed = failed};
+	struct ImgPackStatsTimer timer = imgpack_stats_begin(ctx->stats, 0);
+	imgpack_parallel_for(ctx->jobs, count, mipmap_rect_task, &mipmaps);
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_COMPOSITE, timer, 0);
+	int status = 0;
+	for (int i = 0; i < count; i++) status |= failed[i];
+	timer = imgpack_stats_begin(ctx->stats, 0);
+	status = status || begin_page_level(out, level);
+	if (!status) status = write_page_rows(out, data, level_width, 0, level_height);
+	status |= end_page_level(out, status || level == ctx->mipmaps);
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_ENCODE, timer, 0);
+	ISLIP_FREE(data);
+	return status;
+}
+
+// Draws rows [band_y, band_y + rows) of the page, ids and failed have room
+// for all images
+static int composite_band(struct ImgPackContext *ctx, int page, unsigned char *output_data, int band_y, int rows,
+		int *ids, unsigned char *failed) {
+	int width = ctx->pages[page].width, count = 0, status = 0;
+	memset(output_data, 0, 4 * (size_t)width * rows);
+	for (int i = 0; i < ctx->size; i++) {
+		int rid = ctx->images[i].id;
+		struct stbrp_rect rect = ctx->packingRects[rid];
+		if (rect.w == 0 || rect.h == 0 || ctx->packingPages[rid] != page ||
+				rect.y >= band_y + rows || rect.y + rect.h <= band_y) {
+			continue;
+		}
+		if (ctx->verbose && rect.y >= band_y) printf("// Drawing %s\n", ctx->images[i].path);
+		failed[count] = 0;
+		ids[count++] = i;
+	}
+	struct ImgPackBlits blits = {.ctx = ctx, .outputData = output_data, .width = width,
+		.bandY = band_y, .bandHeight = rows, .ids = ids, .failed = failed};
+	imgpack_parallel_for(ctx->jobs, count, blit_image_task, &blits);
+	for (int i = 0; i < count; i++) {
+		if (failed[i]) {
+			printf("Cannot decode \"%s\" again\n", ctx->images[ids[i]].path);
+			status = 1;
+		}
+	}
+	return status;
+}
+
+// Composites the page band by band, so only bandHeight rows are in memory,
+// and passes every band to the PNG, texture or raw writer. Bands of block
+// compressed pages are made of whole blocks, bands of reduced precision
+// formats are quantized first. Mip levels need the whole page, they are made
+// from it before the base level is quantized and written
+static int write_atlas_page(struct ImgPackContext *ctx, int page) {
+	int width = ctx->pages[page].width, height = ctx->pages[page].height;
+	const struct ImgPackTextureFormat *format = &imgpack_texture_formats[ctx->colorFormat];
+	int block = format->blockSize;
+	int band_height = ctx->bandHeight > 0 && ctx->bandHeight < height ? (ctx->bandHeight + block - 1) / block * block : height;
+	if (band_height > height || ctx->mipmaps > 0) band_height = height;
+	unsigned char *output_data = ISLIP_MALLOC(4 * (size_t)width * band_height);
+	unsigned char *base = NULL;
+	int *ids = ISLIP_MALLOC(sizeof(*ids) * (ctx->size + 1));
+	unsigned char *failed = ISLIP_MALLOC(ctx->size + 1);
+	struct ImgPackPageOutput out = {
+		.ctx = ctx,
+		.page = page,
+		.writingPng = ctx->imageFormat == IMGPACK_IMAGE_PNG,
+		.writingTexture = ctx->imageFormat == IMGPACK_IMAGE_DDS || ctx->imageFormat == IMGPACK_IMAGE_KTX2,
+		.quantizing = block == 1 && ctx->colorFormat != IMGPACK_RGBA8888,
+		.pngChannels = get_png_channels(ctx->colorFormat),
+	};
+	struct ImgPackStatsTimer timer = imgpack_stats_begin(ctx->stats, 0);
+	int status = !output_data || !ids || !failed || begin_page_level(&out, 0);
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_ENCODE, timer, 0);
+	if (ctx->verbose && !status) printf("// Drawing atlas image to \"%s\" in bands of %d rows\n", ctx->pages[page].imagePath, band_height);
+	for (int band_y = 0; band_y < height && !status; band_y += band_height) {
+		int rows = band_y + band_height < height ? band_height : height - band_y;
+		timer = imgpack_stats_begin(ctx->stats, 0);
+		status = composite_band(ctx, page, output_data, band_y, rows, ids, failed);
+		imgpack_stats_end(ctx->stats, IMGPACK_STAGE_COMPOSITE, timer, 0);
+		if (status) break;
+		if (ctx->mipmaps > 0) {
+			// Writing the base level may quantize and pack pixels in place
+			base = ISLIP_MALLOC(4 * (size_t)width * height);
+			if (!base) {
+				status = 1;
+				break;
+			}
+			memcpy(base, output_data, 4 * (size_t)width * height);
+		}
+		timer = imgpack_stats_begin(ctx->stats, 0);
+		status = write_page_rows(&out, output_data, width, band_y, rows);
+		imgpack_stats_end(ctx->stats, IMGPACK_STAGE_ENCODE, timer, 0);
+	}
+	timer = imgpack_stats_begin(ctx->stats, 0);
+	status |= end_page_level(&out, status || ctx->mipmaps == 0);
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_ENCODE, timer, 0);
+	if (ctx->verbose && !status && ctx->mipmaps > 0) printf("// Making %d mip levels using %d threads\n", ctx->mipmaps, ctx->jobs);
+	for (int level = 1; level <= ctx->mipmaps && !status; level++) {
+		status = write_mip_level(&out, base, level, ids, failed);
+	}
+	ISLIP_FREE(base);
+	ISLIP_FREE(ids);
+	ISLIP_FREE(failed);
+	ISLIP_FREE(output_data);
+	return status;
+}
+
+static int write_atlas_image(struct ImgPackContext *ctx) {
+	for (int page = 0; page < ctx->pagesCount; page++) {
+		if (write_atlas_page(ctx, page)) {
+			printf("Cannot write atlas image \"%s\"\n", ctx->pages[page].imagePath);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void clear_images(struct ImgPackContext *ctx) {
+	for (int i = 0; i < ctx->size; i++) {
+		ISLIP_FREE(ctx->images[i].path);
+		ISLIP_FREE(ctx->images[i].name);
+		ISLIP_FREE(ctx->images[i].ext);
+		stbi_image_free(ctx->images[i].data);
+	}
+	for (int i = 0; i < ctx->pagesCount; i++) {
+		ISLIP_FREE(ctx->pages[i].imagePath);
+	}
+	ISLIP_FREE(ctx->pages);
+	ctx->pages = NULL;
+	ctx->pagesCount = 0;
+	ISLIP_FREE(ctx->packingRects);
+	ISLIP_FREE(ctx->packingPages);
+	ISLIP_FREE(ctx->packingRotated);
+	ctx->packingRotated = NULL;
+	ISLIP_FREE(ctx->images);
+	ctx->packingPages = NULL;
+	ISLIP_FREE(ctx->uniqueSlots);
+	ctx->uniqueSlots = NULL;
+	ctx->uniqueSlotsCount = 0;
+	ctx->uniqueSlotsAllocated = 0;
+	ctx->packingRects = NULL;
+	ctx->images = NULL;
+	ctx->size = 0;
+	ctx->allocated = 0;
+}
+
+static void clear_context(struct ImgPackContext *ctx) {
+	clear_images(ctx);
+	imgpack_cache_free(ctx);
+	imgpack_seed_free(ctx->seed);
+	ctx->seed = NULL;
+	imgpack_stats_free(ctx->stats);
+	ctx->stats = NULL;
+	imgpack_filter_free(ctx->filter);
+	ctx->filter = NULL;
+}
+
+static int parse_scale(struct ImgPackContext *ctx, const char *scale) {
+	char numerator[128];
+	char denominator[128] = "1";
+	int i = 0, j = 0;
+	int num = 1, den = 1;
+	for (j = 0; j < 127 && scale[i] != '/' && scale[i] != '\0'; i++, j++) {
+		numerator[j] = scale[i];
+	}
+	numerator[j] = '\0';
+	if (scale[i] == '\0') {
+		num = strtol(numerator, NULL, 10);
+	} else if (scale[i] == '/') {
+		i++;
+		for (j = 0; j < 127 && scale[i] != '\0'; i++, j++) {
+			denominator[j] = scale[i];
+		}
+		denominator[j] = '\0';
+	}
+	num = strtol(numerator, NULL, 10);
+	den = strtol(denominator, NULL, 10);
+	if (num > 0 && den > 0) {
+		int gcd = 1;
+		for(int k = 1; k <= num && k <= den; k++) {
+			if (num % k == 0 && den % k == 0) {
+				gcd = k;
+			}
+    }
+		ctx->scaleNumerator = num / gcd;
+		ctx->scaleDenominator = den / gcd;
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+static int compare_images(const void *a, const void *b) {
+	return strcmp(((struct ImgPackImage *)a)->path, ((struct ImgPackImage *)b)->path);
+}
+
+static void sort_images(struct ImgPackContext *ctx) {
+	qsort(ctx->images, ctx->size, sizeof(struct ImgPackImage), compare_images);
+}
+
+// Library interface, see imgpack.h
+
+struct ImgPackContext *imgpack_create(void) {
+	struct ImgPackContext *ctx = ISLIP_MALLOC(sizeof(*ctx));
+	struct ImgPackInputs *inputs = ISLIP_MALLOC(sizeof(*inputs));
+	if (!ctx || !inputs) {
+		ISLIP_FREE(ctx);
+		ISLIP_FREE(inputs);
+		return NULL;
+	}
+	*ctx = (struct ImgPackContext) {
+		.scaleNumerator = 1,
+		.scaleDenominator = 1,
+		.sideGrowCoefficient = 1.2,
+		.trimThreshold = -1,
+		.jobs = 1,
+		.repackThreshold = 0.25,
+		.inputs = inputs,
+	};
+	*inputs = (struct ImgPackInputs) {.ctx = ctx};
+	return ctx;
+}
+
+void imgpack_destroy(struct ImgPackContext *ctx) {
+	if (!ctx) return;
+	clear_context(ctx);
+	for (int i = 0; i < ctx->inputs->size; i++) {
+		free_image_input(&ctx->inputs->items[i]);
+	}
+	ISLIP_FREE(ctx->inputs->items);
+	ISLIP_FREE(ctx->inputs);
+	for (int i = 0; i < ctx->argc; i++) {
+		ISLIP_FREE(ctx->argv[i]);
+	}
+	ISLIP_FREE(ctx->argv);
+	ISLIP_FREE(ctx);
+}
+
+// Options of the context point into argv. Help is printed for the only
+// argument and for --help, nothing else is done then
+static int parse_arguments(struct ImgPackContext *ctx, int argc, char *argv[]) {
+	char *format_data = "C";
+	char *format_color = "RGBA8888";
+	char *scale = "1";
+	char *naming = "NAME_WITH_EXT";
+	char *packer = "SKYLINE_BL";
+	char *sort_order = NULL;
+	char *cache_dir = NULL;
+	char *seed_path = NULL;
+	char *stats_path = NULL;
+	char *include = NULL;
+	char *exclude = NULL;
+	char *extensions = NULL;
+	char *image_format = NULL;
+	char *block_quality = "DEFAULT";
+	char *dither = "NONE";
+	char *png_level = "DEFAULT";
+	char *png_filter = "ADAPTIVE";
+	IA_BEGIN(argc, argv, "--help", "-?", "ImgPack texture packer v0.8\n"
+		"Copyright 2019 Ilya Kolbin <iskolbin@gmail.com>\n\n"
+		"Usage : imgpack <OPTIONS> <images folder>\n\n"
+		"| Key          |    | Value   | Description\n"
+		"|--------------|----|---------|----------------------------------------------\n"
+		"| --data       | -d | string  | output file path, if ommited `stdout` is used\n"
+		"| --image      | -i | string  | output image path (NEEDED)\n"
+		"| --name       | -n | string  | name\n"
+		"| --format     | -f | string  | output atlas data format (CSV, JSON_HASH, JSON_ARRAY, RAYLIB, BINARY)\n"
+		"| --naming     | -N | string  | frames naming for JSON_HASH/ARRAY: FULL_PATH, NAME_NO_EXT, NAME_WITH_EXT(default)\n"
+		"| --trim       | -t | int     | alpha threshold for trimming image with transparent border, should be 0-255\n"
+		"| --padding    | -p | int     | adds transparent padding\n"
+		"| --exturde    | -e | int     | adds copied pixels on image borders, which helps with texture bleeding\n"
+		"| --max-width  | -w | int     | maximum atlas width, without it sides over 8192 are used only when images don't fit\n"
+		"| --max-height | -h | int     | maximum atlas height, without it sides over 8192 are used only when images don't fit\n"
+		"| --scale      | -x | int/int | scaling ratio int form \"A/B\" or just \"K\"\n"
+		"| --color      | -c | string  | color format: RGBA8888(default), RGBA4444, RGB565, RGBA5551, A8, L8, BC1, BC3, BC7 for DDS or KTX2, ETC2_RGB, ETC2_RGBA for KTX2\n"
+		"| --dither     | -D | string  | dithering for RGBA4444, RGB565, RGBA5551: NONE(default), ORDERED, FLOYD_STEINBERG\n"
+		"| --mipmaps    | -l | int     | number of mip levels below the base one, rects are aligned to 2^N pixels (default 0)\n"
+		"| --unique     | -u |         | remove identical images (after trimming)\n"
+		"| --force-pot  | -2 |         | force power of two texture output\n"
+		"| --force-squared | -sq |      | force square texture output\n"
+		"| --sort       | -s |         | sorting by path name (ascending)\n"
+		"| --jobs       | -j | int     | number of threads for decoding, packing and drawing, 0 means number of CPUs (default 1)\n"
+		"| --multipack  | -m |         | split images into several pages limited by max width and height, both are required\n"
+		"| --allow-rotation | -r |      | allow images to be rotated 90 degrees clockwise for tighter packing\n"
+		"| --packer     | -P | string  | packing algorithm: SKYLINE_BL(default), SKYLINE_BF, MAXRECTS_BSSF, MAXRECTS_BAF, MAXRECTS_BL, MAXRECTS_CP, GUILLOTINE, SHELF\n"
+		"| --pack-sort  | -S | string  | order of packing: AREA, PERIMETER, MAX_SIDE, HEIGHT, WIDTH (default depends on packer, ignored by SKYLINE)\n"
+		"| --pack-effort | -E | int    | 0 uses selected packer, 1 tries all packers, 2 tries all packers with all orders; variants run on --jobs threads\n"
+		"| --cache-dir  | -C | string  | directory for incremental build cache, unchanged inputs are not decoded again\n"
+		"| --seed       | -L | string  | previous JSON_HASH, JSON_ARRAY or CSV data, unchanged frames keep their places\n"
+		"| --repack-threshold | -R | float | repack fully if seeded layout is bigger than full repack by this fraction (default 0.25)\n"
+		"| --low-memory | -M |         | keep only sizes after the first pass, decode images again while drawing the atlas\n"
+		"| --watch      | -W |         | keep running and repack when images change, only changed outputs are rewritten (needs --data)\n"
+		"| --manifest   | -B | string  | build every atlas listed in the file in one process on --jobs threads, other options are defaults for its jobs\n"
+		"| --stats      | -T | string  | write JSON report with time and CPU time of every stage, peak memory, bytes read and written and atlas occupancy\n"
+		"| --include    | -G | string  | comma separated globs of files to pack, * and ? match inside of a name, ** any directories, globs without / match names\n"
+		"| --exclude    | -X | string  | comma separated globs of files and directories to skip, matched like --include\n"
+		"| --extensions | -A | string  | comma separated extensions of files to decode, ALL for any (default " IMGPACK_FILTER_DEFAULT_EXTENSIONS ")\n"
+		"| --image-format | -I | string | atlas image format: PNG, RAW for headerless rows of packed pixels, DDS, KTX2 (default by --image extension, PNG otherwise)\n"
+		"| --band-height | -b | int    | composite and encode atlas by bands of this many rows to limit memory, 0 is whole page (default)\n"
+		"| --block-quality | -Q | string | block compression quality: FAST, DEFAULT(default), MAX; blocks are compressed on --jobs threads\n"
+		"| --png-level  | -Z | string  | PNG compression: FAST, DEFAULT(default), MAX; strips are compressed on --jobs threads\n"
+		"| --png-filter | -F | string  | PNG row filter: ADAPTIVE(default) picks per row, or fixed NONE, SUB, UP, AVERAGE, PAETH\n"
+		"| --verbose    | -v |         | print debug messages during the packing process\n"
+		"| --help       | -? |         | prints this memo\n\n")
+		IA_STR("--data", "-d", ctx->outputDataPath)
+		IA_STR("--image", "-i", ctx->outputImagePath)
+		IA_STR("--name", "-n", ctx->name)
+		IA_STR("--format", "-f", format_data)
+		IA_STR("--naming", "-N", naming)
+		IA_INT("--trim", "-t", ctx->trimThreshold)
+		IA_INT("--padding", "-p", ctx->padding)
+		IA_INT("--extrude", "-e", ctx->extrude)
+		IA_INT("--max-width", "-w", ctx->maxWidth)
+		IA_INT("--max-height", "-h", ctx->maxHeight)
+		IA_STR("--scale", "-x", scale)
+		IA_STR("--color", "-c", format_color)
+		IA_FLAG("--unique", "-u", ctx->unique)
+		IA_FLAG("--force-pot", "-2", ctx->forcePOT)
+		IA_FLAG("--sort", "-s", ctx->sortImages)
+		IA_INT("--jobs", "-j", ctx->jobs)
+		IA_FLAG("--multipack", "-m", ctx->allowMultipack)
+		IA_FLAG("--allow-rotation", "-r", ctx->allowRotation)
+		IA_STR("--packer", "-P", packer)
+		IA_STR("--pack-sort", "-S", sort_order)
+		IA_INT("--pack-effort", "-E", ctx->packEffort)
+		IA_STR("--cache-dir", "-C", cache_dir)
+		IA_STR("--seed", "-L", seed_path)
+		IA_FLOAT("--repack-threshold", "-R", ctx->repackThreshold)
+		IA_FLAG("--low-memory", "-M", ctx->lowMemory)
+		IA_FLAG("--watch", "-W", ctx->watch)
+		IA_STR("--manifest", "-B", ctx->manifestPath)
+		IA_STR("--stats", "-T", stats_path)
+		IA_STR("--include", "-G", include)
+		IA_STR("--exclude", "-X", exclude)
+		IA_STR("--extensions", "-A", extensions)
+		IA_STR("--image-format", "-I", image_format)
+		IA_INT("--band-height", "-b", ctx->bandHeight)
+		IA_STR("--block-quality", "-Q", block_quality)
+		IA_STR("--dither", "-D", dither)
+		IA_INT("--mipmaps", "-l", ctx->mipmaps)
+		IA_STR("--png-level", "-Z", png_level)
+		IA_STR("--png-filter", "-F", png_filter)
+		IA_FLAG("--verbose", "-v", ctx->verbose)
+		IA_FLAG("--force-squared", "-sq", ctx->forceSquared)
+	IA_END
+
+	// Options of manifest jobs are checked when the jobs are configured, only
+	// the size of the pool is needed
+	if (ctx->manifestPath) {
+		if (ctx->jobs <= 0) ctx->jobs = imgpack_cpu_count();
+		if (ctx->verbose) printf("// Using %d threads for manifest jobs\n", ctx->jobs);
+		return 0;
+	}
+
+	if (!ctx->outputImagePath) {
+		printf("Specify output image path using --image/-i <image path>");
+		return 1;
+	}
+
+	if (!parse_data_format(ctx, format_data)) {
+		if (ctx->verbose) printf("// Using data format %s\n", format_data);
+	} else {
+		printf("Bad data format \"%s\"\n", format_data);
+		return 1;
+	}
+
+	if (!parse_data_color(ctx, format_color)) {
+		if (ctx->verbose) printf("// Using color format %s\n", format_color);
+	} else {
+		printf("Bad color format \"%s\"\n", format_color);
+		return 1;
+	}
+
+	if (!parse_packer(ctx, packer)) {
+		if (ctx->verbose) printf("// Using packer %s\n", packer);
+	} else {
+		printf("Bad packer \"%s\"\n", packer);
+		return 1;
+	}
+
+	if (!sort_order || !parse_sort_order(ctx, sort_order)) {
+		if (ctx->verbose) printf("// Using packing order %s\n", sort_order_names[ctx->sortOrder]);
+	} else {
+		printf("Bad packing order \"%s\"\n", sort_order);
+		return 1;
+	}
+
+	if (!image_format) image_format = (char *)guess_image_format(ctx->outputImagePath);
+	if (!parse_image_format(ctx, image_format)) {
+		if (ctx->verbose) printf("// Using image format %s\n", image_format);
+	} else {
+		printf("Bad image format \"%s\"\n", image_format);
+		return 1;
+	}
+
+	if (imgpack_texture_formats[ctx->colorFormat].blockSize > 1 && ctx->imageFormat != IMGPACK_IMAGE_DDS && ctx->imageFormat != IMGPACK_IMAGE_KTX2) {
+		printf("Color format %s needs DDS or KTX2 image format\n", format_color);
+		return 1;
+	}
+	if (ctx->imageFormat == IMGPACK_IMAGE_DDS && !imgpack_texture_supported(IMGPACK_TEXTURE_DDS, ctx->colorFormat)) {
+		printf("Color format %s can't be written to DDS, use KTX2\n", format_color);
+		return 1;
+	}
+
+	if (!parse_block_quality(ctx, block_quality)) {
+		if (ctx->verbose) printf("// Using block compression quality %s\n", block_quality);
+	} else {
+		printf("Bad block compression quality \"%s\"\n", block_quality);
+		return 1;
+	}
+
+	if (ctx->mipmaps < 0 || ctx->mipmaps >= IMGPACK_TEXTURE_MAX_LEVELS) {
+		printf("Bad number of mip levels %d, should be 0-%d\n", ctx->mipmaps, IMGPACK_TEXTURE_MAX_LEVELS - 1);
+		return 1;
+	}
+	if (ctx->verbose && ctx->mipmaps > 0) printf("// Using %d mip levels\n", ctx->mipmaps);
+
+	if (!parse_dither(ctx, dither)) {
+		if (ctx->verbose) printf("// Using dithering %s\n", dither);
+	} else {
+		printf("Bad dithering \"%s\"\n", dither);
+		return 1;
+	}
+
+	if (!parse_png_level(ctx, png_level)) {
+		if (ctx->verbose) printf("// Using PNG level %s\n", png_level);
+	} else {
+		printf("Bad PNG level \"%s\"\n", png_level);
+		return 1;
+	}
+
+	if (!parse_png_filter(ctx, png_filter)) {
+		if (ctx->verbose) printf("// Using PNG filter %s\n", png_filter);
+	} else {
+		printf("Bad PNG filter \"%s\"\n", png_filter);
+		return 1;
+	}
+
+	if (!parse_naming(ctx, naming)) {
+		if (ctx->verbose) printf("// Using naming %s\n", naming);
+	} else {
+		printf("Bad naming \"%s\"\n", naming);
+		return 1;
+	}
+
+	if (!parse_scale(ctx, scale)) {
+		if (ctx->verbose) printf("// Set scaling to %d/%d\n", ctx->scaleNumerator, ctx->scaleDenominator);
+	} else {
+		printf("Bad scale \"%s\"\n", scale);
+		return 1;
+	}
+
+	if (ctx->maxWidth > 0 || ctx->maxHeight > 0) {
+		if (ctx->verbose) printf("// Size constraints: %d x %d\n", ctx->maxWidth, ctx->maxHeight);
+	}
+	if (ctx->allowMultipack && (ctx->maxWidth <= 0 || ctx->maxHeight <= 0)) {
+		printf("--multipack needs both --max-width and --max-height\n");
+		return 1;
+	}
+
+	if (ctx->jobs <= 0) {
+		ctx->jobs = imgpack_cpu_count();
+	}
+	if (ctx->verbose) printf("// Using %d threads\n", ctx->jobs);
+	if (ctx->verbose && ctx->lowMemory) printf("// Low memory mode, images are decoded twice\n");
+
+	ctx->filter = imgpack_filter_create(include, exclude, extensions);
+	if (!ctx->filter) return 1;
+	if (ctx->verbose) {
+		if (include) printf("// Including %s\n", include);
+		if (exclude) printf("// Excluding %s\n", exclude);
+		printf("// Decoding files with extensions %s\n", extensions ? extensions : IMGPACK_FILTER_DEFAULT_EXTENSIONS);
+	}
+
+	if (stats_path) {
+		ctx->stats = imgpack_stats_create(stats_path);
+		if (!ctx->stats) return 1;
+		if (ctx->verbose) printf("// Writing stats to \"%s\"\n", stats_path);
+	}
+
+	if (cache_dir && imgpack_cache_open(ctx, cache_dir)) return 1;
+
+	if (seed_path && get_pack_unit(ctx) > 1) {
+		printf("Seeded layout is not supported for block compressed color formats and mipmaps, packing from scratch\n");
+	} else if (seed_path) {
+		ctx->seed = imgpack_seed_load(seed_path);
+		if (ctx->seed) {
+			if (ctx->verbose) printf("// Loaded %d seed frames from \"%s\"\n", ctx->seed->framesCount, seed_path);
+		} else {
+			// The first run has no previous data yet
+			if (ctx->verbose) printf("// Cannot read seed data \"%s\", packing from scratch\n", seed_path);
+		}
+	}
+	return 0;
+}
+
+int imgpack_configure(struct ImgPackContext *ctx, int argc, char *argv[]) {
+	if (ctx->argv) {
+		printf("Context is configured already\n");
+		return 1;
+	}
+	ctx->argv = ISLIP_MALLOC(sizeof(*ctx->argv) * (argc + 1));
+	if (!ctx->argv) return 1;
+	for (int i = 0; i < argc; i++) {
+		ctx->argv[i] = copy_string(argv[i]);
+	}
+	ctx->argv[argc] = NULL;
+	ctx->argc = argc;
+	return parse_arguments(ctx, argc, ctx->argv);
+}
+
+int imgpack_add_directory(struct ImgPackContext *ctx, const char *path) {
+	if (!cf_file_exists(path)) {
+		printf("Cannot open images folder \"%s\"\n", path);
+		return 1;
+	}
+	struct ImgPackStatsTimer timer = imgpack_stats_begin(ctx->stats, 0);
+	collect_images_paths(ctx->inputs, path, path);
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_SCAN, timer, 0);
+	return 0;
+}
+
+int imgpack_add_memory(struct ImgPackContext *ctx, const char *path, const void *data, size_t size) {
+	unsigned char *memory = ISLIP_MALLOC(size > 0 ? size : 1);
+	if (ctx->cache || !memory || size > INT_MAX) {
+		if (ctx->cache) printf("Cannot cache \"%s\" added from memory\n", path);
+		ISLIP_FREE(memory);
+		return 1;
+	}
+	memcpy(memory, data, size);
+	struct ImgPackInput *input = push_memory_input(ctx->inputs, path);
+	input->memory = memory;
+	input->memorySize = size;
+	return 0;
+}
+
+int imgpack_add_rgba(struct ImgPackContext *ctx, const char *path, const unsigned char *pixels, int width, int height, int stride) {
+	if (stride == 0) stride = 4 * width;
+	stbi_uc *data = width > 0 && height > 0 ? ISLIP_MALLOC(4 * (size_t)width * height) : NULL;
+	if (ctx->cache || !data) {
+		if (ctx->cache) printf("Cannot cache \"%s\" added from memory\n", path);
+		ISLIP_FREE(data);
+		return 1;
+	}
+	for (int y = 0; y < height; y++) {
+		memcpy(data + 4 * (size_t)y * width, pixels + (size_t)y * stride, 4 * (size_t)width);
+	}
+	struct ImgPackInput *input = push_memory_input(ctx->inputs, path);
+	input->data = data;
+	input->originalWidth = width;
+	input->originalHeight = height;
+	return 0;
+}
+
+int imgpack_prepare(struct ImgPackContext *ctx) {
+	prepare_images_data(ctx);
+	return 0;
+}
+
+int imgpack_is_up_to_date(struct ImgPackContext *ctx) {
+	return ctx->cache && ctx->cache->upToDate;
+}
+
+int imgpack_pack(struct ImgPackContext *ctx) {
+	struct ImgPackStatsTimer timer = imgpack_stats_begin(ctx->stats, 0);
+	int status = ctx->seed ? pack_seeded_images(ctx) : pack_images(ctx);
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_PACK, timer, 0);
+	if (status) {
+		printf("Cannot pack images\n");
+		return 1;
+	}
+	if (ctx->verbose) printf("// Images have been packed\n");
+	if (ctx->sortImages) {
+		if (ctx->verbose) printf("// Sorting images\n");
+		sort_images(ctx);
+	}
+	return 0;
+}
+
+int imgpack_get_pages_count(struct ImgPackContext *ctx) {
+	return ctx->pagesCount;
+}
+
+int imgpack_get_page_size(struct ImgPackContext *ctx, int page, int *width, int *height) {
+	if (page < 0 || page >= ctx->pagesCount) return 1;
+	*width = ctx->pages[page].width;
+	*height = ctx->pages[page].height;
+	return 0;
+}
+
+int imgpack_composite(struct ImgPackContext *ctx, int page, int y, int rows, unsigned char *rgba) {
+	if (page < 0 || page >= ctx->pagesCount || y < 0 || rows <= 0 || y + rows > ctx->pages[page].height) return 1;
+	int *ids = ISLIP_MALLOC(sizeof(*ids) * (ctx->size + 1));
+	unsigned char *failed = ISLIP_MALLOC(ctx->size + 1);
+	struct ImgPackStatsTimer timer = imgpack_stats_begin(ctx->stats, 0);
+	int status = !ids || !failed || composite_band(ctx, page, rgba, y, rows, ids, failed);
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_COMPOSITE, timer, 0);
+	ISLIP_FREE(ids);
+	ISLIP_FREE(failed);
+	return status;
+}
+
+int imgpack_write_data(struct ImgPackContext *ctx, struct ImgPackWriter *writer) {
+	struct ImgPackStatsTimer timer = imgpack_stats_begin(ctx->stats, 0);
+	int status = ctx->formatter(ctx, writer);
+	status = imgpack_writer_close(writer) || status;
+	imgpack_stats_end(ctx->stats, IMGPACK_STAGE_FORMAT, timer, 0);
+	imgpack_stats_add_bytes(ctx->stats, 0, (long long)writer->written);
+	return status;
+}
+
+void imgpack_set_image_writer(struct ImgPackContext *ctx, ImgPackOpenImage open_image, void *udata) {
+	ctx->openImage = open_image;
+	ctx->openImageUdata = udata;
+}
+
+// Cache is saved and stats are reported once the atlas is written
+int imgpack_write_images(struct ImgPackContext *ctx) {
+	if (write_atlas_image(ctx)) return 1;
+	if (ctx->cache && imgpack_cache_save(ctx)) printf("Cannot save cache to \"%s\"\n", ctx->cache->dir);
+	return imgpack_stats_save(ctx);
+}
+
+void imgpack_buffer_writer(struct ImgPackBuffer *buffer, struct ImgPackWriter *writer) {
+	imgpack_writer_buffer(writer, buffer);
+}
+
+void imgpack_buffer_free(struct ImgPackBuffer *buffer) {
+	ISLIP_FREE(buffer->data);
+	*buffer = (struct ImgPackBuffer) {0};
+}
+
+#ifndef IMGPACK_NO_MAIN
+static int write_atlas_data(struct ImgPackContext *ctx) {
+	struct ImgPackWriter writer;
+	if (!ctx->outputDataPath) {
+		imgpack_writer_file(&writer, stdout);
+	} else if (imgpack_writer_open(&writer, ctx->outputDataPath)) {
+		printf("// Cannot open for writing \"%s\"", ctx->outputDataPath);
+		return 1;
+	}
+	if (ctx->verbose) printf("// Writing description data to \"%s\"\n", ctx->outputDataPath ? ctx->outputDataPath : "stdout");
+	int status = imgpack_write_data(ctx, &writer);
+	if (ctx->verbose) printf("// Written\n");
+	return status;
+}
+
+// Watch mode keeps decoded files in memory and on every change decodes only
+// touched files, repacks seeded with the previous layout and rewrites only the
+// outputs which differ. Images of the context borrow strings and pixels of the
+// files, so the context is rebuilt without decoding anything else
+
+enum {
+	IMGPACK_WATCH_KEPT,
+	IMGPACK_WATCH_CHANGED,
+	IMGPACK_WATCH_REMOVED,
+};
+
+struct ImgPackWatchFile {
+	struct ImgPackInput input;
+	int state;
+	int seen;
+};
+
+struct ImgPackWatch {
+	struct ImgPackContext *ctx;
+	struct ImgPackWatchFile *files;
+	int filesCount;
+	int filesAllocated;
+	struct ImgPackUniqueSlot *slots;
+	int slotsAllocated;
+	int *decoded;
+	int packed;
+	uint64_t *pageKeys;
+	int pageKeysCount;
+	struct ImgPackBuffer data;
+	struct ImgPackBuffer nextData;
+};
+
+static void index_watch_file(struct ImgPackWatch *watch, int index) {
+	uint64_t key = imgpack_hash(watch->files[index].input.path, strlen(watch->files[index].input.path), 0);
+	uint64_t mask = watch->slotsAllocated - 1, j = key & mask;
+	while (watch->slots[j].id >= 0) j = (j + 1) & mask;
+	watch->slots[j] = (struct ImgPackUniqueSlot) {.key = key, .id = index};
+}
+
+static void index_watch_files(struct ImgPackWatch *watch) {
+	if (watch->slotsAllocated < 64) watch->slotsAllocated = 64;
+	while (watch->slotsAllocated < 2 * watch->filesAllocated) watch->slotsAllocated *= 2;
+	ISLIP_FREE(watch->slots);
+	watch->slots = ISLIP_MALLOC(watch->slotsAllocated * sizeof(*watch->slots));
+	for (int i = 0; i < watch->slotsAllocated; i++) watch->slots[i].id = -1;
+	for (int i = 0; i < watch->filesCount; i++) index_watch_file(watch, i);
+}
+
+static int find_watch_file(struct ImgPackWatch *watch, const char *path) {
+	if (!watch->slots) return -1;
+	uint64_t key = imgpack_hash(path, strlen(path), 0), mask = watch->slotsAllocated - 1;
+	for (uint64_t j = key & mask; watch->slots[j].id >= 0; j = (j + 1) & mask) {
+		if (watch->slots[j].key == key && !strcmp(watch->files[watch->slots[j].id].input.path, path)) return watch->slots[j].id;
+	}
+	return -1;
+}
+
+// Marks the file changed if it's new or its mtime or size differ, files
+// reported by the watcher are decoded again anyway
+static void touch_watch_file(struct ImgPackWatch *watch, const char *path, const char *name, const char *ext, int force) {
+	int64_t mtime, size;
+	if (imgpack_watch_stat(path, &mtime, &size) != 0) return;
+	int i = find_watch_file(watch, path);
+	if (i < 0) {
+		if (watch->filesCount >= watch->filesAllocated) {
+			watch->filesAllocated = watch->filesAllocated ? 2 * watch->filesAllocated : 64;
+			watch->files = ISLIP_REALLOC(watch->files, watch->filesAllocated * sizeof(*watch->files));
+			watch->decoded = ISLIP_REALLOC(watch->decoded, watch->filesAllocated * sizeof(*watch->decoded));
+		}
+		i = watch->filesCount++;
+		watch->files[i] = (struct ImgPackWatchFile) {.input = make_image_input(path, name, ext)};
+		if (2 * watch->filesAllocated > watch->slotsAllocated) index_watch_files(watch);
+		else index_watch_file(watch, i);
+	} else if (!force && watch->files[i].state != IMGPACK_WATCH_REMOVED &&
+			watch->files[i].input.mtime == mtime && watch->files[i].input.fileSize == size) {
+		watch->files[i].seen = 1;
+		return;
+	}
+	struct ImgPackWatchFile *file = &watch->files[i];
+	file->state = IMGPACK_WATCH_CHANGED;
+	file->seen = 1;
+	file->input.mtime = mtime;
+	file->input.fileSize = size;
+}
+
+// Scans the directory like the images folder is scanned
+static void scan_watch_tree(struct ImgPackWatch *watch, const char *root, const char *path) {
+	struct ImgPackInputs found = {.ctx = watch->ctx};
+	collect_images_paths(&found, root, path);
+	for (int i = 0; i < found.size; i++) {
+		struct ImgPackInput *input = &found.items[i];
+		const char *ext, *name = get_path_name(input->path, &ext);
+		touch_watch_file(watch, input->path, name, ext, 0);
+		free_image_input(input);
+	}
+	ISLIP_FREE(found.items);
+}
+
+// Removes the file or all files of the directory
+static void remove_watch_files(struct ImgPackWatch *watch, const char *path) {
+	size_t length = strlen(path);
+	for (int i = 0; i < watch->filesCount; i++) {
+		const char *file_path = watch->files[i].input.path;
+		if (!strncmp(file_path, path, length) && (file_path[length] == '\0' || file_path[length] == '/')) {
+			watch->files[i].state = IMGPACK_WATCH_REMOVED;
+		}
+	}
+}
+
+// Returns non-zero if some files were touched
+static int collect_watch_changes(struct ImgPackWatch *watch, struct ImgPackWatcher *watcher, const char *root) {
+	if (watcher->rescan) {
+		for (int i = 0; i < watch->filesCount; i++) watch->files[i].seen = 0;
+		scan_watch_tree(watch, root, root);
+		for (int i = 0; i < watch->filesCount; i++) {
+			if (!watch->files[i].seen) watch->files[i].state = IMGPACK_WATCH_REMOVED;
+		}
+	}
+	for (int i = 0; i < watcher->pathsCount && !watcher->rescan; i++) {
+		const char *path = watcher->paths[i], *ext, *name = get_path_name(path, &ext);
+		const char *relative_path = path + strlen(root);
+		while (*relative_path == '/') relative_path++;
+		int64_t mtime, size;
+		int kind = imgpack_watch_stat(path, &mtime, &size);
+		if (kind < 0) remove_watch_files(watch, path);
+		else if (!imgpack_filter_path(watch->ctx->filter, relative_path, kind > 0)) continue;
+		else if (kind > 0) scan_watch_tree(watch, root, path);
+		else touch_watch_file(watch, path, name, ext, 1);
+	}
+	for (int i = 0; i < watch->filesCount; i++) {
+		if (watch->files[i].state != IMGPACK_WATCH_KEPT) return 1;
+	}
+	return 0;
+}
+
+static void decode_watch_file(void *udata, int index) {
+	struct ImgPackWatch *watch = udata;
+	int i = watch->decoded[index];
+	decode_image_data(watch->ctx, &watch->files[i].input, i);
+}
+
+// Forgets images of the context without freeing what they borrow
+static void detach_images(struct ImgPackContext *ctx) {
+	for (int i = 0; i < ctx->size; i++) {
+		ctx->images[i].path = ctx->images[i].name = ctx->images[i].ext = NULL;
+		ctx->images[i].data = NULL;
+	}
+	clear_images(ctx);
+}
+
+// Drops removed files, decodes changed ones on --jobs threads and adds all
+// decoded files to the context in the order they were found
+static void update_watch_images(struct ImgPackWatch *watch, int *decoded_count, int *removed_count) {
+	struct ImgPackContext *ctx = watch->ctx;
+	int count = 0;
+	*decoded_count = *removed_count = 0;
+	for (int i = 0; i < watch->filesCount; i++) {
+		struct ImgPackWatchFile file = watch->files[i];
+		if (file.state == IMGPACK_WATCH_REMOVED) {
+			free_image_input(&file.input);
+			(*removed_count)++;
+			continue;
+		}
+		if (file.state == IMGPACK_WATCH_CHANGED) {
+			stbi_image_free(file.input.data);
+			struct ImgPackInput input = file.input;
+			file.input = (struct ImgPackInput) {.path = input.path, .name = input.name, .ext = input.ext,
+				.mtime = input.mtime, .fileSize = input.fileSize, .cacheEntry = -1};
+			watch->decoded[(*decoded_count)++] = count;
+		}
+		file.state = IMGPACK_WATCH_KEPT;
+		watch->files[count++] = file;
+	}
+	watch->filesCount = count;
+	if (*removed_count > 0) index_watch_files(watch);
+	imgpack_parallel_for(ctx->jobs, *decoded_count, decode_watch_file, watch);
+	for (int i = 0; i < watch->filesCount; i++) {
+		if (watch->files[i].input.width > 0) add_image_data(ctx, &watch->files[i].input);
+	}
+}
+
+// Fingerprint of everything drawn on the page
+static uint64_t get_page_key(struct ImgPackContext *ctx, int page) {
+	uint64_t key = imgpack_hash(&ctx->pages[page].width, sizeof(int), ctx->pages[page].height);
+	for (int i = 0; i < ctx->size; i++) {
+		const struct ImgPackImage *image = &ctx->images[i];
+		if (image->copyOf >= 0 || ctx->packingPages[image->id] != page) continue;
+		const stbrp_rect *rect = &ctx->packingRects[image->id];
+		int fields[] = {rect->x, rect->y, rect->w, rect->h, ctx->packingRotated[image->id],
+			image->source.x, image->source.y, image->source.w, image->source.h};
+		// Sum doesn't depend on the order of images
+		key += imgpack_hash(fields, sizeof(fields), image->hash);
+	}
+	return key;
+}
+
+static int open_watch_image(void *udata, struct ImgPackWriter *writer, const char *path, int page, int level) {
+	(void)udata;
+	(void)page;
+	(void)level;
+	return imgpack_watch_open_output(writer, path);
+}
+
+// Returns the number of written pages or -1 on failure, failed pages are
+// tried again on the next change
+static int write_watch_pages(struct ImgPackWatch *watch) {
+	struct ImgPackContext *ctx = watch->ctx;
+	int written = 0, status = 0;
+	uint64_t *keys = ISLIP_MALLOC((ctx->pagesCount + 1) * sizeof(*keys));
+	if (!keys) return -1;
+	for (int page = 0; page < ctx->pagesCount; page++) {
+		keys[page] = get_page_key(ctx, page);
+		if (page < watch->pageKeysCount && watch->pageKeys[page] == keys[page] && cf_file_exists(ctx->pages[page].imagePath)) continue;
+		if (write_atlas_page(ctx, page)) {
+			printf("Cannot write atlas image \"%s\"\n", ctx->pages[page].imagePath);
+			keys[page] = 0;
+			status = -1;
+		} else {
+			written++;
+		}
+	}
+	ISLIP_FREE(watch->pageKeys);
+	watch->pageKeys = keys;
+	watch->pageKeysCount = ctx->pagesCount;
+	return status ? status : written;
+}
+
+// Returns 1 if the data changed and was written, 0 if it's the same and -1 on failure
+static int write_watch_data(struct ImgPackWatch *watch) {
+	struct ImgPackContext *ctx = watch->ctx;
+	struct ImgPackWriter writer;
+	imgpack_buffer_writer(&watch->nextData, &writer);
+	if (imgpack_write_data(ctx, &writer)) return -1;
+	if (watch->data.size > 0 && watch->nextData.size == watch->data.size && !memcmp(watch->nextData.data, watch->data.data, watch->data.size) &&
+			cf_file_exists(ctx->outputDataPath)) {
+		return 0;
+	}
+	if (imgpack_watch_open_output(&writer, ctx->outputDataPath)) {
+		printf("Cannot open for writing \"%s\"\n", ctx->outputDataPath);
+		return -1;
+	}
+	imgpack_writer_write(&writer, watch->nextData.data, watch->nextData.size);
+	if (imgpack_writer_close(&writer)) {
+		printf("Cannot write data \"%s\"\n", ctx->outputDataPath);
+		return -1;
+	}
+	struct ImgPackBuffer data = watch->data;
+	watch->data = watch->nextData;
+	watch->nextData = data;
+	return 1;
+}
+
+// Returns non-zero if the atlas could not be updated, the reason is printed
+static int repack_watch(struct ImgPackWatch *watch, const char *path) {
+	struct ImgPackContext *ctx = watch->ctx;
+	long long start = imgpack_watch_time_ms();
+	int decoded, removed;
+	imgpack_stats_reset(ctx->stats);
+	if (watch->packed && get_pack_unit(ctx) == 1) {
+		imgpack_seed_free(ctx->seed);
+		ctx->seed = imgpack_seed_from_layout(ctx);
+	}
+	detach_images(ctx);
+	update_watch_images(watch, &decoded, &removed);
+	watch->packed = 0;
+	if (ctx->size == 0) {
+		printf("No images in \"%s\"\n", path);
+		return 1;
+	}
+	if (imgpack_pack(ctx)) return 1;
+	if (!ctx->seed || ctx->repackArea == 0) ctx->repackArea = get_pages_area(ctx);
+	watch->packed = 1;
+	int data_written = write_watch_data(watch), pages_written = write_watch_pages(watch);
+	if (data_written < 0 || pages_written < 0 || imgpack_stats_save(ctx)) return 1;
+	printf("Repacked %d images in %lld ms: %d decoded, %d removed, %d of %d pages%s written\n", ctx->size,
+			imgpack_watch_time_ms() - start, decoded, removed, pages_written, ctx->pagesCount, data_written ? " and data" : "");
+	return 0;
+}
+
+static void free_watch(struct ImgPackWatch *watch) {
+	detach_images(watch->ctx);
+	for (int i = 0; i < watch->filesCount; i++) free_image_input(&watch->files[i].input);
+	ISLIP_FREE(watch->files);
+	ISLIP_FREE(watch->decoded);
+	ISLIP_FREE(watch->slots);
+	ISLIP_FREE(watch->pageKeys);
+	imgpack_buffer_free(&watch->data);
+	imgpack_buffer_free(&watch->nextData);
+}
+
+// Runs until interrupted, failed repacks are reported and tried again on the
+// next change. Cache is not used and low memory mode is off, everything is in
+// memory anyway
+static int watch_images(struct ImgPackContext *ctx, const char *path) {
+	struct ImgPackWatch watch = {.ctx = ctx};
+	struct ImgPackWatcher watcher;
+	if (!ctx->outputDataPath) {
+		printf("Specify output data path using --data/-d <data path> with --watch\n");
+		return 1;
+	}
+	if (!cf_file_exists(path)) {
+		printf("Cannot open images folder \"%s\"\n", path);
+		return 1;
+	}
+	if (imgpack_watcher_open(&watcher, path)) {
+		printf("Cannot watch \"%s\"\n", path);
+		imgpack_watcher_close(&watcher);
+		return 1;
+	}
+	if (ctx->verbose && ctx->cache) printf("// Cache is not used in watch mode\n");
+	imgpack_cache_free(ctx);
+	ctx->lowMemory = 0;
+	imgpack_set_image_writer(ctx, open_watch_image, NULL);
+	scan_watch_tree(&watch, path, path);
+	repack_watch(&watch, path);
+	printf("Watching \"%s\"\n", path);
+	fflush(stdout);
+	int status = 0;
+	while (!(status = imgpack_watcher_wait(&watcher, 20))) {
+		if (collect_watch_changes(&watch, &watcher, path)) {
+			repack_watch(&watch, path);
+			fflush(stdout);
+		}
+	}
+	printf("Cannot watch \"%s\"\n", path);
+	imgpack_watcher_close(&watcher);
+	free_watch(&watch);
+	return status;
+}
+
+// Manifest jobs run on one work-stealing pool sized by --jobs. Every file is
+// decoded once for all jobs which use it, a job is packed as soon as its last
+// file is prepared and its pages are written by separate tasks, so decoding,
+// packing and encoding of different atlases overlap. Contexts of the jobs run
+// single-threaded inside of the tasks
+struct ImgPackBatchJob {
+	struct ImgPackContext *ctx;
+	int line;
+	// Inputs to prepare and then pages to write
+	int pending;
+	int nextPage;
+	int status;
+};
+
+// Input waiting for its file, users of the same file are linked by next
+struct ImgPackBatchUser {
+	int job;
+	int input;
+	int next;
+};
+
+struct ImgPackBatchFile {
+	char *path;
+	int firstUser;
+};
+
+struct ImgPackBatch {
+	const char *manifestPath;
+	struct ImgPackBatchJob *jobs;
+	int jobsCount;
+	struct ImgPackBatchUser *users;
+	int usersCount;
+	int usersAllocated;
+	struct ImgPackBatchFile *files;
+	int filesCount;
+	int filesAllocated;
+	struct ImgPackUniqueSlot *slots;
+	int slotsAllocated;
+	imgpack_mutex_t lock;
+};
+
+static int push_batch_user(struct ImgPackBatch *batch, int job, int input, int next) {
+	if (batch->usersCount >= batch->usersAllocated) {
+		batch->usersAllocated = batch->usersAllocated ? 2 * batch->usersAllocated : 64;
+		batch->users = ISLIP_REALLOC(batch->users, batch->usersAllocated * sizeof(*batch->users));
+	}
+	batch->users[batch->usersCount] = (struct ImgPackBatchUser) {.job = job, .input = input, .next = next};
+	return batch->usersCount++;
+}
+
+static void index_batch_file(struct ImgPackBatch *batch, int index) {
+	uint64_t key = imgpack_hash(batch->files[index].path, strlen(batch->files[index].path), 0);
+	uint64_t mask = batch->slotsAllocated - 1, j = key & mask;
+	while (batch->slots[j].id >= 0) j = (j + 1) & mask;
+	batch->slots[j] = (struct ImgPackUniqueSlot) {.key = key, .id = index};
+}
+
+// Files are matched by paths as they are collected, so folders of different
+// jobs should be spelled the same way to share files
+static void add_batch_user(struct ImgPackBatch *batch, int job, int input) {
+	const char *path = batch->jobs[job].ctx->inputs->items[input].path;
+	uint64_t key = imgpack_hash(path, strlen(path), 0), mask = batch->slotsAllocated - 1, j = key & mask;
+	for (; batch->slots && batch->slots[j].id >= 0; j = (j + 1) & mask) {
+		struct ImgPackBatchFile *file = &batch->files[batch->slots[j].id];
+		if (batch->slots[j].key == key && !strcmp(file->path, path)) {
+			file->firstUser = push_batch_user(batch, job, input, file->firstUser);
+			return;
+		}
+	}
+	if (batch->filesCount >= batch->filesAllocated) {
+		batch->filesAllocated = batch->filesAllocated ? 2 * batch->filesAllocated : 64;
+		batch->files = ISLIP_REALLOC(batch->files, batch->filesAllocated * sizeof(*batch->files));
+	}
+	int index = batch->filesCount++;
+	batch->files[index] = (struct ImgPackBatchFile) {.path = copy_string(path), .firstUser = push_batch_user(batch, job, input, -1)};
+	if (2 * batch->filesAllocated > batch->slotsAllocated) {
+		batch->slotsAllocated = 4 * batch->filesAllocated;
+		ISLIP_FREE(batch->slots);
+		batch->slots = ISLIP_MALLOC(batch->slotsAllocated * sizeof(*batch->slots));
+		for (int i = 0; i < batch->slotsAllocated; i++) batch->slots[i].id = -1;
+		for (int i = 0; i < batch->filesCount; i++) index_batch_file(batch, i);
+	} else {
+		index_batch_file(batch, index);
+	}
+}
+
+static void push_batch_task(struct ImgPackPool *pool, int worker, imgpack_pool_fn fn, struct ImgPackBatch *batch, int index) {
+	// Out of memory for the deque, the task is run right away then
+	if (imgpack_pool_push(pool, worker, fn, batch, index)) fn(pool, worker, batch, index);
+}
+
+// Job is done once its pages are written, the context is freed right away
+static void finish_batch_job(struct ImgPackBatch *batch, int index) {
+	struct ImgPackBatchJob *job = &batch->jobs[index];
+	struct ImgPackContext *ctx = job->ctx;
+	if (!job->status && ctx->cache && !imgpack_is_up_to_date(ctx) && imgpack_cache_save(ctx)) {
+		printf("Cannot save cache to \"%s\"\n", ctx->cache->dir);
+	}
+	if (!job->status) job->status = imgpack_stats_save(ctx);
+	if (job->status) printf("Job at line %d of manifest \"%s\" failed\n", job->line, batch->manifestPath);
+	imgpack_destroy(ctx);
+	job->ctx = NULL;
+}
+
+static void write_batch_page(struct ImgPackPool *pool, int worker, void *udata, int index) {
+	struct ImgPackBatch *batch = udata;
+	struct ImgPackBatchJob *job = &batch->jobs[index];
+	(void)pool;
+	(void)worker;
+	imgpack_mutex_lock(&batch->lock);
+	int page = job->nextPage++;
+	imgpack_mutex_unlock(&batch->lock);
+	int status = write_atlas_page(job->ctx, page);
+	if (status) printf("Cannot write atlas image \"%s\"\n", job->ctx->pages[page].imagePath);
+	imgpack_mutex_lock(&batch->lock);
+	job->status |= status;
+	int done = --job->pending == 0;
+	imgpack_mutex_unlock(&batch->lock);
+	if (done) finish_batch_job(batch, index);
+}
+
+// Jobs using the cache decode their changed files here, they are checked
+// against the cache all at once
+static void pack_batch_job(struct ImgPackPool *pool, int worker, void *udata, int index) {
+	struct ImgPackBatch *batch = udata;
+	struct ImgPackBatchJob *job = &batch->jobs[index];
+	struct ImgPackContext *ctx = job->ctx;
+	if (ctx->cache) prepare_images_data(ctx);
+	else add_prepared_images(ctx);
+	if (imgpack_is_up_to_date(ctx)) {
+		if (ctx->verbose) printf("// Atlas \"%s\" is up to date\n", ctx->outputImagePath);
+	} else {
+		job->status = imgpack_pack(ctx) || write_atlas_data(ctx);
+	}
+	if (job->status || imgpack_is_up_to_date(ctx) || ctx->pagesCount == 0) {
+		finish_batch_job(batch, index);
+		return;
+	}
+	// The last written page frees the context
+	int pages_count = ctx->pagesCount;
+	job->pending = pages_count;
+	for (int page = 0; page < pages_count; page++) {
+		push_batch_task(pool, worker, write_batch_page, batch, index);
+	}
+}
+
+static void finish_batch_input(struct ImgPackPool *pool, int worker, struct ImgPackBatch *batch, int index) {
+	struct ImgPackBatchJob *job = &batch->jobs[index];
+	imgpack_mutex_lock(&batch->lock);
+	int ready = --job->pending == 0;
+	imgpack_mutex_unlock(&batch->lock);
+	if (ready) push_batch_task(pool, worker, pack_batch_job, batch, index);
+}
+
+// Decodes files of low memory jobs, scales, trims and hashes shared pixels
+// of other jobs
+static void prepare_batch_input(struct ImgPackPool *pool, int worker, void *udata, int index) {
+	struct ImgPackBatch *batch = udata;
+	struct ImgPackBatchUser *user = &batch->users[index];
+	prepare_image_data(batch->jobs[user->job].ctx->inputs, user->input);
+	finish_batch_input(pool, worker, batch, user->job);
+}
+
+// Users get copies of decoded pixels and the last one takes them, so pixels
+// aren't touched after the last prepare task is pushed. Inputs of files which
+// are not images are left empty without decoding them for every user
+static void decode_batch_file(struct ImgPackPool *pool, int worker, void *udata, int index) {
+	struct ImgPackBatch *batch = udata;
+	struct ImgPackBatchFile *file = &batch->files[index];
+	int width, height;
+	const char *ext;
+	get_path_name(file->path, &ext);
+	stbi_uc *data = load_image_file(file->path, ext, &width, &height);
+	for (int i = file->firstUser; i >= 0;) {
+		struct ImgPackBatchUser *user = &batch->users[i];
+		struct ImgPackInput *input = &batch->jobs[user->job].ctx->inputs->items[user->input];
+		int next = user->next;
+		if (data) {
+			stbi_uc *copy = next < 0 ? data : ISLIP_MALLOC(4 * (size_t)width * height);
+			// Without memory for the copy the file is decoded by the user
+			if (copy && copy != data) memcpy(copy, data, 4 * (size_t)width * height);
+			input->data = copy;
+			input->originalWidth = width;
+			input->originalHeight = height;
+		}
+		if (data) push_batch_task(pool, worker, prepare_batch_input, batch, i);
+		else finish_batch_input(pool, worker, batch, user->job);
+		i = next;
+	}
+}
+
+// Options of the command line go before options of the line, so they are
+// defaults for every job. Files of the job are collected right away
+static int configure_batch_job(struct ImgPackBatch *batch, struct ImgPackContext *ctx, const struct ImgPackManifestEntry *entry, int index) {
+	struct ImgPackBatchJob *job = &batch->jobs[index];
+	char **argv = ISLIP_MALLOC(sizeof(*argv) * (ctx->argc + entry->argc + 1));
+	int argc = 0;
+	*job = (struct ImgPackBatchJob) {.line = entry->line};
+	if (!argv) return 1;
+	for (int i = 0; i < ctx->argc; i++) {
+		// Stats of the command line would be overwritten by every job
+		if (i > 0 && i + 1 < ctx->argc && (!strcmp(ctx->argv[i], "--manifest") || !strcmp(ctx->argv[i], "-B") ||
+				!strcmp(ctx->argv[i], "--stats") || !strcmp(ctx->argv[i], "-T"))) {
+			i++;
+		} else {
+			argv[argc++] = ctx->argv[i];
+		}
+	}
+	for (int i = 0; i < entry->argc; i++) argv[argc++] = entry->argv[i];
+	argv[argc] = NULL;
+	job->ctx = imgpack_create();
+	int status = !job->ctx || imgpack_configure(job->ctx, argc, argv);
+	if (!status && (job->ctx->manifestPath || job->ctx->watch)) {
+		printf("Manifest jobs can't use --manifest or --watch\n");
+		status = 1;
+	} else if (!status && !job->ctx->outputDataPath) {
+		printf("Specify output data path using --data/-d <data path> for every manifest job\n");
+		status = 1;
+	}
+	if (!status) status = imgpack_add_directory(job->ctx, argv[argc-1]);
+	ISLIP_FREE(argv);
+	if (status) return 1;
+	job->ctx->jobs = 1;
+	struct ImgPackInputs *inputs = job->ctx->inputs;
+	if (!job->ctx->cache) job->pending = inputs->size;
+	for (int i = 0; i < inputs->size && !job->ctx->cache; i++) {
+		if (job->ctx->lowMemory) push_batch_user(batch, index, i, -1);
+		else add_batch_user(batch, index, i);
+	}
+	return 0;
+}
+
+static int build_manifest(struct ImgPackContext *ctx) {
+	struct ImgPackManifest manifest;
+	if (imgpack_manifest_load(&manifest, ctx->manifestPath)) return 1;
+	struct ImgPackBatch batch = {
+		.manifestPath = ctx->manifestPath,
+		.jobs = ISLIP_MALLOC(sizeof(*batch.jobs) * (manifest.entriesCount + 1)),
+		.jobsCount = manifest.entriesCount,
+	};
+	struct ImgPackPool pool;
+	int status = !batch.jobs || imgpack_pool_init(&pool, ctx->jobs);
+	if (status) {
+		imgpack_manifest_free(&manifest);
+		ISLIP_FREE(batch.jobs);
+		return 1;
+	}
+	long long start = imgpack_watch_time_ms();
+	for (int i = 0; i < batch.jobsCount; i++) {
+		if (configure_batch_job(&batch, ctx, &manifest.entries[i], i)) {
+			printf("Job at line %d of manifest \"%s\" failed\n", manifest.entries[i].line, ctx->manifestPath);
+			imgpack_destroy(batch.jobs[i].ctx);
+			batch.jobs[i].ctx = NULL;
+			batch.jobs[i].status = 1;
+		}
+	}
+	imgpack_manifest_free(&manifest);
+	if (ctx->verbose) printf("// Manifest has %d jobs using %d files, %d of them are different\n", batch.jobsCount, batch.usersCount, batch.filesCount);
+
+	// CRC table of the PNG writer is filled on the first use
+	imgpack_png__crc_init();
+	imgpack_mutex_init(&batch.lock);
+	int worker = 0;
+	for (int i = 0; i < batch.filesCount; i++) {
+		push_batch_task(&pool, worker++, decode_batch_file, &batch, i);
+	}
+	for (int i = 0; i < batch.usersCount; i++) {
+		if (batch.jobs[batch.users[i].job].ctx->lowMemory) push_batch_task(&pool, worker++, prepare_batch_input, &batch, i);
+	}
+	for (int i = 0; i < batch.jobsCount; i++) {
+		if (batch.jobs[i].ctx && batch.jobs[i].pending == 0) push_batch_task(&pool, worker++, pack_batch_job, &batch, i);
+	}
+	imgpack_pool_run(&pool);
+	imgpack_pool_free(&pool);
+	imgpack_mutex_destroy(&batch.lock);
+
+	int built = 0;
+	for (int i = 0; i < batch.jobsCount; i++) {
+		if (batch.jobs[i].status) status = 1;
+		else built++;
+	}
+	if (ctx->verbose) printf("// Built %d of %d atlases in %lld ms\n", built, batch.jobsCount, imgpack_watch_time_ms() - start);
+	for (int i = 0; i < batch.filesCount; i++) ISLIP_FREE(batch.files[i].path);
+	ISLIP_FREE(batch.files);
+	ISLIP_FREE(batch.slots);
+	ISLIP_FREE(batch.users);
+	ISLIP_FREE(batch.jobs);
+	return status;
+}
+
+static int is_help_requested(int argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-?")) return 1;
+	}
+	return argc == 1;
+}
+
+int main(int argc, char *argv[]) {
+	struct ImgPackContext *ctx = imgpack_create();
+	if (!ctx) return 1;
+	int status = imgpack_configure(ctx, argc, argv);
+	if (!status && !is_help_requested(argc, argv) && ctx->manifestPath) {
+		status = build_manifest(ctx);
+	} else if (!status && !is_help_requested(argc, argv) && ctx->watch) {
+		status = watch_images(ctx, argv[argc-1]);
+	} else if (!status && !is_help_requested(argc, argv)) {
+		status = imgpack_add_directory(ctx, argv[argc-1]) || imgpack_prepare(ctx);
+		if (!status && imgpack_is_up_to_date(ctx)) {
+			if (ctx->verbose) printf("// Atlas is up to date\n");
+			status = imgpack_stats_save(ctx);
+		} else if (!status) {
+			status = imgpack_pack(ctx) || write_atlas_data(ctx) || imgpack_write_images(ctx);
+		}
+	}
+	imgpack_destroy(ctx);
+	return status;
+}
+#endif
+
 /*
 Copyright (c) 2019 Ilya Kolbin (iskolbin@gmail.com)
 
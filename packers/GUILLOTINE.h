@@ -0,0 +1,57 @@
+// Guillotine packing: the rect goes to the free area with the best area fit, the
+// rest of the area is cut into two along the shorter leftover axis
+static int imgpack_packer_GUILLOTINE(int heuristic, int allow_rotation, int width, int height, stbrp_rect *rects, const int *order, int count) {
+	(void)heuristic;
+	struct ImgPackAreas free_areas = {0};
+	int all_packed = 1;
+	if (imgpack_areas_push(&free_areas, (struct ImgPackArea) {0, 0, width, height})) return 0;
+	for (int k = 0; k < count; k++) {
+		stbrp_rect *rect = &rects[order[k]];
+		if (rect->w == 0 || rect->h == 0) {
+			imgpack_rect_place(rect, 0, 0, 0);
+			continue;
+		}
+		int best = -1, best_rotated = 0;
+		long long best_score1 = 0, best_score2 = 0;
+		for (int i = 0; i < free_areas.size; i++) {
+			struct ImgPackArea f = free_areas.items[i];
+			for (int rotated = 0; rotated <= allow_rotation; rotated++) {
+				int w = rotated ? rect->h : rect->w, h = rotated ? rect->w : rect->h;
+				if (w > f.w || h > f.h) continue;
+				long long score1 = (long long)f.w * f.h - (long long)w * h;
+				long long score2 = f.w - w < f.h - h ? f.w - w : f.h - h;
+				if (best < 0 || score1 < best_score1 || (score1 == best_score1 && score2 < best_score2)) {
+					best = i;
+					best_rotated = rotated;
+					best_score1 = score1;
+					best_score2 = score2;
+				}
+			}
+		}
+		if (best < 0) {
+			rect->was_packed = 0;
+			all_packed = 0;
+			continue;
+		}
+		struct ImgPackArea f = free_areas.items[best];
+		imgpack_rect_place(rect, f.x, f.y, best_rotated);
+		free_areas.items[best] = free_areas.items[--free_areas.size];
+		int leftover_w = f.w - rect->w, leftover_h = f.h - rect->h;
+		struct ImgPackArea bottom, right;
+		if (leftover_w <= leftover_h) {
+			bottom = (struct ImgPackArea) {f.x, f.y + rect->h, f.w, leftover_h};
+			right = (struct ImgPackArea) {f.x + rect->w, f.y, leftover_w, rect->h};
+		} else {
+			bottom = (struct ImgPackArea) {f.x, f.y + rect->h, rect->w, leftover_h};
+			right = (struct ImgPackArea) {f.x + rect->w, f.y, leftover_w, f.h};
+		}
+		if ((bottom.w > 0 && bottom.h > 0 && imgpack_areas_push(&free_areas, bottom)) ||
+				(right.w > 0 && right.h > 0 && imgpack_areas_push(&free_areas, right))) {
+			all_packed = 0;
+			for (; k < count; k++) rects[order[k]].was_packed = 0;
+			break;
+		}
+	}
+	ISLIP_FREE(free_areas.items);
+	return all_packed;
+}
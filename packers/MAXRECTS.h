@@ -0,0 +1,132 @@
+enum ImgPackMaxRectsHeuristic {
+	IMGPACK_MAXRECTS_BSSF,
+	IMGPACK_MAXRECTS_BAF,
+	IMGPACK_MAXRECTS_BL,
+	IMGPACK_MAXRECTS_CP,
+};
+
+static int imgpack_maxrects__common_length(int a0, int a1, int b0, int b1) {
+	if (a1 < b0 || b1 < a0) return 0;
+	return (a1 < b1 ? a1 : b1) - (a0 > b0 ? a0 : b0);
+}
+
+static int imgpack_maxrects__contact(const struct ImgPackAreas *used, int width, int height, struct ImgPackArea a) {
+	int score = 0;
+	if (a.x == 0 || a.x + a.w == width) score += a.h;
+	if (a.y == 0 || a.y + a.h == height) score += a.w;
+	for (int i = 0; i < used->size; i++) {
+		struct ImgPackArea u = used->items[i];
+		if (u.x == a.x + a.w || u.x + u.w == a.x) score += imgpack_maxrects__common_length(u.y, u.y + u.h, a.y, a.y + a.h);
+		if (u.y == a.y + a.h || u.y + u.h == a.y) score += imgpack_maxrects__common_length(u.x, u.x + u.w, a.x, a.x + a.w);
+	}
+	return score;
+}
+
+// Lower score is better, second score breaks ties
+static void imgpack_maxrects__score(int heuristic, const struct ImgPackAreas *used, int width, int height,
+		struct ImgPackArea f, int w, int h, long long *score1, long long *score2) {
+	int leftover_w = f.w - w, leftover_h = f.h - h;
+	int short_side = leftover_w < leftover_h ? leftover_w : leftover_h;
+	int long_side = leftover_w < leftover_h ? leftover_h : leftover_w;
+	switch (heuristic) {
+		case IMGPACK_MAXRECTS_BAF:
+			*score1 = (long long)f.w * f.h - (long long)w * h;
+			*score2 = short_side;
+			break;
+		case IMGPACK_MAXRECTS_BL:
+			*score1 = f.y + h;
+			*score2 = f.x;
+			break;
+		case IMGPACK_MAXRECTS_CP:
+			*score1 = -imgpack_maxrects__contact(used, width, height, (struct ImgPackArea) {f.x, f.y, w, h});
+			*score2 = short_side;
+			break;
+		default:
+			*score1 = short_side;
+			*score2 = long_side;
+			break;
+	}
+}
+
+// Cuts the used area out of all free areas it intersects and removes free areas
+// contained in other ones. Old free areas never contain each other, so only the
+// new ones have to be checked
+static int imgpack_maxrects__split(struct ImgPackAreas *free_areas, struct ImgPackArea used) {
+	int size = free_areas->size;
+	for (int i = 0; i < size; i++) {
+		struct ImgPackArea f = free_areas->items[i];
+		if (!imgpack_areas_intersect(f, used)) continue;
+		int status = 0;
+		if (used.y > f.y) status |= imgpack_areas_push(free_areas, (struct ImgPackArea) {f.x, f.y, f.w, used.y - f.y});
+		if (used.y + used.h < f.y + f.h) status |= imgpack_areas_push(free_areas, (struct ImgPackArea) {f.x, used.y + used.h, f.w, f.y + f.h - used.y - used.h});
+		if (used.x > f.x) status |= imgpack_areas_push(free_areas, (struct ImgPackArea) {f.x, f.y, used.x - f.x, f.h});
+		if (used.x + used.w < f.x + f.w) status |= imgpack_areas_push(free_areas, (struct ImgPackArea) {used.x + used.w, f.y, f.x + f.w - used.x - used.w, f.h});
+		if (status) return 1;
+		free_areas->items[i].w = 0;
+	}
+	struct ImgPackArea *items = free_areas->items;
+	for (int j = size; j < free_areas->size; j++) {
+		for (int i = 0; i < free_areas->size && items[j].w > 0; i++) {
+			if (i == j || items[i].w == 0) continue;
+			if (imgpack_area_contains(items[i], items[j]) && (i < j || !imgpack_area_contains(items[j], items[i]))) {
+				items[j].w = 0;
+			} else if (i < size && imgpack_area_contains(items[j], items[i])) {
+				items[i].w = 0;
+			}
+		}
+	}
+	int count = 0;
+	for (int i = 0; i < free_areas->size; i++) {
+		if (items[i].w > 0) items[count++] = items[i];
+	}
+	free_areas->size = count;
+	return 0;
+}
+
+// MaxRects packing: keeps all maximal free areas, rects are placed in the given
+// order into the free area chosen by the heuristic
+static int imgpack_packer_MAXRECTS(int heuristic, int allow_rotation, int width, int height, stbrp_rect *rects, const int *order, int count) {
+	struct ImgPackAreas free_areas = {0}, used_areas = {0};
+	int all_packed = 1;
+	if (imgpack_areas_push(&free_areas, (struct ImgPackArea) {0, 0, width, height})) return 0;
+	for (int k = 0; k < count; k++) {
+		stbrp_rect *rect = &rects[order[k]];
+		if (rect->w == 0 || rect->h == 0) {
+			imgpack_rect_place(rect, 0, 0, 0);
+			continue;
+		}
+		int best = -1, best_rotated = 0;
+		long long best_score1 = 0, best_score2 = 0;
+		for (int i = 0; i < free_areas.size; i++) {
+			struct ImgPackArea f = free_areas.items[i];
+			for (int rotated = 0; rotated <= allow_rotation; rotated++) {
+				int w = rotated ? rect->h : rect->w, h = rotated ? rect->w : rect->h;
+				if (w > f.w || h > f.h) continue;
+				long long score1, score2;
+				imgpack_maxrects__score(heuristic, &used_areas, width, height, f, w, h, &score1, &score2);
+				if (best < 0 || score1 < best_score1 || (score1 == best_score1 && score2 < best_score2)) {
+					best = i;
+					best_rotated = rotated;
+					best_score1 = score1;
+					best_score2 = score2;
+				}
+			}
+		}
+		if (best < 0) {
+			rect->was_packed = 0;
+			all_packed = 0;
+			continue;
+		}
+		imgpack_rect_place(rect, free_areas.items[best].x, free_areas.items[best].y, best_rotated);
+		struct ImgPackArea used = {rect->x, rect->y, rect->w, rect->h};
+		if (imgpack_maxrects__split(&free_areas, used) ||
+				(heuristic == IMGPACK_MAXRECTS_CP && imgpack_areas_push(&used_areas, used))) {
+			all_packed = 0;
+			for (; k < count; k++) rects[order[k]].was_packed = 0;
+			break;
+		}
+	}
+	ISLIP_FREE(free_areas.items);
+	ISLIP_FREE(used_areas.items);
+	return all_packed;
+}
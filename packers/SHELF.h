@@ -0,0 +1,63 @@
+struct ImgPackShelf {
+	int y;
+	int height;
+	int used;
+};
+
+// Shelf packing with best height fit: the rect goes to the shelf where it leaves
+// the smallest gap above it, new shelf is opened on top of the last one
+static int imgpack_packer_SHELF(int heuristic, int allow_rotation, int width, int height, stbrp_rect *rects, const int *order, int count) {
+	(void)heuristic;
+	struct ImgPackShelf *shelves = ISLIP_MALLOC(sizeof(*shelves) * (count + 1));
+	int shelves_count = 0, top = 0, all_packed = 1;
+	if (!shelves) return 0;
+	for (int k = 0; k < count; k++) {
+		stbrp_rect *rect = &rects[order[k]];
+		if (rect->w == 0 || rect->h == 0) {
+			rect->x = rect->y = 0;
+			rect->was_packed = 1;
+			continue;
+		}
+		int best = -1, best_gap = 0, best_rotated = 0;
+		for (int i = 0; i < shelves_count; i++) {
+			for (int rotated = 0; rotated <= allow_rotation; rotated++) {
+				int w = rotated ? rect->h : rect->w, h = rotated ? rect->w : rect->h;
+				if (h <= shelves[i].height && w <= width - shelves[i].used) {
+					int gap = shelves[i].height - h;
+					if (best < 0 || gap < best_gap) {
+						best = i;
+						best_gap = gap;
+						best_rotated = rotated;
+					}
+				}
+			}
+		}
+		if (best < 0) {
+			// Open the new shelf, flat orientation leaves more room for the next shelves
+			int rotated = allow_rotation && rect->h > rect->w && rect->h <= width;
+			int w = rotated ? rect->h : rect->w, h = rotated ? rect->w : rect->h;
+			if (w <= width && top + h <= height) {
+				shelves[shelves_count++] = (struct ImgPackShelf) {.y = top, .height = h};
+				top += h;
+				best = shelves_count - 1;
+				best_rotated = rotated;
+			}
+		}
+		if (best < 0) {
+			rect->was_packed = 0;
+			all_packed = 0;
+			continue;
+		}
+		if (best_rotated) {
+			stbrp_coord w = rect->w;
+			rect->w = rect->h;
+			rect->h = w;
+		}
+		rect->x = shelves[best].used;
+		rect->y = shelves[best].y;
+		rect->was_packed = 1;
+		shelves[best].used += rect->w;
+	}
+	ISLIP_FREE(shelves);
+	return all_packed;
+}
@@ -0,0 +1,12 @@
+static int imgpack_packer_SKYLINE(int heuristic, int allow_rotation, int width, int height, stbrp_rect *rects, const int *order, int count) {
+	(void)allow_rotation;
+	(void)order;
+	stbrp_context rp_ctx = {0};
+	stbrp_node *nodes = ISLIP_MALLOC(sizeof(*nodes) * width);
+	if (!nodes) return 0;
+	stbrp_init_target(&rp_ctx, width, height, nodes, width);
+	stbrp_setup_heuristic(&rp_ctx, heuristic);
+	int all_packed = stbrp_pack_rects(&rp_ctx, rects, count);
+	ISLIP_FREE(nodes);
+	return all_packed;
+}
@@ -0,0 +1,47 @@
+/*
+ * List of free areas shared by MAXRECTS and GUILLOTINE packers
+ */
+
+struct ImgPackArea {
+	int x;
+	int y;
+	int w;
+	int h;
+};
+
+struct ImgPackAreas {
+	struct ImgPackArea *items;
+	int size;
+	int allocated;
+};
+
+static int imgpack_areas_push(struct ImgPackAreas *areas, struct ImgPackArea area) {
+	if (areas->size >= areas->allocated) {
+		int allocated = areas->allocated ? 2 * areas->allocated : 64;
+		struct ImgPackArea *items = ISLIP_REALLOC(areas->items, allocated * sizeof(*items));
+		if (!items) return 1;
+		areas->items = items;
+		areas->allocated = allocated;
+	}
+	areas->items[areas->size++] = area;
+	return 0;
+}
+
+static int imgpack_area_contains(struct ImgPackArea a, struct ImgPackArea b) {
+	return b.x >= a.x && b.y >= a.y && b.x + b.w <= a.x + a.w && b.y + b.h <= a.y + a.h;
+}
+
+static int imgpack_areas_intersect(struct ImgPackArea a, struct ImgPackArea b) {
+	return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+static void imgpack_rect_place(stbrp_rect *rect, int x, int y, int rotated) {
+	if (rotated) {
+		stbrp_coord w = rect->w;
+		rect->w = rect->h;
+		rect->h = w;
+	}
+	rect->x = x;
+	rect->y = y;
+	rect->was_packed = 1;
+}
@@ -0,0 +1,266 @@
+/*
+ * Loader of atlas data written with `--format BINARY`, copy this header to
+ * the game. The file is used as it is: it's mapped to memory with
+ * imgpack_atlas_open (or passed with imgpack_atlas_init), frames are read from
+ * the arrays in place and names are looked up in the precomputed hash table,
+ * so nothing is parsed or allocated.
+ *
+ * Layout, all numbers are little endian 32-bit:
+ *
+ *   header   magic "IMGPACKB", version, file size, frames, pages and hash
+ *            slots counts, offsets of the sections, strings size, format
+ *            name, scale numerator and denominator
+ *   frames   IMGPACK_ATLAS_ARRAYS arrays of frames count numbers each
+ *   pages    image path, width, height and reserved number for every page
+ *   hash     FNV-1a hash of the name and frame id plus one for every slot,
+ *            empty slots are zero, collisions go to the next slot
+ *   strings  zero terminated strings, referenced by offsets in the pool
+ *
+ *   #include "imgpack_atlas.h"
+ *
+ *   struct ImgPackAtlas atlas;
+ *   if (imgpack_atlas_open(&atlas, "atlas.bin")) return error;
+ *   int id = imgpack_atlas_find(&atlas, "hero.png");
+ *   struct ImgPackAtlasFrame frame = imgpack_atlas_frame(&atlas, id);
+ *   ...
+ *   imgpack_atlas_close(&atlas);
+ *
+ * Functions are static inline, define IMGPACK_ATLAS_DEF to change that, and
+ * IMGPACK_ATLAS_NO_MMAP to leave only imgpack_atlas_init for data loaded by the
+ * game. Arrays can be read directly as well, for instance atlas.frames[IMGPACK_ATLAS_X][id].
+ * Only little endian hosts are supported, imgpack_atlas_init fails on others.
+ */
+
+#ifndef IMGPACK_ATLAS_H_
+#define IMGPACK_ATLAS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef IMGPACK_ATLAS_NO_MMAP
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif
+
+#ifndef IMGPACK_ATLAS_DEF
+#define IMGPACK_ATLAS_DEF static inline
+#endif
+
+#define IMGPACK_ATLAS_MAGIC "IMGPACKB"
+#define IMGPACK_ATLAS_VERSION 1
+#define IMGPACK_ATLAS_HEADER_SIZE 64
+
+// Frame arrays in the order they are stored
+enum ImgPackAtlasArray {
+	IMGPACK_ATLAS_X,
+	IMGPACK_ATLAS_Y,
+	IMGPACK_ATLAS_W,
+	IMGPACK_ATLAS_H,
+	IMGPACK_ATLAS_OFFSET_X,
+	IMGPACK_ATLAS_OFFSET_Y,
+	IMGPACK_ATLAS_SOURCE_W,
+	IMGPACK_ATLAS_SOURCE_H,
+	IMGPACK_ATLAS_PAGE,
+	IMGPACK_ATLAS_FLAGS,
+	IMGPACK_ATLAS_NAME,
+	IMGPACK_ATLAS_ARRAYS,
+};
+
+// Bits of IMGPACK_ATLAS_FLAGS
+#define IMGPACK_ATLAS_ROTATED 1
+#define IMGPACK_ATLAS_TRIMMED 2
+
+// Frame is x, y, w, h in the atlas page, w and h are the size of the image,
+// rotated frames take h x w area of the page. Offset is the position of the
+// trimmed image in the source one of source_w x source_h size
+struct ImgPackAtlasFrame {
+	int x, y, w, h;
+	int offsetX, offsetY;
+	int sourceW, sourceH;
+	int page;
+	int rotated;
+	int trimmed;
+	const char *name;
+};
+
+struct ImgPackAtlas {
+	const unsigned char *data;
+	size_t size;
+	int framesCount;
+	int pagesCount;
+	const int32_t *frames[IMGPACK_ATLAS_ARRAYS];
+	const uint32_t *pages;
+	const uint32_t *hash;
+	uint32_t hashSlots;
+	const char *strings;
+	uint32_t stringsSize;
+	const char *format;
+	int scaleNumerator;
+	int scaleDenominator;
+	// Mapping of imgpack_atlas_open
+	void *mapping;
+};
+
+IMGPACK_ATLAS_DEF uint32_t imgpack_atlas__u32(const unsigned char *p) {
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+IMGPACK_ATLAS_DEF uint32_t imgpack_atlas_hash(const char *s) {
+	uint32_t hash = 2166136261u;
+	for (; *s; s++) hash = (hash ^ (unsigned char)*s) * 16777619u;
+	return hash;
+}
+
+IMGPACK_ATLAS_DEF const char *imgpack_atlas__string(const struct ImgPackAtlas *atlas, uint32_t offset) {
+	return offset < atlas->stringsSize ? atlas->strings + offset : "";
+}
+
+// Checks data of size bytes, which has to be aligned to 4 bytes and live while
+// the atlas is used. Returns non-zero if it's not a valid atlas
+IMGPACK_ATLAS_DEF int imgpack_atlas_init(struct ImgPackAtlas *atlas, const void *data, size_t size) {
+	const unsigned char *p = (const unsigned char *)data;
+	uint32_t one = 1;
+	memset(atlas, 0, sizeof(*atlas));
+	if (!p || size < IMGPACK_ATLAS_HEADER_SIZE || ((uintptr_t)p & 3) || *(const unsigned char *)&one != 1) return 1;
+	if (memcmp(p, IMGPACK_ATLAS_MAGIC, 8) || imgpack_atlas__u32(p + 8) != IMGPACK_ATLAS_VERSION) return 1;
+	uint32_t file_size = imgpack_atlas__u32(p + 12), frames = imgpack_atlas__u32(p + 16), pages = imgpack_atlas__u32(p + 20);
+	uint32_t slots = imgpack_atlas__u32(p + 24), frames_offset = imgpack_atlas__u32(p + 28), pages_offset = imgpack_atlas__u32(p + 32);
+	uint32_t hash_offset = imgpack_atlas__u32(p + 36), strings_offset = imgpack_atlas__u32(p + 40), strings_size = imgpack_atlas__u32(p + 44);
+	if (file_size > size || frames > file_size / 4 / IMGPACK_ATLAS_ARRAYS || pages > file_size / 16 || slots > file_size / 8 ||
+			(slots & (slots - 1)) || slots < frames) {
+		return 1;
+	}
+	if ((frames_offset | pages_offset | hash_offset) & 3 ||
+			frames_offset > file_size || file_size - frames_offset < (uint64_t)4 * IMGPACK_ATLAS_ARRAYS * frames ||
+			pages_offset > file_size || file_size - pages_offset < (uint64_t)16 * pages ||
+			hash_offset > file_size || file_size - hash_offset < (uint64_t)8 * slots ||
+			strings_offset > file_size || file_size - strings_offset < strings_size ||
+			strings_size == 0 || p[strings_offset + strings_size - 1] != 0) {
+		return 1;
+	}
+	atlas->data = p;
+	atlas->size = size;
+	atlas->framesCount = (int)frames;
+	atlas->pagesCount = (int)pages;
+	for (int i = 0; i < IMGPACK_ATLAS_ARRAYS; i++) {
+		atlas->frames[i] = (const int32_t *)(p + frames_offset + (size_t)4 * frames * i);
+	}
+	atlas->pages = (const uint32_t *)(p + pages_offset);
+	atlas->hash = (const uint32_t *)(p + hash_offset);
+	atlas->hashSlots = slots;
+	atlas->strings = (const char *)(p + strings_offset);
+	atlas->stringsSize = strings_size;
+	atlas->format = imgpack_atlas__string(atlas, imgpack_atlas__u32(p + 48));
+	atlas->scaleNumerator = (int32_t)imgpack_atlas__u32(p + 52);
+	atlas->scaleDenominator = (int32_t)imgpack_atlas__u32(p + 56);
+	return 0;
+}
+
+#ifndef IMGPACK_ATLAS_NO_MMAP
+IMGPACK_ATLAS_DEF void imgpack_atlas_close(struct ImgPackAtlas *atlas) {
+	if (atlas->mapping) {
+#ifdef _WIN32
+		UnmapViewOfFile(atlas->data);
+		CloseHandle((HANDLE)atlas->mapping);
+#else
+		munmap(atlas->mapping, atlas->size);
+#endif
+	}
+	memset(atlas, 0, sizeof(*atlas));
+}
+
+// Maps the file read only. Returns non-zero on failure
+IMGPACK_ATLAS_DEF int imgpack_atlas_open(struct ImgPackAtlas *atlas, const char *path) {
+	void *data = NULL, *mapping = NULL;
+	size_t size = 0;
+	memset(atlas, 0, sizeof(*atlas));
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	LARGE_INTEGER file_size;
+	if (file == INVALID_HANDLE_VALUE) return 1;
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+		size = (size_t)file_size.QuadPart;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		data = mapping ? MapViewOfFile((HANDLE)mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	}
+	CloseHandle(file);
+	if (!data) {
+		if (mapping) CloseHandle((HANDLE)mapping);
+		return 1;
+	}
+#else
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return 1;
+	if (!fstat(fd, &st) && st.st_size > 0) {
+		size = (size_t)st.st_size;
+		data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) data = NULL;
+	}
+	close(fd);
+	if (!data) return 1;
+	mapping = data;
+#endif
+	if (imgpack_atlas_init(atlas, data, size)) {
+		atlas->mapping = mapping;
+		atlas->data = (const unsigned char *)data;
+		atlas->size = size;
+		imgpack_atlas_close(atlas);
+		return 1;
+	}
+	atlas->mapping = mapping;
+	return 0;
+}
+#endif
+
+// Returns frame id by name or -1
+IMGPACK_ATLAS_DEF int imgpack_atlas_find(const struct ImgPackAtlas *atlas, const char *name) {
+	if (atlas->hashSlots == 0) return -1;
+	uint32_t hash = imgpack_atlas_hash(name), mask = atlas->hashSlots - 1;
+	for (uint32_t i = 0, j = hash & mask; i < atlas->hashSlots; i++, j = (j + 1) & mask) {
+		uint32_t slot_hash = atlas->hash[2*j], id = atlas->hash[2*j + 1];
+		if (id == 0 || id > (uint32_t)atlas->framesCount) return -1;
+		if (slot_hash == hash && !strcmp(imgpack_atlas__string(atlas, (uint32_t)atlas->frames[IMGPACK_ATLAS_NAME][id - 1]), name)) {
+			return (int)id - 1;
+		}
+	}
+	return -1;
+}
+
+// Returns frame by id, all fields are zero for bad ids
+IMGPACK_ATLAS_DEF struct ImgPackAtlasFrame imgpack_atlas_frame(const struct ImgPackAtlas *atlas, int id) {
+	struct ImgPackAtlasFrame frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.name = "";
+	if (id < 0 || id >= atlas->framesCount) return frame;
+	frame.x = atlas->frames[IMGPACK_ATLAS_X][id];
+	frame.y = atlas->frames[IMGPACK_ATLAS_Y][id];
+	frame.w = atlas->frames[IMGPACK_ATLAS_W][id];
+	frame.h = atlas->frames[IMGPACK_ATLAS_H][id];
+	frame.offsetX = atlas->frames[IMGPACK_ATLAS_OFFSET_X][id];
+	frame.offsetY = atlas->frames[IMGPACK_ATLAS_OFFSET_Y][id];
+	frame.sourceW = atlas->frames[IMGPACK_ATLAS_SOURCE_W][id];
+	frame.sourceH = atlas->frames[IMGPACK_ATLAS_SOURCE_H][id];
+	frame.page = atlas->frames[IMGPACK_ATLAS_PAGE][id];
+	frame.rotated = (atlas->frames[IMGPACK_ATLAS_FLAGS][id] & IMGPACK_ATLAS_ROTATED) != 0;
+	frame.trimmed = (atlas->frames[IMGPACK_ATLAS_FLAGS][id] & IMGPACK_ATLAS_TRIMMED) != 0;
+	frame.name = imgpack_atlas__string(atlas, (uint32_t)atlas->frames[IMGPACK_ATLAS_NAME][id]);
+	return frame;
+}
+
+// Image path and size of the page, path is "" for bad pages
+IMGPACK_ATLAS_DEF const char *imgpack_atlas_page(const struct ImgPackAtlas *atlas, int page, int *width, int *height) {
+	if (page < 0 || page >= atlas->pagesCount) return "";
+	if (width) *width = (int)atlas->pages[4*page + 1];
+	if (height) *height = (int)atlas->pages[4*page + 2];
+	return imgpack_atlas__string(atlas, atlas->pages[4*page]);
+}
+
+#endif
@@ -0,0 +1,21 @@
+#!/bin/sh
+# A layout cached for RGBA8888 pages is not reused for block compressed pages
+# or mipmaps, which align rects to their pack unit. Run with `make check`
+set -e
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+./bench-atlas -c "$dir/corpus" -s borders > /dev/null
+options="-t 0 -f JSON_HASH"
+./imgpack $options -c BC1 -i "$dir/cold.dds" -d "$dir/cold.json" "$dir/corpus/borders"
+./imgpack $options -l 2 -i "$dir/cold_mip.png" -d "$dir/cold_mip.json" "$dir/corpus/borders"
+./imgpack $options -C "$dir/cache" -i "$dir/plain.png" -d "$dir/plain.json" "$dir/corpus/borders"
+./imgpack $options -v -C "$dir/cache" -c BC1 -i "$dir/warm.dds" -d "$dir/warm.json" "$dir/corpus/borders" > "$dir/warm.log"
+! grep -q "Reusing cached layout" "$dir/warm.log" || { echo "cache format: layout reused for BC1"; exit 1; }
+sed 's/warm\.dds/cold.dds/' "$dir/warm.json" | cmp -s - "$dir/cold.json" || { echo "cache format: BC1 data differs"; exit 1; }
+cmp -s "$dir/warm.dds" "$dir/cold.dds" || { echo "cache format: BC1 atlas differs"; exit 1; }
+./imgpack $options -C "$dir/cache" -i "$dir/plain.png" -d "$dir/plain.json" "$dir/corpus/borders"
+./imgpack $options -v -C "$dir/cache" -l 2 -i "$dir/warm_mip.png" -d "$dir/warm_mip.json" "$dir/corpus/borders" > "$dir/warm_mip.log"
+! grep -q "Reusing cached layout" "$dir/warm_mip.log" || { echo "cache format: layout reused for mipmaps"; exit 1; }
+sed 's/warm_mip\.png/cold_mip.png/' "$dir/warm_mip.json" | cmp -s - "$dir/cold_mip.json" || { echo "cache format: mipmap data differs"; exit 1; }
+cmp -s "$dir/warm_mip.png" "$dir/cold_mip.png" || { echo "cache format: mipmap atlas differs"; exit 1; }
+echo "cache format: ok"
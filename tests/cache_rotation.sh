@@ -0,0 +1,16 @@
+#!/bin/sh
+# A rerun which reuses the cached layout of rotated rects gives the same
+# atlas as a run without the cache. Run with `make check`
+set -e
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+./bench-atlas -c "$dir/corpus" -s strips > /dev/null
+options="-r -P MAXRECTS_BSSF -t 0 -f JSON_HASH"
+./imgpack $options -i "$dir/cold.png" -d "$dir/cold.json" "$dir/corpus/strips"
+./imgpack $options -C "$dir/cache" -i "$dir/warm.png" -d "$dir/warm.json" "$dir/corpus/strips"
+grep -q '"rotated": true' "$dir/cold.json"
+touch "$dir/corpus/strips/000000.png"
+./imgpack $options -C "$dir/cache" -i "$dir/warm.png" -d "$dir/warm.json" "$dir/corpus/strips"
+sed 's/warm\.png/cold.png/' "$dir/warm.json" | cmp -s - "$dir/cold.json" || { echo "cache rotation: data differs"; exit 1; }
+cmp -s "$dir/warm.png" "$dir/cold.png" || { echo "cache rotation: atlas differs"; exit 1; }
+echo "cache rotation: ok"
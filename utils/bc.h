@@ -0,0 +1,568 @@
+/*
+ * BC1, BC3 and BC7 block encoders. Every function takes 4x4 block of RGBA
+ * pixels in row-major order and writes one compressed block.
+ *
+ * Colors are fitted along the principal axis of the block and refined with
+ * least squares on the chosen indices, the number of refinement passes and
+ * the variants tried depend on the quality. BC1 blocks with pixels of alpha
+ * below 128 use 3-color mode with transparent index, BC3 ignores colors of
+ * fully transparent pixels. BC7 uses single subset modes: mode 6 with RGBA
+ * endpoints and 4-bit indices or mode 5 with separate color and alpha, the
+ * one with smaller error is kept. Multi-subset modes are not searched.
+ */
+
+#ifndef IMGPACK_BC_H_
+#define IMGPACK_BC_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+enum ImgPackBlockQuality {
+	IMGPACK_BLOCK_FAST,
+	IMGPACK_BLOCK_DEFAULT,
+	IMGPACK_BLOCK_MAX,
+};
+
+// Least squares refinement passes per quality
+static const int imgpack_bc__refines[] = {0, 2, 8};
+
+static int imgpack_bc__clamp(int v, int lo, int hi) {
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+// Principal axis of count points of n channels by power iteration, returns
+// the mean in mean and the axis in axis
+static void imgpack_bc__axis(const float (*points)[4], int count, int n, float *mean, float *axis) {
+	float cov[4][4] = {{0}};
+	for (int k = 0; k < n; k++) {
+		mean[k] = 0;
+		for (int i = 0; i < count; i++) mean[k] += points[i][k];
+		mean[k] /= count;
+	}
+	for (int i = 0; i < count; i++) {
+		for (int j = 0; j < n; j++) {
+			for (int k = j; k < n; k++) cov[j][k] += (points[i][j] - mean[j]) * (points[i][k] - mean[k]);
+		}
+	}
+	for (int j = 0; j < n; j++) {
+		for (int k = 0; k < j; k++) cov[j][k] = cov[k][j];
+		axis[j] = 1;
+	}
+	for (int iter = 0; iter < 8; iter++) {
+		float next[4] = {0}, length = 0;
+		for (int j = 0; j < n; j++) {
+			for (int k = 0; k < n; k++) next[j] += cov[j][k] * axis[k];
+			length = fabsf(next[j]) > length ? fabsf(next[j]) : length;
+		}
+		if (length < 1e-6f) break;
+		for (int j = 0; j < n; j++) axis[j] = next[j] / length;
+	}
+}
+
+// Endpoints at the extreme projections of the points on the principal axis
+static void imgpack_bc__fit(const float (*points)[4], int count, int n, float *e0, float *e1) {
+	float mean[4], axis[4], lo = 0, hi = 0, length = 0;
+	imgpack_bc__axis(points, count, n, mean, axis);
+	for (int k = 0; k < n; k++) length += axis[k] * axis[k];
+	for (int i = 0; i < count && length > 0; i++) {
+		float t = 0;
+		for (int k = 0; k < n; k++) t += (points[i][k] - mean[k]) * axis[k];
+		t /= length;
+		if (t < lo) lo = t;
+		if (t > hi) hi = t;
+	}
+	for (int k = 0; k < n; k++) {
+		e0[k] = mean[k] + axis[k] * lo;
+		e1[k] = mean[k] + axis[k] * hi;
+	}
+}
+
+// Solves for endpoints which minimize the error of points interpolated with
+// weights t, returns zero if the system is degenerate
+static int imgpack_bc__least_squares(const float (*points)[4], const float *t, int count, int n, float *e0, float *e1) {
+	float a = 0, b = 0, c = 0, x[4] = {0}, y[4] = {0};
+	for (int i = 0; i < count; i++) {
+		float s = 1 - t[i];
+		a += s * s;
+		b += s * t[i];
+		c += t[i] * t[i];
+		for (int k = 0; k < n; k++) {
+			x[k] += s * points[i][k];
+			y[k] += t[i] * points[i][k];
+		}
+	}
+	float det = a * c - b * b;
+	if (fabsf(det) < 1e-6f) return 0;
+	for (int k = 0; k < n; k++) {
+		e0[k] = (x[k] * c - y[k] * b) / det;
+		e1[k] = (y[k] * a - x[k] * b) / det;
+	}
+	return 1;
+}
+
+static int imgpack_bc__pack565(const float *c) {
+	int r = imgpack_bc__clamp((int)(c[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+	int g = imgpack_bc__clamp((int)(c[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+	int b = imgpack_bc__clamp((int)(c[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+	return r << 11 | g << 5 | b;
+}
+
+static void imgpack_bc__unpack565(int c, int *rgb) {
+	int r = c >> 11, g = c >> 5 & 63, b = c & 31;
+	rgb[0] = r << 3 | r >> 2;
+	rgb[1] = g << 2 | g >> 4;
+	rgb[2] = b << 3 | b >> 2;
+}
+
+struct ImgPackBcColors {
+	float points[16][4];
+	int pixels[16];
+	int count;
+};
+
+// Picks the nearest palette color for every fitted point, returns the error
+static int imgpack_bc__color_indices(const struct ImgPackBcColors *colors, int c0, int c1, int four, int *indices) {
+	int palette[4][3], error = 0;
+	imgpack_bc__unpack565(c0, palette[0]);
+	imgpack_bc__unpack565(c1, palette[1]);
+	for (int k = 0; k < 3; k++) {
+		if (four) {
+			palette[2][k] = (2*palette[0][k] + palette[1][k]) / 3;
+			palette[3][k] = (palette[0][k] + 2*palette[1][k]) / 3;
+		} else {
+			palette[2][k] = (palette[0][k] + palette[1][k]) / 2;
+		}
+	}
+	for (int i = 0; i < colors->count; i++) {
+		int best = 0, best_error = 0x7fffffff;
+		for (int j = 0; j < (four ? 4 : 3); j++) {
+			int e = 0;
+			for (int k = 0; k < 3; k++) {
+				int d = (int)colors->points[i][k] - palette[j][k];
+				e += d * d;
+			}
+			if (e < best_error) {
+				best = j;
+				best_error = e;
+			}
+		}
+		indices[i] = best;
+		error += best_error;
+	}
+	return error;
+}
+
+struct ImgPackBcColorFit {
+	int c0;
+	int c1;
+	int indices[16];
+	int error;
+};
+
+// Quantizes endpoints in the order the mode needs: c0 > c1 selects 4-color
+// mode, c0 <= c1 selects 3-color mode
+static void imgpack_bc__try_colors(const struct ImgPackBcColors *colors, const float *e0, const float *e1, int four,
+		struct ImgPackBcColorFit *best) {
+	struct ImgPackBcColorFit fit;
+	fit.c0 = imgpack_bc__pack565(e0);
+	fit.c1 = imgpack_bc__pack565(e1);
+	if (four ? fit.c0 < fit.c1 : fit.c0 > fit.c1) {
+		int c = fit.c0;
+		fit.c0 = fit.c1;
+		fit.c1 = c;
+	}
+	fit.error = imgpack_bc__color_indices(colors, fit.c0, fit.c1, four, fit.indices);
+	if (fit.error < best->error) *best = fit;
+}
+
+static struct ImgPackBcColorFit imgpack_bc__fit_colors(const struct ImgPackBcColors *colors, int four, enum ImgPackBlockQuality quality) {
+	static const float weights[2][4] = {{0, 1, 1.0f/3, 2.0f/3}, {0, 1, 0.5f, 0}};
+	struct ImgPackBcColorFit best = {.error = 0x7fffffff};
+	float e0[4], e1[4], t[16];
+	imgpack_bc__fit(colors->points, colors->count, 3, e0, e1);
+	imgpack_bc__try_colors(colors, e0, e1, four, &best);
+	for (int pass = 0; pass < imgpack_bc__refines[quality] && best.error > 0; pass++) {
+		for (int i = 0; i < colors->count; i++) t[i] = weights[!four][best.indices[i]];
+		// Indices are taken against quantized endpoints c0, c1 in this order
+		if (!imgpack_bc__least_squares(colors->points, t, colors->count, 3, e0, e1)) break;
+		int error = best.error;
+		imgpack_bc__try_colors(colors, e0, e1, four, &best);
+		if (best.error >= error) break;
+	}
+	return best;
+}
+
+// Writes 8-byte color block. Pixels with alpha below 128 are transparent in
+// 3-color mode when punch_alpha is set, pixels with zero alpha are ignored
+// otherwise when ignore_transparent is set
+static void imgpack_bc__color_block(const unsigned char *rgba, int punch_alpha, int ignore_transparent,
+		enum ImgPackBlockQuality quality, unsigned char *out) {
+	struct ImgPackBcColors colors = {.count = 0};
+	int transparent = 0;
+	for (int i = 0; i < 16; i++) {
+		int a = rgba[4*i + 3];
+		if ((punch_alpha && a < 128) || (ignore_transparent && a == 0)) {
+			transparent |= 1 << i;
+			continue;
+		}
+		for (int k = 0; k < 3; k++) colors.points[colors.count][k] = rgba[4*i + k];
+		colors.pixels[colors.count++] = i;
+	}
+	struct ImgPackBcColorFit fit = {0};
+	int three = punch_alpha && transparent;
+	if (colors.count > 0) {
+		fit = imgpack_bc__fit_colors(&colors, !three, quality);
+		if (!three && punch_alpha && quality == IMGPACK_BLOCK_MAX && fit.error > 0) {
+			struct ImgPackBcColorFit three_fit = imgpack_bc__fit_colors(&colors, 0, quality);
+			if (three_fit.error < fit.error) {
+				fit = three_fit;
+				three = 1;
+			}
+		}
+	}
+	// Equal endpoints mean 3-color mode, so 4-color blocks use only index 0 then
+	uint32_t bits = 0;
+	for (int i = 0; i < colors.count; i++) {
+		int index = fit.indices[i];
+		if (!three && fit.c0 == fit.c1) index = 0;
+		bits |= (uint32_t)index << 2*colors.pixels[i];
+	}
+	for (int i = 0; i < 16; i++) {
+		if (three && (transparent >> i & 1)) bits |= 3u << 2*i;
+	}
+	out[0] = (unsigned char)fit.c0;
+	out[1] = (unsigned char)(fit.c0 >> 8);
+	out[2] = (unsigned char)fit.c1;
+	out[3] = (unsigned char)(fit.c1 >> 8);
+	for (int i = 0; i < 4; i++) out[4 + i] = (unsigned char)(bits >> 8*i);
+}
+
+static void imgpack_bc1_block(const unsigned char *rgba, enum ImgPackBlockQuality quality, unsigned char *out) {
+	imgpack_bc__color_block(rgba, 1, 0, quality, out);
+}
+
+// Alpha palette: a0 > a1 interpolates 6 values, otherwise 4 values plus 0 and 255
+static int imgpack_bc__alpha_indices(const unsigned char *rgba, int a0, int a1, uint64_t *bits) {
+	int palette[8] = {a0, a1}, error = 0;
+	if (a0 > a1) {
+		for (int i = 1; i < 7; i++) palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+	} else {
+		for (int i = 1; i < 5; i++) palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	*bits = 0;
+	for (int i = 0; i < 16; i++) {
+		int a = rgba[4*i + 3], best = 0, best_error = 0x7fffffff;
+		for (int j = 0; j < 8; j++) {
+			int e = (a - palette[j]) * (a - palette[j]);
+			if (e < best_error) {
+				best = j;
+				best_error = e;
+			}
+		}
+		*bits |= (uint64_t)best << 3*i;
+		error += best_error;
+	}
+	return error;
+}
+
+static void imgpack_bc__alpha_block(const unsigned char *rgba, enum ImgPackBlockQuality quality, unsigned char *out) {
+	int lo = 255, hi = 0, inner_lo = 255, inner_hi = 0;
+	for (int i = 0; i < 16; i++) {
+		int a = rgba[4*i + 3];
+		if (a < lo) lo = a;
+		if (a > hi) hi = a;
+		if (a > 0 && a < 255) {
+			if (a < inner_lo) inner_lo = a;
+			if (a > inner_hi) inner_hi = a;
+		}
+	}
+	uint64_t bits, best_bits;
+	int best_a0 = hi, best_a1 = lo;
+	int best_error = imgpack_bc__alpha_indices(rgba, hi, lo, &best_bits);
+	// Blocks with both extremes and intermediate values may fit better into
+	// the 6-value mode which has exact 0 and 255
+	if (quality > IMGPACK_BLOCK_FAST && best_error > 0 && inner_lo <= inner_hi) {
+		int error = imgpack_bc__alpha_indices(rgba, inner_lo, inner_hi, &bits);
+		if (error < best_error) {
+			best_error = error;
+			best_bits = bits;
+			best_a0 = inner_lo;
+			best_a1 = inner_hi;
+		}
+	}
+	if (quality == IMGPACK_BLOCK_MAX && best_error > 0 && hi > lo) {
+		for (int d0 = -2; d0 <= 2; d0++) {
+			for (int d1 = -2; d1 <= 2; d1++) {
+				int a0 = imgpack_bc__clamp(hi + d0, 0, 255), a1 = imgpack_bc__clamp(lo + d1, 0, 255);
+				if (a0 <= a1) continue;
+				int error = imgpack_bc__alpha_indices(rgba, a0, a1, &bits);
+				if (error < best_error) {
+					best_error = error;
+					best_bits = bits;
+					best_a0 = a0;
+					best_a1 = a1;
+				}
+			}
+		}
+	}
+	out[0] = (unsigned char)best_a0;
+	out[1] = (unsigned char)best_a1;
+	for (int i = 0; i < 6; i++) out[2 + i] = (unsigned char)(best_bits >> 8*i);
+}
+
+static void imgpack_bc3_block(const unsigned char *rgba, enum ImgPackBlockQuality quality, unsigned char *out) {
+	imgpack_bc__alpha_block(rgba, quality, out);
+	imgpack_bc__color_block(rgba, 0, 1, quality, out + 8);
+}
+
+static const int imgpack_bc7__weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+struct ImgPackBc7Fit {
+	int e[2][4];
+	int indices[16];
+	int error;
+};
+
+// Mode 6 endpoints are 7 bits per channel plus p-bit shared by the channels
+static void imgpack_bc7__quantize(const float *e, int pbit, int *q) {
+	for (int k = 0; k < 4; k++) {
+		q[k] = imgpack_bc__clamp((int)((e[k] - pbit) / 2.0f + 0.5f), 0, 127) << 1 | pbit;
+	}
+}
+
+static int imgpack_bc7__quantize_error(const float *e, int pbit) {
+	int q[4];
+	float error = 0;
+	imgpack_bc7__quantize(e, pbit, q);
+	for (int k = 0; k < 4; k++) error += (e[k] - q[k]) * (e[k] - q[k]);
+	return (int)error;
+}
+
+static void imgpack_bc7__indices(const unsigned char *rgba, struct ImgPackBc7Fit *fit) {
+	int palette[16][4];
+	for (int j = 0; j < 16; j++) {
+		for (int k = 0; k < 4; k++) {
+			palette[j][k] = ((64 - imgpack_bc7__weights[j]) * fit->e[0][k] + imgpack_bc7__weights[j] * fit->e[1][k] + 32) >> 6;
+		}
+	}
+	fit->error = 0;
+	for (int i = 0; i < 16; i++) {
+		int best = 0, best_error = 0x7fffffff;
+		for (int j = 0; j < 16; j++) {
+			int e = 0;
+			for (int k = 0; k < 4; k++) {
+				int d = rgba[4*i + k] - palette[j][k];
+				e += d * d;
+			}
+			if (e < best_error) {
+				best = j;
+				best_error = e;
+			}
+		}
+		fit->indices[i] = best;
+		fit->error += best_error;
+	}
+}
+
+// Tries endpoints with p-bits chosen by quantization error, or with all four
+// p-bit combinations at the maximal quality
+static void imgpack_bc7__try(const unsigned char *rgba, const float *e0, const float *e1,
+		enum ImgPackBlockQuality quality, struct ImgPackBc7Fit *best) {
+	struct ImgPackBc7Fit fit;
+	for (int p = 0; p < 4; p++) {
+		int p0 = p & 1, p1 = p >> 1;
+		if (quality < IMGPACK_BLOCK_MAX) {
+			p0 = imgpack_bc7__quantize_error(e0, 1) < imgpack_bc7__quantize_error(e0, 0);
+			p1 = imgpack_bc7__quantize_error(e1, 1) < imgpack_bc7__quantize_error(e1, 0);
+		}
+		imgpack_bc7__quantize(e0, p0, fit.e[0]);
+		imgpack_bc7__quantize(e1, p1, fit.e[1]);
+		imgpack_bc7__indices(rgba, &fit);
+		if (fit.error < best->error) *best = fit;
+		if (quality < IMGPACK_BLOCK_MAX) break;
+	}
+}
+
+struct ImgPackBc7Bits {
+	unsigned char *out;
+	int position;
+};
+
+static void imgpack_bc7__put(struct ImgPackBc7Bits *bits, int value, int count) {
+	for (int i = 0; i < count; i++, bits->position++) {
+		if (value >> i & 1) bits->out[bits->position >> 3] |= (unsigned char)(1 << (bits->position & 7));
+	}
+}
+
+// Mode 6 puts all four channels on one line, fits smooth RGBA blocks
+static int imgpack_bc7__mode6(const unsigned char *rgba, enum ImgPackBlockQuality quality, unsigned char *out) {
+	float points[16][4], e0[4], e1[4], t[16];
+	for (int i = 0; i < 16; i++) {
+		for (int k = 0; k < 4; k++) points[i][k] = rgba[4*i + k];
+	}
+	struct ImgPackBc7Fit best = {.error = 0x7fffffff};
+	imgpack_bc__fit(points, 16, 4, e0, e1);
+	imgpack_bc7__try(rgba, e0, e1, quality, &best);
+	for (int pass = 0; pass < imgpack_bc__refines[quality] && best.error > 0; pass++) {
+		for (int i = 0; i < 16; i++) t[i] = imgpack_bc7__weights[best.indices[i]] / 64.0f;
+		if (!imgpack_bc__least_squares(points, t, 16, 4, e0, e1)) break;
+		int error = best.error;
+		imgpack_bc7__try(rgba, e0, e1, quality, &best);
+		if (best.error >= error) break;
+	}
+	// The most significant bit of the first index is implicit zero
+	if (best.indices[0] & 8) {
+		for (int k = 0; k < 4; k++) {
+			int e = best.e[0][k];
+			best.e[0][k] = best.e[1][k];
+			best.e[1][k] = e;
+		}
+		for (int i = 0; i < 16; i++) best.indices[i] = 15 - best.indices[i];
+	}
+	struct ImgPackBc7Bits bits = {out, 0};
+	memset(out, 0, 16);
+	imgpack_bc7__put(&bits, 1 << 6, 7);
+	for (int k = 0; k < 4; k++) {
+		imgpack_bc7__put(&bits, best.e[0][k] >> 1, 7);
+		imgpack_bc7__put(&bits, best.e[1][k] >> 1, 7);
+	}
+	imgpack_bc7__put(&bits, best.e[0][0] & 1, 1);
+	imgpack_bc7__put(&bits, best.e[1][0] & 1, 1);
+	imgpack_bc7__put(&bits, best.indices[0], 3);
+	for (int i = 1; i < 16; i++) imgpack_bc7__put(&bits, best.indices[i], 4);
+	return best.error;
+}
+
+static const int imgpack_bc7__weights2[4] = {0, 21, 43, 64};
+
+// Endpoints of n channels with bits per channel and 2-bit indices
+struct ImgPackBc7Fit2 {
+	int e[2][3];
+	int indices[16];
+	int error;
+};
+
+static void imgpack_bc7__try2(const float (*points)[4], int n, int bits, const float *e0, const float *e1,
+		struct ImgPackBc7Fit2 *best) {
+	struct ImgPackBc7Fit2 fit = {.error = 0};
+	int max = (1 << bits) - 1, palette[4][3];
+	for (int k = 0; k < n; k++) {
+		fit.e[0][k] = imgpack_bc__clamp((int)(e0[k] * max / 255.0f + 0.5f), 0, max);
+		fit.e[1][k] = imgpack_bc__clamp((int)(e1[k] * max / 255.0f + 0.5f), 0, max);
+		int c0 = bits == 8 ? fit.e[0][k] : fit.e[0][k] << (8 - bits) | fit.e[0][k] >> (2*bits - 8);
+		int c1 = bits == 8 ? fit.e[1][k] : fit.e[1][k] << (8 - bits) | fit.e[1][k] >> (2*bits - 8);
+		for (int j = 0; j < 4; j++) {
+			palette[j][k] = ((64 - imgpack_bc7__weights2[j]) * c0 + imgpack_bc7__weights2[j] * c1 + 32) >> 6;
+		}
+	}
+	for (int i = 0; i < 16; i++) {
+		int best_index = 0, best_error = 0x7fffffff;
+		for (int j = 0; j < 4; j++) {
+			int e = 0;
+			for (int k = 0; k < n; k++) {
+				int d = (int)points[i][k] - palette[j][k];
+				e += d * d;
+			}
+			if (e < best_error) {
+				best_index = j;
+				best_error = e;
+			}
+		}
+		fit.indices[i] = best_index;
+		fit.error += best_error;
+	}
+	if (fit.error < best->error) *best = fit;
+}
+
+static struct ImgPackBc7Fit2 imgpack_bc7__fit2(const float (*points)[4], int n, int bits, enum ImgPackBlockQuality quality) {
+	struct ImgPackBc7Fit2 best = {.error = 0x7fffffff};
+	float e0[4], e1[4], t[16];
+	imgpack_bc__fit(points, 16, n, e0, e1);
+	imgpack_bc7__try2(points, n, bits, e0, e1, &best);
+	for (int pass = 0; pass < imgpack_bc__refines[quality] && best.error > 0; pass++) {
+		for (int i = 0; i < 16; i++) t[i] = imgpack_bc7__weights2[best.indices[i]] / 64.0f;
+		if (!imgpack_bc__least_squares(points, t, 16, n, e0, e1)) break;
+		int error = best.error;
+		imgpack_bc7__try2(points, n, bits, e0, e1, &best);
+		if (best.error >= error) break;
+	}
+	// The most significant bit of the first index is implicit zero
+	if (best.indices[0] & 2) {
+		for (int k = 0; k < n; k++) {
+			int e = best.e[0][k];
+			best.e[0][k] = best.e[1][k];
+			best.e[1][k] = e;
+		}
+		for (int i = 0; i < 16; i++) best.indices[i] = 3 - best.indices[i];
+	}
+	return best;
+}
+
+// Mode 5 has separate 7-bit color and 8-bit alpha endpoints, which fits
+// sprite edges where alpha changes independently of color. Rotation swaps
+// alpha with one of the color channels
+static int imgpack_bc7__mode5(const unsigned char *rgba, int rotation, enum ImgPackBlockQuality quality, unsigned char *out) {
+	float colors[16][4], alphas[16][4];
+	for (int i = 0; i < 16; i++) {
+		unsigned char p[4];
+		memcpy(p, rgba + 4*i, 4);
+		if (rotation > 0) {
+			p[3] = p[rotation - 1];
+			p[rotation - 1] = rgba[4*i + 3];
+		}
+		for (int k = 0; k < 3; k++) colors[i][k] = p[k];
+		alphas[i][0] = p[3];
+	}
+	struct ImgPackBc7Fit2 color = imgpack_bc7__fit2(colors, 3, 7, quality);
+	struct ImgPackBc7Fit2 alpha = imgpack_bc7__fit2(alphas, 1, 8, quality);
+	struct ImgPackBc7Bits bits = {out, 0};
+	memset(out, 0, 16);
+	imgpack_bc7__put(&bits, 1 << 5, 6);
+	imgpack_bc7__put(&bits, rotation, 2);
+	for (int k = 0; k < 3; k++) {
+		imgpack_bc7__put(&bits, color.e[0][k], 7);
+		imgpack_bc7__put(&bits, color.e[1][k], 7);
+	}
+	imgpack_bc7__put(&bits, alpha.e[0][0], 8);
+	imgpack_bc7__put(&bits, alpha.e[1][0], 8);
+	imgpack_bc7__put(&bits, color.indices[0], 1);
+	for (int i = 1; i < 16; i++) imgpack_bc7__put(&bits, color.indices[i], 2);
+	imgpack_bc7__put(&bits, alpha.indices[0], 1);
+	for (int i = 1; i < 16; i++) imgpack_bc7__put(&bits, alpha.indices[i], 2);
+	return color.error + alpha.error;
+}
+
+// Colors of fully transparent pixels are replaced by the average color of the
+// other pixels, so they don't take endpoint precision
+static void imgpack_bc_fill_transparent(const unsigned char *rgba, unsigned char *filled) {
+	int sum[3] = {0}, count = 0;
+	memcpy(filled, rgba, 64);
+	for (int i = 0; i < 16; i++) {
+		if (rgba[4*i + 3] == 0) continue;
+		for (int k = 0; k < 3; k++) sum[k] += rgba[4*i + k];
+		count++;
+	}
+	for (int i = 0; i < 16 && count > 0; i++) {
+		if (rgba[4*i + 3] != 0) continue;
+		for (int k = 0; k < 3; k++) filled[4*i + k] = (unsigned char)((sum[k] + count/2) / count);
+	}
+}
+
+static void imgpack_bc7_block(const unsigned char *rgba, enum ImgPackBlockQuality quality, unsigned char *out) {
+	unsigned char filled[64], block[16];
+	imgpack_bc_fill_transparent(rgba, filled);
+	rgba = filled;
+	int error = imgpack_bc7__mode6(rgba, quality, out);
+	for (int rotation = 0; rotation < (quality == IMGPACK_BLOCK_MAX ? 4 : 1) && error > 0; rotation++) {
+		int mode5_error = imgpack_bc7__mode5(rgba, rotation, quality, block);
+		if (mode5_error < error) {
+			memcpy(out, block, 16);
+			error = mode5_error;
+		}
+	}
+}
+
+#endif
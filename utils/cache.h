@@ -0,0 +1,636 @@
+/*
+ * Incremental build cache kept in --cache-dir. The index stores for every
+ * input file its mtime, size and content hash together with the prepared
+ * (scaled and trimmed) image metadata, trimmed pixels are stored in separate
+ * files named by the content hash. Also the index keeps the last layout and
+ * the written outputs, so unchanged inputs are not decoded, unchanged rects
+ * are not repacked and a completely unchanged run doesn't write anything.
+ *
+ * Files with the same mtime and size are trusted to be unchanged, unless they
+ * were modified in the same second the index was saved, otherwise their
+ * content hash is compared.
+ */
+
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define imgpack_mkdir(path) _mkdir(path)
+#else
+#define imgpack_mkdir(path) mkdir((path), 0755)
+#endif
+
+#define IMGPACK_CACHE_MAGIC 0x4b504d49
+#define IMGPACK_CACHE_VERSION 2
+
+struct ImgPackCacheEntry {
+	char *path;
+	int64_t mtime;
+	int64_t fileSize;
+	uint64_t contentHash;
+	uint64_t hash;
+	int originalWidth;
+	int originalHeight;
+	int width;
+	int height;
+	int minX;
+	int minY;
+	int maxX;
+	int maxY;
+};
+
+struct ImgPackCacheFile {
+	char *path;
+	int64_t mtime;
+	int64_t fileSize;
+};
+
+struct ImgPackCache {
+	char *dir;
+	uint64_t prepareKey;
+	uint64_t loadedPrepareKey;
+	uint64_t runKey;
+	uint64_t layoutKey;
+	int64_t savedAt;
+	int stale;
+	int upToDate;
+	int reused;
+	int decoded;
+
+	struct ImgPackCacheEntry *entries;
+	int entriesCount;
+	struct ImgPackUniqueSlot *pathSlots;
+	struct ImgPackUniqueSlot *contentSlots;
+	int slotsAllocated;
+
+	struct ImgPackCacheEntry *current;
+	int currentCount;
+	int currentAllocated;
+
+	stbrp_rect *rects;
+	int *rectsPages;
+	int *rectsRotated;
+	int rectsCount;
+	struct ImgPackPage *pages;
+	int pagesCount;
+
+	struct ImgPackCacheFile *outputs;
+	int outputsCount;
+};
+
+// FNV-1a, used for the short keys, file contents are hashed with imgpack_hash
+static uint64_t imgpack_cache__hash(uint64_t hash, const void *data, size_t size) {
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static uint64_t imgpack_cache__hash_int(uint64_t hash, int64_t v) {
+	return imgpack_cache__hash(hash, &v, sizeof(v));
+}
+
+static uint64_t imgpack_cache__hash_string(uint64_t hash, const char *s) {
+	return imgpack_cache__hash(hash, s, strlen(s) + 1);
+}
+
+static int imgpack_cache__stat(const char *path, int64_t *mtime, int64_t *size) {
+	struct stat st;
+	if (stat(path, &st)) return 1;
+	*mtime = (int64_t)st.st_mtime;
+	*size = (int64_t)st.st_size;
+	return 0;
+}
+
+static char *imgpack_cache__path(struct ImgPackCache *cache, const char *name) {
+	char *path = ISLIP_MALLOC(strlen(cache->dir) + strlen(name) + 2);
+	sprintf(path, "%s/%s", cache->dir, name);
+	return path;
+}
+
+// Trimmed pixels are stored by content, so renamed and duplicated files share them
+static char *imgpack_cache__pixels_path(struct ImgPackCache *cache, uint64_t prepare_key, uint64_t content_hash) {
+	char name[32];
+	sprintf(name, "%016" PRIx64 ".px", content_hash ^ prepare_key);
+	return imgpack_cache__path(cache, name);
+}
+
+static void imgpack_cache__put(FILE *f, int64_t v) {
+	fwrite(&v, sizeof(v), 1, f);
+}
+
+static void imgpack_cache__put_string(FILE *f, const char *s) {
+	int64_t len = strlen(s);
+	imgpack_cache__put(f, len);
+	fwrite(s, 1, len, f);
+}
+
+static int64_t imgpack_cache__get(FILE *f, int *error) {
+	int64_t v = 0;
+	if (fread(&v, sizeof(v), 1, f) != 1) *error = 1;
+	return v;
+}
+
+static char *imgpack_cache__get_string(FILE *f, int *error) {
+	int64_t len = imgpack_cache__get(f, error);
+	if (*error || len < 0 || len > 0xffff) {
+		*error = 1;
+		return NULL;
+	}
+	char *s = ISLIP_MALLOC(len + 1);
+	if (fread(s, 1, len, f) != (size_t)len) *error = 1;
+	s[len] = '\0';
+	return s;
+}
+
+static void imgpack_cache__put_entry(FILE *f, const struct ImgPackCacheEntry *entry) {
+	imgpack_cache__put_string(f, entry->path);
+	imgpack_cache__put(f, entry->mtime);
+	imgpack_cache__put(f, entry->fileSize);
+	imgpack_cache__put(f, (int64_t)entry->contentHash);
+	imgpack_cache__put(f, (int64_t)entry->hash);
+	imgpack_cache__put(f, (int64_t)entry->originalWidth << 32 | (uint32_t)entry->originalHeight);
+	imgpack_cache__put(f, (int64_t)entry->width << 32 | (uint32_t)entry->height);
+	imgpack_cache__put(f, (int64_t)entry->minX << 32 | (uint32_t)entry->minY);
+	imgpack_cache__put(f, (int64_t)entry->maxX << 32 | (uint32_t)entry->maxY);
+}
+
+static void imgpack_cache__get_entry(FILE *f, struct ImgPackCacheEntry *entry, int *error) {
+	int64_t v;
+	entry->path = imgpack_cache__get_string(f, error);
+	entry->mtime = imgpack_cache__get(f, error);
+	entry->fileSize = imgpack_cache__get(f, error);
+	entry->contentHash = imgpack_cache__get(f, error);
+	entry->hash = imgpack_cache__get(f, error);
+	v = imgpack_cache__get(f, error);
+	entry->originalWidth = (int)(v >> 32);
+	entry->originalHeight = (int)(int32_t)v;
+	v = imgpack_cache__get(f, error);
+	entry->width = (int)(v >> 32);
+	entry->height = (int)(int32_t)v;
+	v = imgpack_cache__get(f, error);
+	entry->minX = (int)(v >> 32);
+	entry->minY = (int)(int32_t)v;
+	v = imgpack_cache__get(f, error);
+	entry->maxX = (int)(v >> 32);
+	entry->maxY = (int)(int32_t)v;
+}
+
+static void imgpack_cache__index_entries(struct ImgPackCache *cache) {
+	int allocated = 64;
+	while (allocated < 2 * cache->entriesCount) allocated *= 2;
+	cache->slotsAllocated = allocated;
+	cache->pathSlots = ISLIP_MALLOC(allocated * sizeof(*cache->pathSlots));
+	cache->contentSlots = ISLIP_MALLOC(allocated * sizeof(*cache->contentSlots));
+	for (int i = 0; i < allocated; i++) {
+		cache->pathSlots[i].id = -1;
+		cache->contentSlots[i].id = -1;
+	}
+	uint64_t mask = allocated - 1;
+	for (int i = 0; i < cache->entriesCount; i++) {
+		uint64_t key = imgpack_cache__hash_string(0xcbf29ce484222325ULL, cache->entries[i].path);
+		uint64_t j = key & mask;
+		while (cache->pathSlots[j].id >= 0) j = (j + 1) & mask;
+		cache->pathSlots[j] = (struct ImgPackUniqueSlot) {.key = key, .id = i};
+		key = cache->entries[i].contentHash;
+		for (j = key & mask; cache->contentSlots[j].id >= 0; j = (j + 1) & mask) {
+			if (cache->contentSlots[j].key == key) break;
+		}
+		if (cache->contentSlots[j].id < 0) {
+			cache->contentSlots[j] = (struct ImgPackUniqueSlot) {.key = key, .id = i};
+		}
+	}
+}
+
+static int imgpack_cache__find_path(const struct ImgPackCache *cache, const char *path) {
+	if (cache->stale || !cache->slotsAllocated) return -1;
+	uint64_t key = imgpack_cache__hash_string(0xcbf29ce484222325ULL, path);
+	uint64_t mask = cache->slotsAllocated - 1;
+	for (uint64_t j = key & mask; cache->pathSlots[j].id >= 0; j = (j + 1) & mask) {
+		if (cache->pathSlots[j].key == key && !strcmp(cache->entries[cache->pathSlots[j].id].path, path)) {
+			return cache->pathSlots[j].id;
+		}
+	}
+	return -1;
+}
+
+static int imgpack_cache__find_content(const struct ImgPackCache *cache, uint64_t content_hash) {
+	if (cache->stale || !cache->slotsAllocated) return -1;
+	uint64_t mask = cache->slotsAllocated - 1;
+	for (uint64_t j = content_hash & mask; cache->contentSlots[j].id >= 0; j = (j + 1) & mask) {
+		if (cache->contentSlots[j].key == content_hash) {
+			return cache->contentSlots[j].id;
+		}
+	}
+	return -1;
+}
+
+// Settings which change prepared pixels invalidate all entries
+static uint64_t imgpack_cache__prepare_key(struct ImgPackContext *ctx) {
+	uint64_t key = 0xcbf29ce484222325ULL;
+	key = imgpack_cache__hash_int(key, IMGPACK_CACHE_VERSION);
+	key = imgpack_cache__hash_int(key, ctx->scaleNumerator);
+	key = imgpack_cache__hash_int(key, ctx->scaleDenominator);
+	key = imgpack_cache__hash_int(key, ctx->trimThreshold);
+	return key;
+}
+
+// Command line without options not affecting outputs, followed by paths and
+// content hashes of all inputs
+static uint64_t imgpack_cache__run_key(struct ImgPackContext *ctx) {
+	uint64_t key = ctx->cache->prepareKey;
+	for (int i = 1; i < ctx->argc; i++) {
+		const char *arg = ctx->argv[i];
+		if (!strcmp(arg, "--verbose") || !strcmp(arg, "-v")) continue;
+		if (!strcmp(arg, "--jobs") || !strcmp(arg, "-j")) {
+			i++;
+			continue;
+		}
+		key = imgpack_cache__hash_string(key, arg);
+	}
+	return key;
+}
+
+static uint64_t imgpack_cache__run_key_input(uint64_t key, const char *path, uint64_t content_hash) {
+	key = imgpack_cache__hash_string(key, path);
+	return imgpack_cache__hash_int(key, content_hash);
+}
+
+// Packing settings and sizes of all rects before packing
+static uint64_t imgpack_cache__layout_key(struct ImgPackContext *ctx) {
+	uint64_t key = ctx->cache->prepareKey;
+	key = imgpack_cache__hash_string(key, ctx->packer->name);
+	key = imgpack_cache__hash_int(key, ctx->sortOrder);
+	key = imgpack_cache__hash_int(key, ctx->packEffort);
+	key = imgpack_cache__hash_int(key, ctx->forcePOT);
+	key = imgpack_cache__hash_int(key, ctx->forceSquared);
+	key = imgpack_cache__hash_int(key, ctx->allowMultipack);
+	key = imgpack_cache__hash_int(key, ctx->allowRotation);
+	key = imgpack_cache__hash_int(key, ctx->maxWidth);
+	key = imgpack_cache__hash_int(key, ctx->maxHeight);
+	key = imgpack_cache__hash_int(key, (int64_t)(ctx->sideGrowCoefficient * 1000));
+	key = imgpack_cache__hash_int(key, ctx->seed != NULL);
+	// Block formats and mipmaps align rects to their pack unit
+	key = imgpack_cache__hash_int(key, imgpack_texture_formats[ctx->colorFormat].blockSize);
+	key = imgpack_cache__hash_int(key, ctx->mipmaps);
+	for (int i = 0; i < ctx->size; i++) {
+		key = imgpack_cache__hash_int(key, (int64_t)ctx->packingRects[i].w << 32 | ctx->packingRects[i].h);
+		key = imgpack_cache__hash_int(key, ctx->images[i].copyOf);
+	}
+	return key;
+}
+
+static void imgpack_cache__load(struct ImgPackCache *cache) {
+	char *index_path = imgpack_cache__path(cache, "index");
+	FILE *f = fopen(index_path, "rb");
+	ISLIP_FREE(index_path);
+	if (!f) return;
+	int error = 0;
+	if (imgpack_cache__get(f, &error) != IMGPACK_CACHE_MAGIC || imgpack_cache__get(f, &error) != IMGPACK_CACHE_VERSION) {
+		fclose(f);
+		return;
+	}
+	cache->loadedPrepareKey = imgpack_cache__get(f, &error);
+	cache->stale = cache->loadedPrepareKey != cache->prepareKey;
+	cache->runKey = imgpack_cache__get(f, &error);
+	cache->layoutKey = imgpack_cache__get(f, &error);
+	cache->savedAt = imgpack_cache__get(f, &error);
+	int64_t count = imgpack_cache__get(f, &error);
+	if (!error && count > 0 && count < INT32_MAX / (int64_t)sizeof(*cache->entries)) {
+		cache->entries = ISLIP_MALLOC(count * sizeof(*cache->entries));
+		for (; cache->entriesCount < count && !error; cache->entriesCount++) {
+			imgpack_cache__get_entry(f, &cache->entries[cache->entriesCount], &error);
+		}
+	}
+	count = imgpack_cache__get(f, &error);
+	if (!error && count > 0 && count < INT32_MAX / (int64_t)sizeof(*cache->rects)) {
+		cache->rects = ISLIP_MALLOC(count * sizeof(*cache->rects));
+		cache->rectsPages = ISLIP_MALLOC(count * sizeof(*cache->rectsPages));
+		cache->rectsRotated = ISLIP_MALLOC(count * sizeof(*cache->rectsRotated));
+		for (; cache->rectsCount < count && !error; cache->rectsCount++) {
+			int64_t xy = imgpack_cache__get(f, &error), wh = imgpack_cache__get(f, &error);
+			cache->rects[cache->rectsCount] = (stbrp_rect) {.id = cache->rectsCount,
+				.x = (int)(xy >> 32), .y = (int)(int32_t)xy, .w = (int)(wh >> 32), .h = (int)(int32_t)wh, .was_packed = 1};
+			int64_t page = imgpack_cache__get(f, &error);
+			cache->rectsPages[cache->rectsCount] = (int)(page >> 1);
+			cache->rectsRotated[cache->rectsCount] = (int)(page & 1);
+		}
+	}
+	count = imgpack_cache__get(f, &error);
+	if (!error && count > 0 && count < 0xffff) {
+		cache->pages = ISLIP_MALLOC(count * sizeof(*cache->pages));
+		for (; cache->pagesCount < count; cache->pagesCount++) {
+			int64_t wh = imgpack_cache__get(f, &error);
+			cache->pages[cache->pagesCount] = (struct ImgPackPage) {.width = (int)(wh >> 32), .height = (int)(int32_t)wh};
+		}
+	}
+	count = imgpack_cache__get(f, &error);
+	if (!error && count > 0 && count < 0xffff) {
+		cache->outputs = ISLIP_MALLOC(count * sizeof(*cache->outputs));
+		for (; cache->outputsCount < count && !error; cache->outputsCount++) {
+			struct ImgPackCacheFile *output = &cache->outputs[cache->outputsCount];
+			output->path = imgpack_cache__get_string(f, &error);
+			output->mtime = imgpack_cache__get(f, &error);
+			output->fileSize = imgpack_cache__get(f, &error);
+		}
+	}
+	fclose(f);
+	if (error) {
+		// Truncated index is not trusted, but its entries are kept to remove their pixels
+		cache->stale = 1;
+		cache->rectsCount = 0;
+		cache->outputsCount = 0;
+	}
+	imgpack_cache__index_entries(cache);
+}
+
+static int imgpack_cache_open(struct ImgPackContext *ctx, const char *dir) {
+	struct stat st;
+	if (stat(dir, &st) && imgpack_mkdir(dir)) {
+		printf("Cannot create cache directory \"%s\"\n", dir);
+		return 1;
+	}
+	struct ImgPackCache *cache = ISLIP_MALLOC(sizeof(*cache));
+	*cache = (struct ImgPackCache) {.dir = copy_string(dir), .prepareKey = imgpack_cache__prepare_key(ctx)};
+	ctx->cache = cache;
+	imgpack_cache__load(cache);
+	if (ctx->verbose) printf("// Loaded %d cached entries from \"%s\"%s\n", cache->entriesCount, dir, cache->stale ? " (stale)" : "");
+	return 0;
+}
+
+// Remembers metadata of the input for the next run, inputs which are not
+// images are remembered too with zero size
+static void imgpack_cache_track_input(struct ImgPackContext *ctx, struct ImgPackInput *input) {
+	struct ImgPackCache *cache = ctx->cache;
+	if (cache->currentCount >= cache->currentAllocated) {
+		cache->currentAllocated = cache->currentAllocated ? 2 * cache->currentAllocated : 64;
+		cache->current = ISLIP_REALLOC(cache->current, cache->currentAllocated * sizeof(*cache->current));
+	}
+	cache->current[cache->currentCount++] = (struct ImgPackCacheEntry) {
+		.path = copy_string(input->path),
+		.mtime = input->mtime,
+		.fileSize = input->fileSize,
+		.contentHash = input->contentHash,
+		.hash = input->hash,
+		.originalWidth = input->originalWidth,
+		.originalHeight = input->originalHeight,
+		.width = input->width,
+		.height = input->height,
+		.minX = input->minX,
+		.minY = input->minY,
+		.maxX = input->maxX,
+		.maxY = input->maxY,
+	};
+	if (input->cacheEntry >= 0 && input->width > 0) cache->reused++;
+	else if (input->width > 0) cache->decoded++;
+}
+
+// Matches inputs against the index by path, mtime and size. Returns 1 if all
+// inputs and outputs are the same as after the last run, so nothing has to be done
+static int imgpack_cache_lookup(struct ImgPackContext *ctx, struct ImgPackInputs *inputs) {
+	struct ImgPackCache *cache = ctx->cache;
+	int matched = 0;
+	for (int i = 0; i < inputs->size; i++) {
+		struct ImgPackInput *input = &inputs->items[i];
+		input->cacheEntry = -1;
+		if (imgpack_cache__stat(input->path, &input->mtime, &input->fileSize)) continue;
+		int entry = imgpack_cache__find_path(cache, input->path);
+		if (entry >= 0 && cache->entries[entry].mtime == input->mtime && cache->entries[entry].fileSize == input->fileSize &&
+				input->mtime < cache->savedAt) {
+			input->cacheEntry = entry;
+			input->contentHash = cache->entries[entry].contentHash;
+			matched++;
+		}
+	}
+	if (matched < inputs->size || cache->outputsCount == 0) return 0;
+	for (int i = 0; i < cache->outputsCount; i++) {
+		int64_t mtime, size;
+		if (imgpack_cache__stat(cache->outputs[i].path, &mtime, &size) ||
+				mtime != cache->outputs[i].mtime || size != cache->outputs[i].fileSize) {
+			return 0;
+		}
+	}
+	uint64_t run_key = imgpack_cache__run_key(ctx);
+	for (int i = 0; i < inputs->size; i++) {
+		run_key = imgpack_cache__run_key_input(run_key, inputs->items[i].path, inputs->items[i].contentHash);
+	}
+	return !cache->stale && run_key == cache->runKey;
+}
+
+static void imgpack_cache__prepare_entry(struct ImgPackInput *input, const struct ImgPackCacheEntry *entry) {
+	input->originalWidth = entry->originalWidth;
+	input->originalHeight = entry->originalHeight;
+	input->width = entry->width;
+	input->height = entry->height;
+	input->minX = entry->minX;
+	input->minY = entry->minY;
+	input->maxX = entry->maxX;
+	input->maxY = entry->maxY;
+	input->hash = entry->hash;
+}
+
+// Restores full size image with trimmed pixels in place, other pixels are
+// never drawn so they are left transparent
+static int imgpack_cache__load_pixels(struct ImgPackCache *cache, struct ImgPackInput *input, const struct ImgPackCacheEntry *entry) {
+	if (entry->width <= 0) return 1;
+	char *path = imgpack_cache__pixels_path(cache, cache->prepareKey, entry->contentHash);
+	FILE *f = fopen(path, "rb");
+	ISLIP_FREE(path);
+	if (!f) return 0;
+	int w = entry->maxX - entry->minX + 1, h = entry->maxY - entry->minY + 1;
+	stbi_uc *data = ISLIP_MALLOC(4 * entry->width * entry->height);
+	int ok = data != NULL;
+	if (ok) {
+		memset(data, 0, 4 * entry->width * entry->height);
+		for (int y = 0; y < h && ok; y++) {
+			ok = fread(data + 4*((entry->minY + y)*entry->width + entry->minX), 4, w, f) == (size_t)w;
+		}
+		ok = ok && fgetc(f) == EOF;
+	}
+	fclose(f);
+	if (!ok) {
+		ISLIP_FREE(data);
+		return 0;
+	}
+	imgpack_cache__prepare_entry(input, entry);
+	input->data = data;
+	return 1;
+}
+
+// Called from decoding workers. Returns 1 if the input was restored from the
+// cache, otherwise reads the whole file into file_data to decode it from memory
+static int imgpack_cache_load_image(struct ImgPackContext *ctx, struct ImgPackInput *input, unsigned char **file_data, int *file_size) {
+	struct ImgPackCache *cache = ctx->cache;
+	if (input->cacheEntry >= 0 && imgpack_cache__load_pixels(cache, input, &cache->entries[input->cacheEntry])) {
+		return 1;
+	}
+	input->cacheEntry = -1;
+	FILE *f = fopen(input->path, "rb");
+	if (!f) return 0;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	unsigned char *data = size > 0 && size < INT32_MAX ? ISLIP_MALLOC(size) : NULL;
+	if (data && fread(data, 1, size, f) != (size_t)size) {
+		ISLIP_FREE(data);
+		data = NULL;
+	}
+	fclose(f);
+	if (!data) return 0;
+	input->fileSize = size;
+	input->contentHash = imgpack_hash(data, size, 0);
+	int entry = imgpack_cache__find_content(cache, input->contentHash);
+	if (entry >= 0 && cache->entries[entry].fileSize == size && imgpack_cache__load_pixels(cache, input, &cache->entries[entry])) {
+		input->cacheEntry = entry;
+		ISLIP_FREE(data);
+		return 1;
+	}
+	*file_data = data;
+	*file_size = (int)size;
+	return 0;
+}
+
+// Called from decoding workers for freshly decoded images. Concurrent writes
+// of the same content go to different temporary files and are renamed over
+static void imgpack_cache_store_image(struct ImgPackContext *ctx, struct ImgPackInput *input, int index) {
+	struct ImgPackCache *cache = ctx->cache;
+	char *path = imgpack_cache__pixels_path(cache, cache->prepareKey, input->contentHash);
+	char *tmp_path = ISLIP_MALLOC(strlen(path) + 16);
+	sprintf(tmp_path, "%s.%d.tmp", path, index);
+	FILE *f = fopen(tmp_path, "wb");
+	if (f) {
+		int w = input->maxX - input->minX + 1, ok = 1;
+		for (int y = input->minY; y <= input->maxY && ok; y++) {
+			ok = fwrite(input->data + 4*(y*input->width + input->minX), 4, w, f) == (size_t)w;
+		}
+		ok = !fclose(f) && ok;
+		if (!ok || rename(tmp_path, path)) remove(tmp_path);
+	}
+	ISLIP_FREE(tmp_path);
+	ISLIP_FREE(path);
+}
+
+// Restores the last layout if packing settings and sizes of all rects are the same
+static int imgpack_cache_restore_layout(struct ImgPackContext *ctx) {
+	struct ImgPackCache *cache = ctx->cache;
+	uint64_t layout_key = cache->layoutKey;
+	cache->layoutKey = imgpack_cache__layout_key(ctx);
+	if (cache->stale || ctx->seed || layout_key != cache->layoutKey || cache->rectsCount != ctx->size || cache->pagesCount == 0) {
+		return 0;
+	}
+	for (int i = 0; i < ctx->size; i++) {
+		stbrp_rect rect = cache->rects[i];
+		// Rotated rects are saved in the original orientation, packers leave them swapped
+		if (cache->rectsRotated[i]) {
+			int w = rect.w;
+			rect.w = rect.h;
+			rect.h = w;
+		}
+		ctx->packingRects[i] = rect;
+		ctx->packingPages[i] = cache->rectsPages[i];
+		ctx->packingRotated[i] = cache->rectsRotated[i];
+	}
+	return 1;
+}
+
+static int compare_cache_keys(const void *a, const void *b) {
+	uint64_t ka = *(const uint64_t *)a, kb = *(const uint64_t *)b;
+	return ka < kb ? -1 : ka > kb;
+}
+
+// Removes pixels of entries which are not used anymore, including pixels
+// prepared with other settings
+static void imgpack_cache__remove_unused(struct ImgPackCache *cache) {
+	uint64_t *keys = ISLIP_MALLOC((cache->currentCount + 1) * sizeof(*keys));
+	for (int i = 0; i < cache->currentCount; i++) {
+		keys[i] = cache->current[i].contentHash ^ cache->prepareKey;
+	}
+	qsort(keys, cache->currentCount, sizeof(*keys), compare_cache_keys);
+	for (int i = 0; i < cache->entriesCount; i++) {
+		uint64_t key = cache->entries[i].contentHash ^ cache->loadedPrepareKey;
+		if (cache->entries[i].width > 0 && !bsearch(&key, keys, cache->currentCount, sizeof(*keys), compare_cache_keys)) {
+			char *path = imgpack_cache__pixels_path(cache, cache->loadedPrepareKey, cache->entries[i].contentHash);
+			remove(path);
+			ISLIP_FREE(path);
+		}
+	}
+	ISLIP_FREE(keys);
+}
+
+static int imgpack_cache_save(struct ImgPackContext *ctx) {
+	struct ImgPackCache *cache = ctx->cache;
+	char *index_path = imgpack_cache__path(cache, "index");
+	char *tmp_path = imgpack_cache__path(cache, "index.tmp");
+	FILE *f = fopen(tmp_path, "wb");
+	int status = 1;
+	if (f) {
+		imgpack_cache__put(f, IMGPACK_CACHE_MAGIC);
+		imgpack_cache__put(f, IMGPACK_CACHE_VERSION);
+		imgpack_cache__put(f, cache->prepareKey);
+		uint64_t run_key = imgpack_cache__run_key(ctx);
+		for (int i = 0; i < cache->currentCount; i++) {
+			run_key = imgpack_cache__run_key_input(run_key, cache->current[i].path, cache->current[i].contentHash);
+		}
+		imgpack_cache__put(f, run_key);
+		imgpack_cache__put(f, cache->layoutKey);
+		imgpack_cache__put(f, (int64_t)time(NULL));
+		imgpack_cache__put(f, cache->currentCount);
+		for (int i = 0; i < cache->currentCount; i++) {
+			imgpack_cache__put_entry(f, &cache->current[i]);
+		}
+		imgpack_cache__put(f, ctx->size);
+		for (int i = 0; i < ctx->size; i++) {
+			stbrp_rect rect = ctx->packingRects[i];
+			int rotated = ctx->packingRotated[i];
+			// Layout is restored before packing, so rects are saved in the original orientation
+			if (rotated) rect = (stbrp_rect) {.x = rect.x, .y = rect.y, .w = rect.h, .h = rect.w};
+			imgpack_cache__put(f, (int64_t)rect.x << 32 | (uint32_t)rect.y);
+			imgpack_cache__put(f, (int64_t)rect.w << 32 | (uint32_t)rect.h);
+			imgpack_cache__put(f, (int64_t)ctx->packingPages[i] << 1 | rotated);
+		}
+		imgpack_cache__put(f, ctx->pagesCount);
+		for (int i = 0; i < ctx->pagesCount; i++) {
+			imgpack_cache__put(f, (int64_t)ctx->pages[i].width << 32 | (uint32_t)ctx->pages[i].height);
+		}
+		int outputs_count = ctx->pagesCount + (ctx->outputDataPath != NULL);
+		imgpack_cache__put(f, ctx->outputDataPath ? outputs_count : 0);
+		for (int i = 0; ctx->outputDataPath && i < outputs_count; i++) {
+			const char *path = i < ctx->pagesCount ? ctx->pages[i].imagePath : ctx->outputDataPath;
+			int64_t mtime = 0, size = -1;
+			imgpack_cache__stat(path, &mtime, &size);
+			imgpack_cache__put_string(f, path);
+			imgpack_cache__put(f, mtime);
+			imgpack_cache__put(f, size);
+		}
+		status = ferror(f);
+		status = fclose(f) || status;
+		if (!status) status = rename(tmp_path, index_path) != 0;
+	}
+	if (!status) imgpack_cache__remove_unused(cache);
+	if (ctx->verbose) printf("// Cache: %d images reused, %d decoded\n", cache->reused, cache->decoded);
+	ISLIP_FREE(tmp_path);
+	ISLIP_FREE(index_path);
+	return status;
+}
+
+static void imgpack_cache_free(struct ImgPackContext *ctx) {
+	struct ImgPackCache *cache = ctx->cache;
+	if (!cache) return;
+	for (int i = 0; i < cache->entriesCount; i++) ISLIP_FREE(cache->entries[i].path);
+	for (int i = 0; i < cache->currentCount; i++) ISLIP_FREE(cache->current[i].path);
+	for (int i = 0; i < cache->outputsCount; i++) ISLIP_FREE(cache->outputs[i].path);
+	ISLIP_FREE(cache->entries);
+	ISLIP_FREE(cache->current);
+	ISLIP_FREE(cache->outputs);
+	ISLIP_FREE(cache->pathSlots);
+	ISLIP_FREE(cache->contentSlots);
+	ISLIP_FREE(cache->rects);
+	ISLIP_FREE(cache->rectsPages);
+	ISLIP_FREE(cache->rectsRotated);
+	ISLIP_FREE(cache->pages);
+	ISLIP_FREE(cache->dir);
+	ISLIP_FREE(cache);
+	ctx->cache = NULL;
+}
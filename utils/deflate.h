@@ -0,0 +1,537 @@
+/*
+ * Raw deflate encoder used by the PNG writer. Compresses a range of the buffer
+ * with LZ77 over hash chains and emits dynamic, fixed or stored blocks,
+ * whichever is the smallest. Bytes before the range serve as a preset
+ * dictionary, so independently compressed ranges lose almost nothing when they
+ * are joined.
+ *
+ * Output of imgpack_deflate ends with a sync flush (an empty stored block), so
+ * outputs of consecutive ranges can be concatenated as is; the stream is closed
+ * by a final empty fixed block, bytes 03 00.
+ */
+
+#ifndef IMGPACK_DEFLATE_H_
+#define IMGPACK_DEFLATE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IMGPACK_DEFLATE_WINDOW 32768
+#define IMGPACK_DEFLATE_MIN_MATCH 3
+#define IMGPACK_DEFLATE_MAX_MATCH 258
+#define IMGPACK_DEFLATE_HASH_BITS 15
+#define IMGPACK_DEFLATE_BLOCK_SYMBOLS 65536
+
+enum ImgPackDeflateLevel {
+	IMGPACK_DEFLATE_FAST,
+	IMGPACK_DEFLATE_DEFAULT,
+	IMGPACK_DEFLATE_MAX,
+};
+
+struct ImgPackDeflateOutput {
+	unsigned char *data;
+	size_t size;
+	size_t allocated;
+	uint64_t bits;
+	int bitsCount;
+	int failed;
+};
+
+// Literal or length/distance pair with precomputed codes and extra bits
+struct ImgPackDeflateSymbol {
+	uint16_t litlen;
+	uint16_t dist;
+	uint16_t litlenExtra;
+	uint16_t distExtra;
+};
+
+struct ImgPackDeflateTree {
+	uint16_t codes[288];
+	uint8_t lengths[288];
+};
+
+static const uint16_t imgpack_deflate__length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t imgpack_deflate__length_bits[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t imgpack_deflate__dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+	1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t imgpack_deflate__dist_bits[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+static const uint8_t imgpack_deflate__lengths_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+};
+
+static int imgpack_deflate__log2(unsigned v) {
+	int n = 0;
+	while (v >>= 1) n++;
+	return n;
+}
+
+static void imgpack_deflate__reserve(struct ImgPackDeflateOutput *out, size_t size) {
+	if (out->size + size <= out->allocated || out->failed) return;
+	size_t allocated = out->allocated ? out->allocated : 4096;
+	while (allocated < out->size + size) allocated *= 2;
+	unsigned char *data = ISLIP_REALLOC(out->data, allocated);
+	if (!data) {
+		out->failed = 1;
+		return;
+	}
+	out->data = data;
+	out->allocated = allocated;
+}
+
+// Bits are written LSB first, whole bytes are moved to the buffer
+static void imgpack_deflate__put(struct ImgPackDeflateOutput *out, unsigned value, int count) {
+	out->bits |= (uint64_t)value << out->bitsCount;
+	out->bitsCount += count;
+	if (out->bitsCount >= 32) {
+		imgpack_deflate__reserve(out, 4);
+		if (out->failed) return;
+		for (int i = 0; i < 4; i++) out->data[out->size++] = (unsigned char)(out->bits >> 8*i);
+		out->bits >>= 32;
+		out->bitsCount -= 32;
+	}
+}
+
+static void imgpack_deflate__align(struct ImgPackDeflateOutput *out) {
+	imgpack_deflate__reserve(out, 8);
+	if (out->failed) return;
+	while (out->bitsCount > 0) {
+		out->data[out->size++] = (unsigned char)out->bits;
+		out->bits >>= 8;
+		out->bitsCount -= 8;
+	}
+	out->bits = 0;
+	out->bitsCount = 0;
+}
+
+static void imgpack_deflate__bytes(struct ImgPackDeflateOutput *out, const unsigned char *data, size_t size) {
+	imgpack_deflate__reserve(out, size);
+	if (out->failed) return;
+	memcpy(out->data + out->size, data, size);
+	out->size += size;
+}
+
+static int imgpack_deflate__compare_freqs(const void *a, const void *b) {
+	const uint32_t *x = a, *y = b;
+	return x[0] != y[0] ? (x[0] < y[0] ? -1 : 1) : (x[1] < y[1] ? -1 : x[1] > y[1]);
+}
+
+// Huffman code lengths limited to max_bits. Lengths from the Huffman tree are
+// turned into per-length counts, overlong codes are moved to max_bits and the
+// Kraft sum is fixed by lengthening the deepest shorter codes, then lengths are
+// given back to symbols from the most frequent one
+static void imgpack_deflate__build_lengths(const uint32_t *freqs, int count, int max_bits, uint8_t *lengths) {
+	uint32_t sorted[288][2];
+	uint32_t weights[2*288];
+	int parents[2*288];
+	int n = 0;
+	memset(lengths, 0, count);
+	for (int i = 0; i < count; i++) {
+		if (freqs[i]) {
+			sorted[n][0] = freqs[i];
+			sorted[n][1] = i;
+			n++;
+		}
+	}
+	if (n == 0) return;
+	if (n == 1) {
+		// Some decoders reject incomplete codes, so add one unused symbol
+		lengths[sorted[0][1]] = 1;
+		lengths[sorted[0][1] ? 0 : 1] = 1;
+		return;
+	}
+	qsort(sorted, n, sizeof(*sorted), imgpack_deflate__compare_freqs);
+	// Two queues: leaves are sorted, internal nodes are created in increasing weight
+	for (int i = 0; i < n; i++) weights[i] = sorted[i][0];
+	int leaf = 0, node = n, next = n;
+	for (; next < 2*n - 1; next++) {
+		int child[2];
+		for (int k = 0; k < 2; k++) {
+			if (leaf < n && (node >= next || weights[leaf] <= weights[node])) child[k] = leaf++;
+			else child[k] = node++;
+		}
+		weights[next] = weights[child[0]] + weights[child[1]];
+		parents[child[0]] = next;
+		parents[child[1]] = next;
+	}
+	int depths[2*288];
+	int counts[64] = {0};
+	depths[2*n - 2] = 0;
+	for (int i = 2*n - 3; i >= 0; i--) {
+		depths[i] = depths[parents[i]] + 1;
+		if (i < n) counts[depths[i] < 63 ? depths[i] : 63]++;
+	}
+	for (int i = max_bits + 1; i < 64; i++) {
+		counts[max_bits] += counts[i];
+		counts[i] = 0;
+	}
+	uint32_t total = 0;
+	for (int i = 1; i <= max_bits; i++) total += (uint32_t)counts[i] << (max_bits - i);
+	while (total > (1u << max_bits)) {
+		counts[max_bits]--;
+		for (int i = max_bits - 1; i > 0; i--) {
+			if (counts[i]) {
+				counts[i]--;
+				counts[i + 1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
+	for (int bits = 1, i = n - 1; bits <= max_bits; bits++) {
+		for (int k = 0; k < counts[bits]; k++) lengths[sorted[i--][1]] = (uint8_t)bits;
+	}
+}
+
+// Canonical codes, bit-reversed for LSB first output
+static void imgpack_deflate__build_codes(struct ImgPackDeflateTree *tree, int count) {
+	int counts[16] = {0};
+	unsigned next[16];
+	for (int i = 0; i < count; i++) counts[tree->lengths[i]]++;
+	counts[0] = 0;
+	unsigned code = 0;
+	for (int bits = 1; bits < 16; bits++) {
+		code = (code + counts[bits - 1]) << 1;
+		next[bits] = code;
+	}
+	for (int i = 0; i < count; i++) {
+		int length = tree->lengths[i];
+		if (!length) continue;
+		unsigned c = next[length]++, reversed = 0;
+		for (int k = 0; k < length; k++) reversed |= ((c >> k) & 1) << (length - 1 - k);
+		tree->codes[i] = (uint16_t)reversed;
+	}
+}
+
+static void imgpack_deflate__fixed_trees(struct ImgPackDeflateTree *litlen, struct ImgPackDeflateTree *dist) {
+	for (int i = 0; i < 288; i++) litlen->lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+	for (int i = 0; i < 30; i++) dist->lengths[i] = 5;
+	imgpack_deflate__build_codes(litlen, 288);
+	imgpack_deflate__build_codes(dist, 30);
+}
+
+// Run-length encoded code lengths of both trees, returns number of items.
+// Items keep the code length symbol in the low byte and repeat count above
+static int imgpack_deflate__encode_lengths(const uint8_t *lengths, int count, uint16_t *items, uint32_t *freqs) {
+	int n = 0;
+	for (int i = 0; i < count;) {
+		int value = lengths[i], run = 1;
+		while (i + run < count && lengths[i + run] == value) run++;
+		i += run;
+		if (value == 0) {
+			while (run >= 11) {
+				int r = run < 138 ? run : 138;
+				items[n++] = (uint16_t)(18 | (r - 11) << 8);
+				freqs[18]++;
+				run -= r;
+			}
+			if (run >= 3) {
+				items[n++] = (uint16_t)(17 | (run - 3) << 8);
+				freqs[17]++;
+				run = 0;
+			}
+		} else {
+			items[n++] = (uint16_t)value;
+			freqs[value]++;
+			run--;
+			while (run >= 3) {
+				int r = run < 6 ? run : 6;
+				items[n++] = (uint16_t)(16 | (r - 3) << 8);
+				freqs[16]++;
+				run -= r;
+			}
+		}
+		for (; run > 0; run--) {
+			items[n++] = (uint16_t)value;
+			freqs[value]++;
+		}
+	}
+	return n;
+}
+
+static uint64_t imgpack_deflate__symbols_cost(const struct ImgPackDeflateSymbol *symbols, int count,
+		const struct ImgPackDeflateTree *litlen, const struct ImgPackDeflateTree *dist) {
+	uint64_t bits = litlen->lengths[256];
+	for (int i = 0; i < count; i++) {
+		bits += litlen->lengths[symbols[i].litlen];
+		if (symbols[i].litlen > 256) {
+			bits += imgpack_deflate__length_bits[symbols[i].litlen - 257];
+			bits += dist->lengths[symbols[i].dist] + imgpack_deflate__dist_bits[symbols[i].dist];
+		}
+	}
+	return bits;
+}
+
+static void imgpack_deflate__put_symbols(struct ImgPackDeflateOutput *out, const struct ImgPackDeflateSymbol *symbols, int count,
+		const struct ImgPackDeflateTree *litlen, const struct ImgPackDeflateTree *dist) {
+	for (int i = 0; i < count; i++) {
+		const struct ImgPackDeflateSymbol *s = &symbols[i];
+		imgpack_deflate__put(out, litlen->codes[s->litlen], litlen->lengths[s->litlen]);
+		if (s->litlen > 256) {
+			imgpack_deflate__put(out, s->litlenExtra, imgpack_deflate__length_bits[s->litlen - 257]);
+			imgpack_deflate__put(out, dist->codes[s->dist], dist->lengths[s->dist]);
+			imgpack_deflate__put(out, s->distExtra, imgpack_deflate__dist_bits[s->dist]);
+		}
+	}
+	imgpack_deflate__put(out, litlen->codes[256], litlen->lengths[256]);
+}
+
+// Writes symbols as one block of the cheapest type, raw is the uncompressed
+// data of the block used for stored blocks
+static void imgpack_deflate__block(struct ImgPackDeflateOutput *out, const struct ImgPackDeflateSymbol *symbols, int count,
+		const unsigned char *raw, size_t raw_size) {
+	uint32_t litlen_freqs[288] = {0}, dist_freqs[30] = {0}, lengths_freqs[19] = {0};
+	int matches = 0;
+	for (int i = 0; i < count; i++) {
+		litlen_freqs[symbols[i].litlen]++;
+		if (symbols[i].litlen > 256) {
+			dist_freqs[symbols[i].dist]++;
+			matches++;
+		}
+	}
+	litlen_freqs[256] = 1;
+
+	struct ImgPackDeflateTree litlen, dist, lengths_tree;
+	imgpack_deflate__build_lengths(litlen_freqs, 286, 15, litlen.lengths);
+	imgpack_deflate__build_lengths(dist_freqs, 30, 15, dist.lengths);
+	if (!matches) {
+		// Block of literals still needs a valid distance tree
+		dist.lengths[0] = dist.lengths[1] = 1;
+	}
+	int hlit = 286, hdist = 30;
+	while (hlit > 257 && !litlen.lengths[hlit - 1]) hlit--;
+	while (hdist > 1 && !dist.lengths[hdist - 1]) hdist--;
+	uint8_t all_lengths[286 + 30];
+	memcpy(all_lengths, litlen.lengths, hlit);
+	memcpy(all_lengths + hlit, dist.lengths, hdist);
+	uint16_t items[286 + 30];
+	int items_count = imgpack_deflate__encode_lengths(all_lengths, hlit + hdist, items, lengths_freqs);
+	imgpack_deflate__build_lengths(lengths_freqs, 19, 7, lengths_tree.lengths);
+	int hclen = 19;
+	while (hclen > 4 && !lengths_tree.lengths[imgpack_deflate__lengths_order[hclen - 1]]) hclen--;
+	imgpack_deflate__build_codes(&litlen, 286);
+	imgpack_deflate__build_codes(&dist, 30);
+	imgpack_deflate__build_codes(&lengths_tree, 19);
+
+	uint64_t dynamic_bits = 3 + 14 + 3*hclen + imgpack_deflate__symbols_cost(symbols, count, &litlen, &dist);
+	for (int i = 0; i < items_count; i++) {
+		int symbol = items[i] & 0xff;
+		dynamic_bits += lengths_tree.lengths[symbol] + (symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0);
+	}
+	struct ImgPackDeflateTree fixed_litlen, fixed_dist;
+	imgpack_deflate__fixed_trees(&fixed_litlen, &fixed_dist);
+	uint64_t fixed_bits = 3 + imgpack_deflate__symbols_cost(symbols, count, &fixed_litlen, &fixed_dist);
+	uint64_t stored_bits = (raw_size + 5 * (raw_size / 65535 + 1)) * 8 + 7;
+
+	if (stored_bits <= dynamic_bits && stored_bits <= fixed_bits) {
+		do {
+			size_t size = raw_size < 65535 ? raw_size : 65535;
+			imgpack_deflate__put(out, 0, 3);
+			imgpack_deflate__align(out);
+			unsigned char header[4] = {size & 0xff, size >> 8, ~size & 0xff, (~size >> 8) & 0xff};
+			imgpack_deflate__bytes(out, header, 4);
+			imgpack_deflate__bytes(out, raw, size);
+			raw += size;
+			raw_size -= size;
+		} while (raw_size > 0);
+	} else if (fixed_bits <= dynamic_bits) {
+		imgpack_deflate__put(out, 2, 3);
+		imgpack_deflate__put_symbols(out, symbols, count, &fixed_litlen, &fixed_dist);
+	} else {
+		imgpack_deflate__put(out, 4, 3);
+		imgpack_deflate__put(out, hlit - 257, 5);
+		imgpack_deflate__put(out, hdist - 1, 5);
+		imgpack_deflate__put(out, hclen - 4, 4);
+		for (int i = 0; i < hclen; i++) imgpack_deflate__put(out, lengths_tree.lengths[imgpack_deflate__lengths_order[i]], 3);
+		for (int i = 0; i < items_count; i++) {
+			int symbol = items[i] & 0xff, extra = items[i] >> 8;
+			imgpack_deflate__put(out, lengths_tree.codes[symbol], lengths_tree.lengths[symbol]);
+			if (symbol == 16) imgpack_deflate__put(out, extra, 2);
+			else if (symbol == 17) imgpack_deflate__put(out, extra, 3);
+			else if (symbol == 18) imgpack_deflate__put(out, extra, 7);
+		}
+		imgpack_deflate__put_symbols(out, symbols, count, &litlen, &dist);
+	}
+}
+
+static struct ImgPackDeflateSymbol imgpack_deflate__match(int length, int distance) {
+	struct ImgPackDeflateSymbol s;
+	int l = length - IMGPACK_DEFLATE_MIN_MATCH, d = distance - 1;
+	int code;
+	if (length == IMGPACK_DEFLATE_MAX_MATCH) code = 28;
+	else if (l < 8) code = l;
+	else code = 4 * (imgpack_deflate__log2(l) - 1) + ((l >> (imgpack_deflate__log2(l) - 2)) & 3);
+	s.litlen = (uint16_t)(257 + code);
+	s.litlenExtra = (uint16_t)(length - imgpack_deflate__length_base[code]);
+	code = d < 4 ? d : 2 * imgpack_deflate__log2(d) + ((d >> (imgpack_deflate__log2(d) - 1)) & 1);
+	s.dist = (uint16_t)code;
+	s.distExtra = (uint16_t)(distance - imgpack_deflate__dist_base[code]);
+	return s;
+}
+
+// Length of the common prefix of a and b up to max_length, compares 8 bytes at
+// once where count trailing zeros is available
+static int imgpack_deflate__common(const unsigned char *a, const unsigned char *b, int max_length) {
+	int l = 0;
+#if defined(__GNUC__) || defined(__clang__)
+	for (; l + 8 <= max_length; l += 8) {
+		uint64_t x, y;
+		memcpy(&x, a + l, 8);
+		memcpy(&y, b + l, 8);
+		if (x != y) {
+			uint64_t diff = x ^ y;
+			const uint16_t endian = 1;
+			if (*(const unsigned char *)&endian) return l + (__builtin_ctzll(diff) >> 3);
+			return l + (__builtin_clzll(diff) >> 3);
+		}
+	}
+#endif
+	while (l < max_length && a[l] == b[l]) l++;
+	return l;
+}
+
+static uint32_t imgpack_deflate__hash(const unsigned char *p) {
+	uint32_t v = p[0] | p[1] << 8 | (uint32_t)p[2] << 16;
+	return (v * 2654435761u) >> (32 - IMGPACK_DEFLATE_HASH_BITS);
+}
+
+struct ImgPackDeflateMatcher {
+	const unsigned char *base;
+	int32_t *head;
+	int32_t *prev;
+	int32_t limit;
+};
+
+static void imgpack_deflate__insert(struct ImgPackDeflateMatcher *m, int32_t pos) {
+	if (pos + IMGPACK_DEFLATE_MIN_MATCH > m->limit) return;
+	uint32_t h = imgpack_deflate__hash(m->base + pos);
+	m->prev[pos % IMGPACK_DEFLATE_WINDOW] = m->head[h];
+	m->head[h] = pos;
+}
+
+// Longest match for pos among max_chain previous positions with the same hash,
+// pos is inserted into the chains. Returns 0 if there is no usable match
+static int imgpack_deflate__longest(struct ImgPackDeflateMatcher *m, int32_t pos, int max_chain, int nice, int *distance) {
+	int max_length = m->limit - pos < IMGPACK_DEFLATE_MAX_MATCH ? m->limit - pos : IMGPACK_DEFLATE_MAX_MATCH;
+	if (max_length < IMGPACK_DEFLATE_MIN_MATCH) return 0;
+	const unsigned char *b = m->base + pos;
+	int32_t candidate = m->head[imgpack_deflate__hash(b)];
+	int length = 0;
+	imgpack_deflate__insert(m, pos);
+	while (candidate >= 0 && pos - candidate <= IMGPACK_DEFLATE_WINDOW && max_chain-- > 0) {
+		const unsigned char *a = m->base + candidate;
+		if (a[length] == b[length] && a[0] == b[0]) {
+			int l = imgpack_deflate__common(a, b, max_length);
+			if (l > length) {
+				length = l;
+				*distance = pos - candidate;
+				// Nothing is longer than max_length, and a[length] would be past the limit
+				if (l >= nice || l >= max_length) break;
+			}
+		}
+		int32_t next = m->prev[candidate % IMGPACK_DEFLATE_WINDOW];
+		if (next >= candidate) break;
+		candidate = next;
+	}
+	// Short far matches cost more than literals
+	if (length < IMGPACK_DEFLATE_MIN_MATCH || (length == IMGPACK_DEFLATE_MIN_MATCH && *distance > 4096)) return 0;
+	return length;
+}
+
+// Compresses data[start, end) into out as non-final blocks followed by a sync
+// flush, data[0, start) is used as dictionary (only the last window matters).
+// Returns non-zero on allocation failure
+static int imgpack_deflate(struct ImgPackDeflateOutput *out, const unsigned char *data, size_t start, size_t end,
+		enum ImgPackDeflateLevel level) {
+	static const struct {int chain, lazy, nice, insert;} params[] = {
+		{4, 0, 16, 16},
+		{48, 1, 128, IMGPACK_DEFLATE_MAX_MATCH},
+		{256, 1, IMGPACK_DEFLATE_MAX_MATCH, IMGPACK_DEFLATE_MAX_MATCH},
+	};
+	int max_chain = params[level].chain, lazy = params[level].lazy;
+	int nice = params[level].nice, max_insert = params[level].insert;
+	// Positions in the tables are relative to the dictionary start to fit int32
+	size_t dict = start > IMGPACK_DEFLATE_WINDOW ? start - IMGPACK_DEFLATE_WINDOW : 0;
+	struct ImgPackDeflateMatcher m = {
+		.base = data + dict,
+		.head = ISLIP_MALLOC(sizeof(*m.head) << IMGPACK_DEFLATE_HASH_BITS),
+		.prev = ISLIP_MALLOC(sizeof(*m.prev) * IMGPACK_DEFLATE_WINDOW),
+		.limit = (int32_t)(end - dict),
+	};
+	struct ImgPackDeflateSymbol *symbols = ISLIP_MALLOC(sizeof(*symbols) * IMGPACK_DEFLATE_BLOCK_SYMBOLS);
+	if (!m.head || !m.prev || !symbols) {
+		ISLIP_FREE(m.head);
+		ISLIP_FREE(m.prev);
+		ISLIP_FREE(symbols);
+		return 1;
+	}
+	memset(m.head, 0xff, sizeof(*m.head) << IMGPACK_DEFLATE_HASH_BITS);
+	int32_t pos = (int32_t)(start - dict);
+	for (int32_t i = 0; i < pos; i++) imgpack_deflate__insert(&m, i);
+
+	// With lazy matching the byte before pos can be pending: its match is
+	// emitted only if the match at pos is not longer
+	int32_t block_start = pos;
+	int count = 0, pending = 0, prev_length = 0, prev_distance = 0;
+	while (pos < m.limit) {
+		int distance = 0;
+		int length = imgpack_deflate__longest(&m, pos, max_chain, nice, &distance);
+		if (pending && prev_length > 0 && prev_length >= length) {
+			symbols[count++] = imgpack_deflate__match(prev_length, prev_distance);
+			int32_t match_end = pos - 1 + prev_length;
+			for (pos++; pos < match_end; pos++) {
+				if (prev_length <= max_insert) imgpack_deflate__insert(&m, pos);
+			}
+			pending = 0;
+		} else {
+			if (pending) symbols[count++] = (struct ImgPackDeflateSymbol) {.litlen = m.base[pos - 1]};
+			pending = 0;
+			if (length > 0 && (!lazy || length >= nice)) {
+				symbols[count++] = imgpack_deflate__match(length, distance);
+				int32_t match_end = pos + length;
+				for (pos++; pos < match_end; pos++) {
+					if (length <= max_insert) imgpack_deflate__insert(&m, pos);
+				}
+			} else if (lazy) {
+				pending = 1;
+				prev_length = length;
+				prev_distance = distance;
+				pos++;
+			} else {
+				symbols[count++] = (struct ImgPackDeflateSymbol) {.litlen = m.base[pos]};
+				pos++;
+			}
+		}
+		if (count >= IMGPACK_DEFLATE_BLOCK_SYMBOLS - 2) {
+			imgpack_deflate__block(out, symbols, count, m.base + block_start, pos - pending - block_start);
+			block_start = pos - pending;
+			count = 0;
+		}
+	}
+	if (pending) {
+		if (prev_length > 0) symbols[count++] = imgpack_deflate__match(prev_length, prev_distance);
+		else symbols[count++] = (struct ImgPackDeflateSymbol) {.litlen = m.base[pos - 1]};
+	}
+	if (count > 0) {
+		imgpack_deflate__block(out, symbols, count, m.base + block_start, m.limit - block_start);
+	}
+	// Sync flush: empty stored block aligns output to the byte boundary
+	imgpack_deflate__put(out, 0, 3);
+	imgpack_deflate__align(out);
+	imgpack_deflate__bytes(out, (const unsigned char *)"\x00\x00\xff\xff", 4);
+
+	ISLIP_FREE(m.head);
+	ISLIP_FREE(m.prev);
+	ISLIP_FREE(symbols);
+	return out->failed;
+}
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Reduces precision of RGBA rows to the bits of the output pixel format in
+ * place. Channels are rounded to the nearest representable value and written
+ * back expanded to 8 bits, so the band can go to the PNG writer as it is and
+ * packing to the texture format only drops the low bits.
+ *
+ * Ordered dithering adds 4x4 Bayer matrix threshold at page coordinates, so
+ * bands don't affect it. Floyd-Steinberg dithering carries the error of the
+ * last row over to the next band, rows have to be fed top to bottom.
+ */
+
+#ifndef IMGPACK_DITHER_H_
+#define IMGPACK_DITHER_H_
+
+#include <string.h>
+
+enum ImgPackDither {
+	IMGPACK_DITHER_NONE,
+	IMGPACK_DITHER_ORDERED,
+	IMGPACK_DITHER_FLOYD_STEINBERG,
+};
+
+struct ImgPackQuantizer {
+	int bits[4];
+	int gray;
+	int width;
+	enum ImgPackDither dither;
+	// Errors diffused to the current and the next row, 4 channels per pixel
+	float *errors;
+};
+
+static const unsigned char imgpack_dither__bayer[4][4] = {
+	{0, 8, 2, 10},
+	{12, 4, 14, 6},
+	{3, 11, 1, 9},
+	{15, 7, 13, 5},
+};
+
+// Channels with 0 bits are dropped by the format and set to 255, gray formats
+// keep Rec. 709 luma in red, green and blue. Returns non-zero on failure
+static int imgpack_quantize_begin(struct ImgPackQuantizer *q, const unsigned char bits[4], int gray, int width,
+		enum ImgPackDither dither) {
+	*q = (struct ImgPackQuantizer) {
+		.bits = {bits[0], bits[1], bits[2], bits[3]},
+		.gray = gray,
+		.width = width,
+		.dither = dither,
+	};
+	if (dither == IMGPACK_DITHER_FLOYD_STEINBERG) {
+		q->errors = ISLIP_MALLOC(2 * 4 * sizeof(*q->errors) * (width + 2));
+		if (!q->errors) return 1;
+		memset(q->errors, 0, 2 * 4 * sizeof(*q->errors) * (width + 2));
+	}
+	return 0;
+}
+
+// Rounds value in units of the channel step plus threshold t in [-0.5, 0.5)
+// and expands the result back to 8 bits by bit replication
+static int imgpack_quantize__channel(float v, int bits, float t) {
+	int max = (1 << bits) - 1;
+	int level = (int)(v * max / 255.0f + 0.5f + t);
+	if (level < 0) level = 0;
+	if (level > max) level = max;
+	return level * 255 / max;
+}
+
+// Quantizes count rows of the page starting with row y
+static void imgpack_quantize_rows(struct ImgPackQuantizer *q, unsigned char *rows, int y, int count) {
+	for (int j = 0; j < count; j++) {
+		unsigned char *row = rows + 4 * (size_t)j * q->width;
+		// Errors of the row are shifted by one pixel, so neighbours never go out of bounds
+		float *current = q->errors ? q->errors + (size_t)((y + j) & 1) * 4 * (q->width + 2) : NULL;
+		float *next = q->errors ? q->errors + (size_t)((y + j + 1) & 1) * 4 * (q->width + 2) : NULL;
+		if (next) memset(next, 0, 4 * sizeof(*next) * (q->width + 2));
+		for (int x = 0; x < q->width; x++) {
+			unsigned char *p = row + 4 * x;
+			if (q->gray) {
+				p[0] = p[1] = p[2] = (unsigned char)((54 * p[0] + 183 * p[1] + 19 * p[2] + 128) >> 8);
+			}
+			float t = 0;
+			if (q->dither == IMGPACK_DITHER_ORDERED) t = (imgpack_dither__bayer[(y + j) & 3][x & 3] + 0.5f) / 16 - 0.5f;
+			for (int c = 0; c < 4; c++) {
+				if (q->bits[c] == 0) {
+					if (!q->gray || c == 3) p[c] = 255;
+					continue;
+				}
+				if (q->bits[c] >= 8) continue;
+				if (!current) {
+					p[c] = (unsigned char)imgpack_quantize__channel(p[c], q->bits[c], t);
+					continue;
+				}
+				float v = p[c] + current[4 * (x + 1) + c];
+				int out = imgpack_quantize__channel(v < 0 ? 0 : v > 255 ? 255 : v, q->bits[c], 0);
+				float e = v - out;
+				current[4 * (x + 2) + c] += e * 7 / 16;
+				next[4 * x + c] += e * 3 / 16;
+				next[4 * (x + 1) + c] += e * 5 / 16;
+				next[4 * (x + 2) + c] += e * 1 / 16;
+				p[c] = (unsigned char)out;
+			}
+		}
+	}
+}
+
+static void imgpack_quantize_end(struct ImgPackQuantizer *q) {
+	ISLIP_FREE(q->errors);
+	q->errors = NULL;
+}
+
+#endif
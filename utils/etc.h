@@ -0,0 +1,336 @@
+/*
+ * ETC2 RGB and EAC alpha block encoders. Functions take 4x4 block of RGBA
+ * pixels in row-major order like the BC encoders, ETC2 blocks store pixels
+ * column by column and in big-endian order.
+ *
+ * RGB blocks use ETC1 compatible individual and differential modes, which
+ * split the block into two halves with their own base color and modifier
+ * table, and the ETC2 planar mode for smooth gradients. Base colors are the
+ * averages of the halves, the maximal quality also searches neighbouring
+ * base colors. T and H modes are not used.
+ */
+
+#ifndef IMGPACK_ETC_H_
+#define IMGPACK_ETC_H_
+
+#include <stdint.h>
+#include <string.h>
+
+static const int imgpack_etc__modifiers[8][2] = {
+	{2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183},
+};
+
+static const int imgpack_etc__alpha_modifiers[16][8] = {
+	{-3, -6, -9, -15, 2, 5, 8, 14},
+	{-3, -7, -10, -13, 2, 6, 9, 12},
+	{-2, -5, -8, -13, 1, 4, 7, 12},
+	{-2, -4, -6, -13, 1, 3, 5, 12},
+	{-3, -6, -8, -12, 2, 5, 7, 11},
+	{-3, -7, -9, -11, 2, 6, 8, 10},
+	{-4, -7, -8, -11, 3, 6, 7, 10},
+	{-3, -5, -8, -11, 2, 4, 7, 10},
+	{-2, -6, -8, -10, 1, 5, 7, 9},
+	{-2, -5, -8, -10, 1, 4, 7, 9},
+	{-2, -4, -8, -10, 1, 3, 7, 9},
+	{-2, -5, -7, -10, 1, 4, 6, 9},
+	{-3, -4, -7, -10, 2, 3, 6, 9},
+	{-1, -2, -3, -10, 0, 1, 2, 9},
+	{-4, -6, -8, -9, 3, 5, 7, 8},
+	{-3, -5, -7, -9, 2, 4, 6, 8},
+};
+
+static int imgpack_etc__clamp(int v, int lo, int hi) {
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+static void imgpack_etc__put64(unsigned char *out, uint64_t bits) {
+	for (int i = 0; i < 8; i++) out[i] = (unsigned char)(bits >> (56 - 8*i));
+}
+
+// Half of the block: pixels x*4+y in column-major order of the ETC index
+struct ImgPackEtcHalf {
+	int pixels[8];
+	int error;
+	int table;
+	uint32_t bits;
+};
+
+// Picks the modifier table and per pixel modifiers for the base color,
+// fills error, table and index bits of the half
+static void imgpack_etc__fit_half(const unsigned char *rgba, struct ImgPackEtcHalf *half, const int *base) {
+	half->error = 0x7fffffff;
+	for (int t = 0; t < 8; t++) {
+		int modifiers[4] = {imgpack_etc__modifiers[t][0], imgpack_etc__modifiers[t][1],
+			-imgpack_etc__modifiers[t][0], -imgpack_etc__modifiers[t][1]};
+		int error = 0;
+		uint32_t bits = 0;
+		for (int i = 0; i < 8 && error < half->error; i++) {
+			int p = half->pixels[i], x = p >> 2, y = p & 3;
+			const unsigned char *c = rgba + 4 * (y*4 + x);
+			int best = 0, best_error = 0x7fffffff;
+			for (int j = 0; j < 4; j++) {
+				int e = 0;
+				for (int k = 0; k < 3; k++) {
+					int d = c[k] - imgpack_etc__clamp(base[k] + modifiers[j], 0, 255);
+					e += d * d;
+				}
+				if (e < best_error) {
+					best = j;
+					best_error = e;
+				}
+			}
+			error += best_error;
+			bits |= (uint32_t)(best >> 1) << (16 + p) | (uint32_t)(best & 1) << p;
+		}
+		if (error < half->error) {
+			half->error = error;
+			half->table = t;
+			half->bits = bits;
+		}
+	}
+}
+
+static void imgpack_etc__average(const unsigned char *rgba, const struct ImgPackEtcHalf *half, float *average) {
+	for (int k = 0; k < 3; k++) {
+		int sum = 0;
+		for (int i = 0; i < 8; i++) {
+			int p = half->pixels[i];
+			sum += rgba[4 * ((p & 3)*4 + (p >> 2)) + k];
+		}
+		average[k] = sum / 8.0f;
+	}
+}
+
+// Expands quantized color of 4 or 5 bits to 8 bits
+static void imgpack_etc__expand(const int *q, int bits, int *color) {
+	for (int k = 0; k < 3; k++) {
+		color[k] = bits == 4 ? q[k] * 17 : q[k] << 3 | q[k] >> 2;
+	}
+}
+
+// Fits the half around the quantized color q, with search also tries its
+// neighbours and keeps the best one in q
+static void imgpack_etc__fit_base(const unsigned char *rgba, struct ImgPackEtcHalf *half, int *q, int bits, int search) {
+	int color[3], max = (1 << bits) - 1, best[3] = {q[0], q[1], q[2]};
+	struct ImgPackEtcHalf best_half = *half;
+	best_half.error = 0x7fffffff;
+	for (int dr = -search; dr <= search; dr++) {
+		for (int dg = -search; dg <= search; dg++) {
+			for (int db = -search; db <= search; db++) {
+				int candidate[3] = {q[0] + dr, q[1] + dg, q[2] + db};
+				if (candidate[0] < 0 || candidate[0] > max || candidate[1] < 0 || candidate[1] > max ||
+						candidate[2] < 0 || candidate[2] > max) {
+					continue;
+				}
+				imgpack_etc__expand(candidate, bits, color);
+				imgpack_etc__fit_half(rgba, half, color);
+				if (half->error < best_half.error) {
+					best_half = *half;
+					memcpy(best, candidate, sizeof(best));
+				}
+			}
+		}
+	}
+	*half = best_half;
+	memcpy(q, best, sizeof(best));
+}
+
+// Individual or differential mode with the given flip, returns the error
+static int imgpack_etc__halves_block(const unsigned char *rgba, int flip, int differential, int search, uint64_t *block) {
+	struct ImgPackEtcHalf halves[2];
+	int q[2][3];
+	for (int i = 0; i < 16; i++) {
+		int x = i >> 2, y = i & 3, h = flip ? y >= 2 : x >= 2;
+		halves[h].pixels[(flip ? x*2 + (y & 1) : (x & 1)*4 + y)] = i;
+	}
+	for (int h = 0; h < 2; h++) {
+		float average[3];
+		imgpack_etc__average(rgba, &halves[h], average);
+		for (int k = 0; k < 3; k++) {
+			q[h][k] = differential ? imgpack_etc__clamp((int)(average[k] * 31.0f / 255.0f + 0.5f), 0, 31) :
+				imgpack_etc__clamp((int)(average[k] * 15.0f / 255.0f + 0.5f), 0, 15);
+		}
+		imgpack_etc__fit_base(rgba, &halves[h], q[h], differential ? 5 : 4, search);
+	}
+	if (differential) {
+		// Second color is stored as 3-bit signed difference from the first one
+		for (int k = 0; k < 3; k++) {
+			int d = q[1][k] - q[0][k];
+			if (d < -4 || d > 3) {
+				q[1][k] = q[0][k] + imgpack_etc__clamp(d, -4, 3);
+				int color[3];
+				imgpack_etc__expand(q[1], 5, color);
+				imgpack_etc__fit_half(rgba, &halves[1], color);
+			}
+		}
+	}
+	uint64_t bits = 0;
+	for (int k = 0; k < 3; k++) {
+		int shift = 56 - 8*k;
+		if (differential) {
+			bits |= (uint64_t)(q[0][k] << 3 | ((q[1][k] - q[0][k]) & 7)) << shift;
+		} else {
+			bits |= (uint64_t)(q[0][k] << 4 | q[1][k]) << shift;
+		}
+	}
+	bits |= (uint64_t)(halves[0].table << 5 | halves[1].table << 2 | differential << 1 | flip) << 32;
+	bits |= halves[0].bits | halves[1].bits;
+	*block = bits;
+	return halves[0].error + halves[1].error;
+}
+
+// Planar mode stores origin, horizontal and vertical colors in 6/7/6 bits
+static void imgpack_etc__planar_colors(const int *q, int *color) {
+	color[0] = q[0] << 2 | q[0] >> 4;
+	color[1] = q[1] << 1 | q[1] >> 6;
+	color[2] = q[2] << 2 | q[2] >> 4;
+}
+
+static int imgpack_etc__planar_block(const unsigned char *rgba, uint64_t *block) {
+	static const int maxes[3] = {63, 127, 63};
+	int q[3][3], colors[3][3], error = 0;
+	// Least squares plane c = o + x*dh + y*dv over the 4x4 grid
+	for (int k = 0; k < 3; k++) {
+		float mean = 0, dh = 0, dv = 0;
+		for (int i = 0; i < 16; i++) mean += rgba[4*i + k];
+		mean /= 16;
+		for (int i = 0; i < 16; i++) {
+			dh += ((i & 3) - 1.5f) * (rgba[4*i + k] - mean);
+			dv += ((i >> 2) - 1.5f) * (rgba[4*i + k] - mean);
+		}
+		dh /= 20;
+		dv /= 20;
+		float o = mean - 1.5f*dh - 1.5f*dv, values[3] = {o, o + 4*dh, o + 4*dv};
+		for (int j = 0; j < 3; j++) {
+			q[j][k] = imgpack_etc__clamp((int)(values[j] * maxes[k] / 255.0f + 0.5f), 0, maxes[k]);
+		}
+	}
+	for (int j = 0; j < 3; j++) imgpack_etc__planar_colors(q[j], colors[j]);
+	for (int i = 0; i < 16; i++) {
+		int x = i & 3, y = i >> 2;
+		for (int k = 0; k < 3; k++) {
+			int v = (x * (colors[1][k] - colors[0][k]) + y * (colors[2][k] - colors[0][k]) + 4*colors[0][k] + 2) >> 2;
+			int d = rgba[4*i + k] - imgpack_etc__clamp(v, 0, 255);
+			error += d * d;
+		}
+	}
+	uint64_t bits = (uint64_t)q[0][0] << 57 | (uint64_t)(q[0][1] >> 6) << 56 | (uint64_t)(q[0][1] & 63) << 49 |
+		(uint64_t)(q[0][2] >> 5) << 48 | (uint64_t)(q[0][2] >> 3 & 3) << 43 | (uint64_t)(q[0][2] & 7) << 39 |
+		(uint64_t)(q[1][0] >> 1) << 34 | (uint64_t)1 << 33 | (uint64_t)(q[1][0] & 1) << 32 |
+		(uint64_t)q[1][1] << 25 | (uint64_t)q[1][2] << 19 |
+		(uint64_t)q[2][0] << 13 | (uint64_t)q[2][1] << 6 | (uint64_t)q[2][2];
+	// Unused bits are set so the red and green differential sums stay in
+	// range and the blue one overflows, which is how decoders detect the mode
+	static const int fillers[6] = {63, 55, 47, 46, 45, 42};
+	for (int f = 0; f < 64; f++) {
+		uint64_t candidate = bits;
+		for (int i = 0; i < 6; i++) {
+			if (f >> i & 1) candidate |= (uint64_t)1 << fillers[i];
+		}
+		int r = (int)(candidate >> 59 & 31) + ((int)(candidate >> 56 & 7) ^ 4) - 4;
+		int g = (int)(candidate >> 51 & 31) + ((int)(candidate >> 48 & 7) ^ 4) - 4;
+		int b = (int)(candidate >> 43 & 31) + ((int)(candidate >> 40 & 7) ^ 4) - 4;
+		if (r >= 0 && r <= 31 && g >= 0 && g <= 31 && (b < 0 || b > 31)) {
+			*block = candidate;
+			return error;
+		}
+	}
+	return 0x7fffffff;
+}
+
+static void imgpack_etc2_rgb_block(const unsigned char *rgba, enum ImgPackBlockQuality quality, unsigned char *out) {
+	uint64_t best = 0, block;
+	int best_error = 0x7fffffff;
+	int search = quality == IMGPACK_BLOCK_MAX ? 1 : 0;
+	for (int flip = 0; flip < 2; flip++) {
+		for (int differential = 1; differential >= 0; differential--) {
+			int error = imgpack_etc__halves_block(rgba, flip, differential, search, &block);
+			if (error < best_error) {
+				best = block;
+				best_error = error;
+			}
+			if (quality == IMGPACK_BLOCK_FAST) break;
+		}
+	}
+	if (quality > IMGPACK_BLOCK_FAST && best_error > 0) {
+		int error = imgpack_etc__planar_block(rgba, &block);
+		if (error < best_error) best = block;
+	}
+	imgpack_etc__put64(out, best);
+}
+
+// EAC alpha: base, multiplier and one of 16 tables of 8 modifiers. Stops
+// early when the error reaches limit
+static int imgpack_etc__alpha_indices(const unsigned char *rgba, int base, int multiplier, int table, int limit, uint64_t *bits) {
+	int palette[8], error = 0;
+	for (int j = 0; j < 8; j++) {
+		palette[j] = imgpack_etc__clamp(base + imgpack_etc__alpha_modifiers[table][j] * multiplier, 0, 255);
+	}
+	*bits = (uint64_t)base << 56 | (uint64_t)multiplier << 52 | (uint64_t)table << 48;
+	for (int i = 0; i < 16 && error < limit; i++) {
+		int a = rgba[4*i + 3], best = 0, best_error = 0x7fffffff;
+		for (int j = 0; j < 8; j++) {
+			int e = (a - palette[j]) * (a - palette[j]);
+			if (e < best_error) {
+				best = j;
+				best_error = e;
+			}
+		}
+		*bits |= (uint64_t)best << (45 - 3 * ((i & 3)*4 + (i >> 2)));
+		error += best_error;
+	}
+	return error;
+}
+
+static void imgpack_etc2_alpha_block(const unsigned char *rgba, enum ImgPackBlockQuality quality, unsigned char *out) {
+	int lo = 255, hi = 0;
+	for (int i = 0; i < 16; i++) {
+		int a = rgba[4*i + 3];
+		if (a < lo) lo = a;
+		if (a > hi) hi = a;
+	}
+	// Constant alpha is exact with the zero modifier of table 13
+	if (lo == hi) {
+		uint64_t bits = (uint64_t)lo << 56 | (uint64_t)1 << 52 | (uint64_t)13 << 48;
+		for (int i = 0; i < 16; i++) bits |= (uint64_t)4 << 3*i;
+		imgpack_etc__put64(out, bits);
+		return;
+	}
+	uint64_t best = 0, bits;
+	int best_error = 0x7fffffff;
+	int base_search = quality == IMGPACK_BLOCK_FAST ? 0 : quality == IMGPACK_BLOCK_DEFAULT ? 2 : 6;
+	int multiplier_search = quality == IMGPACK_BLOCK_MAX ? 1 : 0;
+	for (int t = 0; t < 16 && best_error > 0; t++) {
+		int low = imgpack_etc__alpha_modifiers[t][3], high = imgpack_etc__alpha_modifiers[t][7];
+		int multiplier = (hi - lo + (high - low) / 2) / (high - low);
+		int base = lo - low * imgpack_etc__clamp(multiplier, 1, 15);
+		for (int m = multiplier - multiplier_search; m <= multiplier + multiplier_search; m++) {
+			if (m < 1 || m > 15) continue;
+			for (int b = base - base_search; b <= base + base_search; b++) {
+				if (b < 0 || b > 255) continue;
+				int error = imgpack_etc__alpha_indices(rgba, b, m, t, best_error, &bits);
+				if (error < best_error) {
+					best = bits;
+					best_error = error;
+				}
+			}
+		}
+		if (multiplier < 1) {
+			int error = imgpack_etc__alpha_indices(rgba, base, 1, t, best_error, &bits);
+			if (error < best_error) {
+				best = bits;
+				best_error = error;
+			}
+		}
+	}
+	imgpack_etc__put64(out, best);
+}
+
+static void imgpack_etc2_rgba_block(const unsigned char *rgba, enum ImgPackBlockQuality quality, unsigned char *out) {
+	unsigned char filled[64];
+	imgpack_bc_fill_transparent(rgba, filled);
+	imgpack_etc2_alpha_block(rgba, quality, out);
+	imgpack_etc2_rgb_block(filled, quality, out + 8);
+}
+
+#endif
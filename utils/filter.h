@@ -0,0 +1,218 @@
+/*
+ * File filters of the images folder scan and image signatures.
+ *
+ * Globs are matched against paths relative to the images folder with /
+ * between directories: * and ? match inside of one name, ** matches any
+ * number of directories. Globs without / are matched against the name only,
+ * so "*.psd" skips sources anywhere in the tree. Excluded directories are not
+ * read at all. Hidden files and directories are always skipped.
+ *
+ * Extensions are compared ignoring case, files with other extensions are not
+ * queued for decoding. Then the first bytes of every file are checked for a
+ * signature of a format stb_image decodes before the file is handed to it.
+ * TGA has no signature, its header is checked only for .tga files.
+ */
+
+#ifndef IMGPACK_FILTER_H_
+#define IMGPACK_FILTER_H_
+
+#define IMGPACK_FILTER_DEFAULT_EXTENSIONS "PNG,JPG,JPEG,BMP,TGA,GIF,PSD,HDR,PIC,PNM,PPM,PGM"
+
+// Bytes needed by imgpack_sniff_image
+#define IMGPACK_SNIFF_SIZE 18
+
+struct ImgPackFilterList {
+	char **items;
+	int count;
+};
+
+struct ImgPackFilter {
+	struct ImgPackFilterList include;
+	struct ImgPackFilterList exclude;
+	// Without extensions every file is sniffed
+	struct ImgPackFilterList extensions;
+};
+
+static int imgpack_filter__lower(int c) {
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static int imgpack_filter__equal_nocase(const char *a, const char *b) {
+	while (*a && imgpack_filter__lower((unsigned char)*a) == imgpack_filter__lower((unsigned char)*b)) {
+		a++;
+		b++;
+	}
+	return *a == *b;
+}
+
+// Splits comma separated list, empty items are dropped
+static void imgpack_filter__split(struct ImgPackFilterList *list, const char *text) {
+	for (const char *c = text; c && *c;) {
+		const char *end = strchr(c, ',');
+		if (!end) end = c + strlen(c);
+		if (end > c) {
+			char *item = ISLIP_MALLOC(end - c + 1);
+			memcpy(item, c, end - c);
+			item[end - c] = '\0';
+			list->items = ISLIP_REALLOC(list->items, sizeof(*list->items) * (list->count + 1));
+			list->items[list->count++] = item;
+		}
+		c = *end ? end + 1 : end;
+	}
+}
+
+static void imgpack_filter__free_list(struct ImgPackFilterList *list) {
+	for (int i = 0; i < list->count; i++) ISLIP_FREE(list->items[i]);
+	ISLIP_FREE(list->items);
+}
+
+// Lists are comma separated, NULL include or exclude is empty, NULL
+// extensions are the default ones and ALL turns the extension check off
+static struct ImgPackFilter *imgpack_filter_create(const char *include, const char *exclude, const char *extensions) {
+	struct ImgPackFilter *filter = ISLIP_MALLOC(sizeof(*filter));
+	if (!filter) return NULL;
+	*filter = (struct ImgPackFilter) {0};
+	imgpack_filter__split(&filter->include, include);
+	imgpack_filter__split(&filter->exclude, exclude);
+	if (!extensions) extensions = IMGPACK_FILTER_DEFAULT_EXTENSIONS;
+	if (strcmp(extensions, "ALL")) imgpack_filter__split(&filter->extensions, extensions);
+	// Extensions may be given with dots
+	for (int i = 0; i < filter->extensions.count; i++) {
+		char *item = filter->extensions.items[i];
+		if (item[0] == '.') memmove(item, item + 1, strlen(item));
+	}
+	return filter;
+}
+
+static void imgpack_filter_free(struct ImgPackFilter *filter) {
+	if (!filter) return;
+	imgpack_filter__free_list(&filter->include);
+	imgpack_filter__free_list(&filter->exclude);
+	imgpack_filter__free_list(&filter->extensions);
+	ISLIP_FREE(filter);
+}
+
+static int imgpack_glob_match(const char *pattern, const char *path) {
+	for (;; pattern++, path++) {
+		if (pattern[0] == '*' && pattern[1] == '*') {
+			pattern += 2;
+			if (*pattern == '/') {
+				// Zero or more whole directories
+				pattern++;
+				for (;;) {
+					if (imgpack_glob_match(pattern, path)) return 1;
+					const char *slash = strchr(path, '/');
+					if (!slash) return 0;
+					path = slash + 1;
+				}
+			}
+			for (;; path++) {
+				if (imgpack_glob_match(pattern, path)) return 1;
+				if (!*path) return 0;
+			}
+		}
+		if (*pattern == '*') {
+			pattern++;
+			for (;; path++) {
+				if (imgpack_glob_match(pattern, path)) return 1;
+				if (!*path || *path == '/') return 0;
+			}
+		}
+		if (!*pattern) return !*path;
+		if (!*path || (*pattern == '?' ? *path == '/' : *pattern != *path)) return 0;
+	}
+}
+
+static int imgpack_filter__matches(const struct ImgPackFilterList *list, const char *relative_path, const char *name) {
+	for (int i = 0; i < list->count; i++) {
+		const char *pattern = list->items[i];
+		if (imgpack_glob_match(pattern, strchr(pattern, '/') ? relative_path : name)) return 1;
+	}
+	return 0;
+}
+
+// Non-zero if the directory should be read
+static int imgpack_filter_dir(const struct ImgPackFilter *filter, const char *relative_path, const char *name) {
+	if (name[0] == '.') return 0;
+	return !filter || !imgpack_filter__matches(&filter->exclude, relative_path, name);
+}
+
+// Non-zero if the file should be queued, ext is with the dot or empty
+static int imgpack_filter_file(const struct ImgPackFilter *filter, const char *relative_path, const char *name, const char *ext) {
+	if (name[0] == '.') return 0;
+	if (!filter) return 1;
+	if (filter->extensions.count > 0) {
+		int allowed = 0;
+		for (int i = 0; i < filter->extensions.count && !allowed; i++) {
+			allowed = ext[0] == '.' && imgpack_filter__equal_nocase(ext + 1, filter->extensions.items[i]);
+		}
+		if (!allowed) return 0;
+	}
+	if (filter->include.count > 0 && !imgpack_filter__matches(&filter->include, relative_path, name)) return 0;
+	return !imgpack_filter__matches(&filter->exclude, relative_path, name);
+}
+
+#ifndef IMGPACK_NO_MAIN
+// Checks the path relative to the images folder together with directories
+// on the way to it, for single paths reported by the watcher
+static int imgpack_filter_path(const struct ImgPackFilter *filter, const char *relative_path, int is_dir) {
+	size_t length = strlen(relative_path);
+	char *path = ISLIP_MALLOC(length + 1);
+	if (!path) return 0;
+	memcpy(path, relative_path, length + 1);
+	int accepted = 1;
+	char *name = path;
+	for (char *c = path; *c && accepted; c++) {
+		if (*c != '/') continue;
+		*c = '\0';
+		accepted = imgpack_filter_dir(filter, path, name);
+		*c = '/';
+		name = c + 1;
+	}
+	if (accepted && is_dir) {
+		accepted = imgpack_filter_dir(filter, path, name);
+	} else if (accepted) {
+		const char *ext = strrchr(name, '.');
+		accepted = imgpack_filter_file(filter, path, name, ext && ext != name ? ext : "");
+	}
+	ISLIP_FREE(path);
+	return accepted;
+}
+#endif
+
+// Checks the first bytes of the file for a signature of a format stb_image
+// decodes, TGA header is trusted only for .tga files
+static int imgpack_sniff_image(const unsigned char *head, size_t size, const char *ext) {
+	static const struct {
+		const char *magic;
+		size_t size;
+	} signatures[] = {
+		{"\x89PNG\r\n\x1a\n", 8},
+		{"\xff\xd8\xff", 3},
+		{"GIF87a", 6},
+		{"GIF89a", 6},
+		{"BM", 2},
+		{"8BPS", 4},
+		{"#?RADIANCE", 10},
+		{"#?RGBE", 6},
+		{"\x53\x80\xf6\x34", 4},
+		{"P5", 2},
+		{"P6", 2},
+	};
+	for (size_t i = 0; i < sizeof(signatures) / sizeof(*signatures); i++) {
+		if (size >= signatures[i].size && !memcmp(head, signatures[i].magic, signatures[i].size)) return 1;
+	}
+	if (size < 18 || !imgpack_filter__equal_nocase(ext, ".tga")) return 0;
+	// Same checks as stbi__tga_test: color map and image types, sizes and bits
+	int colormap = head[1], type = head[2], bits = head[16];
+	int width = head[12] | head[13] << 8, height = head[14] | head[15] << 8;
+	if (colormap > 1 || width < 1 || height < 1) return 0;
+	if (colormap == 1) {
+		if ((type != 1 && type != 9) || (head[7] != 8 && head[7] != 15 && head[7] != 16 && head[7] != 24 && head[7] != 32)) return 0;
+		return bits == 8 || bits == 16;
+	}
+	if (type != 2 && type != 3 && type != 10 && type != 11) return 0;
+	return bits == 8 || bits == 15 || bits == 16 || bits == 24 || bits == 32;
+}
+
+#endif
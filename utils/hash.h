@@ -0,0 +1,151 @@
+/*
+ * Fast 64-bit content hash in the spirit of XXH3. Input is consumed in 64 byte
+ * stripes by 8 independent 64-bit lanes, each lane mixes its 8 bytes with the
+ * secret using a 32x32->64 multiply, which compilers turn into SIMD code
+ * (pmuludq on SSE2/AVX2, umull on NEON). Lanes are scrambled after every
+ * block of 8 stripes and folded with 128-bit multiplies at the end.
+ *
+ * The hash is streaming, so scattered data like rows of the trimmed image
+ * gives the same result as the same bytes hashed at once. It is not a
+ * cryptographic hash, equal hashes are confirmed by comparing the data.
+ */
+
+#ifndef IMGPACK_HASH_H_
+#define IMGPACK_HASH_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define IMGPACK_HASH_STRIPE 64
+#define IMGPACK_HASH_BLOCK_STRIPES 8
+
+#define IMGPACK_HASH_PRIME32_1 0x9E3779B1U
+#define IMGPACK_HASH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define IMGPACK_HASH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define IMGPACK_HASH_PRIME64_3 0x165667B19E3779F9ULL
+
+struct ImgPackHash {
+	uint64_t acc[8];
+	unsigned char buffer[IMGPACK_HASH_STRIPE];
+	size_t buffered;
+	uint64_t length;
+	uint64_t seed;
+	int stripe;
+};
+
+static const uint64_t imgpack_hash__secret[IMGPACK_HASH_BLOCK_STRIPES + 8] = {
+	0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+	0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+	0xcb00c391bb52283cULL, 0xa32e531b8b65d088ULL, 0x4ef90da297486471ULL, 0xd8acdea946ef1938ULL,
+	0x3f349ce33f76faa8ULL, 0x1d4f0bc7c7bbdcf9ULL, 0x3159b4cd4be0518aULL, 0x647378d9c97e9fc8ULL,
+};
+
+static uint64_t imgpack_hash__read64(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint64_t imgpack_hash__fold64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+	__uint128_t product = (__uint128_t)a * b;
+	return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+	uint64_t a_lo = (uint32_t)a, a_hi = a >> 32, b_lo = (uint32_t)b, b_hi = b >> 32;
+	uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+	uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+	uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	uint64_t lower = (cross << 32) | (uint32_t)lo_lo;
+	return lower ^ upper;
+#endif
+}
+
+static uint64_t imgpack_hash__avalanche(uint64_t h) {
+	h ^= h >> 37;
+	h *= 0x165667919E3779F9ULL;
+	return h ^ (h >> 32);
+}
+
+// Lanes are independent, so the loop is vectorized
+static void imgpack_hash__stripe(uint64_t *acc, const unsigned char *p, const uint64_t *secret) {
+	for (int i = 0; i < 8; i++) {
+		uint64_t value = imgpack_hash__read64(p + 8*i);
+		uint64_t key = value ^ secret[i];
+		acc[i ^ 1] += value;
+		acc[i] += (uint64_t)(uint32_t)key * (key >> 32);
+	}
+}
+
+static void imgpack_hash__scramble(uint64_t *acc) {
+	for (int i = 0; i < 8; i++) {
+		uint64_t a = acc[i];
+		a ^= a >> 47;
+		a ^= imgpack_hash__secret[IMGPACK_HASH_BLOCK_STRIPES + i];
+		acc[i] = a * IMGPACK_HASH_PRIME32_1;
+	}
+}
+
+static void imgpack_hash__consume(struct ImgPackHash *h, const unsigned char *p) {
+	imgpack_hash__stripe(h->acc, p, imgpack_hash__secret + h->stripe);
+	if (++h->stripe == IMGPACK_HASH_BLOCK_STRIPES) {
+		imgpack_hash__scramble(h->acc);
+		h->stripe = 0;
+	}
+}
+
+static void imgpack_hash_init(struct ImgPackHash *h, uint64_t seed) {
+	static const uint64_t init[8] = {
+		IMGPACK_HASH_PRIME32_1, IMGPACK_HASH_PRIME64_1, IMGPACK_HASH_PRIME64_2, IMGPACK_HASH_PRIME64_3,
+		0x85EBCA77U, 0x27D4EB2F165667C5ULL, 0xC2B2AE3DU, 0x61C8864E7A143579ULL,
+	};
+	for (int i = 0; i < 8; i++) h->acc[i] = init[i] ^ (seed * (i + 1));
+	h->buffered = 0;
+	h->length = 0;
+	h->seed = seed;
+	h->stripe = 0;
+}
+
+static void imgpack_hash_update(struct ImgPackHash *h, const void *data, size_t size) {
+	const unsigned char *p = data;
+	h->length += size;
+	if (h->buffered > 0) {
+		size_t n = IMGPACK_HASH_STRIPE - h->buffered;
+		if (n > size) n = size;
+		memcpy(h->buffer + h->buffered, p, n);
+		h->buffered += n;
+		p += n;
+		size -= n;
+		if (h->buffered < IMGPACK_HASH_STRIPE) return;
+		imgpack_hash__consume(h, h->buffer);
+		h->buffered = 0;
+	}
+	for (; size >= IMGPACK_HASH_STRIPE; p += IMGPACK_HASH_STRIPE, size -= IMGPACK_HASH_STRIPE) {
+		imgpack_hash__consume(h, p);
+	}
+	memcpy(h->buffer, p, size);
+	h->buffered = size;
+}
+
+static uint64_t imgpack_hash_final(const struct ImgPackHash *h) {
+	uint64_t acc[8];
+	memcpy(acc, h->acc, sizeof(acc));
+	if (h->buffered > 0) {
+		unsigned char last[IMGPACK_HASH_STRIPE] = {0};
+		memcpy(last, h->buffer, h->buffered);
+		imgpack_hash__stripe(acc, last, imgpack_hash__secret + h->stripe);
+	}
+	uint64_t result = h->length * IMGPACK_HASH_PRIME64_1 ^ h->seed;
+	for (int i = 0; i < 4; i++) {
+		result += imgpack_hash__fold64(acc[2*i] ^ imgpack_hash__secret[2*i], acc[2*i+1] ^ imgpack_hash__secret[2*i+1]);
+	}
+	return imgpack_hash__avalanche(result);
+}
+
+static uint64_t imgpack_hash(const void *data, size_t size, uint64_t seed) {
+	struct ImgPackHash h;
+	imgpack_hash_init(&h, seed);
+	imgpack_hash_update(&h, data, size);
+	return imgpack_hash_final(&h);
+}
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Manifest for --manifest, a list of atlases built by one process. Every line
+ * is a job written like the command line without the program name: options
+ * and then the images folder. Arguments are separated by spaces, double
+ * quotes keep spaces inside of an argument, # starts a comment:
+ *
+ *   # UI and icons share some sprites, they are decoded once
+ *   -f JSON_HASH -t 0 -p 2 -d build/ui.json -i build/ui.png assets/ui
+ *   -f RAYLIB -x 1/2 -m -w 1024 -h 1024 -d build/icons.h -i build/icons.png "assets/icons"
+ */
+
+#ifndef IMGPACK_MANIFEST_H_
+#define IMGPACK_MANIFEST_H_
+
+struct ImgPackManifestEntry {
+	int line;
+	int argc;
+	char **argv;
+};
+
+struct ImgPackManifest {
+	struct ImgPackManifestEntry *entries;
+	int entriesCount;
+	int entriesAllocated;
+};
+
+static void imgpack_manifest__free_entry(struct ImgPackManifestEntry *entry) {
+	for (int j = 0; j < entry->argc; j++) ISLIP_FREE(entry->argv[j]);
+	ISLIP_FREE(entry->argv);
+	entry->argv = NULL;
+	entry->argc = 0;
+}
+
+static void imgpack_manifest_free(struct ImgPackManifest *manifest) {
+	for (int i = 0; i < manifest->entriesCount; i++) imgpack_manifest__free_entry(&manifest->entries[i]);
+	ISLIP_FREE(manifest->entries);
+	*manifest = (struct ImgPackManifest) {0};
+}
+
+static void imgpack_manifest__push_arg(struct ImgPackManifestEntry *entry, const char *arg, size_t length) {
+	entry->argv = ISLIP_REALLOC(entry->argv, sizeof(*entry->argv) * (entry->argc + 1));
+	char *copy = ISLIP_MALLOC(length + 1);
+	memcpy(copy, arg, length);
+	copy[length] = '\0';
+	entry->argv[entry->argc++] = copy;
+}
+
+// Splits the line into arguments, returns non-zero on unterminated quote,
+// arguments of the broken line are freed then
+static int imgpack_manifest__parse_line(struct ImgPackManifestEntry *entry, const char *line, const char *end) {
+	const char *c = line;
+	for (;;) {
+		while (c < end && isspace((unsigned char)*c)) c++;
+		if (c >= end || *c == '#') return 0;
+		const char *start = c;
+		if (*c == '"') {
+			start = ++c;
+			while (c < end && *c != '"') c++;
+			if (c >= end) {
+				imgpack_manifest__free_entry(entry);
+				return 1;
+			}
+			imgpack_manifest__push_arg(entry, start, c - start);
+			c++;
+		} else {
+			while (c < end && !isspace((unsigned char)*c)) c++;
+			imgpack_manifest__push_arg(entry, start, c - start);
+		}
+	}
+}
+
+// Returns non-zero if the file can't be read or has a broken line, the
+// reason is printed
+static int imgpack_manifest_load(struct ImgPackManifest *manifest, const char *path) {
+	*manifest = (struct ImgPackManifest) {0};
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		printf("Cannot open manifest \"%s\"\n", path);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *text = size >= 0 ? ISLIP_MALLOC(size + 1) : NULL;
+	if (!text || fread(text, 1, size, f) != (size_t)size) {
+		printf("Cannot read manifest \"%s\"\n", path);
+		ISLIP_FREE(text);
+		fclose(f);
+		return 1;
+	}
+	fclose(f);
+	text[size] = '\0';
+	int status = 0, line = 1;
+	for (const char *c = text; *c && !status; line++) {
+		const char *end = strchr(c, '\n');
+		if (!end) end = c + strlen(c);
+		struct ImgPackManifestEntry entry = {.line = line};
+		status = imgpack_manifest__parse_line(&entry, c, end);
+		if (status) printf("Unterminated quote at line %d of manifest \"%s\"\n", line, path);
+		if (entry.argc > 0) {
+			if (manifest->entriesCount >= manifest->entriesAllocated) {
+				manifest->entriesAllocated = manifest->entriesAllocated ? 2 * manifest->entriesAllocated : 16;
+				manifest->entries = ISLIP_REALLOC(manifest->entries, sizeof(*manifest->entries) * manifest->entriesAllocated);
+			}
+			manifest->entries[manifest->entriesCount++] = entry;
+		}
+		c = *end ? end + 1 : end;
+	}
+	ISLIP_FREE(text);
+	if (status) imgpack_manifest_free(manifest);
+	return status;
+}
+
+#endif
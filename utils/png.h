@@ -0,0 +1,317 @@
+/*
+ * PNG writer for atlas pages. Rows are split into strips which are filtered
+ * and deflated on worker threads, pigz-style: every strip is compressed on its
+ * own with the preceding window of filtered rows as dictionary and ends with a
+ * sync flush, so compressed strips are written one after another as IDAT
+ * chunks. Adler-32 and chunk CRCs of the strips are computed by the workers
+ * too, checksums of strips are combined at the end. Rows can be fed in bands,
+ * so the whole image never has to be in memory.
+ */
+
+#ifndef IMGPACK_PNG_H_
+#define IMGPACK_PNG_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Uncompressed size of strip compressed by one task
+#define IMGPACK_PNG_STRIP_SIZE (1 << 20)
+
+enum ImgPackPngFilter {
+	IMGPACK_PNG_FILTER_NONE,
+	IMGPACK_PNG_FILTER_SUB,
+	IMGPACK_PNG_FILTER_UP,
+	IMGPACK_PNG_FILTER_AVERAGE,
+	IMGPACK_PNG_FILTER_PAETH,
+	IMGPACK_PNG_FILTER_ADAPTIVE,
+};
+
+struct ImgPackPngStrip {
+	int row;
+	int rows;
+	struct ImgPackDeflateOutput out;
+	uint32_t adler;
+	uint32_t crc;
+	int status;
+};
+
+// Rows are fed in bands, the writer keeps a copy of the last rows of the
+// previous band: the filter needs the row above and the strip dictionary needs
+// the preceding window
+struct ImgPackPngWriter {
+	struct ImgPackWriter *out;
+	int width;
+	int height;
+	int channels;
+	enum ImgPackDeflateLevel level;
+	enum ImgPackPngFilter filter;
+	int jobs;
+	int row;
+	uint32_t adler;
+	unsigned char *tail;
+	int tailRows;
+	const unsigned char *band;
+	struct ImgPackPngStrip *strips;
+	int status;
+};
+
+static uint32_t imgpack_png__crc_table[256];
+
+static void imgpack_png__crc_init(void) {
+	if (imgpack_png__crc_table[1]) return;
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		imgpack_png__crc_table[i] = c;
+	}
+}
+
+// Running CRC without the final inversion, start with 0xffffffff
+static uint32_t imgpack_png__crc(uint32_t crc, const unsigned char *data, size_t size) {
+	for (size_t i = 0; i < size; i++) crc = imgpack_png__crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static uint32_t imgpack_png__adler(uint32_t adler, const unsigned char *data, size_t size) {
+	uint32_t a = adler & 0xffff, b = adler >> 16;
+	while (size > 0) {
+		size_t n = size < 5552 ? size : 5552;
+		size -= n;
+		for (; n > 0; n--) {
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return a | b << 16;
+}
+
+// Adler-32 of concatenation from Adler-32 of both parts, same as adler32_combine of zlib
+static uint32_t imgpack_png__adler_combine(uint32_t adler1, uint32_t adler2, size_t size2) {
+	const uint32_t base = 65521;
+	uint32_t rem = (uint32_t)(size2 % base);
+	uint32_t sum1 = adler1 & 0xffff;
+	uint32_t sum2 = (uint32_t)((uint64_t)rem * sum1 % base);
+	sum1 += (adler2 & 0xffff) + base - 1;
+	sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+	if (sum1 >= base) sum1 -= base;
+	if (sum1 >= base) sum1 -= base;
+	if (sum2 >= 2*base) sum2 -= 2*base;
+	if (sum2 >= base) sum2 -= base;
+	return sum1 | sum2 << 16;
+}
+
+static int imgpack_png__paeth(int a, int b, int c) {
+	int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// Filters row of pixels of bpp bytes with the given type, prev is NULL for the
+// first row where the row above is treated as zeros
+static void imgpack_png__filter(unsigned char *dst, const unsigned char *row, const unsigned char *prev, size_t size, int bpp, int type) {
+	size_t b = (size_t)bpp;
+	size_t i = 0;
+	if (!prev && type == IMGPACK_PNG_FILTER_UP) type = IMGPACK_PNG_FILTER_NONE;
+	if (!prev && type == IMGPACK_PNG_FILTER_PAETH) type = IMGPACK_PNG_FILTER_SUB;
+	switch (type) {
+		case IMGPACK_PNG_FILTER_NONE:
+			memcpy(dst, row, size);
+			break;
+		case IMGPACK_PNG_FILTER_SUB:
+			for (; i < b; i++) dst[i] = row[i];
+			for (; i < size; i++) dst[i] = (unsigned char)(row[i] - row[i - b]);
+			break;
+		case IMGPACK_PNG_FILTER_UP:
+			for (; i < size; i++) dst[i] = (unsigned char)(row[i] - prev[i]);
+			break;
+		case IMGPACK_PNG_FILTER_AVERAGE:
+			if (prev) {
+				for (; i < b; i++) dst[i] = (unsigned char)(row[i] - (prev[i] >> 1));
+				for (; i < size; i++) dst[i] = (unsigned char)(row[i] - ((row[i - b] + prev[i]) >> 1));
+			} else {
+				for (; i < b; i++) dst[i] = row[i];
+				for (; i < size; i++) dst[i] = (unsigned char)(row[i] - (row[i - b] >> 1));
+			}
+			break;
+		case IMGPACK_PNG_FILTER_PAETH:
+			for (; i < b; i++) dst[i] = (unsigned char)(row[i] - prev[i]);
+			for (; i < size; i++) dst[i] = (unsigned char)(row[i] - imgpack_png__paeth(row[i - b], prev[i], prev[i - b]));
+			break;
+	}
+}
+
+// Writes filter type byte and filtered row. Adaptive filter takes the type with
+// the smallest sum of residuals as signed bytes, like libpng does
+static void imgpack_png__filter_row(unsigned char *dst, const unsigned char *row, const unsigned char *prev, size_t size,
+		int bpp, enum ImgPackPngFilter filter) {
+	int type = filter;
+	if (filter == IMGPACK_PNG_FILTER_ADAPTIVE) {
+		uint64_t best = UINT64_MAX;
+		for (int t = IMGPACK_PNG_FILTER_NONE; t < IMGPACK_PNG_FILTER_ADAPTIVE; t++) {
+			imgpack_png__filter(dst + 1, row, prev, size, bpp, t);
+			uint64_t sum = 0;
+			for (size_t i = 0; i < size; i++) sum += (uint64_t)abs((signed char)dst[1 + i]);
+			if (sum < best) {
+				best = sum;
+				type = t;
+			}
+		}
+	}
+	dst[0] = (unsigned char)type;
+	imgpack_png__filter(dst + 1, row, prev, size, bpp, type);
+}
+
+static int imgpack_png__dict_rows(const struct ImgPackPngWriter *writer) {
+	size_t filtered_stride = (size_t)writer->channels * writer->width + 1;
+	return (int)((IMGPACK_DEFLATE_WINDOW + filtered_stride - 1) / filtered_stride);
+}
+
+// Row y of the image from the current band or from the tail before it
+static const unsigned char *imgpack_png__row(const struct ImgPackPngWriter *writer, int y) {
+	size_t stride = (size_t)writer->channels * writer->width;
+	if (y >= writer->row) return writer->band + (y - writer->row) * stride;
+	return writer->tail + (y - (writer->row - writer->tailRows)) * stride;
+}
+
+static void imgpack_png__strip_task(void *udata, int index) {
+	struct ImgPackPngWriter *writer = udata;
+	struct ImgPackPngStrip *strip = &writer->strips[index];
+	size_t stride = (size_t)writer->channels * writer->width, filtered_stride = stride + 1;
+	// Rows before the strip are filtered again to serve as dictionary
+	int dict_rows = imgpack_png__dict_rows(writer);
+	int first = strip->row > dict_rows ? strip->row - dict_rows : 0;
+	unsigned char *filtered = ISLIP_MALLOC(filtered_stride * (strip->row + strip->rows - first));
+	if (!filtered) {
+		strip->status = 1;
+		return;
+	}
+	for (int y = first; y < strip->row + strip->rows; y++) {
+		imgpack_png__filter_row(filtered + (y - first) * filtered_stride, imgpack_png__row(writer, y),
+				y > 0 ? imgpack_png__row(writer, y - 1) : NULL, stride, writer->channels, writer->filter);
+	}
+	size_t start = (strip->row - first) * filtered_stride, end = start + strip->rows * filtered_stride;
+	strip->status = imgpack_deflate(&strip->out, filtered, start, end, writer->level);
+	strip->adler = imgpack_png__adler(1, filtered + start, end - start);
+	strip->crc = imgpack_png__crc(imgpack_png__crc(0xffffffffu, (const unsigned char *)"IDAT", 4), strip->out.data, strip->out.size);
+	ISLIP_FREE(filtered);
+}
+
+static void imgpack_png__put32(unsigned char *p, uint32_t v) {
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+// Writes chunk, crc is the running CRC of type and data
+static void imgpack_png__chunk_crc(struct ImgPackWriter *out, const char *type, const unsigned char *data, size_t size, uint32_t crc) {
+	unsigned char header[8], footer[4];
+	imgpack_png__put32(header, (uint32_t)size);
+	memcpy(header + 4, type, 4);
+	imgpack_png__put32(footer, ~crc);
+	imgpack_writer_write(out, header, 8);
+	imgpack_writer_write(out, data, size);
+	imgpack_writer_write(out, footer, 4);
+}
+
+static void imgpack_png__chunk(struct ImgPackWriter *out, const char *type, const unsigned char *data, size_t size) {
+	uint32_t crc = imgpack_png__crc(imgpack_png__crc(0xffffffffu, (const unsigned char *)type, 4), data, size);
+	imgpack_png__chunk_crc(out, type, data, size, crc);
+}
+
+// Writes the header to out, which is closed by imgpack_png_end. Rows hold 1, 2, 3 or 4 channels for
+// gray, gray with alpha, RGB or RGBA images. Returns non-zero on failure
+static int imgpack_png_begin(struct ImgPackPngWriter *writer, struct ImgPackWriter *out, int width, int height, int channels,
+		enum ImgPackDeflateLevel level, enum ImgPackPngFilter filter, int jobs) {
+	static const unsigned char zlib_headers[][2] = {{0x78, 0x01}, {0x78, 0x9c}, {0x78, 0xda}};
+	static const unsigned char color_types[] = {0, 4, 2, 6};
+	imgpack_png__crc_init();
+	*writer = (struct ImgPackPngWriter) {
+		.out = out,
+		.width = width,
+		.height = height,
+		.channels = channels,
+		.level = level,
+		.filter = filter,
+		.jobs = jobs,
+		.adler = 1,
+	};
+	if (!writer->out) return 1;
+	unsigned char ihdr[13] = {0, 0, 0, 0, 0, 0, 0, 0, 8, color_types[channels - 1], 0, 0, 0};
+	imgpack_png__put32(ihdr, (uint32_t)width);
+	imgpack_png__put32(ihdr + 4, (uint32_t)height);
+	imgpack_writer_write(writer->out, "\x89PNG\r\n\x1a\n", 8);
+	imgpack_png__chunk(writer->out, "IHDR", ihdr, 13);
+	imgpack_png__chunk(writer->out, "IDAT", zlib_headers[level], 2);
+	return 0;
+}
+
+// Compresses next count rows on up to jobs threads and writes them. Returns
+// non-zero on failure, the writer still has to be finished with imgpack_png_end
+static int imgpack_png_write_rows(struct ImgPackPngWriter *writer, const unsigned char *rows, int count) {
+	size_t stride = (size_t)writer->channels * writer->width, filtered_stride = stride + 1;
+	int strip_rows = (int)(IMGPACK_PNG_STRIP_SIZE / filtered_stride);
+	if (strip_rows < 1) strip_rows = 1;
+	int strips_count = (count + strip_rows - 1) / strip_rows;
+	if (writer->status || count <= 0) return writer->status;
+	writer->band = rows;
+	writer->strips = ISLIP_MALLOC(sizeof(*writer->strips) * strips_count);
+	if (!writer->strips) return writer->status = 1;
+	for (int i = 0; i < strips_count; i++) {
+		int row = i * strip_rows;
+		writer->strips[i] = (struct ImgPackPngStrip) {.row = writer->row + row, .rows = row + strip_rows < count ? strip_rows : count - row};
+	}
+	imgpack_parallel_for(writer->jobs, strips_count, imgpack_png__strip_task, writer);
+	for (int i = 0; i < strips_count; i++) {
+		struct ImgPackPngStrip *strip = &writer->strips[i];
+		writer->status |= strip->status;
+		if (!writer->status) {
+			imgpack_png__chunk_crc(writer->out, "IDAT", strip->out.data, strip->out.size, strip->crc);
+			writer->adler = imgpack_png__adler_combine(writer->adler, strip->adler, strip->rows * filtered_stride);
+		}
+		ISLIP_FREE(strip->out.data);
+	}
+	ISLIP_FREE(writer->strips);
+	writer->strips = NULL;
+
+	int tail_rows = imgpack_png__dict_rows(writer) + 1;
+	if (tail_rows > writer->row + count) tail_rows = writer->row + count;
+	unsigned char *tail = writer->status ? NULL : ISLIP_MALLOC(stride * tail_rows);
+	if (tail) {
+		for (int y = 0; y < tail_rows; y++) {
+			memcpy(tail + y * stride, imgpack_png__row(writer, writer->row + count - tail_rows + y), stride);
+		}
+	} else {
+		writer->status = 1;
+	}
+	ISLIP_FREE(writer->tail);
+	writer->tail = tail;
+	writer->tailRows = tail_rows;
+	writer->row += count;
+	writer->band = NULL;
+	return writer->status;
+}
+
+// Writes the trailer and closes the output. Returns non-zero if anything failed
+// or not all rows were written
+static int imgpack_png_end(struct ImgPackPngWriter *writer) {
+	int status = writer->status || writer->row != writer->height;
+	if (writer->out) {
+		// Final empty block and Adler-32 of all filtered rows
+		unsigned char trailer[6] = {0x03, 0x00};
+		imgpack_png__put32(trailer + 2, writer->adler);
+		imgpack_png__chunk(writer->out, "IDAT", trailer, 6);
+		imgpack_png__chunk(writer->out, "IEND", NULL, 0);
+		status |= imgpack_writer_close(writer->out);
+	} else {
+		status = 1;
+	}
+	ISLIP_FREE(writer->tail);
+	writer->tail = NULL;
+	return status;
+}
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * Work-stealing pool for task graphs of --manifest. Every worker has a deque:
+ * running tasks push their continuations to the tail of the deque of their
+ * worker and it takes them back from the tail, so a job is finished before
+ * the next one is started. Idle workers steal the oldest tasks from heads of
+ * other deques. The pool runs until every task is done.
+ *
+ * Uses mutexes and threads of utils/threads.h, single-threaded with
+ * IMGPACK_NO_THREADS.
+ */
+
+#ifndef IMGPACK_POOL_H_
+#define IMGPACK_POOL_H_
+
+struct ImgPackPool;
+
+typedef void (*imgpack_pool_fn)(struct ImgPackPool *pool, int worker, void *udata, int index);
+
+struct ImgPackPoolTask {
+	imgpack_pool_fn fn;
+	void *udata;
+	int index;
+};
+
+// Owner pushes and pops at the tail, thieves take from the head
+struct ImgPackPoolDeque {
+	struct ImgPackPoolTask *tasks;
+	int head;
+	int tail;
+	int allocated;
+	imgpack_mutex_t lock;
+};
+
+struct ImgPackPool {
+	struct ImgPackPoolDeque *deques;
+	int workers;
+	// Tasks in deques and tasks in deques or running, guarded by lock
+	int queued;
+	int pending;
+	imgpack_mutex_t lock;
+	imgpack_cond_t wake;
+};
+
+struct ImgPackPoolWorker {
+	struct ImgPackPool *pool;
+	int worker;
+};
+
+static int imgpack_pool_init(struct ImgPackPool *pool, int workers) {
+	if (workers < 1) workers = 1;
+#ifdef IMGPACK_NO_THREADS
+	workers = 1;
+#endif
+	*pool = (struct ImgPackPool) {.deques = ISLIP_MALLOC(sizeof(*pool->deques) * workers), .workers = workers};
+	if (!pool->deques) return 1;
+	for (int i = 0; i < workers; i++) {
+		pool->deques[i] = (struct ImgPackPoolDeque) {0};
+		imgpack_mutex_init(&pool->deques[i].lock);
+	}
+	imgpack_mutex_init(&pool->lock);
+	imgpack_cond_init(&pool->wake);
+	return 0;
+}
+
+static void imgpack_pool_free(struct ImgPackPool *pool) {
+	for (int i = 0; i < pool->workers; i++) {
+		imgpack_mutex_destroy(&pool->deques[i].lock);
+		ISLIP_FREE(pool->deques[i].tasks);
+	}
+	ISLIP_FREE(pool->deques);
+	imgpack_mutex_destroy(&pool->lock);
+	imgpack_cond_destroy(&pool->wake);
+	*pool = (struct ImgPackPool) {0};
+}
+
+// Queues the task on the deque of the worker, tasks run later may be pushed
+// from inside of tasks. Returns non-zero if out of memory
+static int imgpack_pool_push(struct ImgPackPool *pool, int worker, imgpack_pool_fn fn, void *udata, int index) {
+	struct ImgPackPoolDeque *deque = &pool->deques[worker % pool->workers];
+	imgpack_mutex_lock(&deque->lock);
+	if (deque->tail >= deque->allocated && deque->head > 0) {
+		memmove(deque->tasks, deque->tasks + deque->head, sizeof(*deque->tasks) * (deque->tail - deque->head));
+		deque->tail -= deque->head;
+		deque->head = 0;
+	}
+	if (deque->tail >= deque->allocated) {
+		int allocated = deque->allocated ? 2 * deque->allocated : 64;
+		struct ImgPackPoolTask *tasks = ISLIP_REALLOC(deque->tasks, sizeof(*tasks) * allocated);
+		if (!tasks) {
+			imgpack_mutex_unlock(&deque->lock);
+			return 1;
+		}
+		deque->tasks = tasks;
+		deque->allocated = allocated;
+	}
+	deque->tasks[deque->tail++] = (struct ImgPackPoolTask) {.fn = fn, .udata = udata, .index = index};
+	imgpack_mutex_unlock(&deque->lock);
+	imgpack_mutex_lock(&pool->lock);
+	pool->queued++;
+	pool->pending++;
+	imgpack_cond_broadcast(&pool->wake);
+	imgpack_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+static int imgpack_pool__take(struct ImgPackPool *pool, int worker, struct ImgPackPoolTask *task) {
+	for (int i = 0; i < pool->workers; i++) {
+		struct ImgPackPoolDeque *deque = &pool->deques[(worker + i) % pool->workers];
+		int found = 0;
+		imgpack_mutex_lock(&deque->lock);
+		if (deque->head < deque->tail) {
+			*task = i == 0 ? deque->tasks[--deque->tail] : deque->tasks[deque->head++];
+			if (deque->head == deque->tail) deque->head = deque->tail = 0;
+			found = 1;
+		}
+		imgpack_mutex_unlock(&deque->lock);
+		if (found) return 1;
+	}
+	return 0;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI imgpack_pool__worker(LPVOID arg) {
+#else
+static void *imgpack_pool__worker(void *arg) {
+#endif
+	struct ImgPackPoolWorker *self = arg;
+	struct ImgPackPool *pool = self->pool;
+	for (;;) {
+		struct ImgPackPoolTask task;
+		if (imgpack_pool__take(pool, self->worker, &task)) {
+			imgpack_mutex_lock(&pool->lock);
+			pool->queued--;
+			imgpack_mutex_unlock(&pool->lock);
+			task.fn(pool, self->worker, task.udata, task.index);
+			imgpack_mutex_lock(&pool->lock);
+			if (--pool->pending == 0) imgpack_cond_broadcast(&pool->wake);
+			imgpack_mutex_unlock(&pool->lock);
+			continue;
+		}
+		imgpack_mutex_lock(&pool->lock);
+		while (pool->queued == 0 && pool->pending > 0) imgpack_cond_wait(&pool->wake, &pool->lock);
+		int done = pool->pending == 0;
+		imgpack_mutex_unlock(&pool->lock);
+		if (done) break;
+	}
+	return 0;
+}
+
+// Runs queued tasks and everything they push on the calling thread and
+// workers - 1 more threads, returns when no task is left
+static void imgpack_pool_run(struct ImgPackPool *pool) {
+	struct ImgPackPoolWorker *workers = ISLIP_MALLOC(sizeof(*workers) * pool->workers);
+	if (!workers) {
+		struct ImgPackPoolWorker self = {.pool = pool};
+		imgpack_pool__worker(&self);
+		return;
+	}
+	for (int i = 0; i < pool->workers; i++) {
+		workers[i] = (struct ImgPackPoolWorker) {.pool = pool, .worker = i};
+	}
+#ifndef IMGPACK_NO_THREADS
+	imgpack_thread_t *threads = ISLIP_MALLOC(sizeof(*threads) * pool->workers);
+	int started = 0;
+	for (; threads && started < pool->workers - 1; started++) {
+#ifdef _WIN32
+		threads[started] = CreateThread(NULL, 0, imgpack_pool__worker, &workers[started + 1], 0, NULL);
+		if (!threads[started]) break;
+#else
+		if (pthread_create(&threads[started], NULL, imgpack_pool__worker, &workers[started + 1])) break;
+#endif
+	}
+#endif
+	imgpack_pool__worker(&workers[0]);
+#ifndef IMGPACK_NO_THREADS
+	for (int i = 0; i < started; i++) {
+#ifdef _WIN32
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#else
+		pthread_join(threads[i], NULL);
+#endif
+	}
+	ISLIP_FREE(threads);
+#endif
+	ISLIP_FREE(workers);
+}
+
+#endif
@@ -0,0 +1,408 @@
+/*
+ * Reader of previously written atlas data used as a seed for layout-stable
+ * packing. Understands JSON_HASH, JSON_ARRAY and CSV outputs, only frame
+ * names, positions, rotation, pages and page sizes are read.
+ *
+ * JSON frames are matched by the name written with the current --naming,
+ * CSV frames are matched by path. Watch mode seeds every repack with the
+ * layout in memory, its frames are matched by path too.
+ */
+
+struct ImgPackSeedFrame {
+	char *name;
+	int x;
+	int y;
+	int w;
+	int h;
+	int page;
+	int rotated;
+	int used;
+};
+
+struct ImgPackSeed {
+	struct ImgPackSeedFrame *frames;
+	int framesCount;
+	int framesAllocated;
+	struct ImgPackPage *pages;
+	int pagesCount;
+	int byPath;
+	struct ImgPackUniqueSlot *slots;
+	int slotsAllocated;
+};
+
+struct ImgPackSeedReader {
+	const char *s;
+	int error;
+};
+
+static void imgpack_seed__skip_ws(struct ImgPackSeedReader *r) {
+	while (*r->s == ' ' || *r->s == '\t' || *r->s == '\n' || *r->s == '\r') r->s++;
+}
+
+static int imgpack_seed__accept(struct ImgPackSeedReader *r, char c) {
+	imgpack_seed__skip_ws(r);
+	if (*r->s != c) return 0;
+	r->s++;
+	return 1;
+}
+
+static void imgpack_seed__expect(struct ImgPackSeedReader *r, char c) {
+	if (!imgpack_seed__accept(r, c)) r->error = 1;
+}
+
+// Reads JSON string, escapes are kept except the escaped character itself
+static char *imgpack_seed__string(struct ImgPackSeedReader *r) {
+	imgpack_seed__expect(r, '"');
+	if (r->error) return NULL;
+	const char *end = r->s;
+	while (*end && *end != '"') end += end[0] == '\\' && end[1] ? 2 : 1;
+	if (*end != '"') {
+		r->error = 1;
+		return NULL;
+	}
+	char *s = ISLIP_MALLOC(end - r->s + 1), *out = s;
+	for (; r->s < end; r->s++) {
+		if (*r->s == '\\') r->s++;
+		*out++ = *r->s;
+	}
+	*out = '\0';
+	r->s++;
+	return s;
+}
+
+static double imgpack_seed__number(struct ImgPackSeedReader *r) {
+	imgpack_seed__skip_ws(r);
+	char *end;
+	double v = strtod(r->s, &end);
+	if (end == r->s) r->error = 1;
+	r->s = end;
+	return v;
+}
+
+static void imgpack_seed__skip_value(struct ImgPackSeedReader *r) {
+	imgpack_seed__skip_ws(r);
+	if (*r->s == '"') {
+		ISLIP_FREE(imgpack_seed__string(r));
+	} else if (*r->s == '{' || *r->s == '[') {
+		char close = *r->s == '{' ? '}' : ']';
+		r->s++;
+		if (imgpack_seed__accept(r, close)) return;
+		do {
+			if (close == '}') {
+				ISLIP_FREE(imgpack_seed__string(r));
+				imgpack_seed__expect(r, ':');
+			}
+			imgpack_seed__skip_value(r);
+		} while (!r->error && imgpack_seed__accept(r, ','));
+		imgpack_seed__expect(r, close);
+	} else if (!strncmp(r->s, "true", 4) || !strncmp(r->s, "null", 4)) {
+		r->s += 4;
+	} else if (!strncmp(r->s, "false", 5)) {
+		r->s += 5;
+	} else {
+		imgpack_seed__number(r);
+	}
+}
+
+static int imgpack_seed__bool(struct ImgPackSeedReader *r) {
+	imgpack_seed__skip_ws(r);
+	int v = !strncmp(r->s, "true", 4);
+	imgpack_seed__skip_value(r);
+	return v;
+}
+
+// Reads {"x":..,"y":..,"w":..,"h":..} object, missing fields are left as is
+static void imgpack_seed__rect(struct ImgPackSeedReader *r, int *x, int *y, int *w, int *h) {
+	imgpack_seed__expect(r, '{');
+	if (r->error || imgpack_seed__accept(r, '}')) return;
+	do {
+		char *key = imgpack_seed__string(r);
+		imgpack_seed__expect(r, ':');
+		if (r->error) {
+			ISLIP_FREE(key);
+			return;
+		}
+		if (x && !strcmp(key, "x")) *x = (int)imgpack_seed__number(r);
+		else if (y && !strcmp(key, "y")) *y = (int)imgpack_seed__number(r);
+		else if (!strcmp(key, "w")) *w = (int)imgpack_seed__number(r);
+		else if (!strcmp(key, "h")) *h = (int)imgpack_seed__number(r);
+		else imgpack_seed__skip_value(r);
+		ISLIP_FREE(key);
+	} while (!r->error && imgpack_seed__accept(r, ','));
+	imgpack_seed__expect(r, '}');
+}
+
+static struct ImgPackSeedFrame *imgpack_seed__push_frame(struct ImgPackSeed *seed) {
+	if (seed->framesCount >= seed->framesAllocated) {
+		seed->framesAllocated = seed->framesAllocated ? 2 * seed->framesAllocated : 64;
+		seed->frames = ISLIP_REALLOC(seed->frames, seed->framesAllocated * sizeof(*seed->frames));
+	}
+	struct ImgPackSeedFrame *frame = &seed->frames[seed->framesCount++];
+	*frame = (struct ImgPackSeedFrame) {0};
+	return frame;
+}
+
+static void imgpack_seed__push_page(struct ImgPackSeed *seed, int width, int height) {
+	seed->pages = ISLIP_REALLOC(seed->pages, (seed->pagesCount + 1) * sizeof(*seed->pages));
+	seed->pages[seed->pagesCount++] = (struct ImgPackPage) {.width = width, .height = height};
+}
+
+// Frame object body, name is already known for JSON_HASH
+static void imgpack_seed__frame(struct ImgPackSeedReader *r, struct ImgPackSeed *seed, char *name) {
+	struct ImgPackSeedFrame *frame = imgpack_seed__push_frame(seed);
+	frame->name = name;
+	imgpack_seed__expect(r, '{');
+	if (r->error || imgpack_seed__accept(r, '}')) return;
+	do {
+		char *key = imgpack_seed__string(r);
+		imgpack_seed__expect(r, ':');
+		if (r->error) {
+			ISLIP_FREE(key);
+			return;
+		}
+		if (!strcmp(key, "filename") && !frame->name) frame->name = imgpack_seed__string(r);
+		else if (!strcmp(key, "frame")) imgpack_seed__rect(r, &frame->x, &frame->y, &frame->w, &frame->h);
+		else if (!strcmp(key, "rotated")) frame->rotated = imgpack_seed__bool(r);
+		else if (!strcmp(key, "page")) frame->page = (int)imgpack_seed__number(r);
+		else imgpack_seed__skip_value(r);
+		ISLIP_FREE(key);
+	} while (!r->error && imgpack_seed__accept(r, ','));
+	imgpack_seed__expect(r, '}');
+}
+
+static void imgpack_seed__meta(struct ImgPackSeedReader *r, struct ImgPackSeed *seed) {
+	int width = 0, height = 0, has_pages = 0;
+	imgpack_seed__expect(r, '{');
+	if (r->error || imgpack_seed__accept(r, '}')) return;
+	do {
+		char *key = imgpack_seed__string(r);
+		imgpack_seed__expect(r, ':');
+		if (r->error) {
+			ISLIP_FREE(key);
+			return;
+		}
+		if (!strcmp(key, "size")) {
+			imgpack_seed__rect(r, NULL, NULL, &width, &height);
+		} else if (!strcmp(key, "pages")) {
+			has_pages = 1;
+			imgpack_seed__expect(r, '[');
+			if (!r->error && !imgpack_seed__accept(r, ']')) {
+				do {
+					int page_width = 0, page_height = 0;
+					imgpack_seed__expect(r, '{');
+					if (!r->error && !imgpack_seed__accept(r, '}')) {
+						do {
+							char *page_key = imgpack_seed__string(r);
+							imgpack_seed__expect(r, ':');
+							if (!r->error && !strcmp(page_key, "size")) imgpack_seed__rect(r, NULL, NULL, &page_width, &page_height);
+							else if (!r->error) imgpack_seed__skip_value(r);
+							ISLIP_FREE(page_key);
+						} while (!r->error && imgpack_seed__accept(r, ','));
+						imgpack_seed__expect(r, '}');
+					}
+					imgpack_seed__push_page(seed, page_width, page_height);
+				} while (!r->error && imgpack_seed__accept(r, ','));
+				imgpack_seed__expect(r, ']');
+			}
+		} else {
+			imgpack_seed__skip_value(r);
+		}
+		ISLIP_FREE(key);
+	} while (!r->error && imgpack_seed__accept(r, ','));
+	imgpack_seed__expect(r, '}');
+	if (!has_pages) imgpack_seed__push_page(seed, width, height);
+}
+
+static int imgpack_seed__parse_json(struct ImgPackSeed *seed, const char *text) {
+	struct ImgPackSeedReader r = {.s = text};
+	imgpack_seed__expect(&r, '{');
+	if (r.error || imgpack_seed__accept(&r, '}')) return r.error;
+	do {
+		char *key = imgpack_seed__string(&r);
+		imgpack_seed__expect(&r, ':');
+		if (r.error) {
+			ISLIP_FREE(key);
+			break;
+		}
+		if (!strcmp(key, "frames") && imgpack_seed__accept(&r, '{')) {
+			if (!imgpack_seed__accept(&r, '}')) {
+				do {
+					char *name = imgpack_seed__string(&r);
+					imgpack_seed__expect(&r, ':');
+					if (r.error) ISLIP_FREE(name);
+					else imgpack_seed__frame(&r, seed, name);
+				} while (!r.error && imgpack_seed__accept(&r, ','));
+				imgpack_seed__expect(&r, '}');
+			}
+		} else if (!strcmp(key, "frames") && imgpack_seed__accept(&r, '[')) {
+			if (!imgpack_seed__accept(&r, ']')) {
+				do {
+					imgpack_seed__frame(&r, seed, NULL);
+				} while (!r.error && imgpack_seed__accept(&r, ','));
+				imgpack_seed__expect(&r, ']');
+			}
+		} else if (!strcmp(key, "meta")) {
+			imgpack_seed__meta(&r, seed);
+		} else {
+			imgpack_seed__skip_value(&r);
+		}
+		ISLIP_FREE(key);
+	} while (!r.error && imgpack_seed__accept(&r, ','));
+	imgpack_seed__expect(&r, '}');
+	return r.error;
+}
+
+// Splits CSV line in place, quoted values are unquoted
+static int imgpack_seed__csv_fields(char *line, char **fields, int max_fields) {
+	int count = 0;
+	char *s = line;
+	while (count < max_fields) {
+		while (*s == ' ' || *s == '\t') s++;
+		char *end;
+		if (*s == '"') {
+			fields[count++] = ++s;
+			while (*s && *s != '"') s++;
+			end = s;
+			if (*s) s++;
+			while (*s && *s != ',' && *s != '\r') s++;
+		} else {
+			fields[count++] = s;
+			while (*s && *s != ',' && *s != '\r') s++;
+			end = s;
+			while (end > fields[count-1] && (end[-1] == ' ' || end[-1] == '\t')) end--;
+		}
+		char next = *s;
+		*end = '\0';
+		if (next != ',') break;
+		s++;
+	}
+	return count;
+}
+
+static int imgpack_seed__parse_csv(struct ImgPackSeed *seed, char *text) {
+	enum {PATH, X, Y, WIDTH, HEIGHT, PAGE, ROTATED, COLUMNS};
+	static const char *names[] = {"path", "x", "y", "width", "height", "page", "rotated"};
+	int columns[COLUMNS] = {-1, -1, -1, -1, -1, -1, -1};
+	char *fields[64];
+	char *line = strtok(text, "\n");
+	if (!line) return 1;
+	int count = imgpack_seed__csv_fields(line, fields, 64);
+	for (int i = 0; i < count; i++) {
+		for (int j = 0; j < COLUMNS; j++) {
+			if (!strcmp(fields[i], names[j])) columns[j] = i;
+		}
+	}
+	for (int j = PATH; j <= HEIGHT; j++) {
+		if (columns[j] < 0) return 1;
+	}
+	seed->byPath = 1;
+	while ((line = strtok(NULL, "\n"))) {
+		count = imgpack_seed__csv_fields(line, fields, 64);
+		if (count <= columns[HEIGHT] || count <= columns[PATH]) continue;
+		struct ImgPackSeedFrame *frame = imgpack_seed__push_frame(seed);
+		frame->name = copy_string(fields[columns[PATH]]);
+		frame->x = atoi(fields[columns[X]]);
+		frame->y = atoi(fields[columns[Y]]);
+		frame->w = atoi(fields[columns[WIDTH]]);
+		frame->h = atoi(fields[columns[HEIGHT]]);
+		if (columns[PAGE] >= 0 && columns[PAGE] < count) frame->page = atoi(fields[columns[PAGE]]);
+		if (columns[ROTATED] >= 0 && columns[ROTATED] < count) frame->rotated = atoi(fields[columns[ROTATED]]);
+	}
+	return 0;
+}
+
+static void imgpack_seed_free(struct ImgPackSeed *seed) {
+	if (!seed) return;
+	for (int i = 0; i < seed->framesCount; i++) ISLIP_FREE(seed->frames[i].name);
+	ISLIP_FREE(seed->frames);
+	ISLIP_FREE(seed->pages);
+	ISLIP_FREE(seed->slots);
+	ISLIP_FREE(seed);
+}
+
+static uint64_t imgpack_seed__hash(const char *s) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (; *s; s++) hash = (hash ^ (unsigned char)*s) * 0x100000001b3ULL;
+	return hash;
+}
+
+static void imgpack_seed__index(struct ImgPackSeed *seed) {
+	seed->slotsAllocated = 64;
+	while (seed->slotsAllocated < 2 * seed->framesCount) seed->slotsAllocated *= 2;
+	seed->slots = ISLIP_MALLOC(seed->slotsAllocated * sizeof(*seed->slots));
+	for (int i = 0; i < seed->slotsAllocated; i++) seed->slots[i].id = -1;
+	uint64_t mask = seed->slotsAllocated - 1;
+	for (int i = 0; i < seed->framesCount; i++) {
+		uint64_t key = imgpack_seed__hash(seed->frames[i].name);
+		uint64_t j = key & mask;
+		while (seed->slots[j].id >= 0) j = (j + 1) & mask;
+		seed->slots[j] = (struct ImgPackUniqueSlot) {.key = key, .id = i};
+	}
+}
+
+static struct ImgPackSeed *imgpack_seed_load(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *text = size >= 0 ? ISLIP_MALLOC(size + 1) : NULL;
+	if (!text || fread(text, 1, size, f) != (size_t)size) {
+		ISLIP_FREE(text);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	text[size] = '\0';
+	struct ImgPackSeed *seed = ISLIP_MALLOC(sizeof(*seed));
+	*seed = (struct ImgPackSeed) {0};
+	const char *start = text;
+	while (isspace((unsigned char)*start)) start++;
+	int status = *start == '{' ? imgpack_seed__parse_json(seed, start) : imgpack_seed__parse_csv(seed, text);
+	ISLIP_FREE(text);
+	if (status) {
+		imgpack_seed_free(seed);
+		return NULL;
+	}
+	imgpack_seed__index(seed);
+	return seed;
+}
+
+#ifndef IMGPACK_NO_MAIN
+// Seed of the current layout matched by path, watch mode packs the next
+// layout with it
+static struct ImgPackSeed *imgpack_seed_from_layout(struct ImgPackContext *ctx) {
+	struct ImgPackSeed *seed = ISLIP_MALLOC(sizeof(*seed));
+	*seed = (struct ImgPackSeed) {.byPath = 1};
+	for (int i = 0; i < ctx->pagesCount; i++) {
+		imgpack_seed__push_page(seed, ctx->pages[i].width, ctx->pages[i].height);
+	}
+	for (int i = 0; i < ctx->size; i++) {
+		if (ctx->images[i].copyOf >= 0) continue;
+		struct ImgPackSeedFrame *frame = imgpack_seed__push_frame(seed);
+		struct stbrp_rect rect = get_frame_rect(ctx, i);
+		frame->name = copy_string(ctx->images[i].path);
+		frame->x = rect.x;
+		frame->y = rect.y;
+		frame->w = rect.w;
+		frame->h = rect.h;
+		frame->page = get_frame_page(ctx, i);
+		frame->rotated = is_image_rotated(ctx, i);
+	}
+	imgpack_seed__index(seed);
+	return seed;
+}
+#endif
+
+// Returns the first not used frame with the given name or NULL
+static struct ImgPackSeedFrame *imgpack_seed_find(struct ImgPackSeed *seed, const char *name) {
+	uint64_t key = imgpack_seed__hash(name), mask = seed->slotsAllocated - 1;
+	struct ImgPackSeedFrame *found = NULL;
+	for (uint64_t j = key & mask; seed->slots[j].id >= 0; j = (j + 1) & mask) {
+		struct ImgPackSeedFrame *frame = &seed->frames[seed->slots[j].id];
+		if (seed->slots[j].key == key && !frame->used && !strcmp(frame->name, name) && (!found || frame < found)) {
+			found = frame;
+		}
+	}
+	return found;
+}
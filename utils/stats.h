@@ -0,0 +1,268 @@
+/*
+ * Instrumentation for --stats. Stages run by the calling thread record wall
+ * time and CPU time of the whole process, so worker threads of the stage are
+ * counted too. Stages done inside of parallel tasks (decode, resize, trim and
+ * hash) sum wall and CPU time of the running thread over all tasks, so they
+ * can take longer than the stage which runs the tasks. Per thread CPU time is
+ * known on Linux and Windows, elsewhere wall time is used for them.
+ *
+ * The report is JSON written after the atlas, see imgpack_stats_save.
+ */
+
+#ifndef IMGPACK_STATS_H_
+#define IMGPACK_STATS_H_
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <sys/time.h>
+#endif
+
+enum ImgPackStage {
+	IMGPACK_STAGE_SCAN,
+	IMGPACK_STAGE_PREPARE,
+	IMGPACK_STAGE_DECODE,
+	IMGPACK_STAGE_RESIZE,
+	IMGPACK_STAGE_TRIM,
+	IMGPACK_STAGE_HASH,
+	IMGPACK_STAGE_DEDUP,
+	IMGPACK_STAGE_PACK,
+	IMGPACK_STAGE_COMPOSITE,
+	IMGPACK_STAGE_ENCODE,
+	IMGPACK_STAGE_FORMAT,
+	IMGPACK_STAGES_COUNT,
+};
+
+static const char *imgpack_stage_names[] = {"scan", "prepare", "decode", "resize", "trim", "hash", "dedup", "pack", "composite", "encode", "format"};
+
+struct ImgPackStatsTimer {
+	double wallMs;
+	double cpuMs;
+};
+
+struct ImgPackStageStats {
+	double wallMs;
+	double cpuMs;
+	int count;
+};
+
+struct ImgPackStatsSize {
+	int width;
+	int height;
+	int fits;
+};
+
+struct ImgPackStats {
+	char *path;
+	struct ImgPackStatsTimer start;
+	struct ImgPackStageStats stages[IMGPACK_STAGES_COUNT];
+	// Sizes tried by the packers, in the order they were tried
+	struct ImgPackStatsSize *sizes;
+	int sizesCount;
+	int sizesAllocated;
+	long long bytesRead;
+	long long bytesWritten;
+	imgpack_mutex_t lock;
+};
+
+static double imgpack_stats__wall_ms(void) {
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return 1000.0 * (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return 1000.0 * tv.tv_sec + tv.tv_usec / 1000.0;
+#endif
+}
+
+// CPU time of the process or of the calling thread
+static double imgpack_stats__cpu_ms(int thread) {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	BOOL ok = thread ? GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user) :
+		GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+	if (!ok) return 0.0;
+	ULONGLONG k = ((ULONGLONG)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+	ULONGLONG u = ((ULONGLONG)user.dwHighDateTime << 32) | user.dwLowDateTime;
+	return (double)(k + u) / 10000.0;
+#else
+	int who = RUSAGE_SELF;
+	if (thread) {
+#ifdef __linux__
+		// RUSAGE_THREAD, hidden without _GNU_SOURCE
+		who = 1;
+#else
+		return imgpack_stats__wall_ms();
+#endif
+	}
+	struct rusage usage;
+	if (getrusage(who, &usage)) return 0.0;
+	return 1000.0 * (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+#endif
+}
+
+static long long imgpack_stats__peak_rss(void) {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return (long long)counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage)) return 0;
+#ifdef __APPLE__
+	return (long long)usage.ru_maxrss;
+#else
+	return 1024LL * usage.ru_maxrss;
+#endif
+#endif
+}
+
+static struct ImgPackStats *imgpack_stats_create(const char *path) {
+	struct ImgPackStats *stats = ISLIP_MALLOC(sizeof(*stats));
+	if (!stats) return NULL;
+	*stats = (struct ImgPackStats) {.path = copy_string(path)};
+	stats->start = (struct ImgPackStatsTimer) {imgpack_stats__wall_ms(), imgpack_stats__cpu_ms(0)};
+	imgpack_mutex_init(&stats->lock);
+	return stats;
+}
+
+static void imgpack_stats_free(struct ImgPackStats *stats) {
+	if (!stats) return;
+	imgpack_mutex_destroy(&stats->lock);
+	ISLIP_FREE(stats->sizes);
+	ISLIP_FREE(stats->path);
+	ISLIP_FREE(stats);
+}
+
+#ifndef IMGPACK_NO_MAIN
+// Forgets everything measured, watch mode reports every repack on its own
+static void imgpack_stats_reset(struct ImgPackStats *stats) {
+	if (!stats) return;
+	memset(stats->stages, 0, sizeof(stats->stages));
+	stats->sizesCount = 0;
+	stats->bytesRead = 0;
+	stats->bytesWritten = 0;
+	stats->start = (struct ImgPackStatsTimer) {imgpack_stats__wall_ms(), imgpack_stats__cpu_ms(0)};
+}
+#endif
+
+// Pass thread = 1 for stages measured inside of parallel tasks
+static struct ImgPackStatsTimer imgpack_stats_begin(struct ImgPackStats *stats, int thread) {
+	struct ImgPackStatsTimer timer = {0};
+	if (stats) timer = (struct ImgPackStatsTimer) {imgpack_stats__wall_ms(), imgpack_stats__cpu_ms(thread)};
+	return timer;
+}
+
+static void imgpack_stats_end(struct ImgPackStats *stats, enum ImgPackStage stage, struct ImgPackStatsTimer timer, int thread) {
+	if (!stats) return;
+	double wall = imgpack_stats__wall_ms() - timer.wallMs, cpu = imgpack_stats__cpu_ms(thread) - timer.cpuMs;
+	imgpack_mutex_lock(&stats->lock);
+	stats->stages[stage].wallMs += wall;
+	stats->stages[stage].cpuMs += cpu;
+	stats->stages[stage].count++;
+	imgpack_mutex_unlock(&stats->lock);
+}
+
+static void imgpack_stats_add_size(struct ImgPackStats *stats, int width, int height, int fits) {
+	if (!stats) return;
+	imgpack_mutex_lock(&stats->lock);
+	if (stats->sizesCount >= stats->sizesAllocated) {
+		int allocated = stats->sizesAllocated ? 2 * stats->sizesAllocated : 64;
+		struct ImgPackStatsSize *sizes = ISLIP_REALLOC(stats->sizes, sizeof(*sizes) * allocated);
+		if (sizes) {
+			stats->sizes = sizes;
+			stats->sizesAllocated = allocated;
+		}
+	}
+	if (stats->sizesCount < stats->sizesAllocated) {
+		stats->sizes[stats->sizesCount++] = (struct ImgPackStatsSize) {width, height, fits};
+	}
+	imgpack_mutex_unlock(&stats->lock);
+}
+
+static void imgpack_stats_add_bytes(struct ImgPackStats *stats, long long read, long long written) {
+	if (!stats) return;
+	imgpack_mutex_lock(&stats->lock);
+	stats->bytesRead += read;
+	stats->bytesWritten += written;
+	imgpack_mutex_unlock(&stats->lock);
+}
+
+// Counts the file decoded by stb_image, which reads it whole
+static void imgpack_stats_add_file(struct ImgPackStats *stats, const char *path) {
+	struct stat st;
+	if (stats && !stat(path, &st)) imgpack_stats_add_bytes(stats, (long long)st.st_size, 0);
+}
+
+static void imgpack_stats__write_time(struct ImgPackWriter *writer, double wall_ms, double cpu_ms) {
+	imgpack_writer_printf(writer, "\"wall_ms\": %.3f, \"cpu_ms\": %.3f", wall_ms, cpu_ms);
+}
+
+// Area of packed rects of the page with padding and extrusion, copies take
+// no place
+static long long imgpack_stats_used_area(const struct ImgPackContext *ctx, int page) {
+	long long used = 0;
+	for (int i = 0; i < ctx->size; i++) {
+		int id = ctx->images[i].id;
+		if (ctx->packingPages[id] == page) used += (long long)ctx->packingRects[id].w * ctx->packingRects[id].h;
+	}
+	return used;
+}
+
+// Occupancy is the used area over the area of pages
+static int imgpack_stats_save(struct ImgPackContext *ctx) {
+	struct ImgPackStats *stats = ctx->stats;
+	struct ImgPackWriter writer;
+	if (!stats) return 0;
+	if (imgpack_writer_open(&writer, stats->path)) {
+		printf("Cannot open for writing \"%s\"\n", stats->path);
+		return 1;
+	}
+	int copies = 0;
+	long long used_area = 0, pages_area = 0;
+	for (int i = 0; i < ctx->size; i++) {
+		if (ctx->images[i].copyOf >= 0) copies++;
+	}
+	imgpack_writer_printf(&writer, "{\n\t\"version\": \"%s\",\n\t\"images\": %d,\n\t\"copies\": %d,\n\t\"total\": {", ISLIP_VERSION, ctx->size, copies);
+	imgpack_stats__write_time(&writer, imgpack_stats__wall_ms() - stats->start.wallMs, imgpack_stats__cpu_ms(0) - stats->start.cpuMs);
+	imgpack_writer_printf(&writer, "},\n\t\"peak_rss\": %lld,\n\t\"bytes_read\": %lld,\n\t\"bytes_written\": %lld,\n\t\"stages\": {\n",
+			imgpack_stats__peak_rss(), stats->bytesRead, stats->bytesWritten);
+	for (int i = 0; i < IMGPACK_STAGES_COUNT; i++) {
+		const struct ImgPackStageStats *stage = &stats->stages[i];
+		imgpack_writer_printf(&writer, "\t\t\"%s\": {", imgpack_stage_names[i]);
+		imgpack_stats__write_time(&writer, stage->wallMs, stage->cpuMs);
+		imgpack_writer_printf(&writer, ", \"count\": %d", stage->count);
+		if (i == IMGPACK_STAGE_PACK) {
+			imgpack_writer_printf(&writer, ", \"attempts\": %d, \"sizes\": [", ctx->packAttempts);
+			for (int j = 0; j < stats->sizesCount; j++) {
+				const struct ImgPackStatsSize *size = &stats->sizes[j];
+				imgpack_writer_printf(&writer, "%s{\"w\": %d, \"h\": %d, \"fits\": %s}", j > 0 ? ", " : "", size->width, size->height, size->fits ? "true" : "false");
+			}
+			imgpack_writer_printf(&writer, "]");
+		}
+		imgpack_writer_printf(&writer, "}%s\n", i + 1 < IMGPACK_STAGES_COUNT ? "," : "");
+	}
+	imgpack_writer_printf(&writer, "\t},\n\t\"pages\": [");
+	for (int page = 0; page < ctx->pagesCount; page++) {
+		long long area = (long long)ctx->pages[page].width * ctx->pages[page].height, used = imgpack_stats_used_area(ctx, page);
+		imgpack_writer_printf(&writer, "%s\n\t\t{\"w\": %d, \"h\": %d, \"used_area\": %lld, \"occupancy\": %.4f}", page > 0 ? "," : "",
+				ctx->pages[page].width, ctx->pages[page].height, used, area > 0 ? (double)used / area : 0.0);
+		used_area += used;
+		pages_area += area;
+	}
+	imgpack_writer_printf(&writer, "%s],\n\t\"occupancy\": %.4f\n}\n", ctx->pagesCount > 0 ? "\n\t" : "", pages_area > 0 ? (double)used_area / pages_area : 0.0);
+	if (imgpack_writer_close(&writer)) {
+		printf("Cannot write stats \"%s\"\n", stats->path);
+		return 1;
+	}
+	return 0;
+}
+
+#endif
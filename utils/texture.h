@@ -0,0 +1,344 @@
+/*
+ * DDS and KTX2 writer for atlas pages in GPU formats. Rows are fed in bands
+ * like to the PNG writer, block rows of the band are compressed on worker
+ * threads and written in order. Sizes of block compressed pages should be
+ * multiples of 4, edge blocks of other sizes repeat the last row and column.
+ * Mip levels are fed one after another from the largest one, each level is
+ * written at its place in the file, which is smallest first in KTX2.
+ *
+ * DDS gets BC1 and BC3 as DXT1 and DXT5, BC7 with DX10 header extension and
+ * uncompressed formats with channel masks. ETC2 formats are written only to
+ * KTX2. Uncompressed pixels are packed as OpenGL and Vulkan expect them: 16-bit
+ * little endian words with red in the high bits, A8 and L8 go to KTX2 as R8
+ * with swizzle.
+ */
+
+#ifndef IMGPACK_TEXTURE_H_
+#define IMGPACK_TEXTURE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define IMGPACK_TEXTURE_MAX_LEVELS 16
+
+enum ImgPackColorFormat {
+	IMGPACK_RGBA8888,
+	IMGPACK_BC1,
+	IMGPACK_BC3,
+	IMGPACK_BC7,
+	IMGPACK_ETC2_RGB,
+	IMGPACK_ETC2_RGBA,
+	IMGPACK_RGBA4444,
+	IMGPACK_RGB565,
+	IMGPACK_RGBA5551,
+	IMGPACK_A8,
+	IMGPACK_L8,
+};
+
+enum ImgPackTextureContainer {
+	IMGPACK_TEXTURE_DDS,
+	IMGPACK_TEXTURE_KTX2,
+};
+
+struct ImgPackTextureFormat {
+	void (*encode)(const unsigned char *rgba, enum ImgPackBlockQuality quality, unsigned char *out);
+	int blockSize;
+	int blockBytes;
+	uint32_t fourCC;
+	uint32_t dxgiFormat;
+	uint32_t vkFormat;
+	int dfdModel;
+	int dfdColorChannel;
+	int dfdAlphaChannel;
+	// Uncompressed formats: bits and bit offsets of red, green, blue and
+	// alpha in the pixel, DDS pixel format flags and KTX2 swizzle
+	unsigned char bits[4];
+	unsigned char shifts[4];
+	uint32_t ddsFlags;
+	int gray;
+	const char *swizzle;
+};
+
+// Indexed by ImgPackColorFormat. Compressed KTX2 formats are described by
+// one data format descriptor sample per block half
+static const struct ImgPackTextureFormat imgpack_texture_formats[] = {
+	{NULL, 1, 4, 0, 0, 37, 1, 0, 15, {8, 8, 8, 8}, {0, 8, 16, 24}, 0x41, 0, NULL},
+	{imgpack_bc1_block, 4, 8, 0x31545844, 0, 133, 128, 1, -1, {0}, {0}, 0, 0, NULL},
+	{imgpack_bc3_block, 4, 16, 0x35545844, 0, 137, 130, 0, 15, {0}, {0}, 0, 0, NULL},
+	{imgpack_bc7_block, 4, 16, 0, 98, 145, 134, 0, -1, {0}, {0}, 0, 0, NULL},
+	{imgpack_etc2_rgb_block, 4, 8, 0, 0, 147, 161, 2, -1, {0}, {0}, 0, 0, NULL},
+	{imgpack_etc2_rgba_block, 4, 16, 0, 0, 151, 161, 2, 15, {0}, {0}, 0, 0, NULL},
+	{NULL, 1, 2, 0, 0, 2, 1, 0, 15, {4, 4, 4, 4}, {12, 8, 4, 0}, 0x41, 0, NULL},
+	{NULL, 1, 2, 0, 0, 4, 1, 0, -1, {5, 6, 5, 0}, {11, 5, 0, 0}, 0x40, 0, NULL},
+	{NULL, 1, 2, 0, 0, 6, 1, 0, 15, {5, 5, 5, 1}, {11, 6, 1, 0}, 0x41, 0, NULL},
+	{NULL, 1, 1, 0, 0, 9, 1, 0, -1, {0, 0, 0, 8}, {0, 0, 0, 0}, 0x2, 0, "000r"},
+	{NULL, 1, 1, 0, 0, 9, 1, 0, -1, {8, 0, 0, 0}, {0, 0, 0, 0}, 0x20000, 1, "rrr1"},
+};
+
+struct ImgPackTextureWriter {
+	struct ImgPackWriter *out;
+	enum ImgPackColorFormat format;
+	enum ImgPackBlockQuality quality;
+	int width;
+	int height;
+	int levels;
+	int jobs;
+	int level;
+	int levelWidth;
+	int levelHeight;
+	uint64_t offsets[IMGPACK_TEXTURE_MAX_LEVELS];
+	int row;
+	const unsigned char *band;
+	int bandRows;
+	unsigned char *blocks;
+	int status;
+};
+
+static int imgpack_texture_supported(enum ImgPackTextureContainer container, enum ImgPackColorFormat format) {
+	return container == IMGPACK_TEXTURE_KTX2 || (format != IMGPACK_ETC2_RGB && format != IMGPACK_ETC2_RGBA);
+}
+
+static void imgpack_texture__put32(unsigned char *p, uint32_t v) {
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+static void imgpack_texture__put64(unsigned char *p, uint64_t v) {
+	imgpack_texture__put32(p, (uint32_t)v);
+	imgpack_texture__put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t imgpack_texture__size(const struct ImgPackTextureFormat *format, int width, int height) {
+	uint64_t w = (width + format->blockSize - 1) / format->blockSize, h = (height + format->blockSize - 1) / format->blockSize;
+	return w * h * format->blockBytes;
+}
+
+static int imgpack_texture_level_size(int size, int level) {
+	return size >> level > 0 ? size >> level : 1;
+}
+
+static uint64_t imgpack_texture__level_bytes(const struct ImgPackTextureWriter *writer, int level) {
+	return imgpack_texture__size(&imgpack_texture_formats[writer->format],
+			imgpack_texture_level_size(writer->width, level), imgpack_texture_level_size(writer->height, level));
+}
+
+static void imgpack_texture__write_dds(struct ImgPackTextureWriter *writer) {
+	const struct ImgPackTextureFormat *format = &imgpack_texture_formats[writer->format];
+	unsigned char header[4 + 124 + 20] = {'D', 'D', 'S', ' '};
+	unsigned char *h = header + 4, *pf = h + 72;
+	int compressed = format->blockSize > 1, dx10 = format->dxgiFormat != 0;
+	// Caps, height, width and pixel format, plus linear size or pitch
+	imgpack_texture__put32(h, 124);
+	imgpack_texture__put32(h + 4, 0x1007 | (compressed ? 0x80000 : 0x8) | (writer->levels > 1 ? 0x20000 : 0));
+	imgpack_texture__put32(h + 8, writer->height);
+	imgpack_texture__put32(h + 12, writer->width);
+	imgpack_texture__put32(h + 16, compressed ? (uint32_t)imgpack_texture__size(format, writer->width, writer->height) :
+			(uint32_t)format->blockBytes * writer->width);
+	if (writer->levels > 1) imgpack_texture__put32(h + 24, writer->levels);
+	imgpack_texture__put32(pf, 32);
+	if (compressed) {
+		imgpack_texture__put32(pf + 4, 0x4);
+		imgpack_texture__put32(pf + 8, dx10 ? 0x30315844 : format->fourCC);
+	} else {
+		imgpack_texture__put32(pf + 4, format->ddsFlags);
+		imgpack_texture__put32(pf + 12, 8 * format->blockBytes);
+		for (int c = 0; c < 4; c++) {
+			if (format->bits[c]) imgpack_texture__put32(pf + 16 + 4*c, ((1u << format->bits[c]) - 1) << format->shifts[c]);
+		}
+	}
+	imgpack_texture__put32(h + 104, 0x1000 | (writer->levels > 1 ? 0x400008 : 0));
+	if (dx10) {
+		// DXGI format, 2D texture dimension, no flags and single array element
+		imgpack_texture__put32(h + 124, format->dxgiFormat);
+		imgpack_texture__put32(h + 128, 3);
+		imgpack_texture__put32(h + 136, 1);
+	}
+	imgpack_writer_write(writer->out, header, dx10 ? sizeof(header) : 4 + 124);
+	writer->offsets[0] = dx10 ? sizeof(header) : 4 + 124;
+	for (int i = 1; i < writer->levels; i++) {
+		writer->offsets[i] = writer->offsets[i - 1] + imgpack_texture__level_bytes(writer, i - 1);
+	}
+}
+
+static void imgpack_texture__write_ktx2(struct ImgPackTextureWriter *writer) {
+	static const unsigned char identifier[12] = {0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+	const struct ImgPackTextureFormat *format = &imgpack_texture_formats[writer->format];
+	unsigned char header[1024] = {0};
+	int compressed = format->blockSize > 1;
+	int samples = compressed ? (format->dfdAlphaChannel >= 0 ? 2 : 1) : !!format->bits[0] + !!format->bits[1] + !!format->bits[2] + !!format->bits[3];
+	uint32_t dfd_size = 4 + 24 + 16 * samples, dfd_offset = 80 + 24 * writer->levels;
+	// Swizzle is the only key-value pair, 4 bytes of length, key and value with terminating zeros
+	uint32_t kvd_offset = dfd_offset + dfd_size, kvd_size = format->swizzle ? 4 + 11 + 5 : 0;
+	uint32_t align = format->blockBytes < 4 ? 4 : format->blockBytes;
+	uint32_t data_offset = (kvd_offset + kvd_size + align - 1) / align * align;
+	memcpy(header, identifier, 12);
+	imgpack_texture__put32(header + 12, format->vkFormat);
+	imgpack_texture__put32(header + 16, compressed ? 1 : format->blockBytes == 2 ? 2 : 1);
+	imgpack_texture__put32(header + 20, writer->width);
+	imgpack_texture__put32(header + 24, writer->height);
+	imgpack_texture__put32(header + 36, 1);
+	imgpack_texture__put32(header + 40, writer->levels);
+	imgpack_texture__put32(header + 48, dfd_offset);
+	imgpack_texture__put32(header + 52, dfd_size);
+	if (kvd_size) {
+		imgpack_texture__put32(header + 56, kvd_offset);
+		imgpack_texture__put32(header + 60, kvd_size);
+		imgpack_texture__put32(header + kvd_offset, kvd_size - 4);
+		memcpy(header + kvd_offset + 4, "KTXswizzle", 11);
+		memcpy(header + kvd_offset + 4 + 11, format->swizzle, 5);
+	}
+	// Level index goes from the base level, data from the smallest level
+	uint64_t level_offset = data_offset;
+	for (int i = writer->levels - 1; i >= 0; i--) {
+		uint64_t size = imgpack_texture__level_bytes(writer, i);
+		writer->offsets[i] = level_offset;
+		imgpack_texture__put64(header + 80 + 24*i, level_offset);
+		imgpack_texture__put64(header + 88 + 24*i, size);
+		imgpack_texture__put64(header + 96 + 24*i, size);
+		level_offset = (level_offset + size + align - 1) / align * align;
+	}
+
+	// Basic data format descriptor: color model, BT.709 primaries, linear
+	// transfer, straight alpha, block dimensions and bytes per block
+	unsigned char *dfd = header + dfd_offset;
+	imgpack_texture__put32(dfd, dfd_size);
+	imgpack_texture__put32(dfd + 8, 2 | (24 + 16 * samples) << 16);
+	imgpack_texture__put32(dfd + 12, format->dfdModel | 1 << 8 | 1 << 16);
+	imgpack_texture__put32(dfd + 16, compressed ? 3 | 3 << 8 : 0);
+	imgpack_texture__put32(dfd + 20, format->blockBytes);
+	if (compressed) {
+		for (int i = 0; i < samples; i++) {
+			unsigned char *sample = dfd + 28 + 16 * i;
+			// Alpha half goes first in the block
+			int alpha = samples == 2 && i == 0, offset = samples == 2 && i == 1 ? 64 : 0;
+			int channel = alpha ? format->dfdAlphaChannel : format->dfdColorChannel;
+			imgpack_texture__put32(sample, offset | (8 * format->blockBytes / samples - 1) << 16 | channel << 24);
+			imgpack_texture__put32(sample + 12, 0xffffffffu);
+		}
+	} else {
+		// Samples go in order of bit offsets, single channel formats are red
+		unsigned char *sample = dfd + 28;
+		for (int shift = 0; shift < 8 * format->blockBytes; shift++) {
+			for (int c = 0; c < 4; c++) {
+				if (!format->bits[c] || format->shifts[c] != shift) continue;
+				int channel = samples == 1 ? 0 : c == 3 ? format->dfdAlphaChannel : c;
+				imgpack_texture__put32(sample, shift | (format->bits[c] - 1) << 16 | channel << 24);
+				imgpack_texture__put32(sample + 12, (1u << format->bits[c]) - 1);
+				sample += 16;
+			}
+		}
+	}
+	imgpack_writer_write(writer->out, header, data_offset);
+}
+
+// Writes the header for levels mip levels to out, which is closed by
+// imgpack_texture_end. Returns non-zero on failure
+static int imgpack_texture_begin(struct ImgPackTextureWriter *writer, struct ImgPackWriter *out, enum ImgPackTextureContainer container,
+		enum ImgPackColorFormat format, int width, int height, int levels, enum ImgPackBlockQuality quality, int jobs) {
+	*writer = (struct ImgPackTextureWriter) {
+		.out = imgpack_texture_supported(container, format) && levels >= 1 && levels <= IMGPACK_TEXTURE_MAX_LEVELS ? out : NULL,
+		.format = format,
+		.quality = quality,
+		.width = width,
+		.height = height,
+		.levels = levels,
+		.jobs = jobs,
+		.levelWidth = width,
+		.levelHeight = height,
+	};
+	if (!writer->out) return 1;
+	if (container == IMGPACK_TEXTURE_DDS) {
+		imgpack_texture__write_dds(writer);
+	} else {
+		imgpack_texture__write_ktx2(writer);
+	}
+	return writer->status = imgpack_writer_seek(writer->out, writer->offsets[0]);
+}
+
+// Compresses one row of blocks of the band
+static void imgpack_texture__blocks_task(void *udata, int index) {
+	struct ImgPackTextureWriter *writer = udata;
+	const struct ImgPackTextureFormat *format = &imgpack_texture_formats[writer->format];
+	int blocks = (writer->levelWidth + 3) / 4;
+	unsigned char pixels[64], *out = writer->blocks + (size_t)index * blocks * format->blockBytes;
+	for (int bx = 0; bx < blocks; bx++) {
+		for (int y = 0; y < 4; y++) {
+			int row = index*4 + y < writer->bandRows ? index*4 + y : writer->bandRows - 1;
+			for (int x = 0; x < 4; x++) {
+				int column = bx*4 + x < writer->levelWidth ? bx*4 + x : writer->levelWidth - 1;
+				memcpy(pixels + 4 * (y*4 + x), writer->band + 4 * ((size_t)row * writer->levelWidth + column), 4);
+			}
+		}
+		format->encode(pixels, writer->quality, out + (size_t)bx * format->blockBytes);
+	}
+}
+
+// Packs count quantized RGBA pixels to the uncompressed format in place
+static void imgpack_texture_pack(enum ImgPackColorFormat format, unsigned char *pixels, size_t count) {
+	const struct ImgPackTextureFormat *f = &imgpack_texture_formats[format];
+	if (format == IMGPACK_RGBA8888 || f->blockSize > 1) return;
+	for (size_t i = 0; i < count; i++) {
+		const unsigned char *p = pixels + 4*i;
+		uint32_t v = 0;
+		for (int c = 0; c < 4; c++) {
+			if (f->bits[c]) v |= (uint32_t)(p[c] >> (8 - f->bits[c])) << f->shifts[c];
+		}
+		for (int b = 0; b < f->blockBytes; b++) pixels[f->blockBytes*i + b] = (unsigned char)(v >> 8*b);
+	}
+}
+
+// Moves to the next mip level once all rows of the current one are written
+static void imgpack_texture__next_level(struct ImgPackTextureWriter *writer) {
+	if (writer->row < writer->levelHeight || writer->level + 1 >= writer->levels) return;
+	writer->level++;
+	writer->row = 0;
+	writer->levelWidth = imgpack_texture_level_size(writer->width, writer->level);
+	writer->levelHeight = imgpack_texture_level_size(writer->height, writer->level);
+	writer->status |= imgpack_writer_seek(writer->out, writer->offsets[writer->level]);
+}
+
+// Writes next count rows of the current level, count should be a multiple of
+// the block size except for the last band. Rows of uncompressed formats are
+// packed already with imgpack_texture_pack. Returns non-zero on failure, the
+// writer still has to be finished with imgpack_texture_end
+static int imgpack_texture_write_rows(struct ImgPackTextureWriter *writer, const unsigned char *rows, int count) {
+	const struct ImgPackTextureFormat *format = &imgpack_texture_formats[writer->format];
+	if (writer->status || count <= 0) return writer->status;
+	if (format->blockSize == 1) {
+		writer->status = imgpack_writer_write(writer->out, rows, (size_t)format->blockBytes * writer->levelWidth * count);
+		writer->row += count;
+		imgpack_texture__next_level(writer);
+		return writer->status;
+	}
+	int block_rows = (count + 3) / 4;
+	size_t size = (size_t)block_rows * ((writer->levelWidth + 3) / 4) * format->blockBytes;
+	writer->blocks = ISLIP_MALLOC(size);
+	if (!writer->blocks) return writer->status = 1;
+	writer->band = rows;
+	writer->bandRows = count;
+	imgpack_parallel_for(writer->jobs, block_rows, imgpack_texture__blocks_task, writer);
+	writer->status = imgpack_writer_write(writer->out, writer->blocks, size);
+	ISLIP_FREE(writer->blocks);
+	writer->blocks = NULL;
+	writer->band = NULL;
+	writer->row += count;
+	imgpack_texture__next_level(writer);
+	return writer->status;
+}
+
+// Closes the output. Returns non-zero if anything failed or not all rows of all
+// levels were written
+static int imgpack_texture_end(struct ImgPackTextureWriter *writer) {
+	int status = writer->status || writer->level != writer->levels - 1 || writer->row != writer->levelHeight;
+	if (writer->out) {
+		status |= imgpack_writer_close(writer->out);
+	} else {
+		status = 1;
+	}
+	return status;
+}
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Minimal worker pool used by imgpack. Runs independent tasks on a fixed
+ * number of threads, tasks are taken in index order from a shared counter.
+ *
+ * Define IMGPACK_NO_THREADS to compile everything single-threaded.
+ */
+
+#ifndef IMGPACK_THREADS_H_
+#define IMGPACK_THREADS_H_
+
+typedef void (*imgpack_task_fn)(void *udata, int index);
+
+#if defined(IMGPACK_NO_THREADS)
+
+typedef int imgpack_mutex_t;
+typedef int imgpack_cond_t;
+
+static int imgpack_cpu_count(void) {
+	return 1;
+}
+
+#define imgpack_mutex_init(m) ((void)(m))
+#define imgpack_mutex_destroy(m) ((void)(m))
+#define imgpack_mutex_lock(m) ((void)(m))
+#define imgpack_mutex_unlock(m) ((void)(m))
+#define imgpack_cond_init(c) ((void)(c))
+#define imgpack_cond_destroy(c) ((void)(c))
+#define imgpack_cond_wait(c, m) ((void)(c), (void)(m))
+#define imgpack_cond_broadcast(c) ((void)(c))
+
+#elif defined(_WIN32)
+
+#include <Windows.h>
+
+typedef HANDLE imgpack_thread_t;
+typedef CRITICAL_SECTION imgpack_mutex_t;
+typedef CONDITION_VARIABLE imgpack_cond_t;
+
+static int imgpack_cpu_count(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+#define imgpack_mutex_init(m) InitializeCriticalSection(m)
+#define imgpack_mutex_destroy(m) DeleteCriticalSection(m)
+#define imgpack_mutex_lock(m) EnterCriticalSection(m)
+#define imgpack_mutex_unlock(m) LeaveCriticalSection(m)
+#define imgpack_cond_init(c) InitializeConditionVariable(c)
+#define imgpack_cond_destroy(c) ((void)(c))
+#define imgpack_cond_wait(c, m) SleepConditionVariableCS((c), (m), INFINITE)
+#define imgpack_cond_broadcast(c) WakeAllConditionVariable(c)
+
+#else
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_t imgpack_thread_t;
+typedef pthread_mutex_t imgpack_mutex_t;
+typedef pthread_cond_t imgpack_cond_t;
+
+static int imgpack_cpu_count(void) {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+}
+
+#define imgpack_mutex_init(m) pthread_mutex_init((m), NULL)
+#define imgpack_mutex_destroy(m) pthread_mutex_destroy(m)
+#define imgpack_mutex_lock(m) pthread_mutex_lock(m)
+#define imgpack_mutex_unlock(m) pthread_mutex_unlock(m)
+#define imgpack_cond_init(c) pthread_cond_init((c), NULL)
+#define imgpack_cond_destroy(c) pthread_cond_destroy(c)
+#define imgpack_cond_wait(c, m) pthread_cond_wait((c), (m))
+#define imgpack_cond_broadcast(c) pthread_cond_broadcast(c)
+
+#endif
+
+#ifndef IMGPACK_NO_THREADS
+
+struct ImgPackTaskQueue {
+	imgpack_task_fn fn;
+	void *udata;
+	int count;
+	int next;
+	imgpack_mutex_t lock;
+};
+
+static int imgpack_task_queue_pop(struct ImgPackTaskQueue *queue) {
+	int index;
+	imgpack_mutex_lock(&queue->lock);
+	index = queue->next < queue->count ? queue->next++ : -1;
+	imgpack_mutex_unlock(&queue->lock);
+	return index;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI imgpack_worker(LPVOID arg) {
+#else
+static void *imgpack_worker(void *arg) {
+#endif
+	struct ImgPackTaskQueue *queue = arg;
+	for (int index = imgpack_task_queue_pop(queue); index >= 0; index = imgpack_task_queue_pop(queue)) {
+		queue->fn(queue->udata, index);
+	}
+	return 0;
+}
+
+#endif
+
+// Calls fn(udata, i) for every i in [0, count) using up to jobs threads
+// (the calling thread is one of them). Returns when all tasks are done.
+static void imgpack_parallel_for(int jobs, int count, imgpack_task_fn fn, void *udata) {
+	if (jobs > count) jobs = count;
+#ifndef IMGPACK_NO_THREADS
+	if (jobs > 1) {
+		struct ImgPackTaskQueue queue = {.fn = fn, .udata = udata, .count = count};
+		imgpack_thread_t *threads = ISLIP_MALLOC(sizeof(*threads) * (jobs - 1));
+		if (threads) {
+			int started = 0;
+			imgpack_mutex_init(&queue.lock);
+			for (; started < jobs - 1; started++) {
+#ifdef _WIN32
+				threads[started] = CreateThread(NULL, 0, imgpack_worker, &queue, 0, NULL);
+				if (!threads[started]) break;
+#else
+				if (pthread_create(&threads[started], NULL, imgpack_worker, &queue)) break;
+#endif
+			}
+			imgpack_worker(&queue);
+			for (int i = 0; i < started; i++) {
+#ifdef _WIN32
+				WaitForSingleObject(threads[i], INFINITE);
+				CloseHandle(threads[i]);
+#else
+				pthread_join(threads[i], NULL);
+#endif
+			}
+			imgpack_mutex_destroy(&queue.lock);
+			ISLIP_FREE(threads);
+			return;
+		}
+	}
+#endif
+	for (int i = 0; i < count; i++) {
+		fn(udata, i);
+	}
+}
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * Alpha bounds of RGBA image used for trimming. Image is scanned row by row:
+ * the top and bottom rows are found first, rows between them are checked only
+ * to the left of the current left bound and to the right of the current right
+ * bound, so every pixel is read at most once and always in memory order.
+ *
+ * Blocks of pixels without alpha above the threshold are skipped using AVX2,
+ * SSE2 or NEON when the compiler targets them, otherwise pixels are tested one
+ * by one. Define IMGPACK_NO_SIMD to always use the scalar loop.
+ */
+
+#ifndef IMGPACK_TRIM_H_
+#define IMGPACK_TRIM_H_
+
+#if defined(IMGPACK_NO_SIMD)
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define IMGPACK_TRIM_AVX2
+#define IMGPACK_TRIM_BLOCK 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMGPACK_TRIM_SSE2
+#define IMGPACK_TRIM_BLOCK 4
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define IMGPACK_TRIM_NEON
+#define IMGPACK_TRIM_BLOCK 4
+#endif
+
+#ifdef IMGPACK_TRIM_BLOCK
+// Returns non-zero if any of IMGPACK_TRIM_BLOCK pixels has alpha above the
+// threshold: alpha bytes are saturating-subtracted by the threshold, others are masked out
+static int imgpack_trim__any(const unsigned char *pixels, unsigned char threshold) {
+#if defined(IMGPACK_TRIM_AVX2)
+	__m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)pixels), _mm256_set1_epi32((int)0xff000000u));
+	v = _mm256_subs_epu8(v, _mm256_set1_epi32((int)((unsigned)threshold << 24)));
+	return !_mm256_testz_si256(v, v);
+#elif defined(IMGPACK_TRIM_SSE2)
+	__m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)pixels), _mm_set1_epi32((int)0xff000000u));
+	v = _mm_subs_epu8(v, _mm_set1_epi32((int)((unsigned)threshold << 24)));
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff;
+#else
+	uint8x16_t v = vandq_u8(vld1q_u8(pixels), vreinterpretq_u8_u32(vdupq_n_u32(0xff000000u)));
+	uint64x2_t v64 = vreinterpretq_u64_u8(vqsubq_u8(v, vreinterpretq_u8_u32(vdupq_n_u32((uint32_t)threshold << 24))));
+	return (vgetq_lane_u64(v64, 0) | vgetq_lane_u64(v64, 1)) != 0;
+#endif
+}
+#endif
+
+// Index of the first pixel in [from, to) with alpha above the threshold or to
+static int imgpack_trim__first(const unsigned char *row, int from, int to, unsigned char threshold) {
+	int x = from;
+#ifdef IMGPACK_TRIM_BLOCK
+	while (x + IMGPACK_TRIM_BLOCK <= to && !imgpack_trim__any(row + 4*x, threshold)) x += IMGPACK_TRIM_BLOCK;
+#endif
+	while (x < to && row[4*x+3] <= threshold) x++;
+	return x;
+}
+
+// Index of the last pixel in [from, to) with alpha above the threshold or from-1
+static int imgpack_trim__last(const unsigned char *row, int from, int to, unsigned char threshold) {
+	int x = to;
+#ifdef IMGPACK_TRIM_BLOCK
+	while (x - IMGPACK_TRIM_BLOCK >= from && !imgpack_trim__any(row + 4*(x - IMGPACK_TRIM_BLOCK), threshold)) x -= IMGPACK_TRIM_BLOCK;
+#endif
+	while (x > from && row[4*(x-1)+3] <= threshold) x--;
+	return x - 1;
+}
+
+// Finds the smallest rect containing all pixels with alpha above the threshold.
+// Returns 0 and leaves the bounds untouched if there are no such pixels
+static int imgpack_alpha_bounds(const unsigned char *data, int width, int height, int threshold,
+		int *min_x, int *min_y, int *max_x, int *max_y) {
+	if (threshold < 0 || threshold >= 255 || width <= 0 || height <= 0) return 0;
+	unsigned char t = (unsigned char)threshold;
+	size_t stride = 4 * (size_t)width;
+	int top = 0, left = width, right = -1;
+	for (; top < height && left == width; top++) {
+		left = imgpack_trim__first(data + top*stride, 0, width, t);
+	}
+	if (left == width) return 0;
+	top--;
+	right = imgpack_trim__last(data + top*stride, left, width, t);
+	int bottom = height - 1;
+	for (; bottom > top; bottom--) {
+		const unsigned char *row = data + bottom*stride;
+		int x = imgpack_trim__first(row, 0, width, t);
+		if (x < width) {
+			if (x < left) left = x;
+			x = imgpack_trim__last(row, right + 1, width, t);
+			if (x > right) right = x;
+			break;
+		}
+	}
+	for (int y = top + 1; y < bottom; y++) {
+		const unsigned char *row = data + y*stride;
+		int x = imgpack_trim__first(row, 0, left, t);
+		if (x < left) left = x;
+		x = imgpack_trim__last(row, right + 1, width, t);
+		if (x > right) right = x;
+	}
+	*min_x = left;
+	*min_y = top;
+	*max_x = right;
+	*max_y = bottom;
+	return 1;
+}
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * Change notifications for --watch. On Linux every directory of the tree gets
+ * an inotify watch, events are turned into paths of touched files and
+ * directories, new directories are watched as they appear. Paths are built
+ * like cute_files builds them, so they match paths of collected images.
+ *
+ * Other platforms and builds with IMGPACK_NO_INOTIFY poll: every wait sleeps
+ * and asks to rescan the whole tree, changes are found by mtimes and sizes.
+ * Rescan is also asked when inotify queue overflows or too many paths are
+ * touched at once.
+ */
+
+#ifndef IMGPACK_WATCH_H_
+#define IMGPACK_WATCH_H_
+
+#if defined(__linux__) && !defined(IMGPACK_NO_INOTIFY)
+#define IMGPACK_WATCH_INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <poll.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32) && !defined(S_ISDIR)
+#define S_ISDIR(m) (((m) & _S_IFMT) == _S_IFDIR)
+#define S_ISREG(m) (((m) & _S_IFMT) == _S_IFREG)
+#endif
+
+#define IMGPACK_WATCH_POLL_MS 500
+#define IMGPACK_WATCH_MAX_PATHS 1024
+
+struct ImgPackWatchDir {
+	int wd;
+	char *path;
+};
+
+struct ImgPackWatcher {
+	int fd;
+	struct ImgPackWatchDir *dirs;
+	int dirsCount;
+	int dirsAllocated;
+	// Touched since the last wait, or the whole tree if rescan is set
+	char **paths;
+	int pathsCount;
+	int pathsAllocated;
+	int rescan;
+};
+
+// Monotonic enough for measuring repack time
+static long long imgpack_watch_time_ms(void) {
+#ifdef _WIN32
+	return (long long)GetTickCount64();
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+// Returns 0 for regular files, 1 for directories and -1 if the path is gone
+static int imgpack_watch_stat(const char *path, int64_t *mtime, int64_t *size) {
+	struct stat st;
+	if (stat(path, &st)) return -1;
+	*mtime = (int64_t)st.st_mtime;
+	*size = (int64_t)st.st_size;
+	return S_ISDIR(st.st_mode) ? 1 : S_ISREG(st.st_mode) ? 0 : -1;
+}
+
+static void imgpack_watcher__clear(struct ImgPackWatcher *watcher) {
+	for (int i = 0; i < watcher->pathsCount; i++) ISLIP_FREE(watcher->paths[i]);
+	watcher->pathsCount = 0;
+	watcher->rescan = 0;
+}
+
+#ifdef IMGPACK_WATCH_INOTIFY
+
+#define IMGPACK_WATCH_EVENTS (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+static void imgpack_watcher__touch(struct ImgPackWatcher *watcher, const char *path) {
+	if (watcher->rescan) return;
+	for (int i = 0; i < watcher->pathsCount; i++) {
+		if (!strcmp(watcher->paths[i], path)) return;
+	}
+	if (watcher->pathsCount >= IMGPACK_WATCH_MAX_PATHS) {
+		watcher->rescan = 1;
+		return;
+	}
+	if (watcher->pathsCount >= watcher->pathsAllocated) {
+		watcher->pathsAllocated = watcher->pathsAllocated ? 2 * watcher->pathsAllocated : 16;
+		watcher->paths = ISLIP_REALLOC(watcher->paths, watcher->pathsAllocated * sizeof(*watcher->paths));
+	}
+	watcher->paths[watcher->pathsCount++] = copy_string(path);
+}
+
+// Watches the directory and its subdirectories, hidden ones are skipped like
+// when images are collected
+static int imgpack_watcher__add_tree(struct ImgPackWatcher *watcher, const char *path) {
+	int wd = inotify_add_watch(watcher->fd, path, IMGPACK_WATCH_EVENTS | IN_ONLYDIR);
+	if (wd < 0) return 1;
+	int i = 0;
+	while (i < watcher->dirsCount && watcher->dirs[i].wd != wd) i++;
+	if (i == watcher->dirsCount) {
+		if (watcher->dirsCount >= watcher->dirsAllocated) {
+			watcher->dirsAllocated = watcher->dirsAllocated ? 2 * watcher->dirsAllocated : 16;
+			watcher->dirs = ISLIP_REALLOC(watcher->dirs, watcher->dirsAllocated * sizeof(*watcher->dirs));
+		}
+		watcher->dirs[watcher->dirsCount++] = (struct ImgPackWatchDir) {.wd = wd, .path = copy_string(path)};
+	} else {
+		ISLIP_FREE(watcher->dirs[i].path);
+		watcher->dirs[i].path = copy_string(path);
+	}
+	int status = 0;
+	cf_dir_t dir;
+	if (cf_dir_open(&dir, path)) {
+		while (dir.has_next) {
+			cf_file_t file;
+			cf_read_file(&dir, &file);
+			if (file.is_dir && file.name[0] != '.') status |= imgpack_watcher__add_tree(watcher, file.path);
+			cf_dir_next(&dir);
+		}
+		cf_dir_close(&dir);
+	}
+	return status;
+}
+
+static void imgpack_watcher__remove_dir(struct ImgPackWatcher *watcher, int index) {
+	ISLIP_FREE(watcher->dirs[index].path);
+	watcher->dirs[index] = watcher->dirs[--watcher->dirsCount];
+}
+
+// Directory moved away keeps its watch, forget it together with subdirectories
+static void imgpack_watcher__remove_tree(struct ImgPackWatcher *watcher, const char *path) {
+	size_t length = strlen(path);
+	for (int i = watcher->dirsCount - 1; i >= 0; i--) {
+		const char *dir = watcher->dirs[i].path;
+		if (!strncmp(dir, path, length) && (dir[length] == '\0' || dir[length] == '/')) {
+			inotify_rm_watch(watcher->fd, watcher->dirs[i].wd);
+			imgpack_watcher__remove_dir(watcher, i);
+		}
+	}
+}
+
+static void imgpack_watcher__event(struct ImgPackWatcher *watcher, const struct inotify_event *event) {
+	if (event->mask & IN_Q_OVERFLOW) {
+		watcher->rescan = 1;
+		return;
+	}
+	int i = 0;
+	while (i < watcher->dirsCount && watcher->dirs[i].wd != event->wd) i++;
+	if (i == watcher->dirsCount) return;
+	if (event->mask & IN_IGNORED) {
+		imgpack_watcher__remove_dir(watcher, i);
+		return;
+	}
+	if (event->len == 0 || !event->name[0]) return;
+	int is_dir = (event->mask & IN_ISDIR) != 0;
+	if (is_dir && event->name[0] == '.') return;
+	char *path = ISLIP_MALLOC(strlen(watcher->dirs[i].path) + strlen(event->name) + 2);
+	sprintf(path, "%s/%s", watcher->dirs[i].path, event->name);
+	if (is_dir && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+		imgpack_watcher__add_tree(watcher, path);
+	} else if (is_dir && (event->mask & IN_MOVED_FROM)) {
+		imgpack_watcher__remove_tree(watcher, path);
+	}
+	// Files are reported once written, not when created empty
+	if (is_dir || !(event->mask & IN_CREATE)) imgpack_watcher__touch(watcher, path);
+	ISLIP_FREE(path);
+}
+
+// Reads available events, returns the number of them or -1 on error
+static int imgpack_watcher__read(struct ImgPackWatcher *watcher) {
+	union {
+		struct inotify_event event;
+		char bytes[16 * (sizeof(struct inotify_event) + 256)];
+	} buffer;
+	int count = 0;
+	for (;;) {
+		ssize_t size = read(watcher->fd, buffer.bytes, sizeof(buffer.bytes));
+		if (size <= 0) return size < 0 && errno != EAGAIN && errno != EINTR ? -1 : count;
+		for (ssize_t offset = 0; offset < size; count++) {
+			const struct inotify_event *event = (const struct inotify_event *)(buffer.bytes + offset);
+			imgpack_watcher__event(watcher, event);
+			offset += sizeof(*event) + event->len;
+		}
+	}
+}
+
+#endif
+
+// Starts watching the tree, returns non-zero on failure
+static int imgpack_watcher_open(struct ImgPackWatcher *watcher, const char *path) {
+	*watcher = (struct ImgPackWatcher) {.fd = -1};
+#ifdef IMGPACK_WATCH_INOTIFY
+	watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watcher->fd < 0) return 1;
+	return imgpack_watcher__add_tree(watcher, path);
+#else
+	(void)path;
+	return 0;
+#endif
+}
+
+// Blocks until something changes and then collects changes until nothing
+// happens for quiet_ms, so saves touching several files come at once
+static int imgpack_watcher_wait(struct ImgPackWatcher *watcher, int quiet_ms) {
+	imgpack_watcher__clear(watcher);
+#ifdef IMGPACK_WATCH_INOTIFY
+	struct pollfd fd = {.fd = watcher->fd, .events = POLLIN};
+	for (;;) {
+		int changed = watcher->pathsCount > 0 || watcher->rescan;
+		int ready = poll(&fd, 1, changed ? quiet_ms : -1);
+		if (ready < 0 && errno != EINTR) return 1;
+		if (ready == 0 && changed) return 0;
+		if (ready > 0 && imgpack_watcher__read(watcher) < 0) return 1;
+	}
+#else
+	(void)quiet_ms;
+#ifdef _WIN32
+	Sleep(IMGPACK_WATCH_POLL_MS);
+#else
+	poll(NULL, 0, IMGPACK_WATCH_POLL_MS);
+#endif
+	watcher->rescan = 1;
+	return 0;
+#endif
+}
+
+static void imgpack_watcher_close(struct ImgPackWatcher *watcher) {
+	imgpack_watcher__clear(watcher);
+	ISLIP_FREE(watcher->paths);
+	for (int i = 0; i < watcher->dirsCount; i++) ISLIP_FREE(watcher->dirs[i].path);
+	ISLIP_FREE(watcher->dirs);
+#ifdef IMGPACK_WATCH_INOTIFY
+	if (watcher->fd >= 0) close(watcher->fd);
+#endif
+	*watcher = (struct ImgPackWatcher) {.fd = -1};
+}
+
+// Writer to a temporary file next to the path which is renamed over the path
+// on close, so the game never reads partially written atlas
+struct ImgPackWatchOutput {
+	FILE *file;
+	char *path;
+	char *tempPath;
+};
+
+static int imgpack_watch__output_write(void *udata, const void *data, size_t size) {
+	return imgpack_writer__file_write(((struct ImgPackWatchOutput *)udata)->file, data, size);
+}
+
+static int imgpack_watch__output_seek(void *udata, size_t offset) {
+	return imgpack_writer__file_seek(((struct ImgPackWatchOutput *)udata)->file, offset);
+}
+
+static int imgpack_watch__output_close(void *udata) {
+	struct ImgPackWatchOutput *file = udata;
+	int status = imgpack_writer__file_close(file->file);
+#ifdef _WIN32
+	if (!status) remove(file->path);
+#endif
+	if (!status) status = rename(file->tempPath, file->path) != 0;
+	if (status) remove(file->tempPath);
+	ISLIP_FREE(file->path);
+	ISLIP_FREE(file->tempPath);
+	ISLIP_FREE(file);
+	return status;
+}
+
+static int imgpack_watch_open_output(struct ImgPackWriter *writer, const char *path) {
+	struct ImgPackWatchOutput *file = ISLIP_MALLOC(sizeof(*file));
+	char *temp_path = ISLIP_MALLOC(strlen(path) + 5);
+	if (!file || !temp_path) {
+		ISLIP_FREE(file);
+		ISLIP_FREE(temp_path);
+		return 1;
+	}
+	sprintf(temp_path, "%s.tmp", path);
+	*file = (struct ImgPackWatchOutput) {.file = fopen(temp_path, "wb"), .path = copy_string(path), .tempPath = temp_path};
+	if (!file->file) {
+		ISLIP_FREE(file->path);
+		ISLIP_FREE(file->tempPath);
+		ISLIP_FREE(file);
+		return 1;
+	}
+	*writer = (struct ImgPackWriter) {
+		.write = imgpack_watch__output_write,
+		.seek = imgpack_watch__output_seek,
+		.close = imgpack_watch__output_close,
+		.udata = file,
+	};
+	return 0;
+}
+
+#endif
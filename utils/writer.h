@@ -0,0 +1,129 @@
+/*
+ * Operations on struct ImgPackWriter from imgpack.h, used by the formatters
+ * and the image writers. The first failure sticks: the rest of the writes are
+ * skipped and the status is returned by imgpack_writer_close. Writers over
+ * files and memory buffers are here too
+ */
+
+#ifndef IMGPACK_WRITER_H_
+#define IMGPACK_WRITER_H_
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static int imgpack_writer_write(struct ImgPackWriter *writer, const void *data, size_t size) {
+	if (writer->status || size == 0) return writer->status;
+	writer->status = writer->write(writer->udata, data, size) != 0;
+	writer->position += size;
+	writer->written += size;
+	return writer->status;
+}
+
+static int imgpack_writer_printf(struct ImgPackWriter *writer, const char *format, ...) {
+	char buffer[512], *text = buffer;
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if (length < 0) return writer->status = 1;
+	if ((size_t)length >= sizeof(buffer)) {
+		text = ISLIP_MALLOC((size_t)length + 1);
+		if (!text) return writer->status = 1;
+		va_start(args, format);
+		vsnprintf(text, (size_t)length + 1, format, args);
+		va_end(args);
+	}
+	imgpack_writer_write(writer, text, (size_t)length);
+	if (text != buffer) ISLIP_FREE(text);
+	return writer->status;
+}
+
+// Sequential writers fail only if the position actually changes
+static int imgpack_writer_seek(struct ImgPackWriter *writer, size_t offset) {
+	if (writer->status || offset == writer->position) return writer->status;
+	writer->status = !writer->seek || writer->seek(writer->udata, offset) != 0;
+	writer->position = offset;
+	return writer->status;
+}
+
+// Returns non-zero if anything failed
+static int imgpack_writer_close(struct ImgPackWriter *writer) {
+	int status = writer->status;
+	if (writer->close) status |= writer->close(writer->udata) != 0;
+	writer->close = NULL;
+	return status;
+}
+
+static int imgpack_writer__file_write(void *udata, const void *data, size_t size) {
+	return fwrite(data, 1, size, udata) != size;
+}
+
+static int imgpack_writer__file_seek(void *udata, size_t offset) {
+	return fseek(udata, (long)offset, SEEK_SET) != 0;
+}
+
+static int imgpack_writer__file_close(void *udata) {
+	int status = ferror((FILE *)udata);
+	return fclose(udata) || status;
+}
+
+static int imgpack_writer__file_flush(void *udata) {
+	return ferror((FILE *)udata) || fflush(udata);
+}
+
+// Writer over the open file, it is flushed but not closed in the end
+static void imgpack_writer_file(struct ImgPackWriter *writer, FILE *f) {
+	*writer = (struct ImgPackWriter) {
+		.write = imgpack_writer__file_write,
+		.seek = imgpack_writer__file_seek,
+		.close = imgpack_writer__file_flush,
+		.udata = f,
+	};
+}
+
+// Creates the file, returns non-zero if it can't be opened
+static int imgpack_writer_open(struct ImgPackWriter *writer, const char *path) {
+	FILE *f = fopen(path, "wb");
+	if (!f) return 1;
+	imgpack_writer_file(writer, f);
+	writer->close = imgpack_writer__file_close;
+	return 0;
+}
+
+// Gap left by seeking past the end is filled with zeros like files do
+static int imgpack_writer__buffer_write(void *udata, const void *data, size_t size) {
+	struct ImgPackBuffer *buffer = udata;
+	size_t end = buffer->position + size;
+	if (end > buffer->allocated) {
+		size_t allocated = buffer->allocated ? buffer->allocated : 4096;
+		while (allocated < end) allocated *= 2;
+		unsigned char *grown = ISLIP_REALLOC(buffer->data, allocated);
+		if (!grown) return 1;
+		buffer->data = grown;
+		buffer->allocated = allocated;
+	}
+	if (buffer->position > buffer->size) memset(buffer->data + buffer->size, 0, buffer->position - buffer->size);
+	memcpy(buffer->data + buffer->position, data, size);
+	buffer->position = end;
+	if (end > buffer->size) buffer->size = end;
+	return 0;
+}
+
+static int imgpack_writer__buffer_seek(void *udata, size_t offset) {
+	((struct ImgPackBuffer *)udata)->position = offset;
+	return 0;
+}
+
+// Fills the buffer from the start, allocated memory is reused
+static void imgpack_writer_buffer(struct ImgPackWriter *writer, struct ImgPackBuffer *buffer) {
+	buffer->size = 0;
+	buffer->position = 0;
+	*writer = (struct ImgPackWriter) {
+		.write = imgpack_writer__buffer_write,
+		.seek = imgpack_writer__buffer_seek,
+		.udata = buffer,
+	};
+}
+
+#endif